@@ -257,6 +257,8 @@ struct blk_alloc_hints {
     bool partial_alloc_ok{false};   // ok to allocate only portion of nblks? Mutually exclusive with is_contiguous
     uint32_t min_blks_per_piece{1}; // blks allocated in a blkid should be atleast this size per entry
     uint32_t max_blks_per_piece{max_blks_per_blkid()}; // Number of blks on every entry
+
+    bool operator==(blk_alloc_hints const& other) const = default;
 };
 
 } // namespace homestore
@@ -16,6 +16,11 @@
 #pragma once
 #include <sys/uio.h>
 #include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <vector>
 
 #include <folly/small_vector.h>
 #include <folly/futures/Future.h>
@@ -35,6 +40,14 @@ struct stream_info_t;
 class BlkReadTracker;
 struct blk_alloc_hints;
 class ChunkSelector;
+class Chunk;
+class AppendBlkAllocator;
+struct gc_chunk_ctx;
+
+// gc callbacks for the consumer to provide, returns all the live blkids consumer holds in the given chunk
+typedef std::function< std::vector< MultiBlkId >(chunk_num_t) > gc_live_blks_cb_t;
+// gc callback to let consumer know that the data of old blkid is now in the new blkid
+typedef std::function< void(MultiBlkId const& old_bid, MultiBlkId const& new_bid) > gc_remap_cb_t;
 
 class BlkDataService {
 public:
@@ -154,6 +167,18 @@ public:
      */
     BlkAllocStatus alloc_blks(uint32_t size, blk_alloc_hints const& hints, MultiBlkId& out_blkids);
 
+    /**
+     * @brief Allocates blocks for a batch of requests in one call, contiguous across the requests if possible.
+     * Allocation is all or nothing, on failure nothing remains allocated for the batch.
+     *
+     * @param sizes The size of each request of the batch, in bytes.
+     * @param hints Hints for how to allocate the blocks, common for the entire batch.
+     * @param out_blkids Output parameter that will be filled with the MultiBlkId of each request, in the same order.
+     * @return The status of the block allocation attempt.
+     */
+    BlkAllocStatus alloc_blks(std::vector< uint32_t > const& sizes, blk_alloc_hints const& hints,
+                              std::vector< MultiBlkId >& out_blkids);
+
     /**
      * @brief Asynchronously frees the specified block IDs.
      * It is asynchronous because it might need to wait for pending read to complete if same block is being read and not
@@ -198,6 +223,28 @@ public:
 
     uint64_t get_used_capacity() const;
 
+    /**
+     * @brief Registers the consumer callbacks needed for garbage collecting the chunks of append blk allocator.
+     *
+     * @param live_cb Callback to get all the live blkids consumer holds in a chunk. It is called only after every blk
+     * allocated in the chunk is either committed (commit_blk) or freed, so it has to include all committed blks.
+     * @param remap_cb Callback to let consumer point to the new location of a relocated blkid. Consumer has to make the
+     * new mapping durable before the next cp completes. The old chunk is kept sealed till a cp after the last remap
+     * completes and is reset only then. Consumer is also expected not to free the blks of a chunk which is being
+     * collected, other than through this callback.
+     */
+    void register_gc_handler(gc_live_blks_cb_t live_cb, gc_remap_cb_t remap_cb);
+
+    /**
+     * @brief Runs one gc pass on the chunks of append blk allocator. Chunks are picked by their garbage ratio, their
+     * live blks are relocated to other chunks (throttled to gc_max_bytes_per_sec) and then the chunk is reset for
+     * allocation again, once a cp persists the remaps. Nothing blocks the calling thread. If a gc pass is already in
+     * progress, this returns 0 right away.
+     *
+     * @return Future of the number of chunks reclaimed.
+     */
+    folly::Future< uint32_t > gc_chunks();
+
 private:
     /**
      * @brief Initializes the block data service.
@@ -217,11 +264,25 @@ private:
      */
     static void process_data_completion(std::error_condition ec, void* cookie);
 
+    std::vector< shared< Chunk > > pick_gc_chunks() const;
+    folly::Future< bool > relocate_chunk(shared< gc_chunk_ctx > ctx);
+    folly::Future< bool > wait_for_commits(AppendBlkAllocator* allocator,
+                                           std::chrono::steady_clock::time_point deadline);
+    folly::Future< bool > relocate_next_blk(shared< gc_chunk_ctx > ctx);
+    folly::Future< bool > abort_chunk_relocation(shared< gc_chunk_ctx > ctx);
+    folly::Future< bool > complete_chunk_relocation(shared< gc_chunk_ctx > ctx);
+    static folly::Future< folly::Unit > gc_delay(std::chrono::nanoseconds delay);
+
 private:
     std::shared_ptr< VirtualDev > m_vdev;
     std::unique_ptr< BlkReadTracker > m_blk_read_tracker;
     std::shared_ptr< ChunkSelector > m_custom_chunk_selector;
     uint32_t m_blk_size;
+
+    std::mutex m_gc_mtx;                         // Protects the gc callbacks
+    std::atomic< bool > m_gc_in_progress{false}; // Only one gc pass at a time
+    gc_live_blks_cb_t m_gc_live_cb;
+    gc_remap_cb_t m_gc_remap_cb;
 };
 
 extern BlkDataService& data_service();
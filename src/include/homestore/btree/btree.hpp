@@ -115,6 +115,17 @@ protected:
                                                 const BtreeNodePtr& child_node, const BtreeNodePtr& parent_node,
                                                 void* context) = 0;
 
+    /// @brief Hint to the underlying store that these nodes are going to be read soon. Stores which have to load the
+    /// node from a device could issue the reads ahead, default is to ignore the hint.
+    virtual void prefetch_nodes_impl(std::vector< bnodeid_t > const& ids) const {}
+
+    /// @brief Read the node as of the snapshot. If the node is not modified after the snapshot, store could return
+    /// the live node read locked, in which case it sets is_locked and caller unlocks it after use.
+    virtual btree_status_t read_snapshot_node_impl(bnodeid_t id, const BtreeSnapshot& snap, BtreeNodePtr& node,
+                                                   bool& is_locked) const {
+        return btree_status_t::not_supported;
+    }
+
     virtual std::string btree_store_type() const = 0;
     virtual void update_new_root_info(bnodeid_t root_node, uint64_t version) = 0;
 
@@ -208,6 +219,9 @@ protected:
                                   std::vector< std::pair< K, V > >& out_values) const;
     btree_status_t do_traversal_query(const BtreeNodePtr& my_node, BtreeQueryRequest< K >& qreq,
                                       std::vector< std::pair< K, V > >& out_values) const;
+    void prefetch_sweep_children(const BtreeNodePtr& my_node, uint32_t start_idx,
+                                 BtreeQueryRequest< K >& qreq) const;
+    btree_status_t do_snapshot_query(BtreeQueryRequest< K >& qreq, std::vector< std::pair< K, V > >& out_values) const;
 #ifdef SERIALIZABLE_QUERY_IMPLEMENTATION
     btree_status_t do_serialzable_query(const BtreeNodePtr& my_node, BtreeSerializableQueryRequest& qreq,
                                         std::vector< std::pair< K, V > >& out_values);
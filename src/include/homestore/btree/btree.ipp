@@ -237,6 +237,21 @@ btree_status_t Btree< K, V >::query(BtreeQueryRequest< K >& qreq, std::vector< s
     btree_status_t ret = btree_status_t::success;
     if (qreq.batch_size() == 0) { return ret; }
 
+    if (qreq.query_type() == BtreeQueryType::SNAPSHOT_QUERY) {
+        // Snapshot carries its own root and doesn't need to be protected against root changes
+        ret = do_snapshot_query(qreq, out_values);
+        if (out_values.size()) {
+            K out_last_key = out_values.back().first;
+            if (out_last_key.compare(qreq.input_range().end_key()) >= 0) { ret = btree_status_t::success; }
+            qreq.shift_working_range(std::move(out_last_key), false /* non inclusive*/);
+        }
+        if ((ret != btree_status_t::success) && (ret != btree_status_t::has_more)) {
+            BT_LOG(ERROR, "btree snapshot query failed {}", ret);
+            COUNTER_INCREMENT(m_metrics, query_err_cnt, 1);
+        }
+        return ret;
+    }
+
     m_btree_lock.lock_shared();
     BtreeNodePtr root = nullptr;
     ret = read_and_lock_node(m_root_node_info.bnode_id(), root, locktype_t::READ, locktype_t::READ, qreq.m_op_context);
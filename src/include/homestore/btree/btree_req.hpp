@@ -195,7 +195,20 @@ ENUM(BtreeQueryType, uint8_t,
      // This is both inefficient and quiet intrusive/unsafe query, where it locks the range
      // that is being queried for and do not allow any insert or update within that range. It
      // essentially create a serializable level of isolation.
-     SERIALIZABLE_QUERY)
+     SERIALIZABLE_QUERY,
+
+     // Sweep query which reads the tree as of the point in time the snapshot in the request was taken,
+     // irrespective of the modifications done after that. Node locks are held only while a node is being
+     // read and never across nodes or pagination, so it doesn't block writers. Useful for long running
+     // scans like backup or verification. Supported only by the stores which can provide snapshots.
+     SNAPSHOT_QUERY)
+
+// Point in time view of the btree, which the underlying store provides for SNAPSHOT_QUERY. Store keeps the node
+// versions as of the snapshot, for the nodes modified after the snapshot, as long as this instance is alive.
+struct BtreeSnapshot {
+    virtual ~BtreeSnapshot() = default;
+    BtreeLinkInfo m_root_info; // Root of the btree as of the snapshot
+};
 
 using get_filter_cb_t = std::function< bool(BtreeKey const&, BtreeValue const&) >;
 
@@ -216,9 +229,14 @@ public:
 
     get_filter_cb_t const& filter() const { return m_filter_cb; }
 
+    // Snapshot to read from, needed only for SNAPSHOT_QUERY
+    void set_snapshot(std::shared_ptr< BtreeSnapshot > snap) { m_snapshot = std::move(snap); }
+    const std::shared_ptr< BtreeSnapshot >& snapshot() const { return m_snapshot; }
+
 protected:
     const BtreeQueryType m_query_type; // Type of the query
     get_filter_cb_t m_filter_cb;
+    std::shared_ptr< BtreeSnapshot > m_snapshot;
 };
 
 /* This class is a top level class to keep track of the locks that are held currently. It is
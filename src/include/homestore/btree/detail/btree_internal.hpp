@@ -243,6 +243,7 @@ struct BtreeConfig {
     uint32_t m_max_merge_nodes{3};
     bool m_rebalance_turned_on{false};
     bool m_merge_turned_on{true};
+    uint32_t m_max_sweep_prefetch_nodes{8}; // Max sibling leaves to read ahead during sweep query, 0 to disable
 
     btree_node_type m_leaf_node_type{btree_node_type::VAR_OBJECT};
     btree_node_type m_int_node_type{btree_node_type::VAR_KEY};
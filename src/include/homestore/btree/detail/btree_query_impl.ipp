@@ -56,6 +56,11 @@ btree_status_t Btree< K, V >::do_sweep_query(BtreeNodePtr& my_node, BtreeQueryRe
                 ret = read_and_lock_node(my_node->next_bnode(), next_node, locktype_t::READ, locktype_t::READ,
                                          qreq.m_op_context);
                 if (ret != btree_status_t::success) { break; }
+
+                // Keep one sibling read ahead of the cursor, so that crossing the parent boundary doesn't stall
+                if ((m_bt_cfg.m_max_sweep_prefetch_nodes != 0) && (next_node->next_bnode() != empty_bnodeid)) {
+                    prefetch_nodes_impl({next_node->next_bnode()});
+                }
             } else {
                 ret = btree_status_t::has_more;
                 break;
@@ -71,6 +76,9 @@ btree_status_t Btree< K, V >::do_sweep_query(BtreeNodePtr& my_node, BtreeQueryRe
     ASSERT_IS_VALID_INTERIOR_CHILD_INDX(isfound, idx, my_node);
     if (qreq.route_tracing) { append_route_trace(qreq, my_node, btree_event_t::READ, idx, idx); }
 
+    // Children are leaves, which the sweep is going to walk across. Issue the reads for the next few of them
+    if (my_node->level() == 1) { prefetch_sweep_children(my_node, idx, qreq); }
+
     BtreeNodePtr child_node;
     ret = read_and_lock_node(start_child_info.bnode_id(), child_node, locktype_t::READ, locktype_t::READ,
                              qreq.m_op_context);
@@ -79,6 +87,77 @@ btree_status_t Btree< K, V >::do_sweep_query(BtreeNodePtr& my_node, BtreeQueryRe
     return (do_sweep_query(child_node, qreq, out_values));
 }
 
+template < typename K, typename V >
+void Btree< K, V >::prefetch_sweep_children(const BtreeNodePtr& my_node, uint32_t start_idx,
+                                            BtreeQueryRequest< K >& qreq) const {
+    if (m_bt_cfg.m_max_sweep_prefetch_nodes == 0) { return; }
+
+    [[maybe_unused]] const auto [end_isfound, end_idx] = my_node->find(qreq.input_range().end_key(), nullptr, false);
+    auto const last_idx = std::min(end_idx, start_idx + m_bt_cfg.m_max_sweep_prefetch_nodes);
+
+    std::vector< bnodeid_t > ids;
+    for (auto idx = start_idx + 1; idx <= last_idx; ++idx) {
+        BtreeLinkInfo child_info;
+        if (idx < my_node->total_entries()) {
+            my_node->get_nth_value(idx, &child_info, false);
+        } else if (my_node->has_valid_edge()) {
+            child_info = my_node->get_edge_value();
+        } else {
+            break;
+        }
+        ids.push_back(child_info.bnode_id());
+    }
+
+    if (!ids.empty()) { prefetch_nodes_impl(ids); }
+}
+
+template < typename K, typename V >
+btree_status_t Btree< K, V >::do_snapshot_query(BtreeQueryRequest< K >& qreq,
+                                                std::vector< std::pair< K, V > >& out_values) const {
+    if (qreq.snapshot() == nullptr) {
+        BT_LOG(ERROR, "Snapshot query is issued without a snapshot");
+        return btree_status_t::not_supported;
+    }
+    const BtreeSnapshot& snap = *qreq.snapshot();
+
+    BtreeNodePtr node;
+    bool is_locked{false};
+    auto ret = read_snapshot_node_impl(snap.m_root_info.bnode_id(), snap, node, is_locked);
+    if (ret != btree_status_t::success) { return ret; }
+
+    // Walk down to the leaf holding the first key, holding at most one node at a time
+    while (!node->is_leaf()) {
+        BtreeLinkInfo child_info;
+        [[maybe_unused]] const auto [isfound, idx] = node->find(qreq.first_key(), &child_info, false);
+        ASSERT_IS_VALID_INTERIOR_CHILD_INDX(isfound, idx, node);
+        if (is_locked) { unlock_node(node, locktype_t::READ); }
+
+        ret = read_snapshot_node_impl(child_info.bnode_id(), snap, node, is_locked);
+        if (ret != btree_status_t::success) { return ret; }
+    }
+
+    // Sweep across the leaves
+    auto count = 0U;
+    do {
+        uint32_t start_ind{0};
+        uint32_t end_ind{0};
+        count += to_variant_node(node)->multi_get(qreq.working_range(), qreq.batch_size() - count, start_ind, end_ind,
+                                                  &out_values, qreq.filter());
+        if (qreq.route_tracing) { append_route_trace(qreq, node, btree_event_t::READ, start_ind, end_ind); }
+
+        bool const done = (node->get_last_key< K >().compare(qreq.input_range().end_key()) >= 0);
+        auto const next_id = node->next_bnode();
+        if (is_locked) { unlock_node(node, locktype_t::READ); }
+
+        if (count >= qreq.batch_size()) { return btree_status_t::has_more; }
+        if (done || (next_id == empty_bnodeid)) { break; }
+
+        ret = read_snapshot_node_impl(next_id, snap, node, is_locked);
+    } while (ret == btree_status_t::success);
+
+    return ret;
+}
+
 template < typename K, typename V >
 btree_status_t Btree< K, V >::do_traversal_query(const BtreeNodePtr& my_node, BtreeQueryRequest< K >& qreq,
                                                  std::vector< std::pair< K, V > >& out_values) const {
@@ -18,10 +18,12 @@
 #include <array>
 #include <memory>
 #include <mutex>
+#include <vector>
 
 #include <sisl/logging/logging.h>
 #include <sisl/utility/atomic_counter.hpp>
 #include <iomgr/iomgr.hpp>
+#include <folly/futures/Future.h>
 #include <folly/futures/SharedPromise.h>
 
 /*
@@ -29,7 +31,9 @@
  * consequences in btree.
  * 1. It doesn't allow a cp to start if io is still in cp critical section. CP critical section is code between
  * cp_io_enter() and cp_io_exit().
- * 2. It doesn't allow two cps to start simultanously. second CP doesn't start until cp_done is not called in first cp.
+ * 2. CPs can be pipelined upto cp_max_inflight, i.e. CP N+1 can be triggered and flushed while CP N is still being
+ * flushed. However each consumer flushes the CPs in order, i.e. consumer's flush of CP N+1 starts only after its flush
+ * of CP N is completed, and CPs complete (cp superblock is written) in order.
  * 3. It call cp prepare. Purpose of this function is to create new cp and also to decide what operations we want to do
  * in that CP.
  * 4. New cp doesn't start until cp prepare is not called on a current cp.
@@ -85,11 +89,26 @@ struct CP {
     cp_id_t m_cp_id;
     std::array< std::unique_ptr< CPContext >, (size_t)cp_consumer_t::SENTINEL > m_contexts;
     folly::SharedPromise< bool > m_comp_promise;
+    uint64_t m_dirty_bytes{0};     // Bytes consumers had to flush, as of cp trigger
+    uint64_t m_journal_written{0}; // Journal written counter, as of cp trigger
+    Clock::time_point m_flush_start_time;
+    std::atomic< uint64_t > m_consumer_flush_us{0}; // Longest flush among consumers, excluding the pipelined wait
+
+    // To keep the flushes of each consumer and the completion of CPs in order, when CPs are pipelined. Futures are of
+    // the previous CP, promises are fulfilled by this CP.
+    std::vector< folly::Future< bool > > m_prev_flush_done; // Per consumer
+    std::array< std::shared_ptr< folly::SharedPromise< bool > >, (size_t)cp_consumer_t::SENTINEL > m_flush_done;
+    folly::Future< bool > m_prev_cp_done{folly::Future< bool >::makeEmpty()};
+    std::shared_ptr< folly::SharedPromise< bool > > m_cp_done;
 
 public:
     CP(CPManager* mgr) : m_cp_mgr{mgr} {}
 
     cp_id_t id() const { return m_cp_id; }
+    void record_consumer_flush_us(uint64_t flush_us) {
+        auto cur = m_consumer_flush_us.load();
+        while ((cur < flush_us) && !m_consumer_flush_us.compare_exchange_weak(cur, flush_us)) {}
+    }
     cp_status_t get_status() const { return m_cp_status.load(); }
     CPContext* context(cp_consumer_t consumer) const { return m_contexts[(size_t)consumer].get(); }
     void set_context(cp_consumer_t consumer, std::unique_ptr< CPContext > context) {
@@ -28,14 +28,27 @@
 #include <homestore/checkpoint/cp.hpp>
 
 namespace homestore {
-static constexpr size_t MAX_CP_COUNT{2};
+// Max number of CPs alive at any point, i.e. the CP taking new ios along with the CPs being flushed. Consumers keeping
+// per CP state in an array can index it with cp_id % MAX_CP_COUNT
+static constexpr size_t MAX_CP_COUNT{3};
 
 class CPMgrMetrics : public sisl::MetricsGroup {
 public:
     explicit CPMgrMetrics() : sisl::MetricsGroup("CPMgr") {
         REGISTER_COUNTER(back_to_back_cps, "back to back cp");
+        REGISTER_COUNTER(pipelined_cps, "cp triggered while previous cp is still being flushed");
         REGISTER_COUNTER(cp_cnt, "cp cnt");
         REGISTER_HISTOGRAM(cp_latency, "cp latency (in us)");
+
+        // Inputs and decisions of the cp scheduler
+        REGISTER_GAUGE(cp_dirty_bytes, "Bytes to be flushed if cp is triggered now");
+        REGISTER_GAUGE(cp_flush_bytes_per_sec, "Recent cp flush throughput");
+        REGISTER_GAUGE(cp_predicted_flush_ms, "Predicted time to flush the current cp");
+        REGISTER_GAUGE(cp_journal_replay_bytes, "Journal written since last completed cp, to be replayed on recovery");
+        REGISTER_GAUGE(cp_predicted_recovery_ms, "Predicted time to replay the journal on recovery");
+        REGISTER_COUNTER(cp_triggered_by_flush_target, "cp triggered as predicted flush time reached its target");
+        REGISTER_COUNTER(cp_triggered_by_recovery_target, "cp triggered as predicted recovery time reached its target");
+        REGISTER_COUNTER(cp_triggered_by_timer, "cp triggered as max interval between cps elapsed");
         register_me_to_farm();
     }
 
@@ -90,6 +103,10 @@ public:
     /// @brief In case CP is not progressing at all, CPManager calls this method to attempt the consumer to push harder
     /// to flush. Consumers are expected to increase any flow control to ensure flush goes faster.
     virtual void repair_slow_cp() {}
+
+    /// @brief CPManager calls this method to estimate the cost of flushing the given cp, which drives cp scheduling.
+    /// @return Returns the number of bytes the consumer has to write if the cp is flushed now.
+    virtual uint64_t cp_dirty_bytes(CP*) { return 0; }
 };
 
 class CPWatchdog;
@@ -145,7 +162,7 @@ class CPManager {
 
 private:
     CP* m_cur_cp{nullptr}; // Current CP information
-    std::atomic< bool > m_in_flush_phase{false};
+    std::atomic< uint32_t > m_inflight_cps{0}; // CPs triggered, but not completed yet
     std::unique_ptr< CPMgrMetrics > m_metrics;
     std::mutex trigger_cp_mtx;
     Clock::time_point m_cp_start_time;
@@ -154,8 +171,15 @@ private:
     superblk< cp_mgr_super_block > m_sb;
     std::vector< iomgr::io_fiber_t > m_cp_io_fibers;
     iomgr::timer_handle_t m_cp_timer_hdl;
+    std::atomic< Clock::time_point > m_last_trigger_time{Clock::now()};
+    std::atomic< uint64_t > m_flush_bytes_per_sec{0};  // Moving average of recent cp flushes
+    std::atomic< uint64_t > m_replay_journal_start{0}; // Journal written counter as of the last completed cp
     std::atomic< bool > m_cp_shutdown_initiated{false};
 
+    // Flush done promise of the last triggered CP, per consumer and for the CP as a whole. Protected by trigger_cp_mtx
+    std::array< std::shared_ptr< folly::SharedPromise< bool > >, (size_t)cp_consumer_t::SENTINEL > m_last_flush_done;
+    std::shared_ptr< folly::SharedPromise< bool > > m_last_cp_done;
+
 public:
     CPManager();
     virtual ~CPManager();
@@ -196,9 +220,11 @@ public:
     /// @return Returns the current CP
     CP* get_cur_cp();
 
-    /// @brief Trigger a checkpoint flush on all subsystems registered. There is only 1 checkpoint per checkpoint
-    /// manager. Checkpoint flush will wait for cp to exited all critical io sections.
-    /// @param force : Do we need to force queue the checkpoint flush, in case previous checkpoint is being flushed
+    /// @brief Trigger a checkpoint flush on all subsystems registered. Upto cp_max_inflight checkpoints can be
+    /// flushing at a time, flush of a triggered checkpoint will wait for it to exit all critical io sections and for
+    /// each consumer to finish flushing the previous checkpoint.
+    /// @param force : Do we need to force queue the checkpoint flush, in case max number of checkpoints are already
+    /// being flushed
     folly::Future< bool > trigger_cp_flush(bool force = false);
 
     const std::array< std::unique_ptr< CPCallbacks >, (size_t)cp_consumer_t::SENTINEL >& consumer_list() const {
@@ -207,13 +233,20 @@ public:
 
     iomgr::io_fiber_t pick_blocking_io_fiber() const;
 
+    nlohmann::json get_metrics_in_json() const { return m_metrics->get_result_in_json(true); }
+
 private:
     void cp_ref(CP* cp);
     void create_first_cp();
     void cp_start_flush(CP* cp);
     void on_cp_flush_done(CP* cp);
+    void complete_cp(CP* cp);
+    void chain_to_prev_cp(CP* cp);
     void cleanup_cp(CP* cp);
     void on_meta_blk_found(const sisl::byte_view& buf, void* meta_cookie);
     void start_cp_thread();
+    void cp_sched_check();
+    uint64_t cp_dirty_bytes(CP* cp) const;
+    void record_flush_throughput(CP* cp);
 };
 } // namespace homestore
@@ -96,7 +96,7 @@ ENUM(io_flag, uint8_t,
      DIRECT_IO,   // recommended mode
      READ_ONLY    // Read-only mode for post-mortem checks
 );
-ENUM(blk_allocator_type_t, uint8_t, none, fixed, varsize, append);
+ENUM(blk_allocator_type_t, uint8_t, none, fixed, varsize, append, extent);
 ENUM(chunk_selector_type_t, uint8_t, // What are the options to select chunk to allocate a block
      NONE,                           // Caller want nothing to be set
      ROUND_ROBIN,                    // Pick round robin
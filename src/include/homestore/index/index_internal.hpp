@@ -16,11 +16,15 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 #include <boost/intrusive_ptr.hpp>
 #include <sisl/utility/atomic_counter.hpp>
 #include <homestore/blk.h>
 #include <homestore/homestore_decl.hpp>
 #include <homestore/btree/detail/btree_internal.hpp>
+#include <homestore/btree/btree_req.hpp>
 
 namespace homestore {
 
@@ -55,6 +59,10 @@ public:
     virtual uuid_t uuid() const = 0;
     virtual uint64_t used_size() const = 0;
     virtual void destroy() = 0;
+
+    /// @brief Repair the structural changes (splits) which were partially persisted when the last CP flush was
+    /// interrupted by a crash. Called during recovery with the ids of this index's nodes dirtied in that CP.
+    virtual void repair_nodes(std::vector< bnodeid_t > const& node_ids) {}
 };
 
 enum class index_buf_state_t : uint8_t {
@@ -84,9 +92,14 @@ typedef std::shared_ptr< IndexBuffer > IndexBufferPtr;
 struct IndexBuffer {
     NodeBufferPtr m_node_buf;
     BlkId m_blkid;                              // BlkId where this needs to be persisted
+    uuid_t m_index_uuid{};                      // Index table this buffer belongs to
     std::weak_ptr< IndexBuffer > m_next_buffer; // Next buffer in the chain
     // Number of leader buffers we are waiting for before we write this buffer
     sisl::atomic_counter< int > m_wait_for_leaders{0};
+    // Generation of modifications on this buffer within its CP and the generation which was persisted ahead of CP
+    // flush by trickle flush. If they match during CP flush, the buffer is already on disk and need not be rewritten.
+    sisl::atomic_counter< int64_t > m_modified_gen{0};
+    std::atomic< int64_t > m_trickled_gen{-1};
 
     IndexBuffer(BlkId blkid, uint32_t buf_size, uint32_t align_size);
     IndexBuffer(NodeBufferPtr node_buf, BlkId blkid);
@@ -144,4 +157,28 @@ public:
     static IndexBtreeNode* convert(BtreeNode* bt_node);
 };
 
+// Snapshot of an index as of the end of a CP. The first time a node is modified (or freed) in a later CP, the write
+// back cache hands over its buffer, which has the contents as of the snapshot, before it makes a copy to modify.
+// Nodes not found here are unmodified since the snapshot and could be read from the live tree.
+struct IndexSnapshot : public BtreeSnapshot {
+    uuid_t m_index_uuid;
+    cp_id_t m_cp_id{-1};
+
+    mutable std::mutex m_mtx;
+    std::unordered_map< bnodeid_t, IndexBufferPtr > m_bufs;
+
+    IndexBufferPtr find(bnodeid_t id) const {
+        std::unique_lock lg(m_mtx);
+        auto it = m_bufs.find(id);
+        return (it == m_bufs.end()) ? nullptr : it->second;
+    }
+
+    // Only the first version after the snapshot is retained
+    void preserve(const IndexBufferPtr& buf) {
+        std::unique_lock lg(m_mtx);
+        m_bufs.try_emplace(buf->m_blkid.to_integer(), buf);
+    }
+};
+using IndexSnapshotPtr = std::shared_ptr< IndexSnapshot >;
+
 } // namespace homestore
@@ -17,6 +17,7 @@
 
 #include <vector>
 #include <atomic>
+#include <unordered_set>
 #include <homestore/btree/btree.ipp>
 #include <homestore/index/index_internal.hpp>
 #include <homestore/superblk_handler.hpp>
@@ -33,6 +34,9 @@ class IndexTable : public IndexTableBase, public Btree< K, V > {
 private:
     superblk< index_table_sb > m_sb;
 
+    std::mutex m_snap_mtx;
+    std::vector< std::weak_ptr< IndexSnapshot > > m_snapshots; // Snapshots whose root could still change
+
 public:
     IndexTable(uuid_t uuid, uuid_t parent_uuid, uint32_t user_sb_size, const BtreeConfig& cfg) :
             Btree< K, V >{cfg}, m_sb{"index"} {
@@ -71,6 +75,82 @@ public:
         m_sb->link_version = version;
         m_sb.write();
         BT_LOG(DEBUG, "Updated index superblk root bnode_id {} version {}", root_node, version);
+        update_snapshot_roots(BtreeLinkInfo{root_node, version});
+    }
+
+    /// @brief Take a snapshot of the index as of the end of the current CP. Returned future is fulfilled once the CP
+    /// is flushed, after which no more modifications could go into the snapshot, and it can be used for
+    /// SNAPSHOT_QUERY. Versions of the nodes modified after the snapshot are retained in memory, till the snapshot is
+    /// released, so long lived snapshots hold up memory proportional to the number of nodes modified meanwhile.
+    folly::Future< IndexSnapshotPtr > create_snapshot() {
+        auto snap = std::make_shared< IndexSnapshot >();
+        {
+            auto cpg = hs()->cp_mgr().cp_guard();
+            snap->m_index_uuid = uuid();
+            snap->m_cp_id = cpg->id();
+
+            std::unique_lock lg(m_snap_mtx);
+            snap->m_root_info = BtreeLinkInfo{Btree< K, V >::root_node_id(), Btree< K, V >::root_link_version()};
+            m_snapshots.emplace_back(snap);
+            wb_cache().register_snapshot(snap);
+        }
+
+        return hs()->cp_mgr().trigger_cp_flush(true /* force */).thenValue([this, snap](bool) {
+            // Snapshot cp is done, its root can't change anymore
+            std::unique_lock lg(m_snap_mtx);
+            std::erase_if(m_snapshots, [&snap](auto const& s) { return s.expired() || (s.lock() == snap); });
+            return snap;
+        });
+    }
+
+    void repair_nodes(std::vector< bnodeid_t > const& node_ids) override {
+        // Only the parent-child links between the nodes dirtied in the interrupted CP could be torn, since both sides
+        // of a split are always written in the same CP. So visit only those interior nodes and their children which
+        // are in the same set.
+        std::unordered_set< bnodeid_t > touched{node_ids.begin(), node_ids.end()};
+        uint32_t repaired{0};
+
+        auto cpg = hs()->cp_mgr().cp_guard();
+        auto context = (void*)cpg.context(cp_consumer_t::INDEX_SVC);
+        for (auto const id : node_ids) {
+            BtreeNodePtr parent_node;
+            if (this->read_node_impl(id, parent_node) != btree_status_t::success) { continue; }
+            if (!parent_node->is_valid_node() || parent_node->is_leaf()) { continue; }
+
+            auto ret = this->lock_node(parent_node, locktype_t::WRITE, context);
+            if (ret != btree_status_t::success) { continue; }
+
+            // repair_split inserts an entry at the repaired index, so walk the entries including edge one by one and
+            // re-read the entry count every iteration
+            for (uint32_t idx{0}; idx <= parent_node->total_entries(); ++idx) {
+                BtreeLinkInfo child_info;
+                if (idx == parent_node->total_entries()) {
+                    if (!parent_node->has_valid_edge()) { break; }
+                    child_info = parent_node->get_edge_value();
+                } else {
+                    parent_node->get_nth_value(idx, &child_info, false /* copy */);
+                }
+                if (!touched.count(child_info.bnode_id())) { continue; }
+
+                BtreeNodePtr child_node;
+                if (this->read_node_impl(child_info.bnode_id(), child_node) != btree_status_t::success) { continue; }
+                if (child_info.link_version() == child_node->link_version()) { continue; }
+
+                ret = this->lock_node(child_node, locktype_t::WRITE, context);
+                if (ret != btree_status_t::success) { continue; }
+                ret = prepare_node_txn(parent_node, child_node, context);
+                if (ret == btree_status_t::success) {
+                    BT_LOG(INFO, "Repairing torn split of node {} under parent {}", child_node->node_id(),
+                           parent_node->node_id());
+                    ret = this->repair_split(parent_node, child_node, idx, context);
+                    if (ret == btree_status_t::success) { ++repaired; }
+                }
+                this->unlock_node(child_node, locktype_t::WRITE);
+            }
+            this->unlock_node(parent_node, locktype_t::WRITE);
+        }
+        BT_LOG(INFO, "Index recovery visited {} nodes dirtied in last cp, repaired {} torn splits", node_ids.size(),
+               repaired);
     }
 
     template < typename ReqT >
@@ -95,6 +175,7 @@ protected:
                                            true, is_leaf);
             uint8_t* ctx_mem = uintptr_cast(IndexBtreeNode::convert(n));
             new (ctx_mem) IndexBtreeNode(idx_buf); // TODO: Figure out a way to call destructor of IndexBtreeNode
+            idx_buf->m_index_uuid = uuid();
             return BtreeNodePtr{n};
         });
     }
@@ -114,6 +195,7 @@ protected:
             LOGTRACEMOD(wbcache, "add to dirty list cp {} {}", cp_ctx->id(), idx_node->m_idx_buf->to_string());
         }
         node->set_checksum(this->m_bt_cfg);
+        idx_node->m_idx_buf->m_modified_gen.increment(1);
         return btree_status_t::success;
     }
 
@@ -156,18 +238,67 @@ protected:
 
     btree_status_t read_node_impl(bnodeid_t id, BtreeNodePtr& node) const override {
         try {
-            wb_cache().read_buf(id, node, [this](const IndexBufferPtr& idx_buf) mutable -> BtreeNodePtr {
-                bool is_leaf = BtreeNode::identify_leaf_node(idx_buf->raw_buffer());
-                BtreeNode* n = this->init_node(idx_buf->raw_buffer(), sizeof(IndexBtreeNode),
-                                               idx_buf->blkid().to_integer(), false /* init_buf */, is_leaf);
-                uint8_t* ctx_mem = uintptr_cast(IndexBtreeNode::convert(n));
-                new (ctx_mem) IndexBtreeNode(idx_buf); // TODO: Figure out a way to call destructor of IndexBtreeNode]2
-                return BtreeNodePtr{n};
-            });
+            wb_cache().read_buf(id, node, loaded_node_initializer());
             return btree_status_t::success;
         } catch (std::exception& e) { return btree_status_t::node_read_failed; }
     }
 
+    void prefetch_nodes_impl(std::vector< bnodeid_t > const& ids) const override {
+        wb_cache().prefetch_bufs(ids, loaded_node_initializer());
+    }
+
+    btree_status_t read_snapshot_node_impl(bnodeid_t id, const BtreeSnapshot& snap, BtreeNodePtr& node,
+                                           bool& is_locked) const override {
+        auto const& idx_snap = s_cast< const IndexSnapshot& >(snap);
+        is_locked = false;
+
+        auto buf = idx_snap.find(id);
+        if (buf == nullptr) {
+            auto ret = this->read_and_lock_node(id, node, locktype_t::READ, locktype_t::READ, nullptr);
+            if (ret != btree_status_t::success) { return ret; }
+
+            // Node could have been modified after we looked up, but that happens under the write lock, so if it is
+            // not retained by the snapshot by now, the live node is as of snapshot till we unlock it.
+            buf = idx_snap.find(id);
+            if (buf == nullptr) {
+                is_locked = true;
+                return btree_status_t::success;
+            }
+            this->unlock_node(node, locktype_t::READ);
+        }
+
+        // Retained buffer is immutable and lives as long as the snapshot, so wrap it in a transient node without
+        // holding a reference to the buffer
+        BtreeNode* n = this->init_node(buf->raw_buffer(), sizeof(IndexBtreeNode), id, false /* init_buf */,
+                                       BtreeNode::identify_leaf_node(buf->raw_buffer()));
+        new (uintptr_cast(IndexBtreeNode::convert(n))) IndexBtreeNode(nullptr);
+        node = BtreeNodePtr{n};
+        return btree_status_t::success;
+    }
+
+    void update_snapshot_roots(const BtreeLinkInfo& root_info) {
+        // Root change within the cp of a snapshot is part of the snapshot
+        auto cpg = hs()->cp_mgr().cp_guard();
+        std::unique_lock lg(m_snap_mtx);
+        for (auto const& s : m_snapshots) {
+            auto snap = s.lock();
+            if (snap && (snap->m_cp_id >= cpg->id())) { snap->m_root_info = root_info; }
+        }
+    }
+
+    // Initializer which turns a buffer read from the device into a btree node
+    node_initializer_t loaded_node_initializer() const {
+        return [this](const IndexBufferPtr& idx_buf) mutable -> BtreeNodePtr {
+            bool is_leaf = BtreeNode::identify_leaf_node(idx_buf->raw_buffer());
+            BtreeNode* n = this->init_node(idx_buf->raw_buffer(), sizeof(IndexBtreeNode), idx_buf->blkid().to_integer(),
+                                           false /* init_buf */, is_leaf);
+            uint8_t* ctx_mem = uintptr_cast(IndexBtreeNode::convert(n));
+            new (ctx_mem) IndexBtreeNode(idx_buf); // TODO: Figure out a way to call destructor of IndexBtreeNode
+            idx_buf->m_index_uuid = uuid();
+            return BtreeNodePtr{n};
+        };
+    }
+
     btree_status_t refresh_node(const BtreeNodePtr& node, bool for_read_modify_write, void* context) const override {
         CPContext* cp_ctx = (CPContext*)context;
         if (cp_ctx == nullptr) { return btree_status_t::success; }
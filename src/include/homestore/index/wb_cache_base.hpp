@@ -16,6 +16,7 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 #include <boost/intrusive_ptr.hpp>
 #include <sisl/utility/atomic_counter.hpp>
 #include <homestore/blk.h>
@@ -48,8 +49,19 @@ public:
     /// @param context
     virtual void write_buf(const BtreeNodePtr& node, const IndexBufferPtr& buf, CPContext* context) = 0;
 
+    /// @brief Read the buffer for given node id and initialize the btree node, if it is not already in cache. If the
+    /// same node is already being read by someone else, it waits for that read to complete instead of issuing another.
+    /// @param id Node id to read
+    /// @param node Btree node which is read or found in the cache
+    /// @param node_initializer Callback to be called upon which buffer is turned into btree node
     virtual void read_buf(bnodeid_t id, BtreeNodePtr& node, node_initializer_t&& node_initializer) = 0;
 
+    /// @brief Issue asynchronous reads for the nodes which are not in cache, so that a subsequent read_buf on them is
+    /// likely to find them in cache or in flight. It does not wait for any of the reads to complete.
+    /// @param ids List of node ids to read ahead
+    /// @param node_initializer Callback to be called upon which buffer is turned into btree node
+    virtual void prefetch_bufs(std::vector< bnodeid_t > const& ids, node_initializer_t&& node_initializer) = 0;
+
     /// @brief Start a chain of related btree buffers. Typically a chain is creating from second and third pairs and
     /// then first is prepended to the chain. In case the second buffer is already with the WB cache, it will create a
     /// new buffer for both second and third. We append the buffers to a list in dependency chain.
@@ -74,6 +86,10 @@ public:
     /// @param cur_buf
     /// @return
     virtual IndexBufferPtr copy_buffer(const IndexBufferPtr& cur_buf, const CPContext* context) const = 0;
+
+    /// @brief Start retaining the versions of nodes of the index as of the snapshot, till the snapshot is released
+    /// @param snap Snapshot to fill in, with its cp id and index uuid set
+    virtual void register_snapshot(const IndexSnapshotPtr& snap) = 0;
 };
 
 } // namespace homestore
@@ -47,6 +47,10 @@ private:
     mutable std::mutex m_index_map_mtx;
     std::map< uuid_t, std::shared_ptr< IndexTableBase > > m_index_map;
 
+    // Journal of nodes dirtied in the last CP, found during meta blk scan and used to repair the indexes at start
+    sisl::byte_view m_cp_journal_buf;
+    void* m_cp_journal_cookie{nullptr};
+
 public:
     IndexService(std::unique_ptr< IndexServiceCallbacks > cbs);
 
@@ -73,6 +77,7 @@ public:
 
 private:
     void meta_blk_found(const sisl::byte_view& buf, void* meta_cookie);
+    void repair_indexes();
 };
 
 extern IndexService& index_service();
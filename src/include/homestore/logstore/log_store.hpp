@@ -20,6 +20,7 @@
 #include <cstdint>
 #include <functional>
 #include <limits>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <set>
@@ -256,6 +257,15 @@ public:
      */
     void flush_sync(logstore_seq_num_t upto_seq_num = invalid_lsn());
 
+    /**
+     * @brief Flush this log store (write/sync to disk) up to the sequence number, without waiting for it
+     *
+     * @param upto_seq_num Sequence number upto which logs are to be flushed.
+     * @param cb Callback once the logs upto the sequence number are flushed. It is called in the caller's thread if
+     * they are already flushed, else in the thread which completes the flush.
+     */
+    void flush_async(logstore_seq_num_t upto_seq_num, std::function< void() > cb);
+
     /**
      * @brief Rollback the given instance to the given sequence number
      *
@@ -304,6 +314,8 @@ private:
     std::atomic< logstore_seq_num_t > m_sync_flush_waiter_lsn{invalid_lsn()};
     std::mutex m_sync_flush_mtx;
     std::condition_variable m_sync_flush_cv;
+    std::multimap< logstore_seq_num_t, std::function< void() > > m_flush_waiters; // Async flush callbacks by seqnum
+    std::atomic< logstore_seq_num_t > m_min_flush_waiter_lsn{std::numeric_limits< logstore_seq_num_t >::max()};
 
     std::vector< seq_ld_key_pair > m_truncation_barriers; // List of truncation barriers
     truncation_info m_safe_truncation_boundary;
@@ -26,6 +26,7 @@
 #include <vector>
 #include <optional>
 
+#include <folly/futures/Future.h>
 #include <sisl/fds/buffer.hpp>
 #include <sisl/metrics/metrics.hpp>
 #include <nlohmann/json.hpp>
@@ -38,6 +39,8 @@ struct meta_blk_ovf_hdr;
 struct meta_blk_sb;
 struct meta_blk;
 struct meta_vdev_context;
+struct meta_write_req;
+struct meta_write_batch;
 struct MetaSubRegInfo;
 struct BlkId;
 class VirtualDev;
@@ -54,6 +57,7 @@ typedef std::map< uint64_t, meta_blk* > meta_blk_map_t;                 // blkid
 typedef std::map< uint64_t, meta_blk_ovf_hdr* > ovf_hdr_map_t;          // ovf_blkid to ovf_blk_hdr map;
 typedef std::map< meta_sub_type, MetaSubRegInfo > client_info_map_t;    // client information map;
 typedef std::unordered_map< meta_sub_type, std::vector< meta_sub_type > > subtype_graph_t;
+typedef std::vector< std::pair< uint64_t, uint64_t > > meta_dirty_ranges_t; // (offset, len) in context data
 
 class MetablkMetrics : public sisl::MetricsGroupWrapper {
 public:
@@ -63,6 +67,14 @@ public:
         REGISTER_COUNTER(compress_backoff_ratio_cnt, "compression back-off cnt because of exceeding ratio limit");
 
         REGISTER_HISTOGRAM(compress_ratio_percent, "compression ration percentage");
+
+        REGISTER_COUNTER(delta_update_cnt, "Number of partial sub sb updates written as delta records");
+        REGISTER_COUNTER(delta_compact_cnt, "Number of partial sub sb updates which compacted to full image");
+
+        REGISTER_COUNTER(write_batches, "Number of batches of async sub sb writes");
+        REGISTER_COUNTER(write_batch_ios, "Number of meta blk ios issued by batched sub sb writes");
+        REGISTER_HISTOGRAM(write_batch_size, "Number of async sub sb writes coalesced into one batch",
+                           HistogramBucketsType(LinearUpto64Buckets));
         register_me_to_farm();
     }
 
@@ -76,6 +88,11 @@ public:
 
 struct meta_vdev_context;
 
+struct update_gens {
+    uint64_t issued{0};  // latest update issued on the sub sb
+    uint64_t applied{0}; // latest update applied on the sub sb
+};
+
 class MetaBlkService {
 private:
     static bool s_self_recover;
@@ -93,6 +110,12 @@ private:
     std::unique_ptr< meta_vdev_context > m_meta_vdev_context;
     subtype_graph_t m_dep_topo_graph;
 
+    std::mutex m_pending_mtx;                                          // protects the pending async writes below
+    std::vector< std::shared_ptr< meta_write_req > > m_pending_writes; // async writes waiting for next batch
+    bool m_batch_in_progress{false};                                   // is a batch of m_pending_writes being written
+    std::unordered_map< void*, update_gens > m_update_gens; // update gens of each sub sb, under m_pending_mtx
+    meta_write_batch* m_write_batch{nullptr}; // batch being built (under m_meta_mtx), writes are deferred into it
+
 public:
     MetaBlkService(const char* name = "MetaBlkStore");
     MetaBlkService(const MetaBlkService&) = delete;
@@ -166,6 +189,44 @@ public:
      */
     void update_sub_sb(const uint8_t* context_data, uint64_t sz, void*& cookie);
 
+    /**
+     * @brief : Asynchronous version of add_sub_sb. Async adds and updates issued close together, by one or more
+     * callers, are coalesced into one batch, which is written on a blocking io fiber with one batched submission of
+     * meta blks and a single update of the previous last meta blk (or ssb). Context data is copied, caller can release
+     * it once the call returns.
+     *
+     * @return : Future with the cookie of the added sub sb, fulfilled once the sb is persisted;
+     */
+    folly::Future< void* > async_add_sub_sb(meta_sub_type type, const uint8_t* context_data, uint64_t sz);
+
+    /**
+     * @brief : Asynchronous version of update_sub_sb, batched along with other async adds and updates. If the sb is
+     * updated again with a sync update before this one is written, this one is skipped in favour of the newer one.
+     * Caller should not remove the sb until this future is fulfilled.
+     *
+     * @return : Future which is fulfilled with true once the update is persisted;
+     */
+    folly::Future< bool > async_update_sub_sb(const uint8_t* context_data, uint64_t sz, void* cookie);
+
+    /**
+     * @brief : update metablk where only parts of the context data has changed since it was last written. For sbs in
+     * overflow blks, the changed ranges are appended as delta records to the meta blk, costing one blk write. Once the
+     * delta records exceed the space in meta blk or metablk.max_delta_records, the full image is written instead.
+     *
+     * @param context_data : entire new context data of the sub sb;
+     * @param sz : size of context_data, it has to be same as the size last written, otherwise it is a full update;
+     * @param ranges : ranges of context_data which differ from what was last written;
+     * @param cookie : handle to address the unique subsytem sb that is being updated;
+     */
+    void update_sub_sb_delta(const uint8_t* context_data, uint64_t sz, const meta_dirty_ranges_t& ranges,
+                             void*& cookie);
+
+    /**
+     * @brief : Ranges of the buffer which differ between the previous and current versions, at a granularity of 64
+     * bytes, to be used for update_sub_sb_delta.
+     */
+    static meta_dirty_ranges_t dirty_ranges(const uint8_t* prev, const uint8_t* cur, uint64_t sz);
+
     // size_t read_sub_sb(const meta_sub_type type, sisl::byte_view& buf);
     void read_sub_sb(meta_sub_type type);
 
@@ -312,6 +373,32 @@ private:
      */
     void write_meta_blk_internal(meta_blk* mblk, const uint8_t* context_data, uint64_t sz);
 
+    bool append_delta(meta_blk* mblk, const uint8_t* context_data, uint64_t sz, const meta_dirty_ranges_t& ranges);
+    void reset_delta(meta_blk* mblk) const;
+    void apply_delta(const meta_blk* mblk, uint8_t* context_data, uint64_t sz) const;
+
+    void add_sub_sb_internal(meta_sub_type type, const uint8_t* context_data, uint64_t sz, void*& cookie);
+    void update_sub_sb_internal(const uint8_t* context_data, uint64_t sz, void* cookie);
+
+    /**
+     * @brief : Queue the async write request and if no one else is writing a batch, schedule one on a blocking io
+     * fiber. Requests queued till the batch is picked up go in the same batch, the ones queued meanwhile are written
+     * as the next batch, batch after batch. Callers are never held up by the writes.
+     */
+    void queue_write(const std::shared_ptr< meta_write_req >& req);
+    void drain_one_batch();
+    void write_batch(std::vector< std::shared_ptr< meta_write_req > >& reqs);
+
+    /**
+     * @brief : Updates of a sub sb are numbered in the order they are issued. An async update which is yet to be
+     * written when a newer sync update is written, is skipped, so that it doesn't overwrite the newer one.
+     *
+     * @return : apply_update_gen returns false if a newer update is already applied or the sb is removed meanwhile.
+     * Needs m_meta_mtx to be held.
+     */
+    uint64_t next_update_gen(void* cookie);
+    bool apply_update_gen(void* cookie, uint64_t gen);
+
     /**
      * @brief : sync read;
      *
@@ -362,7 +449,9 @@ private:
     bool scan_and_load_meta_blks(meta_blk_map_t& meta_blks, ovf_hdr_map_t& ovf_blk_hdrs, BlkId* last_mblk_id,
                                  client_info_map_t& sub_info);
 
-    void recover_meta_block(meta_blk* meta_block);
+    void recover_meta_blks(const std::vector< meta_blk* >& mblks);
+    std::vector< sisl::byte_array > read_sub_sbs_internal(const std::vector< meta_blk* >& mblks) const;
+    sisl::byte_array prepare_recovered_sb(const meta_blk* mblk, sisl::byte_array buf, size_t& out_size) const;
     void recover_meta_sub_type(bool do_comp_cb, const meta_sub_type&);
 
 public:
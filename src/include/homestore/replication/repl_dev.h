@@ -6,6 +6,7 @@
 #include <boost/smart_ptr/intrusive_ref_counter.hpp>
 #include <flatbuffers/flatbuffers.h>
 #include <folly/futures/Future.h>
+#include <folly/hash/Hash.h>
 #include <sisl/fds/buffer.hpp>
 #include <sisl/grpc/generic_service.hpp>
 #include <homestore/replication/repl_decls.h>
@@ -29,7 +30,8 @@ VENUM(repl_req_state_t, uint32_t,
       DATA_RECEIVED = 1 << 1, // Data has been received and being written to the storage
       DATA_WRITTEN = 1 << 2,  // Data has been written to the storage
       LOG_RECEIVED = 1 << 3,  // Log is received and waiting for data
-      LOG_FLUSHED = 1 << 4    // Log has been flushed
+      LOG_FLUSHED = 1 << 4,   // Log has been flushed
+      ROLLED_BACK = 1 << 5    // Log is rolled back by raft, the data need not be written anymore
 )
 
 struct repl_key {
@@ -38,22 +40,49 @@ struct repl_key {
     uint64_t dsn{0};      // Data sequence number to tie the data with the raft journal entry
 
     struct Hasher {
-        size_t operator()(repl_key const& rk) const {
-            return std::hash< int32_t >()(rk.server_id) ^ std::hash< uint64_t >()(rk.term) ^
-                std::hash< uint64_t >()(rk.dsn);
-        }
+        // Mix all the bits, concurrent maps pick their shard from the high order bits of the hash
+        size_t operator()(repl_key const& rk) const { return folly::hash::hash_combine(rk.server_id, rk.term, rk.dsn); }
     };
 
     bool operator==(repl_key const& other) const = default;
     std::string to_string() const { return fmt::format("server={}, term={}, dsn={}", server_id, term, dsn); }
 };
 
+// Data channel rpc, shared by all the repl_reqs whose data was pushed together in it. Response to the rpc is sent once
+// all of them are done with it.
+struct data_rpc_ctx : public boost::intrusive_ref_counter< data_rpc_ctx, boost::thread_safe_counter > {
+    intrusive< sisl::GenericRpcData > rpc_data;
+    sisl::io_blob_safe aligned_buf; // Aligned copy of the data, if the rpc buffer is not aligned
+
+    ~data_rpc_ctx() {
+        if (rpc_data) { rpc_data->send_response(); }
+    }
+};
+
+// Entry in the state of the repl dev, as shipped by a snapshot to a replica which is behind the compacted log.
+struct snapshot_entry {
+    int64_t lsn{0};            // Lsn at which the entry was last written
+    sisl::io_blob_safe header; // User header
+    sisl::io_blob_safe key;    // User key
+    MultiBlkId blkid;          // Blkid of the data. Invalid if the entry has no data
+};
+
 struct repl_journal_entry;
 struct repl_req_ctx : public boost::intrusive_ref_counter< repl_req_ctx, boost::thread_safe_counter > {
     friend class SoloReplDev;
 
 public:
     virtual ~repl_req_ctx();
+
+    // repl_req_ctx created internally on followers are recycled through a freelist, instead of going to the heap for
+    // every request. Contexts derived by the users are of different size and they are allocated from the heap.
+    static void* operator new(size_t size);
+    static void operator delete(void* ptr, size_t size);
+
+    // Class specific operator new hides the placement new, bring it back for the ones constructing in their own buffer
+    static void* operator new(size_t, void* place) noexcept { return place; }
+    static void operator delete(void*, void*) noexcept {}
+
     int64_t get_lsn() const { return lsn; }
     MultiBlkId const& get_local_blkid() const { return local_blkid; }
 
@@ -90,8 +119,13 @@ public:
     //////////////// Communication packet/builder section /////////////////
     sisl::io_blob_list_t pkts;
     flatbuffers::FlatBufferBuilder fb_builder;
-    sisl::io_blob_safe buf_for_unaligned_data;
-    intrusive< sisl::GenericRpcData > rpc_data;
+    intrusive< data_rpc_ctx > rpc_data;
+
+    //////////////// Leader write pipeline section, to track the latency of each stage /////////////////
+    Clock::time_point created_time;    // Time the write is submitted by the user
+    Clock::time_point data_write_time; // Time the blks are allocated and local data write is started
+    Clock::time_point push_time;       // Time the data is queued to be pushed to followers
+    Clock::time_point propose_time;    // Time the journal entry is queued to be proposed to raft
 };
 
 //
@@ -169,6 +203,40 @@ public:
     /// @brief Called when the replica set is being stopped
     virtual void on_replica_stop() = 0;
 
+    /// @brief Called on the leader to get the entries making up the state of the replica set, to resync a replica
+    /// which is behind the compacted log.
+    ///
+    /// Listener is expected to return its entries which were last written in the lsn range (from_lsn, upto_lsn], in
+    /// lsn order. Entries removed in that range need to be returned as well (with an invalid blkid and a header which
+    /// tells the listener that it is removed), so that a replica resyncing incrementally from from_lsn removes them.
+    /// Entries which were written after upto_lsn are not needed, they are replayed from the log. This is called
+    /// repeatedly with from_lsn as the last lsn returned so far, until there are no more entries. It is called from a
+    /// raft thread (not an io thread) and it can block.
+    ///
+    /// @param from_lsn Entries upto this lsn are already with the replica
+    /// @param upto_lsn Lsn of the snapshot being sent
+    /// @param max_data_size Approximate size of the data of the returned entries, at least one entry is to be returned
+    /// @param out_entries Entries to be sent to the replica
+    /// @return true if there are no more entries after the ones returned
+    ///
+    /// Default implementation is for listeners which don't support resync from snapshot, it returns no entries.
+    virtual bool get_snapshot_entries(int64_t from_lsn, int64_t upto_lsn, uint64_t max_data_size,
+                                      std::vector< snapshot_entry >& out_entries) {
+        return true;
+    }
+
+    /// @brief Called on the replica being resynced, for each entry received from the leader's snapshot.
+    ///
+    /// Data of the entry is already written to the local blkid (entry.blkid) before this call. Listener is expected
+    /// to replace any existing entry of the same key, freeing its blks. Entries are passed in lsn order, but if the
+    /// replica restarts in the middle of resync, some of them could be passed again.
+    ///
+    /// @param entry Entry received from the leader, with the blkid allocated locally
+    virtual void on_snapshot_entry(snapshot_entry const& entry) {
+        RELEASE_ASSERT(false, "Received snapshot entry of lsn={}, but the listener doesn't support snapshots",
+                       entry.lsn);
+    }
+
 private:
     ReplDev* m_repl_dev;
 };
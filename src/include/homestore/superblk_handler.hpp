@@ -14,8 +14,11 @@
  *
  *********************************************************************************/
 #pragma once
+#include <algorithm>
 #include <atomic>
+#include <cstring>
 #include <string>
+#include <vector>
 
 #include <nlohmann/json.hpp>
 #include <sisl/fds/buffer.hpp>
@@ -40,7 +43,8 @@ public:
          : m_meta_mgr_cookie(rhs.m_meta_mgr_cookie)
            , m_raw_buf(std::move(rhs.m_raw_buf))
            , m_sb(rhs.m_sb)
-           , m_metablk_name(std::move(rhs.m_metablk_name)) {
+           , m_metablk_name(std::move(rhs.m_metablk_name))
+           , m_persisted_buf(std::move(rhs.m_persisted_buf)) {
 	rhs.m_meta_mgr_cookie = nullptr;
 	rhs.m_sb = nullptr;
     }
@@ -51,6 +55,7 @@ public:
             m_raw_buf = std::move(rhs.m_raw_buf);
             m_sb = rhs.m_sb;
             m_metablk_name = std::move(rhs.m_metablk_name);
+            m_persisted_buf = std::move(rhs.m_persisted_buf);
             rhs.m_meta_mgr_cookie = nullptr;
             rhs.m_sb = nullptr;
 	}
@@ -70,6 +75,7 @@ public:
         m_raw_buf = meta_service().is_aligned_buf_needed(buf.size()) ? buf.extract(meta_service().align_size())
                                                                      : buf.extract(0);
         m_sb = r_cast< T* >(m_raw_buf->bytes());
+        save_persisted();
         return m_sb;
     }
 
@@ -84,6 +90,16 @@ public:
         return m_sb;
     }
 
+    // Resizes the loaded superblk, keeping its contents. Bytes added at the end are zeroed, which is what an upgrade
+    // of an older version to a larger layout needs. Caller is expected to write() it after the upgrade.
+    T* resize(uint32_t size) {
+        auto const old_buf = m_raw_buf;
+        create(size);
+        std::memset(m_raw_buf->bytes(), 0, m_raw_buf->size());
+        std::memcpy(m_raw_buf->bytes(), old_buf->cbytes(), std::min(old_buf->size(), m_raw_buf->size()));
+        return m_sb;
+    }
+
     void destroy() {
         if (m_meta_mgr_cookie) {
             meta_service().remove_sub_sb(m_meta_mgr_cookie);
@@ -91,6 +107,7 @@ public:
         }
         m_raw_buf.reset();
         m_sb = nullptr;
+        m_persisted_buf.clear();
     }
 
     uint32_t size() const { return m_raw_buf->size(); }
@@ -98,10 +115,30 @@ public:
 
     void write() {
         if (m_meta_mgr_cookie) {
-            meta_service().update_sub_sb(m_raw_buf->cbytes(), m_raw_buf->size(), m_meta_mgr_cookie);
+            if (m_persisted_buf.size() == m_raw_buf->size()) {
+                // Only part of a large superblk typically changes, let meta service write just the changes.
+                meta_service().update_sub_sb_delta(
+                    m_raw_buf->cbytes(), m_raw_buf->size(),
+                    MetaBlkService::dirty_ranges(m_persisted_buf.data(), m_raw_buf->cbytes(), m_raw_buf->size()),
+                    m_meta_mgr_cookie);
+            } else {
+                meta_service().update_sub_sb(m_raw_buf->cbytes(), m_raw_buf->size(), m_meta_mgr_cookie);
+            }
         } else {
             meta_service().add_sub_sb(m_metablk_name, m_raw_buf->cbytes(), m_raw_buf->size(), m_meta_mgr_cookie);
         }
+        save_persisted();
+    }
+
+    // Asynchronous version of write(), batched by meta service along with other async writes. Superblks large enough
+    // to be written as deltas, and the first write which adds the superblk, are done synchronously.
+    folly::Future< bool > async_write() {
+        if ((m_meta_mgr_cookie == nullptr) || (m_raw_buf->size() > meta_service().meta_blk_context_sz())) {
+            write();
+            return folly::makeFuture< bool >(true);
+        }
+        save_persisted();
+        return meta_service().async_update_sub_sb(m_raw_buf->cbytes(), m_raw_buf->size(), m_meta_mgr_cookie);
     }
 
     bool is_empty() const { return (m_sb == nullptr); }
@@ -110,11 +147,22 @@ public:
     const T* operator->() const { return m_sb; }
     T& operator*() { return *m_sb; }
 
+private:
+    void save_persisted() {
+        // Superblks which fit in a meta blk are written with one blk write anyway, no need to track their changes
+        if (m_raw_buf->size() > meta_service().meta_blk_context_sz()) {
+            m_persisted_buf.assign(m_raw_buf->cbytes(), m_raw_buf->cbytes() + m_raw_buf->size());
+        } else {
+            m_persisted_buf.clear();
+        }
+    }
+
 private:
     void* m_meta_mgr_cookie{nullptr};
     sisl::byte_array m_raw_buf;
     T* m_sb{nullptr};
     std::string m_metablk_name;
+    std::vector< uint8_t > m_persisted_buf; // Copy of what was last persisted, to find the changes on next write
 };
 
 class json_superblk {
@@ -13,6 +13,8 @@
  * specific language governing permissions and limitations under the License.
  * *
  * *********************************************************************************/
+#include <algorithm>
+
 #include <homestore/checkpoint/cp_mgr.hpp>
 #include <homestore/checkpoint/cp.hpp>
 #include <homestore/meta_service.hpp>
@@ -22,7 +24,9 @@
 namespace homestore {
 
 AppendBlkAllocator::AppendBlkAllocator(const BlkAllocConfig& cfg, bool need_format, allocator_id_t id) :
-        BlkAllocator{cfg, id}, m_metrics{get_name().c_str()} {
+        BlkAllocator{cfg, id},
+        m_committed_bm{std::make_unique< std::atomic< uint64_t >[] >((get_total_blks() + 63) / 64)},
+        m_metrics{get_name().c_str()} {
     // TODO: try to make all append_blk_allocator instances use same client type to reduce metablk's cache footprint;
     meta_service().register_handler(
         get_name(),
@@ -30,20 +34,16 @@ AppendBlkAllocator::AppendBlkAllocator(const BlkAllocConfig& cfg, bool need_form
         nullptr);
 
     if (need_format) {
-        m_freeable_nblks = available_blks();
-        m_last_append_offset = 0;
+        m_cursor.store(0);
+        m_garbage.store(0);
     }
 
     // for both fresh start and recovery, firstly init m_sb fields;
     m_sb.create(sizeof(append_blk_sb_t));
     m_sb.set_name(get_name());
     m_sb->allocator_id = id;
-    m_sb->last_append_offset = m_last_append_offset;
-    m_sb->freeable_nblks = m_freeable_nblks;
-
-    for (auto i = 0ul; i < m_dirty_sb.size(); ++i) {
-        m_dirty_sb[i].is_dirty = false;
-    }
+    m_sb->last_append_offset = get_used_blks();
+    m_sb->freeable_nblks = get_freeable_nblks();
 
     // for recovery boot, fields will also be recovered from metablks;
 }
@@ -51,12 +51,15 @@ AppendBlkAllocator::AppendBlkAllocator(const BlkAllocConfig& cfg, bool need_form
 void AppendBlkAllocator::on_meta_blk_found(const sisl::byte_view& buf, void* meta_cookie) {
     m_sb.load(buf, meta_cookie);
 
-    // recover in-memory counter/offset from metablk;
-    m_last_append_offset = m_sb->last_append_offset;
-    m_freeable_nblks = m_sb->freeable_nblks;
-
     HS_REL_ASSERT_EQ(m_sb->magic, append_blkalloc_sb_magic, "Invalid AppendBlkAlloc metablk, magic mismatch");
     HS_REL_ASSERT_EQ(m_sb->version, append_blkalloc_sb_version, "Invalid version of AppendBlkAllocator metablk");
+
+    // recover in-memory counter/offset from metablk;
+    m_cursor.store(m_sb->last_append_offset);
+    m_garbage.store(m_sb->freeable_nblks - (get_total_blks() - m_sb->last_append_offset));
+
+    // Blks allocated before the restart are either committed or are garbage nobody will ever commit
+    set_committed(0, m_sb->last_append_offset, true);
 }
 
 //
@@ -65,59 +68,52 @@ void AppendBlkAllocator::on_meta_blk_found(const sisl::byte_view& buf, void* met
 //
 // alloc a single block;
 //
-BlkAllocStatus AppendBlkAllocator::alloc_contiguous(BlkId& bid) {
-    std::unique_lock lk(m_mtx);
-    if (available_blks() < 1) {
-        COUNTER_INCREMENT(m_metrics, num_alloc_failure, 1);
-        LOGERROR("No space left to serve request nblks: 1, available_blks: {}", available_blks());
-        return BlkAllocStatus::SPACE_FULL;
-    }
-
-    bid = BlkId{m_last_append_offset, 1, m_chunk_id};
-
-    auto cur_cp = hs()->cp_mgr().cp_guard();
-    ++m_last_append_offset;
-    --m_freeable_nblks;
-    set_dirty_offset(cur_cp->id() % MAX_CP_COUNT);
-
-    COUNTER_INCREMENT(m_metrics, num_alloc, 1);
-    return BlkAllocStatus::SUCCESS;
-}
+BlkAllocStatus AppendBlkAllocator::alloc_contiguous(BlkId& bid) { return alloc(1, blk_alloc_hints{}, bid); }
 
 //
 // For append blk allocator, the assumption is only one writer will append data on one chunk.
 // If we want to change above design, we can open this api for vector allocation;
 //
 BlkAllocStatus AppendBlkAllocator::alloc(blk_count_t nblks, const blk_alloc_hints& hint, BlkId& out_bid) {
-    std::unique_lock lk(m_mtx);
-    if (available_blks() < nblks) {
-        COUNTER_INCREMENT(m_metrics, num_alloc_failure, 1);
-        LOGERROR("No space left to serve request nblks: {}, available_blks: {}", nblks, available_blks());
-        return BlkAllocStatus::SPACE_FULL;
-    } else if (nblks > max_blks_per_blkid()) {
+    if (nblks > max_blks_per_blkid()) {
         // consumer(vdev) already handles this case.
         COUNTER_INCREMENT(m_metrics, num_alloc_failure, 1);
         LOGERROR("Can't serve request nblks: {} larger than max_blks_in_op: {}", nblks, max_blks_per_blkid());
         return BlkAllocStatus::FAILED;
     }
 
-    // Push 1 blk to the vector which has all the requested nblks;
-    out_bid = BlkId{m_last_append_offset, nblks, m_chunk_id};
-
+    // Guard is taken before moving the cursor, so that the allocation is part of the cp whose dirty buffer it updates
     auto cur_cp = hs()->cp_mgr().cp_guard();
-    m_last_append_offset += nblks;
-    m_freeable_nblks -= nblks;
+
+    auto cursor = m_cursor.load(std::memory_order_acquire);
+    do {
+        if (cursor & sealed_bit) {
+            // chunk is being garbage collected, vdev will look for other chunks
+            return BlkAllocStatus::SPACE_FULL;
+        } else if (get_total_blks() - offset_of(cursor) < nblks) {
+            // End of chunk, cursor is never moved beyond it
+            COUNTER_INCREMENT(m_metrics, num_alloc_failure, 1);
+            LOGERROR("No space left to serve request nblks: {}, available_blks: {}", nblks,
+                     get_total_blks() - offset_of(cursor));
+            return BlkAllocStatus::SPACE_FULL;
+        }
+    } while (!m_cursor.compare_exchange_weak(cursor, cursor + nblks, std::memory_order_acq_rel));
+
+    out_bid = BlkId{offset_of(cursor), nblks, m_chunk_id};
 
     // it is guaranteed that dirty buffer always contains updates of current_cp or next_cp, it will
     // never get dirty buffer from across updates;
-    set_dirty_offset(cur_cp->id() % MAX_CP_COUNT);
+    set_dirty_offset(cur_cp->id() % MAX_CP_COUNT, cursor + nblks, m_garbage.load(std::memory_order_acquire));
 
     COUNTER_INCREMENT(m_metrics, num_alloc, 1);
-
     return BlkAllocStatus::SUCCESS;
 }
 
-BlkAllocStatus AppendBlkAllocator::alloc_on_disk(BlkId const&) { return BlkAllocStatus::SUCCESS; }
+BlkAllocStatus AppendBlkAllocator::alloc_on_disk(BlkId const& bid) {
+    // Nothing to persist, the append offset is persisted by cp. Blk is now known to the consumer though.
+    set_committed(bid.blk_num(), bid.blk_count(), true);
+    return BlkAllocStatus::SUCCESS;
+}
 
 BlkAllocStatus AppendBlkAllocator::mark_blk_allocated(BlkId const&) { return BlkAllocStatus::SUCCESS; }
 
@@ -130,31 +126,44 @@ bool AppendBlkAllocator::is_blk_alloced_on_disk(BlkId const&, bool) const { retu
 //
 // cp_flush should not block alloc/free;
 //
-void AppendBlkAllocator::cp_flush(CP* cp) {
+folly::Future< bool > AppendBlkAllocator::cp_flush(CP* cp) {
     const auto idx = cp->id() % MAX_CP_COUNT;
+    auto& dirty = m_dirty_sb[idx];
     // check if current cp's context has dirty buffer already
-    if (m_dirty_sb[idx].is_dirty) {
-        m_sb->last_append_offset = m_dirty_sb[idx].last_append_offset;
-        m_sb->freeable_nblks = m_dirty_sb[idx].freeable_nblks;
+    if (!dirty.is_dirty.load(std::memory_order_acquire)) { return folly::makeFuture< bool >(true); }
 
-        // write to metablk;
-        m_sb.write();
+    auto const offset = offset_of(dirty.cursor.load(std::memory_order_acquire));
+    m_sb->last_append_offset = offset;
+    m_sb->freeable_nblks = (get_total_blks() - offset) + nblks_of(dirty.garbage.load(std::memory_order_acquire));
 
-        // clear this dirty buff's dirty flag;
-        clear_dirty_offset(idx);
-    }
+    // write to metablk, superblk contents are copied right away, so the dirty buff could be cleared right after
+    auto fut = m_sb.async_write();
+
+    // clear this dirty buff's dirty flag;
+    clear_dirty_offset(idx);
+    return fut;
 }
 
 // updating current cp's dirty buffer context;
-void AppendBlkAllocator::set_dirty_offset(const uint8_t idx) {
-    m_dirty_sb[idx].is_dirty = true;
-
-    m_dirty_sb[idx].last_append_offset = m_last_append_offset;
-    m_dirty_sb[idx].freeable_nblks = m_freeable_nblks;
+void AppendBlkAllocator::set_dirty_offset(const uint8_t idx, uint64_t cursor, uint64_t garbage) {
+    auto const set_max = [](std::atomic< uint64_t >& val, uint64_t new_val) {
+        auto cur = val.load(std::memory_order_acquire);
+        while ((cur < new_val) && !val.compare_exchange_weak(cur, new_val, std::memory_order_acq_rel)) {}
+    };
+
+    auto& dirty = m_dirty_sb[idx];
+    set_max(dirty.cursor, cursor & ~sealed_bit);
+    set_max(dirty.garbage, garbage);
+    dirty.is_dirty.store(true, std::memory_order_release);
 }
 
-// clearing current cp context's dirty flag;
-void AppendBlkAllocator::clear_dirty_offset(const uint8_t idx) { m_dirty_sb[idx].is_dirty = false; }
+// clearing current cp context's dirty flag, cp using this buffer next will start afresh;
+void AppendBlkAllocator::clear_dirty_offset(const uint8_t idx) {
+    auto& dirty = m_dirty_sb[idx];
+    dirty.is_dirty.store(false, std::memory_order_release);
+    dirty.cursor.store(0, std::memory_order_release);
+    dirty.garbage.store(0, std::memory_order_release);
+}
 
 //
 // free operation does:
@@ -162,15 +171,65 @@ void AppendBlkAllocator::clear_dirty_offset(const uint8_t idx) { m_dirty_sb[idx]
 // 2. if the blk being freed happens to be last block, move last_append_offset backwards accordingly;
 //
 void AppendBlkAllocator::free(const BlkId& bid) {
-    std::unique_lock lk(m_mtx);
     auto cur_cp = hs()->cp_mgr().cp_guard();
     const auto n = bid.blk_count();
-    m_freeable_nblks += n;
-    if (bid.blk_num() + n == m_last_append_offset) {
-        // we are freeing the the last blk id, let's rewind.
-        m_last_append_offset -= n;
+    auto const end = bid.blk_num() + n;
+
+    auto cursor = m_cursor.load(std::memory_order_acquire);
+    while (offset_of(cursor) == end) {
+        // we are freeing the the last blk id, let's rewind. Blks are ours till the rewind, so clear their bits ahead of
+        // it, after the rewind they could be allocated and committed again by others.
+        set_committed(bid.blk_num(), n, false);
+        auto const rewound = next_gen(cursor, bid.blk_num());
+        if (m_cursor.compare_exchange_weak(cursor, rewound, std::memory_order_acq_rel)) {
+            set_dirty_offset(cur_cp->id() % MAX_CP_COUNT, rewound, m_garbage.load(std::memory_order_acquire));
+            return;
+        }
+    }
+
+    // Blks which are freed without being committed (e.g. write was rolled back) are not waited upon by gc anymore
+    set_committed(bid.blk_num(), n, true);
+    auto const garbage = m_garbage.fetch_add(n, std::memory_order_acq_rel) + n;
+    set_dirty_offset(cur_cp->id() % MAX_CP_COUNT, cursor, garbage);
+}
+
+void AppendBlkAllocator::reset() {
+    auto cur_cp = hs()->cp_mgr().cp_guard();
+    set_committed(0, get_used_blks(), false);
+
+    // Moving the cursor back to the start unseals the chunk as well
+    auto cursor = m_cursor.load(std::memory_order_acquire);
+    while (!m_cursor.compare_exchange_weak(cursor, next_gen(cursor, 0) & ~sealed_bit, std::memory_order_acq_rel)) {}
+    auto garbage = m_garbage.load(std::memory_order_acquire);
+    while (!m_garbage.compare_exchange_weak(garbage, next_gen(garbage, 0), std::memory_order_acq_rel)) {}
+
+    set_dirty_offset(cur_cp->id() % MAX_CP_COUNT, next_gen(cursor, 0), next_gen(garbage, 0));
+}
+
+void AppendBlkAllocator::set_committed(blk_num_t blk_num, blk_count_t nblks, bool committed) {
+    auto const end = blk_num + nblks;
+    for (auto b = blk_num; b < end;) {
+        auto const bit = b % 64;
+        auto const n = std::min< blk_num_t >(64 - bit, end - b);
+        auto const mask = (n == 64) ? ~uint64_t{0} : (((uint64_t{1} << n) - 1) << bit);
+        if (committed) {
+            m_committed_bm[b / 64].fetch_or(mask, std::memory_order_acq_rel);
+        } else {
+            m_committed_bm[b / 64].fetch_and(~mask, std::memory_order_acq_rel);
+        }
+        b += n;
+    }
+}
+
+bool AppendBlkAllocator::has_uncommitted_blks() const {
+    auto const end = get_used_blks();
+    for (blk_num_t b{0}; b < end;) {
+        auto const n = std::min< blk_num_t >(64, end - b);
+        auto const mask = (n == 64) ? ~uint64_t{0} : ((uint64_t{1} << n) - 1);
+        if ((m_committed_bm[b / 64].load(std::memory_order_acquire) & mask) != mask) { return true; }
+        b += n;
     }
-    set_dirty_offset(cur_cp->id() % MAX_CP_COUNT);
+    return false;
 }
 
 bool AppendBlkAllocator::is_blk_alloced(const BlkId& in_bid, bool) const {
@@ -181,16 +240,16 @@ bool AppendBlkAllocator::is_blk_alloced(const BlkId& in_bid, bool) const {
 std::string AppendBlkAllocator::get_name() const { return "AppendBlkAlloc_chunk_" + std::to_string(m_chunk_id); }
 
 std::string AppendBlkAllocator::to_string() const {
-    return fmt::format("{}, last_append_offset: {}", get_name(), m_last_append_offset);
+    return fmt::format("{}, last_append_offset: {}", get_name(), get_used_blks());
 }
 
 blk_num_t AppendBlkAllocator::available_blks() const { return get_total_blks() - get_used_blks(); }
 
-blk_num_t AppendBlkAllocator::get_used_blks() const { return m_last_append_offset; }
+blk_num_t AppendBlkAllocator::get_used_blks() const { return offset_of(m_cursor.load(std::memory_order_acquire)); }
 
-blk_num_t AppendBlkAllocator::get_freeable_nblks() const { return m_freeable_nblks; }
+blk_num_t AppendBlkAllocator::get_freeable_nblks() const { return available_blks() + get_defrag_nblks(); }
 
-blk_num_t AppendBlkAllocator::get_defrag_nblks() const { return get_freeable_nblks() - available_blks(); }
+blk_num_t AppendBlkAllocator::get_defrag_nblks() const { return nblks_of(m_garbage.load(std::memory_order_acquire)); }
 
 nlohmann::json AppendBlkAllocator::get_status(int log_level) const { return nlohmann::json{}; }
 } // namespace homestore
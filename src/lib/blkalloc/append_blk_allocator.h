@@ -15,6 +15,8 @@
  * *********************************************************************************/
 #pragma once
 
+#include <atomic>
+
 #include <sisl/logging/logging.h>
 #include "blk_allocator.h"
 #include "common/homestore_assert.hpp"
@@ -36,13 +38,15 @@ struct append_blk_sb_t {
     blk_num_t freeable_nblks;
     blk_num_t last_append_offset;
 };
+#pragma pack()
 
+// Dirty state of a cp. Values are the packed append cursor and garbage count (see below), which only move forward, so
+// concurrent updaters within a cp can record them with an atomic max and without a lock.
 struct append_blk_dirty_buf_t {
-    bool is_dirty; // this field is needed for cp_flush, but not necessarily needed for persistence;
-    blk_num_t freeable_nblks;
-    blk_num_t last_append_offset;
+    std::atomic< bool > is_dirty{false}; // this field is needed for cp_flush, but not for persistence;
+    std::atomic< uint64_t > cursor{0};
+    std::atomic< uint64_t > garbage{0};
 };
-#pragma pack()
 
 class AppendBlkAllocMetrics : public sisl::MetricsGroup {
 public:
@@ -70,6 +74,15 @@ public:
 // 2. for HDD, performance will drop significantly if alloc/write is being done in multi-threaded model, it is left for
 // consumer to make choice;
 //
+// Allocator is lock free. Append offset is kept in a 64 bit cursor along with a generation in its upper half, which is
+// bumped whenever the offset moves backwards (rewind on free of the last blks, or reset). Alloc is a CAS on the cursor
+// which never moves it past the end of chunk. Since the cursor (and the garbage count, packed with a reset epoch the
+// same way) only grows, each cp's dirty buffer just keeps the max of the values produced by the operations in that cp.
+// Top bit of the cursor is the sealed flag, so that an alloc either sees the seal or gc sees the moved cursor.
+//
+// Blks which are committed or freed are tracked in an in-memory bitmap, which only commit and free update. Gc uses it
+// to find the blks allocated before the seal that consumer doesn't know about yet.
+//
 class AppendBlkAllocator : public BlkAllocator {
 public:
     AppendBlkAllocator(const BlkAllocConfig& cfg, bool need_format, allocator_id_t id = 0);
@@ -121,14 +134,26 @@ public:
 
     std::string to_string() const override;
 
-    /// @brief : needs to be called with cp_guard();
-    void set_dirty_offset(const uint8_t idx);
-
     /// @brief : clear dirty is best effort;
     /// offset flush is idempotent;
     void clear_dirty_offset(const uint8_t idx);
 
-    void cp_flush(CP* cp) override;
+    folly::Future< bool > cp_flush(CP* cp) override;
+
+    /// @brief : stop serving any further allocations on this chunk, used by gc while it relocates the live blks out of
+    /// this chunk. Frees are still accepted.
+    void seal() { m_cursor.fetch_or(sealed_bit, std::memory_order_acq_rel); }
+    void unseal() { m_cursor.fetch_and(~sealed_bit, std::memory_order_acq_rel); }
+    bool is_sealed() const { return (m_cursor.load(std::memory_order_acquire) & sealed_bit) != 0; }
+
+    /// @brief : whether any blk handed out is neither committed (alloc_on_disk) nor freed yet. Consumer does not know
+    /// about these blks yet, so gc waits for this to turn false after sealing the chunk, before it asks consumer for
+    /// the live blks. Scans the bitmap upto the append offset, so meant for gc and not for io path.
+    bool has_uncommitted_blks() const;
+
+    /// @brief : make the entire chunk available for allocation again and unseal it. Caller (gc) has to ensure that
+    /// there are no live blks left in this chunk.
+    void reset();
 
     nlohmann::json get_status(int log_level) const override;
 
@@ -136,10 +161,23 @@ private:
     std::string get_name() const;
     void on_meta_blk_found(const sisl::byte_view& buf, void* meta_cookie);
 
+    /// @brief : record the values produced by an operation into dirty buffer, needs to be called with cp_guard();
+    void set_dirty_offset(const uint8_t idx, uint64_t cursor, uint64_t garbage);
+
+    static blk_num_t offset_of(uint64_t cursor) { return s_cast< blk_num_t >(cursor & 0xFFFFFFFF); }
+    static blk_num_t nblks_of(uint64_t garbage) { return s_cast< blk_num_t >(garbage & 0xFFFFFFFF); }
+    static uint64_t next_gen(uint64_t cursor, blk_num_t offset) {
+        auto const gen = ((cursor & ~sealed_bit) >> 32) + 1;
+        return (cursor & sealed_bit) | ((gen << 32) & ~sealed_bit) | offset;
+    }
+    void set_committed(blk_num_t blk_num, blk_count_t nblks, bool committed);
+
+    static constexpr uint64_t sealed_bit{1ull << 63};
+
 private:
-    std::mutex m_mtx;                  // thread_safe, TODO: open option for consumer to choose to go lockless;
-    blk_num_t m_last_append_offset{0}; // last appended offset in blocks;
-    blk_num_t m_freeable_nblks{0};
+    std::atomic< uint64_t > m_cursor{0};  // [sealed | generation | last appended offset in blocks]
+    std::atomic< uint64_t > m_garbage{0}; // [reset epoch | freed blks behind the append offset]
+    std::unique_ptr< std::atomic< uint64_t >[] > m_committed_bm; // bit per blk, set if committed or freed
     AppendBlkAllocMetrics m_metrics;
     superblk< append_blk_sb_t > m_sb;                              // only cp will be writing to this disk
     std::array< append_blk_dirty_buf_t, MAX_CP_COUNT > m_dirty_sb; // keep track of dirty sb;
@@ -21,7 +21,7 @@
 
 namespace homestore {
 BitmapBlkAllocator::BitmapBlkAllocator(BlkAllocConfig const& cfg, bool is_fresh, chunk_num_t id) :
-        BlkAllocator(cfg, id), m_blks_per_portion{cfg.m_blks_per_portion} {
+        BlkAllocator(cfg, id), m_blks_per_portion{cfg.m_blks_per_portion}, m_bm_metrics{get_name().c_str()} {
     if (is_persistent()) {
         meta_service().register_handler(
             get_name(),
@@ -29,6 +29,15 @@ BitmapBlkAllocator::BitmapBlkAllocator(BlkAllocConfig const& cfg, bool is_fresh,
                 on_meta_blk_found(voidptr_cast(mblk), std::move(buf), size);
             },
             nullptr);
+
+        // Delta is applied on top of the full bitmap, so it has to be recovered after it
+        meta_service().register_handler(
+            delta_meta_name(),
+            [this](meta_blk* mblk, sisl::byte_view buf, size_t size) {
+                on_delta_meta_blk_found(voidptr_cast(mblk), std::move(buf), size);
+            },
+            [this](bool success) { on_meta_blk_recovery_done(); }, true /* do_crc */,
+            meta_subtype_vec_t{get_name()});
     }
 
     if (is_fresh) {
@@ -49,24 +58,192 @@ void BitmapBlkAllocator::on_meta_blk_found(void* mblk_cookie, sisl::byte_view co
 
     m_disk_bm = std::unique_ptr< sisl::Bitset >{new sisl::Bitset{
         hs_utils::extract_byte_array(buf, meta_service().is_aligned_buf_needed(size), meta_service().align_size())}};
+    m_disk_bm_recovered = true;
+}
+
+void BitmapBlkAllocator::on_delta_meta_blk_found(void* mblk_cookie, sisl::byte_view const& buf, size_t size) {
+    m_delta_meta_blk_cookie = mblk_cookie;
 
+    auto const hdr = r_cast< const bitmap_delta_sb* >(buf.bytes());
+    BLKALLOC_REL_ASSERT_CMP(hdr->magic, ==, bitmap_delta_sb::s_magic, "Invalid bitmap delta metablk, magic mismatch");
+    BLKALLOC_REL_ASSERT_CMP(hdr->version, ==, bitmap_delta_sb::s_version, "Invalid version of bitmap delta metablk");
+    if (hdr->num_portions == 0) { return; }
+
+    BLKALLOC_REL_ASSERT(m_disk_bm, "Bitmap delta found without the full bitmap");
+    BLKALLOC_REL_ASSERT_CMP(hdr->blks_per_portion, ==, m_blks_per_portion, "Bitmap delta portion size mismatch");
+
+    auto const entry_size = delta_entry_size();
+    uint8_t const* cur = buf.bytes() + sizeof(bitmap_delta_sb);
+    for (uint32_t i{0}; i < hdr->num_portions; ++i) {
+        auto const portion_num = *r_cast< const uint32_t* >(cur);
+        words_to_portion(portion_num, r_cast< const uint64_t* >(cur + sizeof(uint32_t)));
+        m_delta_portions.insert(portion_num); // Next delta should continue to carry these till the next full copy
+        cur += entry_size;
+    }
+    m_delta_bytes_since_full_persist = size;
+    m_num_delta_portions.store(m_delta_portions.size(), std::memory_order_relaxed);
+    COUNTER_INCREMENT(m_bm_metrics, num_delta_portions_recovered, hdr->num_portions);
+    BLKALLOC_LOG(INFO, "Applied {} portions of bitmap delta on top of the full bitmap", hdr->num_portions);
+}
+
+void BitmapBlkAllocator::on_meta_blk_recovery_done() {
+    if (!m_disk_bm_recovered) { return; }
     m_alloced_blk_count.store(m_disk_bm->get_set_count(), std::memory_order_relaxed);
     load();
 }
 
-void BitmapBlkAllocator::cp_flush(CP*) {
-    if (!is_persistent()) { return; }
+folly::Future< bool > BitmapBlkAllocator::cp_flush(CP*) {
+    if (!is_persistent()) { return folly::makeFuture< bool >(true); }
+    if (!m_is_disk_bm_dirty.load()) { return folly::makeFuture< bool >(true); }
 
-    if (m_is_disk_bm_dirty.load()) {
-        sisl::byte_array bitmap_buf = acquire_underlying_buffer();
-        if (m_meta_blk_cookie) {
-            meta_service().update_sub_sb(bitmap_buf->cbytes(), bitmap_buf->size(), m_meta_blk_cookie);
-        } else {
-            meta_service().add_sub_sb(get_name(), bitmap_buf->cbytes(), bitmap_buf->size(), m_meta_blk_cookie);
+    acquire_underlying_buffer();
+    m_is_disk_bm_dirty.store(false); // No longer dirty now, needs to be set before releasing the buffer
+    int64_t num_cleared{0};
+    for (blk_num_t p{0}; p < get_num_portions(); ++p) {
+        if (m_blk_portions[p].test_and_clear_disk_dirty()) {
+            m_delta_portions.insert(p);
+            ++num_cleared;
+        }
+    }
+    // Portions dirtied again while we are scanning stay counted, for the next cp
+    m_num_disk_dirty_portions.fetch_sub(num_cleared, std::memory_order_relaxed);
+
+    // Delta carries every portion dirtied since the last full copy, so it is rewritten in whole every cp. Once the
+    // deltas written since the last full copy add up to the size of the bitmap itself, a full copy is cheaper.
+    bool const full_persist = (m_meta_blk_cookie == nullptr) ||
+        (++m_cps_since_full_persist >= HS_DYNAMIC_CONFIG(blkallocator.bitmap_full_persist_interval_cps)) ||
+        (m_delta_portions.size() * 100 >=
+         uint64_cast(get_num_portions()) * HS_DYNAMIC_CONFIG(blkallocator.bitmap_full_persist_dirty_pct)) ||
+        (m_delta_bytes_since_full_persist + delta_size() >= full_bitmap_size());
+
+    // Bitmaps are serialized right away, while the underlying buffer is acquired, but written asynchronously, so that
+    // they get batched with the meta blk writes of other allocators.
+    //
+    // Delta is persisted ahead of the full copy as well. If we crash after the full copy is written, but before delta
+    // is cleared, the old delta still carries the latest bits of its portions and applying it is harmless. So the full
+    // copy is written only once the delta is written.
+    auto fut = folly::makeFuture< bool >(true);
+    if (m_meta_blk_cookie != nullptr) {
+        auto const delta_sz = uint32_cast(delta_size());
+        m_delta_bytes_since_full_persist += delta_sz;
+        fut = persist_dirty_portions(serialize_dirty_portions(), delta_sz);
+    }
+    if (full_persist) {
+        auto bitmap_buf = m_disk_bm->serialize(m_align_size);
+        m_delta_portions.clear();
+        m_cps_since_full_persist = 0;
+        m_delta_bytes_since_full_persist = 0;
+        auto empty_delta_buf = serialize_dirty_portions();
+        auto const empty_delta_sz = uint32_cast(delta_size());
+        fut = std::move(fut)
+                  .thenValue([this, bitmap_buf = std::move(bitmap_buf)](bool) {
+                      return persist_full_bitmap(bitmap_buf);
+                  })
+                  .thenValue([this, empty_delta_buf = std::move(empty_delta_buf), empty_delta_sz](bool) {
+                      return (m_delta_meta_blk_cookie != nullptr)
+                          ? persist_dirty_portions(empty_delta_buf, empty_delta_sz)
+                          : folly::makeFuture< bool >(true);
+                  });
+        COUNTER_INCREMENT(m_bm_metrics, num_full_bitmap_persists, 1);
+    } else {
+        COUNTER_INCREMENT(m_bm_metrics, num_delta_bitmap_persists, 1);
+    }
+    m_num_delta_portions.store(m_delta_portions.size(), std::memory_order_relaxed);
+    release_underlying_buffer();
+    return fut;
+}
+
+uint64_t BitmapBlkAllocator::cp_dirty_bytes() const {
+    if (!is_persistent() || !m_is_disk_bm_dirty.load()) { return 0; }
+
+    // Next cp rewrites the delta with the portions it already carries, along with the ones dirtied since. Portions in
+    // both are counted twice, which is fine for an estimate. It is never more than a full copy of the bitmap.
+    // Dirty count can briefly go negative, when cp flush clears a portion ahead of its marker counting it
+    uint64_t const portions = m_num_delta_portions.load(std::memory_order_relaxed) +
+        uint64_cast(std::max(m_num_disk_dirty_portions.load(std::memory_order_relaxed), int64_t{0}));
+    return std::min(delta_size_of(std::min(portions, uint64_cast(get_num_portions()))), full_bitmap_size());
+}
+
+folly::Future< bool > BitmapBlkAllocator::persist_full_bitmap(sisl::byte_array bitmap_buf) {
+    if (m_meta_blk_cookie) {
+        return meta_service().async_update_sub_sb(bitmap_buf->cbytes(), bitmap_buf->size(), m_meta_blk_cookie);
+    }
+    // Only the first one adds the sb, which is rare enough to be done synchronously
+    meta_service().add_sub_sb(get_name(), bitmap_buf->cbytes(), bitmap_buf->size(), m_meta_blk_cookie);
+    return folly::makeFuture< bool >(true);
+}
+
+uint64_t BitmapBlkAllocator::delta_entry_size() const {
+    return sizeof(uint32_t) + (words_per_portion() * sizeof(uint64_t));
+}
+
+uint64_t BitmapBlkAllocator::delta_size() const { return delta_size_of(m_delta_portions.size()); }
+
+uint64_t BitmapBlkAllocator::delta_size_of(uint64_t num_portions) const {
+    return sizeof(bitmap_delta_sb) + (num_portions * delta_entry_size());
+}
+
+uint64_t BitmapBlkAllocator::full_bitmap_size() const { return sisl::round_up(uint64_cast(m_num_blks), 8) / 8; }
+
+sisl::byte_array BitmapBlkAllocator::serialize_dirty_portions() const {
+    auto const entry_size = delta_entry_size();
+    auto const size = uint32_cast(delta_size());
+    auto buf = hs_utils::make_byte_array(size, meta_service().is_aligned_buf_needed(size), sisl::buftag::metablk,
+                                         meta_service().align_size());
+
+    auto hdr = new (buf->bytes()) bitmap_delta_sb();
+    hdr->blks_per_portion = m_blks_per_portion;
+    hdr->num_portions = m_delta_portions.size();
+
+    uint8_t* cur = buf->bytes() + sizeof(bitmap_delta_sb);
+    for (auto const portion_num : m_delta_portions) {
+        *r_cast< uint32_t* >(cur) = portion_num;
+        portion_to_words(portion_num, r_cast< uint64_t* >(cur + sizeof(uint32_t)));
+        cur += entry_size;
+    }
+    return buf;
+}
+
+folly::Future< bool > BitmapBlkAllocator::persist_dirty_portions(sisl::byte_array delta_buf, uint32_t size) {
+    if (m_delta_meta_blk_cookie) {
+        return meta_service().async_update_sub_sb(delta_buf->cbytes(), size, m_delta_meta_blk_cookie);
+    }
+    meta_service().add_sub_sb(delta_meta_name(), delta_buf->cbytes(), size, m_delta_meta_blk_cookie);
+    return folly::makeFuture< bool >(true);
+}
+
+void BitmapBlkAllocator::portion_to_words(blk_num_t portion_num, uint64_t* words) const {
+    std::memset(words, 0, words_per_portion() * sizeof(uint64_t));
+    auto const start = uint64_cast(portion_num) * m_blks_per_portion;
+    auto const end = std::min(start + m_blks_per_portion, uint64_cast(m_num_blks));
+
+    // Frees could still be going on, protect against them
+    auto lock{m_blk_portions[portion_num].portion_auto_lock()};
+    auto b = m_disk_bm->get_next_set_bit(start);
+    while ((b != sisl::Bitset::npos) && (b < end)) {
+        words[(b - start) / 64] |= (1ull << ((b - start) % 64));
+        b = m_disk_bm->get_next_set_bit(b + 1);
+    }
+}
+
+void BitmapBlkAllocator::words_to_portion(blk_num_t portion_num, const uint64_t* words) {
+    auto const start = uint64_cast(portion_num) * m_blks_per_portion;
+    auto const nblks = std::min(uint64_cast(m_blks_per_portion), uint64_cast(m_num_blks) - start);
+    m_disk_bm->reset_bits(start, nblks);
+
+    // Set the bits run by run
+    uint64_t run_start{0};
+    uint64_t run_len{0};
+    for (uint64_t i{0}; i < nblks; ++i) {
+        if (words[i / 64] & (1ull << (i % 64))) {
+            if (run_len == 0) { run_start = i; }
+            ++run_len;
+        } else if (run_len != 0) {
+            m_disk_bm->set_bits(start + run_start, run_len);
+            run_len = 0;
         }
-        m_is_disk_bm_dirty.store(false); // No longer dirty now, needs to be set before releasing the buffer
-        release_underlying_buffer();
     }
+    if (run_len != 0) { m_disk_bm->set_bits(start + run_start, run_len); }
 }
 
 bool BitmapBlkAllocator::is_blk_alloced_on_disk(const BlkId& b, bool use_lock) const {
@@ -105,6 +282,7 @@ BlkAllocStatus BitmapBlkAllocator::alloc_on_disk(BlkId const& bid) {
                                         "Expected disk blks to reset");
                 }
                 m_disk_bm->set_bits(b.blk_num(), b.blk_count());
+                if (portion.mark_disk_dirty()) { m_num_disk_dirty_portions.fetch_add(1, std::memory_order_relaxed); }
                 BLKALLOC_LOG(DEBUG, "blks allocated {} chunk number {}", b.to_string(), m_chunk_id);
             }
         };
@@ -151,6 +329,7 @@ void BitmapBlkAllocator::free_on_disk(BlkId const& bid) {
             }
 
             m_disk_bm->reset_bits(b.blk_num(), b.blk_count());
+            if (portion.mark_disk_dirty()) { m_num_disk_dirty_portions.fetch_add(1, std::memory_order_relaxed); }
         }
     };
 
@@ -163,9 +342,10 @@ void BitmapBlkAllocator::free_on_disk(BlkId const& bid) {
     } else {
         unset_on_disk_bm(bid);
     }
+    m_is_disk_bm_dirty.store(true);
 }
 
-sisl::byte_array BitmapBlkAllocator::acquire_underlying_buffer() {
+void BitmapBlkAllocator::acquire_underlying_buffer() {
     // prepare and temporary alloc list, where blkalloc is accumulated till underlying buffer is released.
     // RCU will wait for all I/Os that are still in critical section (allocating on disk bm) to complete and exit;
     auto alloc_list_ptr = new sisl::ThreadVector< BlkId >();
@@ -173,7 +353,6 @@ sisl::byte_array BitmapBlkAllocator::acquire_underlying_buffer() {
     synchronize_rcu();
 
     BLKALLOC_REL_ASSERT(old_alloc_list_ptr == nullptr, "Multiple acquires concurrently?");
-    return (m_disk_bm->serialize(m_align_size));
 }
 
 void BitmapBlkAllocator::release_underlying_buffer() {
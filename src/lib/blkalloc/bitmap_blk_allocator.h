@@ -18,6 +18,7 @@
 #include <cstdint>
 #include <memory>
 #include <mutex>
+#include <set>
 #include <sstream>
 #include <string>
 #include <thread>
@@ -28,6 +29,7 @@
 #include <sisl/utility/enum.hpp>
 #include <sisl/utility/urcu_helper.hpp>
 #include <sisl/fds/thread_vector.hpp>
+#include <sisl/metrics/metrics.hpp>
 
 #include <homestore/homestore_decl.hpp>
 #include <homestore/blk.h>
@@ -43,6 +45,7 @@ private:
     mutable std::mutex m_blk_lock;
     blk_num_t m_portion_num;
     blk_temp_t m_temperature;
+    std::atomic< bool > m_disk_dirty{false}; // Disk bitmap of this portion is modified since last cp
 
 public:
     BlkAllocPortion(blk_temp_t temp = default_temperature()) : m_temperature(temp) {}
@@ -59,6 +62,40 @@ public:
     void set_portion_num(blk_num_t portion_num) { m_portion_num = portion_num; }
     void set_temperature(const blk_temp_t temp) { m_temperature = temp; }
     static constexpr blk_temp_t default_temperature() { return 1; }
+
+    // Returns true if the portion was clean until now
+    bool mark_disk_dirty() { return !m_disk_dirty.exchange(true, std::memory_order_relaxed); }
+    bool test_and_clear_disk_dirty() { return m_disk_dirty.exchange(false, std::memory_order_relaxed); }
+};
+
+#pragma pack(1)
+// Disk bitmap portions modified since the last full copy of the disk bitmap was persisted. Each portion entry is
+// its number followed by its bits, packed as 64 bit words.
+struct bitmap_delta_sb {
+    static constexpr uint64_t s_magic{0xb17de17a};
+    static constexpr uint32_t s_version{0x1};
+
+    uint64_t magic{s_magic};
+    uint32_t version{s_version};
+    uint32_t blks_per_portion{0};
+    uint32_t num_portions{0};
+};
+#pragma pack()
+
+class BitmapBlkAllocMetrics : public sisl::MetricsGroup {
+public:
+    explicit BitmapBlkAllocMetrics(const char* inst_name) : sisl::MetricsGroup("BitmapBlkAlloc", inst_name) {
+        REGISTER_COUNTER(num_full_bitmap_persists, "Number of times the full disk bitmap is persisted");
+        REGISTER_COUNTER(num_delta_bitmap_persists, "Number of times only the disk bitmap delta is persisted");
+        REGISTER_COUNTER(num_delta_portions_recovered, "Number of disk bitmap portions recovered from delta");
+        register_me_to_farm();
+    }
+
+    BitmapBlkAllocMetrics(BitmapBlkAllocMetrics const&) = delete;
+    BitmapBlkAllocMetrics(BitmapBlkAllocMetrics&&) noexcept = delete;
+    BitmapBlkAllocMetrics& operator=(BitmapBlkAllocMetrics const&) = delete;
+    BitmapBlkAllocMetrics& operator=(BitmapBlkAllocMetrics&&) noexcept = delete;
+    ~BitmapBlkAllocMetrics() { deregister_me_from_farm(); }
 };
 
 class CP;
@@ -75,7 +112,8 @@ public:
     BlkAllocStatus alloc_on_disk(BlkId const& in_bid) override;
     void free_on_disk(BlkId const& b) override;
     bool is_blk_alloced_on_disk(BlkId const& b, bool use_lock = false) const override;
-    void cp_flush(CP* cp) override;
+    folly::Future< bool > cp_flush(CP* cp) override;
+    uint64_t cp_dirty_bytes() const override;
 
     blk_num_t get_num_portions() const { return (m_num_blks - 1) / m_blks_per_portion + 1; }
     blk_num_t get_blks_per_portion() const { return m_blks_per_portion; }
@@ -104,14 +142,28 @@ private:
     void do_init();
     sisl::ThreadVector< BlkId >* get_alloc_blk_list();
     void on_meta_blk_found(void* mblk_cookie, sisl::byte_view const& buf, size_t size);
+    void on_delta_meta_blk_found(void* mblk_cookie, sisl::byte_view const& buf, size_t size);
+    void on_meta_blk_recovery_done();
+    std::string delta_meta_name() const { return get_name() + "_delta"; }
 
     // Acquire the underlying bitmap buffer and while the caller has acquired, all the new allocations
     // will be captured in a separate list and then pushes into buffer once released.
     // NOTE: THIS IS NON-THREAD SAFE METHOD. Caller is expected to ensure synchronization between multiple
     // acquires/releases
-    sisl::byte_array acquire_underlying_buffer();
+    void acquire_underlying_buffer();
     void release_underlying_buffer();
 
+    folly::Future< bool > persist_full_bitmap(sisl::byte_array bitmap_buf);
+    sisl::byte_array serialize_dirty_portions() const;
+    folly::Future< bool > persist_dirty_portions(sisl::byte_array delta_buf, uint32_t size);
+    uint64_t delta_entry_size() const;
+    uint64_t delta_size() const;
+    uint64_t delta_size_of(uint64_t num_portions) const;
+    uint64_t full_bitmap_size() const;
+    uint32_t words_per_portion() const { return m_blks_per_portion / 64; }
+    void portion_to_words(blk_num_t portion_num, uint64_t* words) const;
+    void words_to_portion(blk_num_t portion_num, const uint64_t* words);
+
 protected:
     blk_num_t m_blks_per_portion;
 
@@ -121,6 +173,17 @@ private:
     std::unique_ptr< sisl::Bitset > m_disk_bm{nullptr};
     std::atomic< bool > m_is_disk_bm_dirty{true}; // initially disk_bm treated as dirty
     void* m_meta_blk_cookie{nullptr};
+    void* m_delta_meta_blk_cookie{nullptr};
+    bool m_disk_bm_recovered{false};
+
+    // Accessed only by cp flush. Portions persisted in delta since the last full copy, cps and delta bytes written
+    // since then
+    std::set< blk_num_t > m_delta_portions;
+    uint32_t m_cps_since_full_persist{0};
+    uint64_t m_delta_bytes_since_full_persist{0};
+    std::atomic< uint64_t > m_num_delta_portions{0}; // Size of m_delta_portions, for readers outside of cp flush
+    std::atomic< int64_t > m_num_disk_dirty_portions{0}; // Portions dirtied since the last cp flush
     std::atomic< int64_t > m_alloced_blk_count{0};
+    BitmapBlkAllocMetrics m_bm_metrics;
 };
 } // namespace homestore
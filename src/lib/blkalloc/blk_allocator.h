@@ -25,6 +25,7 @@
 
 #include <sisl/fds/bitset.hpp>
 #include <folly/MPMCQueue.h>
+#include <folly/futures/Future.h>
 #include <sisl/utility/enum.hpp>
 #include <sisl/utility/urcu_helper.hpp>
 #include <sisl/fds/thread_vector.hpp>
@@ -165,7 +166,11 @@ public:
     virtual bool is_blk_alloced_on_disk(BlkId const& b, bool use_lock = false) const = 0;
 
     virtual std::string to_string() const = 0;
-    virtual void cp_flush(CP* cp) = 0;
+    /// @brief : persists the allocator state as of this cp, returned future is fulfilled once it is persisted
+    virtual folly::Future< bool > cp_flush(CP* cp) = 0;
+
+    /// @brief : bytes this allocator would persist if cp is flushed now, used by cp scheduling
+    virtual uint64_t cp_dirty_bytes() const { return 0; }
 
     uint32_t get_align_size() const { return m_align_size; }
     blk_num_t get_total_blks() const { return m_num_blks; }
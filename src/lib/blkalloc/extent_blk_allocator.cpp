@@ -0,0 +1,272 @@
+/*********************************************************************************
+ * Modifications Copyright 2017-2019 eBay Inc.
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *    https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ *********************************************************************************/
+#include <algorithm>
+#include <iomgr/iomgr_flip.hpp>
+
+#include "common/homestore_assert.hpp"
+#include "extent_blk_allocator.h"
+
+namespace homestore {
+ExtentBlkAllocator::ExtentBlkAllocator(BlkAllocConfig const& cfg, bool is_fresh, chunk_num_t chunk_id) :
+        BitmapBlkAllocator(cfg, is_fresh, chunk_id) {
+    LOGINFO("ExtentBlkAllocator total blks: {}", get_total_blks());
+
+    if (is_fresh || !is_persistent()) { load(); }
+}
+
+void ExtentBlkAllocator::load() {
+    std::unique_lock lg{m_mtx};
+    m_extents_by_blk.clear();
+    m_extents_by_size.clear();
+    m_free_blks = 0;
+
+    auto const total_blks = get_total_blks();
+    auto const* disk_bm = get_disk_bitmap();
+    if (disk_bm == nullptr) {
+        add_free_extent(0, total_blks);
+    } else {
+        // Every run of reset bits in the disk bitmap is a free extent
+        uint64_t cur{0};
+        while (cur < total_blks) {
+            auto set_bit = disk_bm->get_next_set_bit(cur);
+            if ((set_bit == sisl::Bitset::npos) || (set_bit > total_blks)) { set_bit = total_blks; }
+            if (set_bit > cur) { add_free_extent(s_cast< blk_num_t >(cur), s_cast< blk_num_t >(set_bit - cur)); }
+            if (set_bit >= total_blks) { break; }
+
+            cur = disk_bm->get_next_reset_bit(set_bit);
+            if (cur == sisl::Bitset::npos) { break; }
+        }
+    }
+    BLKALLOC_LOG(INFO, "Loaded {} free blks in {} extents, largest extent={} blks", m_free_blks,
+                 m_extents_by_blk.size(), m_extents_by_size.empty() ? 0 : m_extents_by_size.rbegin()->first);
+}
+
+BlkAllocStatus ExtentBlkAllocator::alloc_contiguous(BlkId& out_blkid) {
+    blk_alloc_hints hints;
+    hints.is_contiguous = true;
+    return alloc(1, hints, out_blkid);
+}
+
+BlkAllocStatus ExtentBlkAllocator::alloc(blk_count_t nblks, blk_alloc_hints const& hints, BlkId& out_blkid) {
+#ifdef _PRERELEASE
+    if (iomgr_flip::instance()->test_flip("extent_blkalloc_no_blks", nblks)) { return BlkAllocStatus::SPACE_FULL; }
+#endif
+
+    if (!hints.is_contiguous && !out_blkid.is_multi()) {
+        HS_DBG_ASSERT(false, "Invalid Input: Non contiguous allocation needs MultiBlkId to store");
+        return BlkAllocStatus::INVALID_INPUT;
+    }
+
+    MultiBlkId tmp_blkid;
+    MultiBlkId& out_mbid = out_blkid.is_multi() ? r_cast< MultiBlkId& >(out_blkid) : tmp_blkid;
+    BlkAllocStatus status{BlkAllocStatus::SUCCESS};
+    blk_count_t nblks_remain = nblks;
+    {
+        std::unique_lock lg{m_mtx};
+
+        // Best fit: smallest extent which can accommodate the entire request
+        auto const fit_it = m_extents_by_size.lower_bound(std::make_pair(s_cast< blk_num_t >(nblks), blk_num_t{0}));
+        if (fit_it != m_extents_by_size.end()) {
+            auto const start_blk = fit_it->second;
+            take_from_extent(m_extents_by_blk.find(start_blk), start_blk, nblks);
+            out_mbid.add(start_blk, nblks, m_chunk_id);
+            nblks_remain = 0;
+        } else if (!hints.is_contiguous) {
+            // No single extent fits, build it from the largest extents
+            blk_count_t const min_blks =
+                std::min< blk_count_t >(nblks, std::max< blk_count_t >(hints.min_blks_per_piece, 1));
+            while (nblks_remain && out_mbid.has_room() && !m_extents_by_size.empty()) {
+                auto const [ext_nblks, start_blk] = *m_extents_by_size.rbegin();
+                if (ext_nblks < std::min(min_blks, nblks_remain)) { break; }
+
+                auto const piece_nblks = s_cast< blk_count_t >(std::min< blk_num_t >(ext_nblks, nblks_remain));
+                take_from_extent(m_extents_by_blk.find(start_blk), start_blk, piece_nblks);
+                out_mbid.add(start_blk, piece_nblks, m_chunk_id);
+                nblks_remain -= piece_nblks;
+            }
+        }
+
+        if (nblks_remain == 0) {
+            status = BlkAllocStatus::SUCCESS;
+        } else if ((nblks_remain != nblks) && hints.partial_alloc_ok) {
+            status = BlkAllocStatus::PARTIAL;
+        } else {
+            // Put back whatever we have taken
+            auto it = out_mbid.iterate();
+            while (auto const b = it.next()) {
+                add_free_extent(b->blk_num(), b->blk_count());
+            }
+            out_mbid = MultiBlkId{};
+            status = hints.is_contiguous ? BlkAllocStatus::FAILED : BlkAllocStatus::SPACE_FULL;
+        }
+    }
+
+    if (status == BlkAllocStatus::SUCCESS || status == BlkAllocStatus::PARTIAL) {
+        BLKALLOC_LOG(TRACE, "Alloced blks [{}] for nblks={}", out_mbid.to_string(), nblks);
+        if (!out_blkid.is_multi()) { out_blkid = out_mbid.to_single_blkid(); }
+    }
+    return status;
+}
+
+BlkAllocStatus ExtentBlkAllocator::mark_blk_allocated(BlkId const& b) {
+    std::unique_lock lg{m_mtx};
+    take_range(b.blk_num(), b.blk_count());
+    BLKALLOC_LOG(TRACE, "mark blk alloced blkid={} free_blks={}", b.to_string(), m_free_blks);
+    return BlkAllocStatus::SUCCESS;
+}
+
+void ExtentBlkAllocator::free(BlkId const& bid) {
+    auto const do_free = [this](BlkId const& b) {
+        BLKALLOC_REL_ASSERT(!overlaps_free_extent(b.blk_num(), b.blk_count()), "Freeing blks {} which are already free",
+                            b.to_string());
+        add_free_extent(b.blk_num(), b.blk_count());
+    };
+
+    std::unique_lock lg{m_mtx};
+    if (bid.is_multi()) {
+        auto it = r_cast< MultiBlkId const& >(bid).iterate();
+        while (auto const b = it.next()) {
+            do_free(*b);
+        }
+    } else {
+        do_free(bid);
+    }
+    BLKALLOC_LOG(TRACE, "Freed blk_num={}", bid.to_string());
+}
+
+bool ExtentBlkAllocator::is_blk_alloced(BlkId const& bid, bool) const {
+    std::unique_lock lg{m_mtx};
+    if (bid.is_multi()) {
+        auto it = r_cast< MultiBlkId const& >(bid).iterate();
+        while (auto const b = it.next()) {
+            if (overlaps_free_extent(b->blk_num(), b->blk_count())) { return false; }
+        }
+        return true;
+    }
+    return !overlaps_free_extent(bid.blk_num(), bid.blk_count());
+}
+
+blk_num_t ExtentBlkAllocator::available_blks() const {
+    std::unique_lock lg{m_mtx};
+    return m_free_blks;
+}
+
+blk_num_t ExtentBlkAllocator::get_used_blks() const { return get_total_blks() - available_blks(); }
+
+// Blks are returned to free extents right away on free, nothing is held back to be reclaimed later
+blk_num_t ExtentBlkAllocator::get_freeable_nblks() const { return 0; }
+
+blk_num_t ExtentBlkAllocator::get_defrag_nblks() const {
+    // Free blks which are not part of the largest free extent
+    std::unique_lock lg{m_mtx};
+    return m_extents_by_size.empty() ? 0 : (m_free_blks - m_extents_by_size.rbegin()->first);
+}
+
+size_t ExtentBlkAllocator::num_free_extents() const {
+    std::unique_lock lg{m_mtx};
+    return m_extents_by_blk.size();
+}
+
+blk_num_t ExtentBlkAllocator::largest_free_extent() const {
+    std::unique_lock lg{m_mtx};
+    return m_extents_by_size.empty() ? 0 : m_extents_by_size.rbegin()->first;
+}
+
+std::string ExtentBlkAllocator::to_string() const {
+    std::unique_lock lg{m_mtx};
+    return fmt::format("Total Blks={} Available_Blks={} Free_Extents={} Largest_Extent={}", get_total_blks(),
+                       m_free_blks, m_extents_by_blk.size(),
+                       m_extents_by_size.empty() ? 0 : m_extents_by_size.rbegin()->first);
+}
+
+void ExtentBlkAllocator::add_free_extent(blk_num_t start_blk, blk_num_t nblks) {
+    m_free_blks += nblks;
+
+    // Merge with the next extent, if it starts right where this ends
+    auto next_it = m_extents_by_blk.lower_bound(start_blk);
+    if ((next_it != m_extents_by_blk.end()) && (next_it->first == start_blk + nblks)) {
+        nblks += next_it->second;
+        m_extents_by_size.erase(std::make_pair(next_it->second, next_it->first));
+        next_it = m_extents_by_blk.erase(next_it);
+    }
+
+    // Merge with the previous extent, if it ends right where this starts
+    if (next_it != m_extents_by_blk.begin()) {
+        auto prev_it = std::prev(next_it);
+        if (prev_it->first + prev_it->second == start_blk) {
+            m_extents_by_size.erase(std::make_pair(prev_it->second, prev_it->first));
+            start_blk = prev_it->first;
+            nblks += prev_it->second;
+            m_extents_by_blk.erase(prev_it);
+        }
+    }
+
+    m_extents_by_blk.emplace(start_blk, nblks);
+    m_extents_by_size.emplace(nblks, start_blk);
+}
+
+void ExtentBlkAllocator::take_from_extent(extent_by_blk_t::iterator it, blk_num_t start_blk, blk_num_t nblks) {
+    auto const ext_start = it->first;
+    auto const ext_nblks = it->second;
+    HS_DBG_ASSERT((start_blk >= ext_start) && (start_blk + nblks <= ext_start + ext_nblks),
+                  "Range [{}-{}) is not within extent [{}-{})", start_blk, start_blk + nblks, ext_start,
+                  ext_start + ext_nblks);
+
+    m_extents_by_size.erase(std::make_pair(ext_nblks, ext_start));
+    m_extents_by_blk.erase(it);
+    m_free_blks -= nblks;
+
+    // Whatever remains on either side of the range stays free
+    if (start_blk > ext_start) {
+        m_extents_by_blk.emplace(ext_start, start_blk - ext_start);
+        m_extents_by_size.emplace(start_blk - ext_start, ext_start);
+    }
+    auto const end_blk = start_blk + nblks;
+    if (end_blk < ext_start + ext_nblks) {
+        m_extents_by_blk.emplace(end_blk, ext_start + ext_nblks - end_blk);
+        m_extents_by_size.emplace(ext_start + ext_nblks - end_blk, end_blk);
+    }
+}
+
+void ExtentBlkAllocator::take_range(blk_num_t start_blk, blk_num_t nblks) {
+    // Range could be partially free or not free at all (say replaying an allocation which is already persisted)
+    auto const end_blk = start_blk + nblks;
+    auto it = m_extents_by_blk.upper_bound(start_blk);
+    if (it != m_extents_by_blk.begin()) { it = std::prev(it); }
+
+    while ((it != m_extents_by_blk.end()) && (it->first < end_blk)) {
+        auto const ext_end = it->first + it->second;
+        if (ext_end <= start_blk) {
+            ++it;
+            continue;
+        }
+        auto const take_start = std::max(start_blk, it->first);
+        auto const take_end = std::min(end_blk, ext_end);
+        take_from_extent(it, take_start, take_end - take_start);
+        it = m_extents_by_blk.upper_bound(take_start);
+    }
+}
+
+bool ExtentBlkAllocator::overlaps_free_extent(blk_num_t start_blk, blk_num_t nblks) const {
+    auto it = m_extents_by_blk.upper_bound(start_blk);
+    if ((it != m_extents_by_blk.end()) && (it->first < start_blk + nblks)) { return true; }
+    if (it != m_extents_by_blk.begin()) {
+        auto const prev_it = std::prev(it);
+        if (prev_it->first + prev_it->second > start_blk) { return true; }
+    }
+    return false;
+}
+} // namespace homestore
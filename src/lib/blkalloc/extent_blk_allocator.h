@@ -0,0 +1,79 @@
+/*********************************************************************************
+ * Modifications Copyright 2017-2019 eBay Inc.
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *    https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ *********************************************************************************/
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <utility>
+
+#include "bitmap_blk_allocator.h"
+
+namespace homestore {
+/* ExtentBlkAllocator keeps the entire free space in memory as extents, indexed both by their start blk and by their
+ * size. There are no caches to be refilled or bitmaps to be swept, so the allocation cost does not depend on how full
+ * or fragmented the chunk is:
+ *
+ * - Contiguous allocation picks the smallest free extent which can fit the request (best fit) in O(log n).
+ * - Non contiguous allocation is served from a single extent if any fits, else from the largest extents first, to keep
+ *   the number of pieces low.
+ * - Freed blks are merged with their adjacent free extents.
+ *
+ * Persistence is through the disk bitmap of BitmapBlkAllocator, from which the extents are rebuilt on recovery.
+ */
+class ExtentBlkAllocator : public BitmapBlkAllocator {
+public:
+    ExtentBlkAllocator(BlkAllocConfig const& cfg, bool is_fresh, chunk_num_t chunk_id);
+    ExtentBlkAllocator(ExtentBlkAllocator const&) = delete;
+    ExtentBlkAllocator(ExtentBlkAllocator&&) noexcept = delete;
+    ExtentBlkAllocator& operator=(ExtentBlkAllocator const&) = delete;
+    ExtentBlkAllocator& operator=(ExtentBlkAllocator&&) noexcept = delete;
+    virtual ~ExtentBlkAllocator() = default;
+
+    void load() override;
+
+    BlkAllocStatus alloc_contiguous(BlkId& bid) override;
+    BlkAllocStatus alloc(blk_count_t nblks, blk_alloc_hints const& hints, BlkId& out_blkid) override;
+    BlkAllocStatus mark_blk_allocated(BlkId const& b) override;
+    void free(BlkId const& b) override;
+
+    blk_num_t available_blks() const override;
+    blk_num_t get_used_blks() const override;
+    blk_num_t get_freeable_nblks() const override;
+    blk_num_t get_defrag_nblks() const override;
+    bool is_blk_alloced(BlkId const& in_bid, bool use_lock = false) const override;
+    std::string to_string() const override;
+
+    size_t num_free_extents() const;
+    blk_num_t largest_free_extent() const;
+
+private:
+    using extent_by_blk_t = std::map< blk_num_t, blk_num_t >;            // start blk -> nblks
+    using extent_by_size_t = std::set< std::pair< blk_num_t, blk_num_t > >; // (nblks, start blk)
+
+    // All the below methods expect m_mtx to be held
+    void add_free_extent(blk_num_t start_blk, blk_num_t nblks);
+    void take_from_extent(extent_by_blk_t::iterator it, blk_num_t start_blk, blk_num_t nblks);
+    void take_range(blk_num_t start_blk, blk_num_t nblks);
+    bool overlaps_free_extent(blk_num_t start_blk, blk_num_t nblks) const;
+
+private:
+    mutable std::mutex m_mtx;
+    extent_by_blk_t m_extents_by_blk;
+    extent_by_size_t m_extents_by_size;
+    blk_num_t m_free_blks{0};
+};
+} // namespace homestore
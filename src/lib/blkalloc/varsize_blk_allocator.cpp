@@ -13,6 +13,7 @@
  * specific language governing permissions and limitations under the License.
  *
  *********************************************************************************/
+#include <chrono>
 #include <iostream>
 #include <iterator>
 #include <random>
@@ -82,6 +83,14 @@ VarsizeBlkAllocator::VarsizeBlkAllocator(VarsizeBlkAllocConfig const& cfg, bool
     if (m_cfg.m_use_slabs) {
         m_fb_cache = std::make_unique< FreeBlkCacheQueue >(cfg.get_slab_config(), &m_metrics);
         LOGINFO("m_fb_cache total free blks: {}", m_fb_cache->total_free_blks());
+
+        auto const num_magazines = HS_DYNAMIC_CONFIG(blkallocator.num_blk_magazines);
+        m_magazines.reserve(num_magazines);
+        for (uint32_t i{0}; i < num_magazines; ++i) {
+            auto mag = std::make_unique< BlkMagazine >();
+            mag->m_slabs.resize(m_cfg.get_slab_cnt());
+            m_magazines.push_back(std::move(mag));
+        }
     }
 
     if (is_fresh || !is_persistent()) { do_start(); }
@@ -414,6 +423,15 @@ BlkAllocStatus VarsizeBlkAllocator::alloc(blk_count_t nblks, blk_alloc_hints con
     blk_count_t num_allocated{0};
     blk_count_t nblks_remain;
 
+    if (use_slabs && is_magazine_eligible(nblks, hints) && out_mbid.has_room()) {
+        num_allocated = alloc_blks_magazine(nblks, out_mbid);
+        if (num_allocated >= nblks) {
+            status = BlkAllocStatus::SUCCESS;
+            goto out;
+        }
+        // Fall through to alloc_blks_slab
+    }
+
     if (use_slabs && (nblks <= m_cfg.highest_slab_blks_count())) {
         num_allocated = alloc_blks_slab(nblks, hints, out_mbid);
         if (num_allocated >= nblks) {
@@ -425,6 +443,11 @@ BlkAllocStatus VarsizeBlkAllocator::alloc(blk_count_t nblks, blk_alloc_hints con
 
     nblks_remain = nblks - num_allocated;
     num_allocated += alloc_blks_direct(nblks_remain, hints, out_mbid);
+    if ((num_allocated < nblks) && drain_magazines()) {
+        // Free blks could be sitting idle in magazines of other threads, put them back to bitmap and retry
+        num_allocated += alloc_blks_direct(nblks - num_allocated, hints, out_mbid);
+    }
+
     if (num_allocated == nblks) {
         status = BlkAllocStatus::SUCCESS;
         BLKALLOC_LOG(TRACE, "Alloced blks [{}] directly", out_mbid.to_string());
@@ -660,7 +683,9 @@ blk_count_t VarsizeBlkAllocator::free_blks_slab(MultiBlkId const& bid) {
     excess_blks.clear();
 
     auto const do_free = [this](BlkId const& b) {
-        m_fb_cache->try_free_blks(blkid_to_blk_cache_entry(b, 2), excess_blks);
+        if (!free_blks_magazine(b, excess_blks)) {
+            m_fb_cache->try_free_blks(blkid_to_blk_cache_entry(b, 2), excess_blks);
+        }
         return b.blk_count();
     };
 
@@ -712,6 +737,126 @@ blk_count_t VarsizeBlkAllocator::free_blks_direct(MultiBlkId const& bid) {
     return n_freed;
 }
 
+bool VarsizeBlkAllocator::is_magazine_eligible(blk_count_t nblks) const {
+    // Only exact slab sized pieces are cached in magazines
+    return !m_magazines.empty() && (nblks <= m_cfg.highest_slab_blks_count()) && ((nblks & (nblks - 1)) == 0) &&
+        (HS_DYNAMIC_CONFIG(blkallocator.blk_magazine_size) > 0);
+}
+
+bool VarsizeBlkAllocator::is_magazine_eligible(blk_count_t nblks, blk_alloc_hints const& hints) const {
+    // Magazines hold only the default temperature blks and hand each of them out as a single piece
+    if ((hints.desired_temp != blk_alloc_hints{}.desired_temp) || (hints.max_blks_per_piece < nblks) ||
+        (hints.min_blks_per_piece > nblks)) {
+        return false;
+    }
+    return is_magazine_eligible(nblks);
+}
+
+BlkMagazine& VarsizeBlkAllocator::this_thread_magazine() {
+    static std::atomic< uint32_t > s_next_thread_slot{0};
+    static thread_local uint32_t t_thread_slot{s_next_thread_slot.fetch_add(1, std::memory_order_relaxed)};
+    return *m_magazines[t_thread_slot % m_magazines.size()];
+}
+
+blk_count_t VarsizeBlkAllocator::alloc_blks_magazine(blk_count_t nblks, MultiBlkId& out_blkid) {
+    auto const slab_idx = FreeBlkCache::find_slab(nblks);
+    auto& mag = this_thread_magazine();
+
+    std::unique_lock lg{mag.m_mtx};
+    auto& mag_slab = mag.m_slabs[slab_idx];
+    if (mag_slab.empty()) {
+        refill_magazine(slab_idx, mag_slab);
+        if (mag_slab.empty()) { return 0; }
+    }
+
+    out_blkid.add(mag_slab.back(), nblks, m_chunk_id);
+    mag_slab.pop_back();
+    COUNTER_INCREMENT(m_metrics, num_alloc, 1);
+    return nblks;
+}
+
+void VarsizeBlkAllocator::refill_magazine(slab_idx_t slab_idx, std::vector< blk_num_t >& mag_slab) {
+    static thread_local blk_cache_alloc_resp s_refill_resp;
+    auto const slab_size = m_cfg.get_slab_block_count(slab_idx);
+    auto const batch = std::max(HS_DYNAMIC_CONFIG(blkallocator.blk_magazine_size) / 2, 1u);
+    auto const nblks = s_cast< blk_count_t >(std::min< uint32_t >(slab_size * batch, max_blks_per_blkid()));
+
+    // Take only this slab (or split higher slabs), merging lower slabs would give us pieces magazine can't hold
+    const blk_cache_alloc_req req{nblks, blk_alloc_hints{}.desired_temp, false /* contiguous */, slab_idx, slab_idx};
+    s_refill_resp.reset();
+    auto const status = m_fb_cache->try_alloc_blks(req, s_refill_resp);
+    if (s_refill_resp.need_refill || (status == BlkAllocStatus::FAILED)) {
+        request_more_blks(nullptr, false /* fill_entire_cache */);
+    }
+
+    for (auto const& e : s_refill_resp.out_blks) {
+        blk_count_t off{0};
+        for (; (off + slab_size) <= e.blk_count(); off += slab_size) {
+            mag_slab.push_back(e.get_blk_num() + off);
+        }
+        if (off < e.blk_count()) {
+            s_refill_resp.excess_blks.emplace_back(e.get_blk_num() + off, e.blk_count() - off, e.get_temperature());
+        }
+    }
+    for (auto const& e : s_refill_resp.excess_blks) {
+        free_blks_direct(MultiBlkId{blk_cache_entry_to_blkid(e)});
+    }
+    if (!mag_slab.empty()) { COUNTER_INCREMENT(m_metrics, num_magazine_refills, 1); }
+}
+
+bool VarsizeBlkAllocator::free_blks_magazine(BlkId const& b, std::vector< blk_cache_entry >& excess_blks) {
+    if (!is_magazine_eligible(b.blk_count())) { return false; }
+
+    auto const mag_size = HS_DYNAMIC_CONFIG(blkallocator.blk_magazine_size);
+    auto const slab_idx = FreeBlkCache::find_slab(b.blk_count());
+    auto& mag = this_thread_magazine();
+
+    std::unique_lock lg{mag.m_mtx};
+    auto& mag_slab = mag.m_slabs[slab_idx];
+    if (mag_slab.size() >= mag_size) {
+        // Magazine is full, flush the older half to the shared blk cache in one go
+        auto const nflush = std::max(mag_size / 2, 1u);
+        for (uint32_t i{0}; i < nflush; ++i) {
+            m_fb_cache->try_free_blks(blk_cache_entry{mag_slab[i], b.blk_count(), 2}, excess_blks);
+        }
+        mag_slab.erase(mag_slab.begin(), mag_slab.begin() + nflush);
+        COUNTER_INCREMENT(m_metrics, num_magazine_flushes, 1);
+    }
+    mag_slab.push_back(b.blk_num());
+    return true;
+}
+
+bool VarsizeBlkAllocator::drain_magazines() {
+    auto const now_ms = std::chrono::duration_cast< std::chrono::milliseconds >(
+                            std::chrono::steady_clock::now().time_since_epoch())
+                            .count();
+    auto last_ms = m_last_drain_time_ms.load(std::memory_order_relaxed);
+    if ((now_ms - last_ms < HS_DYNAMIC_CONFIG(blkallocator.blk_magazine_drain_interval_ms)) ||
+        !m_last_drain_time_ms.compare_exchange_strong(last_ms, now_ms, std::memory_order_relaxed)) {
+        return false; // Drained recently or being drained by another thread
+    }
+
+    std::vector< MultiBlkId > drained;
+    for (auto& mag : m_magazines) {
+        std::unique_lock lg{mag->m_mtx};
+        for (slab_idx_t slab_idx{0}; slab_idx < mag->m_slabs.size(); ++slab_idx) {
+            auto const slab_size = m_cfg.get_slab_block_count(slab_idx);
+            for (auto const blk_num : mag->m_slabs[slab_idx]) {
+                drained.emplace_back(blk_num, slab_size, m_chunk_id);
+            }
+            mag->m_slabs[slab_idx].clear();
+        }
+    }
+    if (drained.empty()) { return false; }
+
+    for (auto const& b : drained) {
+        free_blks_direct(b);
+    }
+    COUNTER_INCREMENT(m_metrics, num_magazine_drains, 1);
+    BLKALLOC_LOG(DEBUG, "Drained {} free blk entries from all magazines back to bitmap", drained.size());
+    return true;
+}
+
 bool VarsizeBlkAllocator::is_blk_alloced(BlkId const& bid, bool use_lock) const {
     auto check_bits_set = [this](BlkId const& b, bool use_lock) {
         if (use_lock) {
@@ -170,6 +170,13 @@ public:
     seg_num_t get_seg_num() const { return m_seg_num; }
 };
 
+// Per thread cache of free blks for each slab size. Allocations and frees of slab sized pieces are served from here
+// and the magazine is refilled from/flushed to the shared free blk cache in bulk.
+struct BlkMagazine {
+    std::mutex m_mtx; // Uncontended, unless there are more threads than magazines or while draining
+    std::vector< std::vector< blk_num_t > > m_slabs;
+};
+
 class BlkAllocMetrics : public sisl::MetricsGroup {
 public:
     explicit BlkAllocMetrics(const char* inst_name) : sisl::MetricsGroup("BlkAlloc", inst_name) {
@@ -178,6 +185,9 @@ public:
         REGISTER_COUNTER(num_alloc_partial, "Number of blk alloc partial allocations");
         REGISTER_COUNTER(num_retries, "Number of times it retried because of empty cache");
         REGISTER_COUNTER(num_blks_alloc_direct, "Number of blks alloc attempt directly because of empty cache");
+        REGISTER_COUNTER(num_magazine_refills, "Number of times per thread magazine is refilled from blk cache");
+        REGISTER_COUNTER(num_magazine_flushes, "Number of times per thread magazine is flushed to blk cache");
+        REGISTER_COUNTER(num_magazine_drains, "Number of times all magazines are drained because of low space");
 
         REGISTER_HISTOGRAM(frag_pct_distribution, "Distribution of fragmentation percentage",
                            HistogramBucketsType(LinearUpto64Buckets));
@@ -245,6 +255,8 @@ private:
 
     std::unique_ptr< sisl::Bitset > m_cache_bm; // Bitset representing entire blks in this allocator
     std::unique_ptr< FreeBlkCache > m_fb_cache; // Free Blks cache
+    std::vector< std::unique_ptr< BlkMagazine > > m_magazines; // Per thread caches in front of free blks cache
+    std::atomic< int64_t > m_last_drain_time_ms{0};           // Steady clock time magazines were last drained
 
     VarsizeBlkAllocConfig m_cfg; // Config for Varsize
 
@@ -272,6 +284,15 @@ private:
     blk_count_t free_blks_slab(MultiBlkId const& b);
     blk_count_t free_blks_direct(MultiBlkId const& b);
 
+    // Magazine related functions
+    bool is_magazine_eligible(blk_count_t nblks) const;
+    bool is_magazine_eligible(blk_count_t nblks, blk_alloc_hints const& hints) const;
+    BlkMagazine& this_thread_magazine();
+    blk_count_t alloc_blks_magazine(blk_count_t nblks, MultiBlkId& out_blkid);
+    void refill_magazine(slab_idx_t slab_idx, std::vector< blk_num_t >& mag_slab);
+    bool free_blks_magazine(BlkId const& b, std::vector< blk_cache_entry >& excess_blks);
+    bool drain_magazines();
+
 #ifdef _PRERELEASE
     void alloc_sanity_check(blk_count_t nblks, blk_alloc_hints const& hints, MultiBlkId const& out_blkids) const;
 #endif
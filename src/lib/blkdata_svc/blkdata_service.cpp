@@ -13,6 +13,10 @@
  * specific language governing permissions and limitations under the License.
  *
  *********************************************************************************/
+#include <algorithm>
+#include <chrono>
+
+#include <iomgr/iomgr.hpp>
 #include <homestore/blkdata_service.hpp>
 #include <homestore/homestore.hpp>
 #include <homestore/chunk_selector.h>
@@ -23,6 +27,8 @@
 #include "common/homestore_config.hpp" // is_data_drive_hdd
 #include "common/homestore_assert.hpp"
 #include "common/error.h"
+#include "common/homestore_utils.hpp"
+#include "blkalloc/append_blk_allocator.h"
 #include "blk_read_tracker.hpp"
 #include "data_svc_cp.hpp"
 
@@ -194,6 +200,17 @@ BlkAllocStatus BlkDataService::alloc_blks(uint32_t size, const blk_alloc_hints&
     return m_vdev->alloc_blks(nblks, hints, out_blkids);
 }
 
+BlkAllocStatus BlkDataService::alloc_blks(std::vector< uint32_t > const& sizes, blk_alloc_hints const& hints,
+                                          std::vector< MultiBlkId >& out_blkids) {
+    std::vector< blk_count_t > nblks_list;
+    nblks_list.reserve(sizes.size());
+    for (auto const size : sizes) {
+        HS_DBG_ASSERT_EQ(size % m_blk_size, 0, "Non aligned size requested");
+        nblks_list.push_back(static_cast< blk_count_t >(size / m_blk_size));
+    }
+    return m_vdev->alloc_blks(nblks_list, hints, out_blkids);
+}
+
 void BlkDataService::commit_blk(MultiBlkId const& blkid) {
     if (blkid.num_pieces() == 1) {
         // Shortcut to most common case
@@ -233,4 +250,197 @@ uint64_t BlkDataService::get_used_capacity() const { return m_vdev->used_size();
 
 uint32_t BlkDataService::get_align_size() const { return m_vdev->align_size(); }
 
+void BlkDataService::register_gc_handler(gc_live_blks_cb_t live_cb, gc_remap_cb_t remap_cb) {
+    std::unique_lock lg(m_gc_mtx);
+    m_gc_live_cb = std::move(live_cb);
+    m_gc_remap_cb = std::move(remap_cb);
+}
+
+struct gc_chunk_ctx {
+    shared< Chunk > chunk;
+    AppendBlkAllocator* allocator;
+    gc_live_blks_cb_t live_cb;
+    gc_remap_cb_t remap_cb;
+    std::vector< MultiBlkId > live_bids;
+    size_t next_idx{0};
+    uint64_t relocated_bytes{0};
+    std::chrono::steady_clock::time_point start_time;
+    std::vector< folly::Future< std::error_code > > free_futs;
+};
+
+folly::Future< uint32_t > BlkDataService::gc_chunks() {
+    bool expected{false};
+    if (!m_gc_in_progress.compare_exchange_strong(expected, true)) { return folly::makeFuture< uint32_t >(0); }
+
+    gc_live_blks_cb_t live_cb;
+    gc_remap_cb_t remap_cb;
+    {
+        std::unique_lock lg(m_gc_mtx);
+        live_cb = m_gc_live_cb;
+        remap_cb = m_gc_remap_cb;
+    }
+    if (!live_cb || !remap_cb) {
+        m_gc_in_progress.store(false);
+        return folly::makeFuture< uint32_t >(0);
+    }
+
+    // Chunks are collected one after the other, so that only one relocation is in flight at a time
+    auto nreclaimed = std::make_shared< uint32_t >(0);
+    auto fut = folly::makeFuture();
+    for (auto const& chunk : pick_gc_chunks()) {
+        auto ctx = std::make_shared< gc_chunk_ctx >();
+        ctx->chunk = chunk;
+        ctx->allocator = r_cast< AppendBlkAllocator* >(chunk->blk_allocator_mutable());
+        ctx->live_cb = live_cb;
+        ctx->remap_cb = remap_cb;
+        fut = std::move(fut).thenValue([this, ctx, nreclaimed](auto&&) {
+            return relocate_chunk(ctx).thenValue([nreclaimed](bool reclaimed) {
+                if (reclaimed) { ++(*nreclaimed); }
+            });
+        });
+    }
+    return std::move(fut).thenTry([this, nreclaimed](folly::Try< folly::Unit >&&) {
+        m_gc_in_progress.store(false);
+        return *nreclaimed;
+    });
+}
+
+std::vector< shared< Chunk > > BlkDataService::pick_gc_chunks() const {
+    auto const garbage_pct = HS_DYNAMIC_CONFIG(blkallocator.gc_garbage_ratio_pct);
+    auto const max_chunks = HS_DYNAMIC_CONFIG(blkallocator.gc_max_chunks_per_pass);
+
+    std::vector< std::pair< blk_num_t, shared< Chunk > > > candidates;
+    for (auto const& chunk : m_vdev->get_chunks()) {
+        auto const* allocator = dynamic_cast< AppendBlkAllocator const* >(chunk->blk_allocator());
+        if ((allocator == nullptr) || allocator->is_sealed()) { continue; }
+
+        auto const used = allocator->get_used_blks();
+        auto const garbage = allocator->get_defrag_nblks();
+        if ((used == 0) || (uint64_cast(garbage) * 100 < uint64_cast(used) * garbage_pct)) { continue; }
+        candidates.emplace_back(garbage, chunk);
+    }
+
+    // Most garbage first, it gives the most space back for the least amount of relocation
+    std::sort(candidates.begin(), candidates.end(),
+              [](auto const& a, auto const& b) { return a.first > b.first; });
+    if (candidates.size() > max_chunks) { candidates.resize(max_chunks); }
+
+    std::vector< shared< Chunk > > chunks;
+    chunks.reserve(candidates.size());
+    for (auto& c : candidates) {
+        chunks.emplace_back(std::move(c.second));
+    }
+    return chunks;
+}
+
+folly::Future< bool > BlkDataService::relocate_chunk(shared< gc_chunk_ctx > ctx) {
+    // No new data lands in this chunk from here on, vdev picks other chunks for the allocation
+    ctx->allocator->seal();
+
+    // Blks allocated before the seal are not known to consumer till they are committed. Wait for them to be either
+    // committed or freed, otherwise a blk committed after the live blks are taken is lost when the chunk is reset.
+    auto const drain_deadline = std::chrono::steady_clock::now() +
+        std::chrono::milliseconds(HS_DYNAMIC_CONFIG(blkallocator.gc_drain_timeout_ms));
+    return wait_for_commits(ctx->allocator, drain_deadline).thenValue([this, ctx](bool drained) {
+        if (!drained) {
+            HS_LOG(WARN, blkalloc, "gc of chunk={} skipped, allocations not committed yet, will retry in next pass",
+                   ctx->chunk->chunk_id());
+            ctx->allocator->unseal();
+            return folly::makeFuture< bool >(false);
+        }
+        ctx->live_bids = ctx->live_cb(ctx->chunk->chunk_id());
+        ctx->start_time = std::chrono::steady_clock::now();
+        return relocate_next_blk(ctx);
+    });
+}
+
+folly::Future< bool > BlkDataService::wait_for_commits(AppendBlkAllocator* allocator,
+                                                       std::chrono::steady_clock::time_point deadline) {
+    if (!allocator->has_uncommitted_blks()) { return folly::makeFuture< bool >(true); }
+    if (std::chrono::steady_clock::now() >= deadline) { return folly::makeFuture< bool >(false); }
+    return gc_delay(std::chrono::milliseconds(1)).thenValue([this, allocator, deadline](auto&&) {
+        return wait_for_commits(allocator, deadline);
+    });
+}
+
+folly::Future< bool > BlkDataService::relocate_next_blk(shared< gc_chunk_ctx > ctx) {
+    if (ctx->next_idx == ctx->live_bids.size()) { return complete_chunk_relocation(std::move(ctx)); }
+
+    auto const old_bid = ctx->live_bids[ctx->next_idx++];
+    auto const size = old_bid.blk_count() * m_blk_size;
+    MultiBlkId new_bid;
+    if (alloc_blks(size, blk_alloc_hints{}, new_bid) != BlkAllocStatus::SUCCESS) {
+        HS_LOG(ERROR, blkalloc, "gc of chunk={} failed allocating blks to relocate blkid={}, will retry in next pass",
+               ctx->chunk->chunk_id(), old_bid.to_string());
+        return abort_chunk_relocation(std::move(ctx));
+    }
+
+    auto* buf = hs_utils::iobuf_alloc(size, sisl::buftag::common, get_align_size());
+    return async_read(old_bid, buf, size)
+        .thenValue([this, buf, size, new_bid](std::error_code err) {
+            if (err) { return folly::makeFuture< std::error_code >(std::move(err)); }
+            return async_write(r_cast< char const* >(buf), size, new_bid);
+        })
+        .thenValue([this, ctx, buf, size, old_bid, new_bid](std::error_code err) {
+            hs_utils::iobuf_free(buf, sisl::buftag::common);
+            if (err) {
+                HS_LOG(ERROR, blkalloc, "gc of chunk={} failed relocating blkid={}, error={}, will retry in next pass",
+                       ctx->chunk->chunk_id(), old_bid.to_string(), err.message());
+                ctx->free_futs.emplace_back(async_free_blk(new_bid));
+                return abort_chunk_relocation(ctx);
+            }
+
+            commit_blk(new_bid);
+            ctx->remap_cb(old_bid, new_bid);
+            ctx->free_futs.emplace_back(async_free_blk(old_bid));
+
+            // Throttle by keeping only one relocation in flight and pacing them to the configured rate
+            ctx->relocated_bytes += size;
+            std::chrono::nanoseconds delay{0};
+            auto const max_bytes_per_sec = HS_DYNAMIC_CONFIG(blkallocator.gc_max_bytes_per_sec);
+            if (max_bytes_per_sec != 0) {
+                auto const due =
+                    ctx->start_time + std::chrono::microseconds(ctx->relocated_bytes * 1000000 / max_bytes_per_sec);
+                delay = due - std::chrono::steady_clock::now();
+            }
+            return gc_delay(delay).thenValue([this, ctx](auto&&) { return relocate_next_blk(ctx); });
+        });
+}
+
+folly::Future< bool > BlkDataService::abort_chunk_relocation(shared< gc_chunk_ctx > ctx) {
+    // Blks relocated so far stay relocated, the rest are collected along with them in the next pass
+    return folly::collectAllUnsafe(ctx->free_futs).thenValue([ctx](auto&&) {
+        ctx->allocator->unseal();
+        return false;
+    });
+}
+
+folly::Future< bool > BlkDataService::complete_chunk_relocation(shared< gc_chunk_ctx > ctx) {
+    // Wait for the in-flight reads on old blks to drain (async_free_blk waits on them) and then for a cp, which
+    // persists the remaps along with the frees. Till then the on-disk state could still point to the old blks, so
+    // chunk is kept sealed and its blks are not overwritten.
+    return folly::collectAllUnsafe(ctx->free_futs)
+        .thenValue([](auto&&) { return hs()->cp_mgr().trigger_cp_flush(true /* force */); })
+        .thenValue([ctx](bool) {
+            ctx->allocator->reset();
+            HS_LOG(INFO, blkalloc, "gc reclaimed chunk={}, relocated {} blkids ({} bytes) in {} ms",
+                   ctx->chunk->chunk_id(), ctx->live_bids.size(), ctx->relocated_bytes,
+                   std::chrono::duration_cast< std::chrono::milliseconds >(std::chrono::steady_clock::now() -
+                                                                           ctx->start_time)
+                       .count());
+            return true;
+        });
+}
+
+folly::Future< folly::Unit > BlkDataService::gc_delay(std::chrono::nanoseconds delay) {
+    if (delay.count() <= 0) { return folly::makeFuture(); }
+
+    auto promise = std::make_shared< folly::Promise< folly::Unit > >();
+    auto fut = promise->getFuture();
+    iomanager.schedule_global_timer(
+        delay.count(), false /* recurring */, nullptr /* cookie */, iomgr::reactor_regex::all_worker,
+        [promise](void*) { promise->setValue(); }, true /* wait_to_schedule */);
+    return fut;
+}
+
 } // namespace homestore
@@ -29,15 +29,21 @@ folly::Future< bool > DataSvcCPCallbacks::cp_flush(CP* cp) {
     // Pick a CP Manager blocking IO fiber to execute the cp flush of vdev
     // iomanager.run_on_forget(hs()->cp_mgr().pick_blocking_io_fiber(), [this, cp]() {
     auto cp_ctx = s_cast< VDevCPContext* >(cp->context(cp_consumer_t::BLK_DATA_SVC));
-    m_vdev->cp_flush(cp_ctx); // this is a blocking io call
-    cp_ctx->complete(true);
+    return m_vdev->cp_flush(cp_ctx).thenValue([cp_ctx](bool success) {
+        cp_ctx->complete(success);
+        return success;
+    });
     //});
-
-    return folly::makeFuture< bool >(true);
 }
 
 void DataSvcCPCallbacks::cp_cleanup(CP* cp) {}
 
 int DataSvcCPCallbacks::cp_progress_percent() { return m_vdev->cp_progress_percent(); }
 
+uint64_t DataSvcCPCallbacks::cp_dirty_bytes(CP*) {
+    // Cp flush persists the bitmaps of allocators. Blks freed in this cp are applied to the bitmap only after that and
+    // get persisted in the next cp.
+    return m_vdev->cp_dirty_bytes();
+}
+
 } // namespace homestore
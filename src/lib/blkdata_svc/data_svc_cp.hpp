@@ -30,6 +30,7 @@ public:
     folly::Future< bool > cp_flush(CP* cp) override;
     void cp_cleanup(CP* cp) override;
     int cp_progress_percent() override;
+    uint64_t cp_dirty_bytes(CP* cp) override;
 
 private:
     shared< VirtualDev > m_vdev;
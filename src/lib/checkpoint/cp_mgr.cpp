@@ -13,6 +13,8 @@
  * specific language governing permissions and limitations under the License.
  *
  *********************************************************************************/
+#include <algorithm>
+
 #include <urcu.h>
 
 #include <homestore/homestore.hpp>
@@ -51,10 +53,14 @@ void CPManager::start(bool first_time_boot) {
         m_sb.write();
     }
 
-    LOGINFO("cp timer is set to {} usec", HS_DYNAMIC_CONFIG(generic.cp_timer_us));
+    m_flush_bytes_per_sec = HS_DYNAMIC_CONFIG(generic.cp_initial_flush_bytes_per_sec);
+    m_last_trigger_time = Clock::now();
+
+    LOGINFO("cp timer is set to {} usec, cp scheduler checks every {} ms", HS_DYNAMIC_CONFIG(generic.cp_timer_us),
+            HS_DYNAMIC_CONFIG(generic.cp_sched_interval_ms));
     m_cp_timer_hdl = iomanager.schedule_global_timer(
-        HS_DYNAMIC_CONFIG(generic.cp_timer_us) * 1000, true, nullptr /*cookie*/, iomgr::reactor_regex::all_worker,
-        [this](void*) { trigger_cp_flush(false /* false */); }, true /* wait_to_schedule */);
+        HS_DYNAMIC_CONFIG(generic.cp_sched_interval_ms) * 1000 * 1000, true, nullptr /*cookie*/,
+        iomgr::reactor_regex::all_worker, [this](void*) { cp_sched_check(); }, true /* wait_to_schedule */);
 }
 
 void CPManager::on_meta_blk_found(const sisl::byte_view& buf, void* meta_cookie) {
@@ -139,11 +145,14 @@ CP* CPManager::get_cur_cp() {
 }
 
 folly::Future< bool > CPManager::trigger_cp_flush(bool force) {
-    // check the state of previous CP flush
-    bool expected = false;
-    auto ret = m_in_flush_phase.compare_exchange_strong(expected, true);
-    if (!ret) {
-        // There is already an existing CP on-going, but if force is set, we create a back-to-back CP.
+    // check if we can have one more cp in flush
+    auto const max_inflight =
+        std::clamp(HS_DYNAMIC_CONFIG(generic.cp_max_inflight), uint32_cast(1), uint32_cast(MAX_CP_COUNT - 1));
+    auto inflight = m_inflight_cps.load();
+    while ((inflight < max_inflight) && !m_inflight_cps.compare_exchange_weak(inflight, inflight + 1)) {}
+
+    if (inflight >= max_inflight) {
+        // There are already max cps on-going, but if force is set, we create a back-to-back CP.
         if (force) {
             std::unique_lock< std::mutex > lk(trigger_cp_mtx);
             auto cur_cp = cp_guard();
@@ -161,16 +170,22 @@ folly::Future< bool > CPManager::trigger_cp_flush(bool force) {
 
     folly::Future< bool > ret_fut = folly::Future< bool >::makeEmpty();
     {
+        // Multiple cps can be triggered concurrently now, take the lock before entering the cp, so that every trigger
+        // switches over a different cp.
+        std::unique_lock< std::mutex > lk(trigger_cp_mtx);
         auto cur_cp = cp_guard();
         cur_cp->m_cp_status = cp_status_t::cp_trigger;
         HS_PERIODIC_LOG(INFO, cp, "<<<<<<<<<<< Triggering flush of the CP {}", cur_cp->to_string());
         COUNTER_INCREMENT(*m_metrics, cp_cnt, 1);
+        if (inflight > 0) { COUNTER_INCREMENT(*m_metrics, pipelined_cps, 1); }
         m_cp_start_time = Clock::now();
+        m_last_trigger_time = m_cp_start_time;
+        cur_cp->m_dirty_bytes = cp_dirty_bytes(cur_cp.get());
+        cur_cp->m_journal_written = resource_mgr().journal_written();
 
         /* allocate a new cp */
         auto new_cp = new CP(this);
         {
-            std::unique_lock< std::mutex > lk(trigger_cp_mtx);
             new_cp->m_cp_id = cur_cp->m_cp_id + 1;
 
             HS_PERIODIC_LOG(DEBUG, cp, "Create New CP session", new_cp->id());
@@ -179,6 +194,7 @@ folly::Future< bool > CPManager::trigger_cp_flush(bool force) {
                 if (consumer) { new_cp->m_contexts[idx] = std::move(consumer->on_switchover_cp(cur_cp.get(), new_cp)); }
                 ++idx;
             }
+            chain_to_prev_cp(cur_cp.get());
 
             HS_PERIODIC_LOG(DEBUG, cp, "CP Attached completed, proceed to exit cp critical section");
             if (cur_cp->m_cp_waiting_to_trigger) {
@@ -201,13 +217,47 @@ folly::Future< bool > CPManager::trigger_cp_flush(bool force) {
     return ret_fut;
 }
 
+void CPManager::chain_to_prev_cp(CP* cp) {
+    // Called in cp trigger order with trigger_cp_mtx held. Each consumer's flush of this cp is to wait for its flush of
+    // the previous cp, and this cp's completion for previous cp's completion.
+    cp->m_prev_flush_done.clear();
+    for (size_t idx{0}; idx < m_cp_cb_table.size(); ++idx) {
+        auto& last = m_last_flush_done[idx];
+        cp->m_prev_flush_done.emplace_back(last ? last->getFuture() : folly::makeFuture< bool >(true));
+        cp->m_flush_done[idx] = std::make_shared< folly::SharedPromise< bool > >();
+        last = cp->m_flush_done[idx];
+    }
+    cp->m_prev_cp_done = m_last_cp_done ? m_last_cp_done->getFuture() : folly::makeFuture< bool >(true);
+    cp->m_cp_done = std::make_shared< folly::SharedPromise< bool > >();
+    m_last_cp_done = cp->m_cp_done;
+}
+
 void CPManager::cp_start_flush(CP* cp) {
     std::vector< folly::Future< bool > > futs;
     HS_PERIODIC_LOG(INFO, cp, "Starting CP {} flush", cp->id());
     cp->m_cp_status = cp_status_t::cp_flushing;
+    cp->m_flush_start_time = Clock::now();
 
+    size_t idx{0};
     for (auto& consumer : m_cp_cb_table) {
-        if (consumer) { futs.emplace_back(std::move(consumer->cp_flush(cp))); }
+        if (consumer) {
+            // Consumers which are done with the previous cp start flushing this cp right away, others once they are
+            // Flush time is taken from the point the consumer starts flushing, so that the wait isn't accounted
+            auto flush_start = std::make_shared< Clock::time_point >();
+            futs.emplace_back(std::move(cp->m_prev_flush_done[idx])
+                                  .thenTry([consumer = consumer.get(), cp, flush_start](auto&&) {
+                                      *flush_start = Clock::now();
+                                      return consumer->cp_flush(cp);
+                                  })
+                                  .thenTry([done = cp->m_flush_done[idx], cp, flush_start](folly::Try< bool >&& t) {
+                                      cp->record_consumer_flush_us(get_elapsed_time_us(*flush_start));
+                                      done->setValue(t.hasValue() && t.value());
+                                      return t.hasValue() && t.value();
+                                  }));
+        } else {
+            cp->m_flush_done[idx]->setValue(true);
+        }
+        ++idx;
     }
 
     folly::collectAllUnsafe(futs).thenValue([this, cp](auto) {
@@ -220,42 +270,128 @@ void CPManager::on_cp_flush_done(CP* cp) {
     HS_DBG_ASSERT_EQ(cp->m_cp_status, cp_status_t::cp_flushing);
     cp->m_cp_status = cp_status_t::cp_flush_done;
 
-    iomanager.run_on_forget(pick_blocking_io_fiber(), [this, cp]() {
-        // Persist the superblock with this flushed cp information
-        ++(m_sb->m_last_flushed_cp);
-        m_sb.write();
+    // CPs are completed in order, since cp superblock records only the last flushed cp
+    std::move(cp->m_prev_cp_done).thenTry([this, cp](auto&&) {
+        iomanager.run_on_forget(pick_blocking_io_fiber(), [this, cp]() { complete_cp(cp); });
+    });
+}
+
+void CPManager::complete_cp(CP* cp) {
+    // Persist the superblock with this flushed cp information
+    m_sb->m_last_flushed_cp = cp->id();
+    m_sb.write();
+    record_flush_throughput(cp);
+
+    cleanup_cp(cp);
+
+    // Setting promise will cause the CP manager destructor to cleanup
+    // before getting a chance to do the checking if shutdown has been
+    // initiated or not.
+    auto shutdown_initiated = m_cp_shutdown_initiated.load();
+    auto promise = std::move(cp->m_comp_promise);
+    auto cp_done = std::move(cp->m_cp_done);
+
+    m_wd_cp->reset_cp();
+    delete cp;
+
+    --m_inflight_cps;
+    cp_done->setValue(true);
+    promise.setValue(true);
+    if (shutdown_initiated) {
+        // If shutdown initiated, dont trigger another CP.
+        // Dont access any cp state after this.
+        return;
+    }
+
+    // Trigger CP in case there is one back to back CP
+    {
+        auto cur_cp = cp_guard();
+        if (cur_cp.get() == nullptr) { return; }
+        m_wd_cp->set_cp(cur_cp.get());
+        if (cur_cp->m_cp_waiting_to_trigger) {
+            HS_PERIODIC_LOG(INFO, cp, "Triggering back to back CP");
+            COUNTER_INCREMENT(*m_metrics, back_to_back_cps, 1);
+            trigger_cp_flush(false);
+        }
+    }
+}
 
-        cleanup_cp(cp);
+void CPManager::cp_sched_check() {
+    uint64_t dirty_bytes;
+    {
+        auto cur_cp = cp_guard();
+        if (cur_cp.get() == nullptr) { return; }
+        dirty_bytes = cp_dirty_bytes(cur_cp.get());
+    }
 
-        // Setting promise will cause the CP manager destructor to cleanup
-        // before getting a chance to do the checking if shutdown has been
-        // initiated or not.
-        auto shutdown_initiated = m_cp_shutdown_initiated.load();
-        auto promise = std::move(cp->m_comp_promise);
+    // Predict how long the flush of current cp and the journal replay (if we crash now) would take
+    auto const flush_bps = std::max(m_flush_bytes_per_sec.load(), uint64_cast(1));
+    auto const flush_ms = dirty_bytes * 1000 / flush_bps;
+    auto const replay_bytes = resource_mgr().journal_written() - m_replay_journal_start.load();
+    auto const replay_ms =
+        replay_bytes * 1000 / std::max(HS_DYNAMIC_CONFIG(generic.cp_journal_replay_bytes_per_sec), uint64_cast(1));
+
+    GAUGE_UPDATE(*m_metrics, cp_dirty_bytes, dirty_bytes);
+    GAUGE_UPDATE(*m_metrics, cp_flush_bytes_per_sec, flush_bps);
+    GAUGE_UPDATE(*m_metrics, cp_predicted_flush_ms, flush_ms);
+    GAUGE_UPDATE(*m_metrics, cp_journal_replay_bytes, replay_bytes);
+    GAUGE_UPDATE(*m_metrics, cp_predicted_recovery_ms, replay_ms);
+
+    enum class trigger_reason_t : uint8_t { flush_target, recovery_target, timer };
+    trigger_reason_t reason;
+    if (flush_ms >= HS_DYNAMIC_CONFIG(generic.cp_target_flush_ms)) {
+        reason = trigger_reason_t::flush_target;
+    } else if (replay_ms >= HS_DYNAMIC_CONFIG(generic.cp_target_recovery_ms)) {
+        reason = trigger_reason_t::recovery_target;
+    } else if (get_elapsed_time_us(m_last_trigger_time.load()) >= HS_DYNAMIC_CONFIG(generic.cp_timer_us)) {
+        reason = trigger_reason_t::timer;
+    } else {
+        return;
+    }
 
-        m_wd_cp->reset_cp();
-        delete cp;
+    // Without force, trigger fails right away if there is no room for one more inflight cp. Scheduler checks again in
+    // its next interval, so count the reason only for the cps which were actually triggered.
+    auto fut = trigger_cp_flush(false /* force */);
+    if (fut.isReady() && !fut.value()) { return; }
+
+    switch (reason) {
+    case trigger_reason_t::flush_target:
+        COUNTER_INCREMENT(*m_metrics, cp_triggered_by_flush_target, 1);
+        break;
+    case trigger_reason_t::recovery_target:
+        COUNTER_INCREMENT(*m_metrics, cp_triggered_by_recovery_target, 1);
+        break;
+    case trigger_reason_t::timer:
+        COUNTER_INCREMENT(*m_metrics, cp_triggered_by_timer, 1);
+        break;
+    }
+    HS_PERIODIC_LOG(DEBUG, cp, "Scheduled cp, dirty_bytes={} predicted flush_ms={} replay_bytes={} replay_ms={}",
+                    dirty_bytes, flush_ms, replay_bytes, replay_ms);
+}
 
-        promise.setValue(true);
-        if (shutdown_initiated) {
-            // If shutdown initiated, dont trigger another CP.
-            // Dont access any cp state after this.
-            return;
-        }
-        m_in_flush_phase = false;
+uint64_t CPManager::cp_dirty_bytes(CP* cp) const {
+    uint64_t dirty_bytes{0};
+    for (auto& consumer : m_cp_cb_table) {
+        if (consumer) { dirty_bytes += consumer->cp_dirty_bytes(cp); }
+    }
+    return dirty_bytes;
+}
 
-        // Trigger CP in case there is one back to back CP
-        {
-            auto cur_cp = cp_guard();
-            if (cur_cp.get() == nullptr) { return; }
-            m_wd_cp->set_cp(cur_cp.get());
-            if (cur_cp->m_cp_waiting_to_trigger) {
-                HS_PERIODIC_LOG(INFO, cp, "Triggering back to back CP");
-                COUNTER_INCREMENT(*m_metrics, back_to_back_cps, 1);
-                trigger_cp_flush(false);
-            }
-        }
-    });
+void CPManager::record_flush_throughput(CP* cp) {
+    HISTOGRAM_OBSERVE(*m_metrics, cp_latency, get_elapsed_time_us(cp->m_flush_start_time));
+    m_replay_journal_start = cp->m_journal_written;
+
+    // Consumers flush in parallel, the slowest of them is what the cp takes to flush
+    auto const flush_us = cp->m_consumer_flush_us.load();
+
+    // Small cps are dominated by fixed costs (superblock writes etc), they don't tell the throughput
+    static constexpr uint64_t min_sample_bytes{1024 * 1024};
+    if ((cp->m_dirty_bytes < min_sample_bytes) || (flush_us == 0)) { return; }
+
+    // Exponential moving average, weighing the latest cp by 1/4
+    auto const bps = cp->m_dirty_bytes * 1000 * 1000 / flush_us;
+    auto const prev = m_flush_bytes_per_sec.load();
+    m_flush_bytes_per_sec = (prev == 0) ? bps : (prev * 3 + bps) / 4;
 }
 
 void CPManager::cleanup_cp(CP* cp) {
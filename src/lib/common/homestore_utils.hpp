@@ -16,6 +16,8 @@
 #pragma once
 
 #include "homestore_config.hpp"
+#include <boost/fiber/future.hpp>
+#include <folly/futures/Future.h>
 #include <sisl/fds/buffer.hpp>
 
 namespace homestore {
@@ -44,6 +46,18 @@ public:
                                             const size_t alignment);
     static uuid_t gen_random_uuid();
 
+    /**
+     * @brief Wait for the future to be fulfilled, parking the calling fiber instead of blocking its reactor thread,
+     * so that the completions the future waits on can still be processed by the reactor.
+     */
+    template < typename T >
+    static T fiber_wait(folly::Future< T >&& fut) {
+        boost::fibers::promise< folly::Try< T > > p;
+        auto f = p.get_future();
+        std::move(fut).thenTry([&p](folly::Try< T >&& t) { p.set_value(std::move(t)); });
+        return std::move(f.get().value());
+    }
+
     /**
      * @brief  given a DAG graph , build the partial order sequence.
      *
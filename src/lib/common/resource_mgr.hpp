@@ -79,6 +79,10 @@ public:
     bool check_journal_size(const uint64_t used_size, const uint64_t total_size);
     void register_journal_exceed_cb(exceed_limit_cb_t cb);
 
+    /* total bytes appended to journal since start, used to estimate the journal to be replayed on recovery */
+    void inc_journal_written(uint64_t size) { m_journal_written.fetch_add(size, std::memory_order_relaxed); }
+    uint64_t journal_written() const { return m_journal_written.load(std::memory_order_relaxed); }
+
     uint32_t get_journal_size_limit() const;
 
     /* monitor chunk size */
@@ -99,6 +103,7 @@ private:
     std::atomic< int64_t > m_hs_ab_cnt;  // alloc count
     std::atomic< int64_t > m_memory_used_in_recovery;
     std::atomic< uint32_t > m_flush_dirty_buf_q_depth{64};
+    std::atomic< uint64_t > m_journal_written{0};
     uint64_t m_total_cap;
     exceed_limit_cb_t m_dirty_buf_exceed_cb;
     exceed_limit_cb_t m_free_blks_exceed_cb;
@@ -90,6 +90,7 @@ off_t JournalVirtualDev::alloc_next_append_blk(size_t sz) {
 
     // update reserved size;
     m_reserved_sz += sz;
+    resource_mgr().inc_journal_written(sz);
 
     high_watermark_check();
 
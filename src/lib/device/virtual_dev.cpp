@@ -45,6 +45,7 @@
 #include "device/round_robin_chunk_selector.h"
 #include "blkalloc/append_blk_allocator.h"
 #include "blkalloc/fixed_blk_allocator.h"
+#include "blkalloc/extent_blk_allocator.h"
 
 SISL_LOGGING_DECL(device)
 
@@ -75,6 +76,11 @@ static std::shared_ptr< BlkAllocator > create_blk_allocator(blk_allocator_type_t
                            std::string("append_chunk_") + std::to_string(unique_id)};
         return std::make_shared< AppendBlkAllocator >(cfg, is_init, unique_id);
     }
+    case blk_allocator_type_t::extent: {
+        BlkAllocConfig cfg{vblock_size, align_sz, size, is_auto_recovery,
+                           std::string("extent_chunk_") + std::to_string(unique_id)};
+        return std::make_shared< ExtentBlkAllocator >(cfg, is_init, unique_id);
+    }
     case blk_allocator_type_t::none:
     default:
         return nullptr;
@@ -253,6 +259,55 @@ BlkAllocStatus VirtualDev::alloc_blks(blk_count_t nblks, blk_alloc_hints const&
     return status;
 }
 
+BlkAllocStatus VirtualDev::alloc_blks(std::vector< blk_count_t > const& nblks_list, blk_alloc_hints const& hints,
+                                      std::vector< MultiBlkId >& out_blkids) {
+    out_blkids.clear();
+    out_blkids.reserve(nblks_list.size());
+
+    uint64_t total_nblks{0};
+    for (auto const nblks : nblks_list) {
+        total_nblks += nblks;
+    }
+
+    if ((nblks_list.size() > 1) && (total_nblks <= std::min(max_blks_per_blkid(), size_t{hints.max_blks_per_piece}))) {
+        // Attempt one contiguous range on the chunk we would have picked for the batch anyways. It is only an
+        // optimization, not finding one is not an allocation failure.
+        Chunk* chunk = hints.chunk_id_hint ? m_dmgr.get_chunk_mutable(*(hints.chunk_id_hint))
+                                           : m_chunk_selector->select_chunk(blk_count_t(total_nblks), hints).get();
+        if (chunk != nullptr) {
+            auto h = hints;
+            h.is_contiguous = true;
+            h.partial_alloc_ok = false;
+
+            MultiBlkId range;
+            if (alloc_blks_from_chunk(blk_count_t(total_nblks), h, range, chunk) == BlkAllocStatus::SUCCESS) {
+                auto blk_num = range.blk_num();
+                for (auto const nblks : nblks_list) {
+                    out_blkids.emplace_back(blk_num, nblks, range.chunk_num());
+                    blk_num += nblks;
+                }
+                COUNTER_INCREMENT(m_metrics, vdev_batch_contiguous_allocs, 1);
+                return BlkAllocStatus::SUCCESS;
+            }
+        }
+    }
+
+    for (auto const nblks : nblks_list) {
+        out_blkids.emplace_back();
+        auto const status = alloc_blks(nblks, hints, out_blkids.back());
+        if (status != BlkAllocStatus::SUCCESS) {
+            // Rollback the allocations done for the batch so far
+            out_blkids.pop_back();
+            for (auto const& blkid : out_blkids) {
+                m_dmgr.get_chunk_mutable(blkid.chunk_num())->blk_allocator_mutable()->free(blkid);
+            }
+            out_blkids.clear();
+            return status;
+        }
+    }
+    return BlkAllocStatus::SUCCESS;
+}
+
 BlkAllocStatus VirtualDev::alloc_blks_from_chunk(blk_count_t nblks, blk_alloc_hints const& hints, MultiBlkId& out_blkid,
                                                  Chunk* chunk) {
 #ifdef _PRERELEASE
@@ -576,12 +631,15 @@ VDevCPContext::VDevCPContext(CP* cp) : CPContext(cp) {}
 
 std::unique_ptr< CPContext > VirtualDev::create_cp_context(CP* cp) { return std::make_unique< VDevCPContext >(cp); }
 
-void VirtualDev::cp_flush(VDevCPContext* v_cp_ctx) {
+folly::Future< bool > VirtualDev::cp_flush(VDevCPContext* v_cp_ctx) {
     CP* cp = v_cp_ctx->cp();
 
-    // pass down cp so that underlying components can get their customized CP context if needed;
-    m_chunk_selector->foreach_chunks(
-        [this, cp](cshared< Chunk >& chunk) { chunk->blk_allocator_mutable()->cp_flush(cp); });
+    // pass down cp so that underlying components can get their customized CP context if needed. Allocators take their
+    // copy of what is to be persisted right away and write them asynchronously, so that they are batched together.
+    std::vector< folly::Future< bool > > futs;
+    m_chunk_selector->foreach_chunks([cp, &futs](cshared< Chunk >& chunk) {
+        futs.emplace_back(chunk->blk_allocator_mutable()->cp_flush(cp));
+    });
 
     // All of the blkids which were captured in the current vdev cp context will now be freed and hence available for
     // allocation on the new CP dirty collection session which is ongoing
@@ -590,6 +648,21 @@ void VirtualDev::cp_flush(VDevCPContext* v_cp_ctx) {
         if (m_auto_recovery) { allocator->free_on_disk(b); }
         allocator->free(b);
     }
+
+    return folly::collectAllUnsafe(futs).thenValue([](auto&& results) {
+        for (auto const& r : results) {
+            if (!r.hasValue() || !r.value()) { return false; }
+        }
+        return true;
+    });
+}
+
+uint64_t VirtualDev::cp_dirty_bytes() const {
+    uint64_t dirty_bytes{0};
+    for (auto& chunk : m_all_chunks) {
+        dirty_bytes += chunk->blk_allocator()->cp_dirty_bytes();
+    }
+    return dirty_bytes;
 }
 
 // sync-ops during cp_flush, so return 100;
@@ -50,6 +50,7 @@ public:
         REGISTER_COUNTER(vdev_truncate_count, "vdev total truncate cnt");
         REGISTER_COUNTER(vdev_high_watermark_count, "vdev total high watermark cnt");
         REGISTER_COUNTER(vdev_num_alloc_failure, "vdev blk alloc failure cnt");
+        REGISTER_COUNTER(vdev_batch_contiguous_allocs, "vdev batch allocs served from one contiguous range cnt");
         REGISTER_COUNTER(unalign_writes, "unalign write cnt");
         REGISTER_COUNTER(default_chunk_allocation_cnt, "default chunk allocation count");
         REGISTER_COUNTER(random_chunk_allocation_cnt,
@@ -138,6 +139,17 @@ public:
     virtual BlkAllocStatus alloc_blks(blk_count_t nblks, blk_alloc_hints const& hints,
                                       std::vector< BlkId >& out_blkids);
 
+    /// @brief This method allocates blocks for a batch of requests in one call. It first attempts to allocate the
+    /// whole batch as one contiguous range and carve it for each request, so that writes of consecutive requests can
+    /// be merged. Failing that, each request is allocated separately. Allocation is all or nothing, if any of them
+    /// fails, whatever is allocated for the batch is freed.
+    /// @param nblks_list : Number of blocks needed for each request of the batch
+    /// @param hints : Hints about block allocation, common for the entire batch
+    /// @param out_blkids : Vector to which the MultiBlkId of each request is added, in the same order as nblks_list
+    /// @return BlkAllocStatus : Status about the allocation
+    virtual BlkAllocStatus alloc_blks(std::vector< blk_count_t > const& nblks_list, blk_alloc_hints const& hints,
+                                      std::vector< MultiBlkId >& out_blkids);
+
     /// @brief Checks if a given block id is allocated in the in-memory version of the blk allocator
     /// @param blkid : BlkId to check for allocation
     /// @return true or false
@@ -257,11 +269,14 @@ public:
     /// @brief
     ///
     /// @param cp
-    void cp_flush(VDevCPContext* v_cp_ctx);
+    folly::Future< bool > cp_flush(VDevCPContext* v_cp_ctx);
 
     /// @brief : percentage CP has been progressed, this api is normally used for cp watchdog;
     int cp_progress_percent();
 
+    /// @brief : bytes the allocators of this vdev would persist if cp is flushed now
+    uint64_t cp_dirty_bytes() const;
+
     std::unique_ptr< CPContext > create_cp_context(CP* cp);
 
     ////////////////////////// Standard Getters ///////////////////////////////
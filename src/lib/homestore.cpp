@@ -218,6 +218,7 @@ void HomeStore::do_start() {
     // In case of custom recovery, let consumer starts the recovery and it is consumer module's responsibilities
     // to start log store
     if (has_log_service() && inp_params.auto_recovery) { m_log_service->start(is_first_time_boot() /* format */); }
+    if (has_repl_data_service()) { s_cast< GenericReplService* >(m_repl_service.get())->on_logs_recovered(); }
 
     m_init_done = true;
 }
@@ -1,7 +1,16 @@
 #include "index/index_cp.hpp"
 #include "index/wb_cache.hpp"
+#include "common/homestore_config.hpp"
 
 namespace homestore {
+IndexCPContext::IndexCPContext(CP* cp) : VDevCPContext(cp) {
+    auto const threshold = HS_DYNAMIC_CONFIG(generic.index_trickle_flush_threshold);
+    if (threshold != 0) {
+        m_trickle_q = std::make_unique< folly::MPMCQueue< IndexBufferPtr > >(
+            2 * threshold + HS_DYNAMIC_CONFIG(generic.index_trickle_flush_batch));
+    }
+}
+
 IndexCPCallbacks::IndexCPCallbacks(IndexWBCache* wb_cache) : m_wb_cache{wb_cache} {}
 
 std::unique_ptr< CPContext > IndexCPCallbacks::on_switchover_cp(CP* cur_cp, CP* new_cp) {
@@ -17,4 +26,9 @@ void IndexCPCallbacks::cp_cleanup(CP* cp) {}
 
 int IndexCPCallbacks::cp_progress_percent() { return 100; }
 
+uint64_t IndexCPCallbacks::cp_dirty_bytes(CP* cp) {
+    auto ctx = s_cast< IndexCPContext* >(cp->context(cp_consumer_t::INDEX_SVC));
+    return ctx ? std::max(ctx->m_dirty_buf_count.get(), int64_t{0}) * m_wb_cache->node_size() : 0;
+}
+
 } // namespace homestore
@@ -15,6 +15,9 @@
  *********************************************************************************/
 #pragma once
 #include <atomic>
+#include <map>
+#include <vector>
+#include <folly/MPMCQueue.h>
 #include <sisl/fds/concurrent_insert_vector.hpp>
 #include <homestore/blk.h>
 #include <homestore/index/index_internal.hpp>
@@ -27,6 +30,26 @@
 SISL_LOGGING_DECL(wbcache)
 
 namespace homestore {
+static constexpr uint64_t index_cp_journal_magic{0xcb1e1d0c};
+static constexpr uint32_t index_cp_journal_version{0x1};
+
+#pragma pack(1)
+// Journal of all the nodes dirtied in a CP, persisted before the CP flush starts writing them. If the flush is
+// interrupted by a crash, recovery visits only these nodes to repair partially persisted structural changes.
+struct index_cp_journal_sb {
+    uint64_t magic{index_cp_journal_magic};
+    uint32_t version{index_cp_journal_version};
+    cp_id_t cp_id{-1};
+    uint32_t num_tables{0};
+    // Followed by num_tables of index_cp_journal_table, each one followed by its num_nodes bnodeids
+};
+
+struct index_cp_journal_table {
+    uuid_t uuid;
+    uint32_t num_nodes{0};
+};
+#pragma pack()
+
 struct IndexCPContext : public VDevCPContext {
 public:
     std::atomic< uint64_t > m_num_nodes_added{0};
@@ -36,17 +59,26 @@ public:
     std::mutex m_flush_buffer_mtx;
     sisl::ConcurrentInsertVector< IndexBufferPtr >::iterator m_dirty_buf_it;
 
-public:
+    // Dirty buffers in the order they are dirtied, which are candidates to be flushed ahead of the CP (trickle flush)
+    // while the CP is still taking IOs. Null if trickle flush is turned off.
+    std::unique_ptr< folly::MPMCQueue< IndexBufferPtr > > m_trickle_q;
 
-    IndexCPContext(CP* cp) : VDevCPContext(cp) {}
+public:
+    IndexCPContext(CP* cp);
     virtual ~IndexCPContext() = default;
 
     void add_to_dirty_list(const IndexBufferPtr& buf) {
         m_dirty_buf_list.push_back(buf);
         buf->set_state(index_buf_state_t::DIRTY);
         m_dirty_buf_count.increment(1);
+
+        // If the trickle queue is full, buffer will be flushed as part of CP flush
+        if (m_trickle_q) { m_trickle_q->write(buf); }
     }
 
+    // Number of dirty buffers waiting to be picked up by trickle flush
+    uint64_t trickle_pending() const { return m_trickle_q ? std::max(m_trickle_q->sizeGuess(), ssize_t{0}) : 0; }
+
     bool any_dirty_buffers() const { return !m_dirty_buf_count.testz(); }
 
     void prepare_flush_iteration() { m_dirty_buf_it = m_dirty_buf_list.begin(); }
@@ -165,6 +197,7 @@ public:
     folly::Future< bool > cp_flush(CP* cp) override;
     void cp_cleanup(CP* cp) override;
     int cp_progress_percent() override;
+    uint64_t cp_dirty_bytes(CP* cp) override;
 
 private:
     IndexWBCache* m_wb_cache;
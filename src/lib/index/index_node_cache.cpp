@@ -0,0 +1,247 @@
+/*********************************************************************************
+ * Modifications Copyright 2017-2019 eBay Inc.
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *    https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ *********************************************************************************/
+#include <homestore/btree/detail/btree_node.hpp>
+#include "index/index_node_cache.hpp"
+#include "common/homestore_assert.hpp"
+
+namespace homestore {
+
+IndexNodeCache::IndexNodeCache(uint64_t max_size, uint32_t node_size, uint32_t num_shards) {
+    num_shards = std::max(num_shards, 1u);
+    m_shard_capacity = std::max(max_size / node_size / num_shards, uint64_cast(1));
+    m_shards.reserve(num_shards);
+    for (uint32_t i{0}; i < num_shards; ++i) {
+        m_shards.emplace_back(std::make_unique< CacheShard >());
+    }
+}
+
+bool IndexNodeCache::insert(const BtreeNodePtr& node) {
+    auto const blkid = blkid_of(node);
+    auto& shard = shard_of(blkid);
+
+    std::unique_lock lg(shard.m_mtx);
+    if (shard.m_entries.count(blkid)) { return false; }
+    insert_locked(shard, blkid, node);
+    evict_locked(shard);
+    return true;
+}
+
+void IndexNodeCache::upsert(const BtreeNodePtr& node) {
+    auto const blkid = blkid_of(node);
+    auto& shard = shard_of(blkid);
+
+    std::unique_lock lg(shard.m_mtx);
+    auto it = shard.m_entries.find(blkid);
+    if (it == shard.m_entries.end()) {
+        insert_locked(shard, blkid, node);
+        evict_locked(shard);
+    } else {
+        auto& entry = it->second;
+        entry.m_node = node;
+        entry.m_level = node->level();
+        entry.m_freq = std::min(static_cast< uint8_t >(entry.m_freq + 1), max_freq(entry.m_level));
+    }
+}
+
+bool IndexNodeCache::get(BlkId const& blkid, BtreeNodePtr& out_node) {
+    auto& shard = shard_of(blkid);
+    uint16_t level;
+    {
+        std::unique_lock lg(shard.m_mtx);
+        auto it = shard.m_entries.find(blkid);
+        if (it == shard.m_entries.end()) { return false; }
+
+        auto& entry = it->second;
+        entry.m_freq = std::min(static_cast< uint8_t >(entry.m_freq + 1), max_freq(entry.m_level));
+        out_node = entry.m_node;
+        level = entry.m_level;
+    }
+    record_hit(level);
+    return true;
+}
+
+bool IndexNodeCache::remove(BlkId const& blkid, BtreeNodePtr& out_node) {
+    auto& shard = shard_of(blkid);
+
+    std::unique_lock lg(shard.m_mtx);
+    auto it = shard.m_entries.find(blkid);
+    if (it == shard.m_entries.end()) { return false; }
+
+    auto& entry = it->second;
+    out_node = std::move(entry.m_node);
+    ((entry.m_queue == cache_queue_t::SMALL) ? shard.m_small_q : shard.m_main_q).erase(entry.m_it);
+    shard.m_entries.erase(it);
+    return true;
+}
+
+bool IndexNodeCache::contains(BlkId const& blkid) {
+    auto& shard = shard_of(blkid);
+    std::unique_lock lg(shard.m_mtx);
+    return (shard.m_entries.count(blkid) != 0);
+}
+
+bool IndexNodeCache::peek(BlkId const& blkid, BtreeNodePtr& out_node) {
+    auto& shard = shard_of(blkid);
+    std::unique_lock lg(shard.m_mtx);
+    auto it = shard.m_entries.find(blkid);
+    if (it == shard.m_entries.end()) { return false; }
+    out_node = it->second.m_node;
+    return true;
+}
+
+void IndexNodeCache::record_miss(const BtreeNodePtr& node) {
+    switch (node->level()) {
+    case 0:
+        COUNTER_INCREMENT(m_metrics, idx_cache_leaf_misses, 1);
+        break;
+    case 1:
+        COUNTER_INCREMENT(m_metrics, idx_cache_l1_misses, 1);
+        break;
+    case 2:
+        COUNTER_INCREMENT(m_metrics, idx_cache_l2_misses, 1);
+        break;
+    default:
+        COUNTER_INCREMENT(m_metrics, idx_cache_upper_misses, 1);
+        break;
+    }
+}
+
+void IndexNodeCache::record_hit(uint16_t level) {
+    switch (level) {
+    case 0:
+        COUNTER_INCREMENT(m_metrics, idx_cache_leaf_hits, 1);
+        break;
+    case 1:
+        COUNTER_INCREMENT(m_metrics, idx_cache_l1_hits, 1);
+        break;
+    case 2:
+        COUNTER_INCREMENT(m_metrics, idx_cache_l2_hits, 1);
+        break;
+    default:
+        COUNTER_INCREMENT(m_metrics, idx_cache_upper_hits, 1);
+        break;
+    }
+}
+
+IndexNodeCache::CacheShard& IndexNodeCache::shard_of(BlkId const& blkid) {
+    return *m_shards[std::hash< BlkId >()(blkid) % m_shards.size()];
+}
+
+void IndexNodeCache::insert_locked(CacheShard& shard, BlkId const& blkid, const BtreeNodePtr& node) {
+    CacheEntry entry;
+    entry.m_node = node;
+    entry.m_level = node->level();
+
+    auto git = shard.m_ghost_map.find(blkid);
+    if (git != shard.m_ghost_map.end()) {
+        // Evicted recently and needed again, it was evicted prematurely. Skip the probation this time
+        shard.m_ghost_q.erase(git->second);
+        shard.m_ghost_map.erase(git);
+        entry.m_queue = cache_queue_t::MAIN;
+        COUNTER_INCREMENT(m_metrics, idx_cache_ghost_hits, 1);
+    } else if (entry.m_level > 0) {
+        // Interior nodes are shared by all lookups underneath them, no need to put them on probation
+        entry.m_queue = cache_queue_t::MAIN;
+        entry.m_freq = 1;
+    }
+
+    auto& q = (entry.m_queue == cache_queue_t::SMALL) ? shard.m_small_q : shard.m_main_q;
+    q.push_front(blkid);
+    entry.m_it = q.begin();
+    shard.m_entries.emplace(blkid, std::move(entry));
+}
+
+void IndexNodeCache::evict_locked(CacheShard& shard) {
+    // Bound the attempts, in case most of the nodes are in use or dirty and hence can't be evicted. In that case we
+    // let the shard stay above capacity until the nodes are released, subsequent inserts continue from where this one
+    // has stopped rotating the queues.
+    auto attempts = s_max_evict_attempts;
+    while ((shard.m_entries.size() > m_shard_capacity) && (attempts-- > 0)) {
+        if (!shard.m_small_q.empty() &&
+            ((shard.m_small_q.size() * 100 >= m_shard_capacity * s_small_queue_pct) || shard.m_main_q.empty())) {
+            evict_from_small(shard);
+        } else {
+            evict_from_main(shard);
+        }
+    }
+}
+
+void IndexNodeCache::evict_from_small(CacheShard& shard) {
+    auto const blkid = shard.m_small_q.back();
+    shard.m_small_q.pop_back();
+
+    auto it = shard.m_entries.find(blkid);
+    HS_DBG_ASSERT(it != shard.m_entries.end(), "Index cache queue and entries are out of sync");
+    auto& entry = it->second;
+
+    if ((entry.m_freq > 0) || !is_evictable(entry.m_node)) {
+        // Accessed again during probation (or can't be evicted now), move to the main queue
+        if (entry.m_freq > 0) { COUNTER_INCREMENT(m_metrics, idx_cache_promotions, 1); }
+        entry.m_freq = 0;
+        entry.m_queue = cache_queue_t::MAIN;
+        shard.m_main_q.push_front(blkid);
+        entry.m_it = shard.m_main_q.begin();
+        return;
+    }
+
+    shard.m_entries.erase(it);
+    add_to_ghost(shard, blkid);
+    COUNTER_INCREMENT(m_metrics, idx_cache_evictions, 1);
+}
+
+void IndexNodeCache::evict_from_main(CacheShard& shard) {
+    auto const blkid = shard.m_main_q.back();
+    shard.m_main_q.pop_back();
+
+    auto it = shard.m_entries.find(blkid);
+    HS_DBG_ASSERT(it != shard.m_entries.end(), "Index cache queue and entries are out of sync");
+    auto& entry = it->second;
+
+    bool const evictable = is_evictable(entry.m_node);
+    if ((entry.m_freq > 0) || !evictable) {
+        // Give it another round
+        if (entry.m_freq > 0) { --entry.m_freq; }
+        if (!evictable) { COUNTER_INCREMENT(m_metrics, idx_cache_evict_skips, 1); }
+        shard.m_main_q.push_front(blkid);
+        entry.m_it = shard.m_main_q.begin();
+        return;
+    }
+
+    shard.m_entries.erase(it);
+    COUNTER_INCREMENT(m_metrics, idx_cache_evictions, 1);
+}
+
+void IndexNodeCache::add_to_ghost(CacheShard& shard, BlkId const& blkid) {
+    shard.m_ghost_q.push_front(blkid);
+    shard.m_ghost_map[blkid] = shard.m_ghost_q.begin();
+
+    // Ghost queue remembers roughly as many nodes as the main queue could hold
+    while (shard.m_ghost_q.size() > m_shard_capacity) {
+        shard.m_ghost_map.erase(shard.m_ghost_q.back());
+        shard.m_ghost_q.pop_back();
+    }
+}
+
+BlkId IndexNodeCache::blkid_of(const BtreeNodePtr& node) {
+    return IndexBtreeNode::convert(node.get())->m_idx_buf->m_blkid;
+}
+
+bool IndexNodeCache::is_evictable(const BtreeNodePtr& node) {
+    // Cache itself holds one reference, anything more means someone is using the node. Dirty nodes are not yet
+    // persisted, evicting them would let a subsequent read load stale contents from the device.
+    return node->m_refcount.test_le(1) && IndexBtreeNode::convert(node.get())->m_idx_buf->is_clean();
+}
+} // namespace homestore
@@ -0,0 +1,144 @@
+/*********************************************************************************
+ * Modifications Copyright 2017-2019 eBay Inc.
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *    https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ *********************************************************************************/
+#pragma once
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <sisl/metrics/metrics.hpp>
+#include <homestore/blk.h>
+#include <homestore/index/index_internal.hpp>
+
+namespace homestore {
+
+class IndexNodeCacheMetrics : public sisl::MetricsGroup {
+public:
+    explicit IndexNodeCacheMetrics() : sisl::MetricsGroup("IndexNodeCache", "index_node_cache") {
+        REGISTER_COUNTER(idx_cache_leaf_hits, "Index cache hits on leaf nodes", "idx_cache_hits", {"level", "0"});
+        REGISTER_COUNTER(idx_cache_l1_hits, "Index cache hits on level 1 nodes", "idx_cache_hits", {"level", "1"});
+        REGISTER_COUNTER(idx_cache_l2_hits, "Index cache hits on level 2 nodes", "idx_cache_hits", {"level", "2"});
+        REGISTER_COUNTER(idx_cache_upper_hits, "Index cache hits on level 3 and above", "idx_cache_hits",
+                         {"level", "3+"});
+        REGISTER_COUNTER(idx_cache_leaf_misses, "Index cache misses on leaf nodes", "idx_cache_misses",
+                         {"level", "0"});
+        REGISTER_COUNTER(idx_cache_l1_misses, "Index cache misses on level 1 nodes", "idx_cache_misses",
+                         {"level", "1"});
+        REGISTER_COUNTER(idx_cache_l2_misses, "Index cache misses on level 2 nodes", "idx_cache_misses",
+                         {"level", "2"});
+        REGISTER_COUNTER(idx_cache_upper_misses, "Index cache misses on level 3 and above", "idx_cache_misses",
+                         {"level", "3+"});
+        REGISTER_COUNTER(idx_cache_evictions, "Number of nodes evicted from index cache");
+        REGISTER_COUNTER(idx_cache_promotions, "Number of nodes promoted from probation to main queue");
+        REGISTER_COUNTER(idx_cache_ghost_hits, "Number of nodes reloaded shortly after eviction");
+        REGISTER_COUNTER(idx_cache_evict_skips, "Number of times eviction skipped an in-use or dirty node");
+        REGISTER_COUNTER(idx_cache_read_joins, "Number of cache misses which joined a read already in flight");
+        REGISTER_COUNTER(idx_cache_prefetch_reads, "Number of node reads issued ahead by prefetch");
+        register_me_to_farm();
+    }
+
+    IndexNodeCacheMetrics(const IndexNodeCacheMetrics&) = delete;
+    IndexNodeCacheMetrics(IndexNodeCacheMetrics&&) noexcept = delete;
+    IndexNodeCacheMetrics& operator=(const IndexNodeCacheMetrics&) = delete;
+    IndexNodeCacheMetrics& operator=(IndexNodeCacheMetrics&&) noexcept = delete;
+    ~IndexNodeCacheMetrics() { deregister_me_from_farm(); }
+};
+
+/*
+ * IndexNodeCache: Sharded cache of btree nodes keyed by the blkid they are persisted in. Each shard runs a S3-FIFO
+ * replacement policy, which is resistant to large scans:
+ *
+ * - A node seen for the first time lands in a small probation queue. Nodes which are not accessed again by the time
+ *   they reach the tail of the probation queue are evicted (remembered in a ghost queue), so a range query or a tree
+ *   traversal touching every leaf once cannot flush out the working set.
+ * - Nodes which are accessed again while in probation, or which are reloaded while their ghost entry is still
+ *   around, are moved to the main queue. Main queue evicts with a CLOCK like second chance based on access frequency.
+ * - Interior nodes skip probation and get a higher frequency cap, so they survive scans and stay resident across
+ *   point lookups (each lookup ideally costs one io for the leaf).
+ *
+ * Nodes which are in use by someone (refcount beyond the cache's own reference) or which are dirty are never
+ * evicted, they are rotated back to the main queue.
+ */
+class IndexNodeCache {
+private:
+    static constexpr uint32_t s_small_queue_pct{10};
+    static constexpr uint8_t s_max_leaf_freq{3};
+    static constexpr uint8_t s_max_interior_freq{7};
+    static constexpr uint32_t s_max_evict_attempts{16}; // Max nodes evicted or rotated per insert
+
+    enum class cache_queue_t : uint8_t { SMALL, MAIN };
+
+    struct CacheEntry {
+        BtreeNodePtr m_node;
+        std::list< BlkId >::iterator m_it;
+        cache_queue_t m_queue{cache_queue_t::SMALL};
+        uint8_t m_freq{0};
+        uint16_t m_level{0};
+    };
+
+    struct CacheShard {
+        std::mutex m_mtx;
+        std::unordered_map< BlkId, CacheEntry > m_entries;
+        std::list< BlkId > m_small_q; // Front is the most recent insert
+        std::list< BlkId > m_main_q;
+        std::list< BlkId > m_ghost_q;
+        std::unordered_map< BlkId, std::list< BlkId >::iterator > m_ghost_map;
+    };
+
+    std::vector< std::unique_ptr< CacheShard > > m_shards;
+    uint64_t m_shard_capacity; // Number of nodes per shard
+    IndexNodeCacheMetrics m_metrics;
+
+public:
+    IndexNodeCache(uint64_t max_size, uint32_t node_size, uint32_t num_shards);
+
+    bool insert(const BtreeNodePtr& node);
+    void upsert(const BtreeNodePtr& node);
+    bool get(BlkId const& blkid, BtreeNodePtr& out_node);
+    bool remove(BlkId const& blkid, BtreeNodePtr& out_node);
+
+    /// @brief Check if the node is in cache, without treating it as an access (no stats and no change in priority)
+    bool contains(BlkId const& blkid);
+
+    /// @brief Get the node without treating it as an access, used by background activities on the cache.
+    bool peek(BlkId const& blkid, BtreeNodePtr& out_node);
+
+    /// @brief Record that the node had to be loaded from device because it was not in cache
+    void record_miss(const BtreeNodePtr& node);
+
+    /// @brief Record that a miss is served by waiting on a read of the node which someone else has issued
+    void record_read_join() { COUNTER_INCREMENT(m_metrics, idx_cache_read_joins, 1); }
+
+    /// @brief Record that a node is being read ahead of its access
+    void record_prefetch() { COUNTER_INCREMENT(m_metrics, idx_cache_prefetch_reads, 1); }
+
+    nlohmann::json get_metrics_in_json() { return m_metrics.get_result_in_json(true); }
+
+private:
+    CacheShard& shard_of(BlkId const& blkid);
+    void insert_locked(CacheShard& shard, BlkId const& blkid, const BtreeNodePtr& node);
+    void evict_locked(CacheShard& shard);
+    void evict_from_small(CacheShard& shard);
+    void evict_from_main(CacheShard& shard);
+    void add_to_ghost(CacheShard& shard, BlkId const& blkid);
+    void record_hit(uint16_t level);
+
+    static BlkId blkid_of(const BtreeNodePtr& node);
+    static bool is_evictable(const BtreeNodePtr& node);
+    static uint8_t max_freq(uint16_t level) { return (level == 0) ? s_max_leaf_freq : s_max_interior_freq; }
+};
+} // namespace homestore
@@ -20,6 +20,7 @@
 #include "index/index_cp.hpp"
 #include "common/homestore_utils.hpp"
 #include "common/homestore_assert.hpp"
+#include "common/resource_mgr.hpp"
 #include "device/virtual_dev.hpp"
 #include "device/physical_dev.hpp"
 #include "device/chunk.h"
@@ -34,6 +35,13 @@ IndexService::IndexService(std::unique_ptr< IndexServiceCallbacks > cbs) : m_svc
             meta_blk_found(std::move(buf), voidptr_cast(mblk));
         },
         nullptr);
+    meta_service().register_handler(
+        "index_cp_journal",
+        [this](meta_blk* mblk, sisl::byte_view buf, size_t size) {
+            m_cp_journal_buf = std::move(buf);
+            m_cp_journal_cookie = voidptr_cast(mblk);
+        },
+        nullptr);
 }
 
 void IndexService::create_vdev(uint64_t size, uint32_t num_chunks) {
@@ -68,12 +76,30 @@ void IndexService::meta_blk_found(const sisl::byte_view& buf, void* meta_cookie)
 
 void IndexService::start() {
     // Start Writeback cache
-    m_wb_cache = std::make_unique< IndexWBCache >(m_vdev, hs()->evictor(),
+    m_wb_cache = std::make_unique< IndexWBCache >(m_vdev, resource_mgr().get_cache_size(),
                                                   hs()->device_mgr()->atomic_page_size(HSDevType::Fast));
 
     // Register to CP for flush dirty buffers
     hs()->cp_mgr().register_consumer(cp_consumer_t::INDEX_SVC,
                                      std::move(std::make_unique< IndexCPCallbacks >(m_wb_cache.get())));
+
+    repair_indexes();
+}
+
+void IndexService::repair_indexes() {
+    if (m_cp_journal_cookie == nullptr) { return; } // No CP was flushed since the vdev is created
+
+    auto table_nodes =
+        s_cast< IndexWBCache* >(m_wb_cache.get())->load_cp_journal(m_cp_journal_buf, m_cp_journal_cookie);
+    m_cp_journal_buf = sisl::byte_view{};
+    m_cp_journal_cookie = nullptr;
+
+    std::unique_lock lg(m_index_map_mtx);
+    for (auto const& [uuid, nodes] : table_nodes) {
+        auto it = m_index_map.find(uuid);
+        if (it == m_index_map.end()) { continue; } // Index destroyed after the cp
+        it->second->repair_nodes(nodes);
+    }
 }
 
 void IndexService::stop() {
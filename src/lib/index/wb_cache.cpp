@@ -14,6 +14,7 @@
  *
  *********************************************************************************/
 #include <sisl/fds/thread_vector.hpp>
+#include <iomgr/iomgr_flip.hpp>
 #include <homestore/btree/detail/btree_node.hpp>
 #include <homestore/index_service.hpp>
 #include <homestore/homestore.hpp>
@@ -31,16 +32,9 @@ namespace homestore {
 
 IndexWBCacheBase& wb_cache() { return index_service().wb_cache(); }
 
-IndexWBCache::IndexWBCache(const std::shared_ptr< VirtualDev >& vdev, const std::shared_ptr< sisl::Evictor >& evictor,
-                           uint32_t node_size) :
+IndexWBCache::IndexWBCache(const std::shared_ptr< VirtualDev >& vdev, uint64_t cache_size, uint32_t node_size) :
         m_vdev{vdev},
-        m_cache{
-            evictor, 100000, node_size,
-            [](const BtreeNodePtr& node) -> BlkId { return IndexBtreeNode::convert(node.get())->m_idx_buf->m_blkid; },
-            [](const sisl::CacheRecord& rec) -> bool {
-                const auto& hnode = (sisl::SingleEntryHashNode< BtreeNodePtr >&)rec;
-                return (hnode.m_value->m_refcount.test_le(1));
-            }},
+        m_cache{cache_size, node_size, HS_DYNAMIC_CONFIG(cache.num_evictor_partitions)},
         m_node_size{node_size} {
     start_flush_threads();
 }
@@ -102,8 +96,10 @@ void IndexWBCache::realloc_buf(const IndexBufferPtr& buf) {
 void IndexWBCache::write_buf(const BtreeNodePtr& node, const IndexBufferPtr& buf, CPContext* cp_ctx) {
     // TODO upsert always returns false even if it succeeds.
     m_cache.upsert(node);
-    r_cast< IndexCPContext* >(cp_ctx)->add_to_dirty_list(buf);
+    auto idx_cp_ctx = r_cast< IndexCPContext* >(cp_ctx);
+    idx_cp_ctx->add_to_dirty_list(buf);
     resource_mgr().inc_dirty_buf_size(m_node_size);
+    maybe_trickle_flush(idx_cp_ctx);
 }
 
 IndexBufferPtr IndexWBCache::copy_buffer(const IndexBufferPtr& cur_buf, const CPContext* cp_ctx) const {
@@ -111,8 +107,10 @@ IndexBufferPtr IndexWBCache::copy_buffer(const IndexBufferPtr& cur_buf, const CP
     bool copied = false;
 
     // When we copy the buffer we check if the node buffer is clean or not. If its clean
-    // we could reuse it otherwise create a copy.
-    if (cur_buf->is_clean()) {
+    // we could reuse it otherwise create a copy. If a snapshot retains the current buffer, it should not be modified
+    // either, so create a copy.
+    bool const preserved = preserve_for_snapshots(cur_buf, cp_ctx->id());
+    if (cur_buf->is_clean() && !preserved) {
         // Refer to the same node buffer.
         new_buf = std::make_shared< IndexBuffer >(cur_buf->m_node_buf, cur_buf->m_blkid);
     } else {
@@ -121,6 +119,7 @@ IndexBufferPtr IndexWBCache::copy_buffer(const IndexBufferPtr& cur_buf, const CP
         std::memcpy(new_buf->raw_buffer(), cur_buf->raw_buffer(), m_node_size);
         copied = true;
     }
+    new_buf->m_index_uuid = cur_buf->m_index_uuid;
 
     LOGTRACEMOD(wbcache, "cp {} new_buf {} cur_buf {} cur_buf_blkid {} copied {}", cp_ctx->id(),
                 static_cast< void* >(new_buf.get()), static_cast< void* >(cur_buf.get()), cur_buf->m_blkid.to_integer(),
@@ -131,25 +130,102 @@ IndexBufferPtr IndexWBCache::copy_buffer(const IndexBufferPtr& cur_buf, const CP
 void IndexWBCache::read_buf(bnodeid_t id, BtreeNodePtr& node, node_initializer_t&& node_initializer) {
     auto const blkid = BlkId{id};
 
-retry:
     // Check if the blkid is already in cache, if not load and put it into the cache
     if (m_cache.get(blkid, node)) { return; }
 
-    // Read the buffer from virtual device
-    auto idx_buf = std::make_shared< IndexBuffer >(blkid, m_node_size, m_vdev->align_size());
-    auto raw_buf = idx_buf->raw_buffer();
+    // Join the read if someone else is already reading this blkid, otherwise issue one ourselves. Either way the
+    // fiber is parked until the read completes, instead of blocking the reactor on a sync read.
+    shared< IndexReadCtx > read_ctx;
+    bool issue_read{false};
+    {
+        std::unique_lock lg(m_read_mtx);
+        auto [it, happened] = m_inflight_reads.try_emplace(blkid, nullptr);
+        if (happened) {
+            it->second = std::make_shared< IndexReadCtx >(blkid, m_node_size, m_vdev->align_size(),
+                                                          std::move(node_initializer));
+            issue_read = true;
+        }
+        read_ctx = it->second;
+    }
+
+    if (issue_read) {
+        do_read_one_buf(read_ctx, false /* part_of_batch */);
+    } else {
+        m_cache.record_read_join();
+    }
+    read_ctx->m_future.wait();
 
-    m_vdev->sync_read(r_cast< char* >(raw_buf), m_node_size, blkid);
+    if (read_ctx->m_err) {
+        throw std::system_error(read_ctx->m_err, fmt::format("Index node read failed for blkid={}", blkid.to_string()));
+    }
+    node = read_ctx->m_node;
+}
 
-    // Create the btree node out of buffer
-    node = node_initializer(idx_buf);
+void IndexWBCache::prefetch_bufs(std::vector< bnodeid_t > const& ids, node_initializer_t&& node_initializer) {
+    auto const max_inflight = HS_DYNAMIC_CONFIG(btree.max_inflight_prefetch_reads);
+    bool issued{false};
 
-    // Push the node into cache
-    bool done = m_cache.insert(node);
-    if (!done) {
-        // There is a race between 2 concurrent reads from vdev and other party won the race. Re-read from cache
-        goto retry;
+    for (auto const id : ids) {
+        auto const blkid = BlkId{id};
+
+        if (m_cache.contains(blkid)) { continue; }
+
+        shared< IndexReadCtx > read_ctx;
+        {
+            std::unique_lock lg(m_read_mtx);
+            if (m_inflight_reads.size() >= max_inflight) { break; }
+
+            auto [it, happened] = m_inflight_reads.try_emplace(blkid, nullptr);
+            if (!happened) { continue; } // Already being read
+            it->second =
+                std::make_shared< IndexReadCtx >(blkid, m_node_size, m_vdev->align_size(), node_initializer);
+            it->second->m_is_prefetch = true;
+            read_ctx = it->second;
+        }
+        m_cache.record_prefetch();
+        do_read_one_buf(std::move(read_ctx), true /* part_of_batch */);
+        issued = true;
+    }
+
+    if (issued) { m_vdev->submit_batch(); }
+}
+
+void IndexWBCache::do_read_one_buf(shared< IndexReadCtx > read_ctx, bool part_of_batch) {
+    auto& idx_buf = read_ctx->m_idx_buf;
+    LOGTRACEMOD(wbcache, "reading buf {} part_of_batch {}", idx_buf->to_string(), part_of_batch);
+
+    m_vdev->async_read(r_cast< char* >(idx_buf->raw_buffer()), m_node_size, idx_buf->m_blkid, part_of_batch)
+        .thenValue([read_ctx](auto&& err) {
+            auto& pthis = s_cast< IndexWBCache& >(wb_cache()); // Avoiding more than 16 bytes capture
+            pthis.process_read_completion(read_ctx, err);
+        });
+
+    if (!part_of_batch) { m_vdev->submit_batch(); }
+}
+
+void IndexWBCache::process_read_completion(const shared< IndexReadCtx >& read_ctx, std::error_code err) {
+    auto const blkid = read_ctx->m_idx_buf->m_blkid;
+    if (err) {
+        LOGERRORMOD(wbcache, "Read of index buf blkid={} failed, error={}", blkid.to_string(), err.message());
+        read_ctx->m_err = err;
+    } else {
+        // Create the btree node out of buffer and push the node into cache
+        auto node = read_ctx->m_node_initializer(read_ctx->m_idx_buf);
+        if (!read_ctx->m_is_prefetch) { m_cache.record_miss(node); }
+        if (!m_cache.insert(node)) {
+            // Someone who missed the in-flight read window has loaded the node already, prefer the cached copy
+            BtreeNodePtr cached_node;
+            if (m_cache.get(blkid, cached_node)) { node = std::move(cached_node); }
+        }
+        read_ctx->m_node = std::move(node);
     }
+    read_ctx->m_node_initializer = nullptr;
+
+    {
+        std::unique_lock lg(m_read_mtx);
+        m_inflight_reads.erase(blkid);
+    }
+    read_ctx->m_promise.set_value();
 }
 
 std::pair< bool, bool > IndexWBCache::create_chain(IndexBufferPtr& second, IndexBufferPtr& third, CPContext* cp_ctx) {
@@ -194,6 +270,7 @@ void IndexWBCache::prepend_to_chain(const IndexBufferPtr& first, const IndexBuff
 }
 
 void IndexWBCache::free_buf(const IndexBufferPtr& buf, CPContext* cp_ctx) {
+    preserve_for_snapshots(buf, cp_ctx->id());
     BtreeNodePtr node;
     bool done = m_cache.remove(buf->m_blkid, node);
     HS_REL_ASSERT_EQ(done, true, "Race on cache removal of btree blkid?");
@@ -202,7 +279,134 @@ void IndexWBCache::free_buf(const IndexBufferPtr& buf, CPContext* cp_ctx) {
     m_vdev->free_blk(buf->m_blkid, s_cast< VDevCPContext* >(cp_ctx));
 }
 
+void IndexWBCache::register_snapshot(const IndexSnapshotPtr& snap) {
+    std::unique_lock lg(m_snap_mtx);
+    m_snapshots.emplace_back(snap);
+    m_num_snapshots.store(m_snapshots.size());
+}
+
+bool IndexWBCache::preserve_for_snapshots(const IndexBufferPtr& buf, cp_id_t cp_id) const {
+    if (m_num_snapshots.load() == 0) { return false; }
+
+    bool preserved{false};
+    std::unique_lock lg(m_snap_mtx);
+    for (auto it = m_snapshots.begin(); it != m_snapshots.end();) {
+        auto snap = it->lock();
+        if (snap == nullptr) {
+            it = m_snapshots.erase(it); // Snapshot released
+            continue;
+        }
+        // Modifications within the snapshot cp itself are part of the snapshot
+        if ((snap->m_cp_id < cp_id) && (snap->m_index_uuid == buf->m_index_uuid)) {
+            snap->preserve(buf);
+            preserved = true;
+        }
+        ++it;
+    }
+    m_num_snapshots.store(m_snapshots.size());
+    return preserved;
+}
+
 //////////////////// CP Related API section /////////////////////////////////
+void IndexWBCache::maybe_trickle_flush(IndexCPContext* cp_ctx) {
+    if (cp_ctx->trickle_pending() <= HS_DYNAMIC_CONFIG(generic.index_trickle_flush_threshold)) { return; }
+
+    bool expected{false};
+    if (!m_trickle_in_progress.compare_exchange_strong(expected, true)) { return; }
+
+    // Hold the CP in critical section till the trickle writes are completed, so that CP flush doesn't start while
+    // they are in progress. Trickle only if the CP is still taking IOs, it is pointless once CP is triggered.
+    auto cp = hs()->cp_mgr().cp_io_enter();
+    if ((cp != cp_ctx->cp()) || (cp->get_status() != cp_status_t::cp_io_ready)) {
+        if (cp) { hs()->cp_mgr().cp_io_exit(cp); }
+        m_trickle_in_progress = false;
+        return;
+    }
+
+    auto const idx = m_trickle_fiber_idx.fetch_add(1, std::memory_order_relaxed) % m_cp_flush_fibers.size();
+    iomanager.run_on_forget(m_cp_flush_fibers[idx], [this, cp, cp_ctx]() { trickle_flush(cp, cp_ctx); });
+}
+
+void IndexWBCache::trickle_flush(CP* cp, IndexCPContext* cp_ctx) {
+    struct TrickleRound {
+        CP* cp;
+        std::vector< std::pair< IndexBufferPtr, int64_t > > bufs;
+        sisl::atomic_counter< int32_t > pending{0};
+    };
+    auto round = std::make_shared< TrickleRound >();
+    round->cp = cp;
+
+    auto const threshold = HS_DYNAMIC_CONFIG(generic.index_trickle_flush_threshold);
+    auto const batch = HS_DYNAMIC_CONFIG(generic.index_trickle_flush_batch);
+
+    // Pick the oldest dirty buffers which are not part of a split or merge chain. Snapshot them under node lock, so
+    // that we write a consistent version of the node.
+    std::vector< IndexBufferPtr > snapshots;
+    while ((snapshots.size() < batch) && (cp_ctx->trickle_pending() > threshold)) {
+        IndexBufferPtr buf;
+        if (!cp_ctx->m_trickle_q->read(buf)) { break; }
+        if (is_chained(buf) || (buf->state() != index_buf_state_t::DIRTY)) { continue; }
+
+        int64_t gen;
+        auto snap = trickle_snapshot(buf, gen);
+        if (snap == nullptr) { continue; }
+        round->bufs.emplace_back(std::move(buf), gen);
+        snapshots.emplace_back(std::move(snap));
+    }
+
+    if (snapshots.empty()) {
+        hs()->cp_mgr().cp_io_exit(cp);
+        m_trickle_in_progress = false;
+        return;
+    }
+
+    LOGTRACEMOD(wbcache, "cp {} trickle flushing {} bufs, pending={}", cp_ctx->id(), snapshots.size(),
+                cp_ctx->trickle_pending());
+    round->pending.set(s_cast< int32_t >(snapshots.size()));
+    for (size_t i{0}; i < snapshots.size(); ++i) {
+        auto& snap = snapshots[i];
+        m_vdev->async_write(r_cast< const char* >(snap->raw_buffer()), m_node_size, snap->m_blkid, true)
+            .thenValue([round, snap, i](auto&& err) {
+                auto& [buf, gen] = round->bufs[i];
+                auto& pthis = s_cast< IndexWBCache& >(wb_cache());
+                // On error, leave it to CP flush to write it again
+                if (!err) {
+                    buf->m_trickled_gen.store(gen);
+                    COUNTER_INCREMENT(pthis.m_metrics, idx_trickle_writes, 1);
+                }
+                if (round->pending.decrement_testz()) {
+                    hs()->cp_mgr().cp_io_exit(round->cp);
+                    pthis.m_trickle_in_progress = false;
+                }
+            });
+    }
+    m_vdev->submit_batch();
+}
+
+bool IndexWBCache::is_chained(const IndexBufferPtr& buf) {
+    // Nodes of a split or merge are written only by the CP flush, in the chain order and after the CP journal listing
+    // them is persisted. Writing any of them in place earlier could leave a torn split on crash, which the repair at
+    // start doesn't know of.
+    return (buf->m_next_buffer.lock() != nullptr) || !buf->m_wait_for_leaders.testz();
+}
+
+IndexBufferPtr IndexWBCache::trickle_snapshot(const IndexBufferPtr& buf, int64_t& out_gen) {
+    BtreeNodePtr node;
+    if (!m_cache.peek(buf->m_blkid, node)) { return nullptr; } // Node is freed already
+
+    auto snap = std::make_shared< IndexBuffer >(buf->m_blkid, m_node_size, m_vdev->align_size());
+    node->lock(locktype_t::READ);
+    if (is_chained(buf)) {
+        // Chained after it was picked, chains are formed under the node lock and hence it can't change after this
+        node->unlock(locktype_t::READ);
+        return nullptr;
+    }
+    out_gen = buf->m_modified_gen.get();
+    std::memcpy(snap->raw_buffer(), buf->raw_buffer(), m_node_size);
+    node->unlock(locktype_t::READ);
+    return snap;
+}
+
 
 folly::Future< bool > IndexWBCache::async_cp_flush(IndexCPContext* cp_ctx) {
     LOGTRACEMOD(wbcache, "cp_ctx {}", cp_ctx->to_string());
@@ -218,26 +422,98 @@ folly::Future< bool > IndexWBCache::async_cp_flush(IndexCPContext* cp_ctx) {
     // cp_ctx->check_cycle();
 #endif
 
-    cp_ctx->prepare_flush_iteration();
+    // Record the nodes we are going to write, before writing any of them, so that recovery can find the torn ones
+    persist_cp_journal(cp_ctx).thenValue([this, cp_ctx](bool) {
+        cp_ctx->prepare_flush_iteration();
+
+        for (auto& fiber : m_cp_flush_fibers) {
+            iomanager.run_on_forget(fiber, [this, cp_ctx]() {
+                static thread_local std::vector< IndexBufferPtr > t_buf_list;
+                t_buf_list.clear();
+                get_next_bufs(cp_ctx, resource_mgr().get_dirty_buf_qd(), t_buf_list);
+
+                for (auto& buf : t_buf_list) {
+                    do_flush_one_buf(cp_ctx, buf, true);
+                }
+                m_vdev->submit_batch();
+            });
+        }
+    });
+    return std::move(cp_ctx->get_future());
+}
 
-    for (auto& fiber : m_cp_flush_fibers) {
-        iomanager.run_on_forget(fiber, [this, cp_ctx]() {
-            static thread_local std::vector< IndexBufferPtr > t_buf_list;
-            t_buf_list.clear();
-            get_next_bufs(cp_ctx, resource_mgr().get_dirty_buf_qd(), t_buf_list);
+folly::Future< bool > IndexWBCache::persist_cp_journal(IndexCPContext* cp_ctx) {
+    std::map< uuid_t, std::vector< bnodeid_t > > table_nodes;
+    uint64_t num_nodes{0};
+    for (auto it = cp_ctx->m_dirty_buf_list.begin(); it != cp_ctx->m_dirty_buf_list.end(); ++it) {
+        table_nodes[(*it)->m_index_uuid].push_back((*it)->m_blkid.to_integer());
+        ++num_nodes;
+    }
 
-            for (auto& buf : t_buf_list) {
-                do_flush_one_buf(cp_ctx, buf, true);
-            }
-            m_vdev->submit_batch();
-        });
+    m_journal_sb.create(sizeof(index_cp_journal_sb) + (table_nodes.size() * sizeof(index_cp_journal_table)) +
+                        (num_nodes * sizeof(bnodeid_t)));
+    m_journal_sb->cp_id = cp_ctx->id();
+    m_journal_sb->num_tables = table_nodes.size();
+
+    uint8_t* cur = uintptr_cast(m_journal_sb.get()) + sizeof(index_cp_journal_sb);
+    for (auto const& [uuid, nodes] : table_nodes) {
+        auto tbl = new (cur) index_cp_journal_table();
+        tbl->uuid = uuid;
+        tbl->num_nodes = nodes.size();
+        cur += sizeof(index_cp_journal_table);
+        std::memcpy(cur, nodes.data(), nodes.size() * sizeof(bnodeid_t));
+        cur += nodes.size() * sizeof(bnodeid_t);
     }
-    return std::move(cp_ctx->get_future());
+    CP_PERIODIC_LOG(DEBUG, cp_ctx->id(), "Persisting index cp journal with {} nodes across {} indexes", num_nodes,
+                    table_nodes.size());
+    return m_journal_sb.async_write();
+}
+
+std::map< uuid_t, std::vector< bnodeid_t > > IndexWBCache::load_cp_journal(const sisl::byte_view& buf,
+                                                                           void* meta_cookie) {
+    std::map< uuid_t, std::vector< bnodeid_t > > table_nodes;
+    m_journal_sb.load(buf, meta_cookie);
+    if ((m_journal_sb->magic != index_cp_journal_magic) || (m_journal_sb->version != index_cp_journal_version)) {
+        LOGERRORMOD(wbcache, "Index cp journal is corrupted or of unsupported version, skipping repair");
+        return table_nodes;
+    }
+
+    auto const end = m_journal_sb.raw_buf()->cbytes() + m_journal_sb.size();
+    uint8_t const* cur = m_journal_sb.raw_buf()->cbytes() + sizeof(index_cp_journal_sb);
+    for (uint32_t i{0}; i < m_journal_sb->num_tables; ++i) {
+        if (cur + sizeof(index_cp_journal_table) > end) { break; }
+        auto tbl = r_cast< const index_cp_journal_table* >(cur);
+        cur += sizeof(index_cp_journal_table);
+        if (cur + (tbl->num_nodes * sizeof(bnodeid_t)) > end) { break; }
+
+        auto& nodes = table_nodes[tbl->uuid];
+        nodes.resize(tbl->num_nodes);
+        std::memcpy(nodes.data(), cur, tbl->num_nodes * sizeof(bnodeid_t));
+        cur += tbl->num_nodes * sizeof(bnodeid_t);
+    }
+    LOGINFOMOD(wbcache, "Loaded index cp journal of cp_id={} with {} indexes", m_journal_sb->cp_id,
+               table_nodes.size());
+    return table_nodes;
 }
 
 void IndexWBCache::do_flush_one_buf(IndexCPContext* cp_ctx, IndexBufferPtr buf, bool part_of_batch) {
     LOGTRACEMOD(wbcache, "cp {} buf {}", cp_ctx->id(), buf->to_string());
     buf->set_state(index_buf_state_t::FLUSHING);
+
+    if (buf->m_trickled_gen.load() == buf->m_modified_gen.get()) {
+        // Trickle flush has already written this version of the buffer, nothing more to write
+        COUNTER_INCREMENT(m_metrics, idx_cp_flush_trickled, 1);
+        process_write_completion(cp_ctx, buf);
+        return;
+    }
+#ifdef _PRERELEASE
+    if (simulate_crash_before_write(buf)) {
+        // Leave the device as if we crashed before writing this buffer, but let the CP go through
+        process_write_completion(cp_ctx, buf);
+        return;
+    }
+#endif
+    COUNTER_INCREMENT(m_metrics, idx_cp_flush_writes, 1);
     m_vdev->async_write(r_cast< const char* >(buf->raw_buffer()), m_node_size, buf->m_blkid, part_of_batch)
         .thenValue([buf, cp_ctx](auto) {
             auto& pthis = s_cast< IndexWBCache& >(wb_cache()); // Avoiding more than 16 bytes capture
@@ -247,6 +523,17 @@ void IndexWBCache::do_flush_one_buf(IndexCPContext* cp_ctx, IndexBufferPtr buf,
     if (!part_of_batch) { m_vdev->submit_batch(); }
 }
 
+#ifdef _PRERELEASE
+bool IndexWBCache::simulate_crash_before_write(const IndexBufferPtr& buf) {
+    // Crash right after the CP journal is persisted, with only the trickled nodes on disk
+    if (iomgr_flip::instance()->test_flip("index_cp_flush_crash_before_writes")) { return true; }
+
+    // Crash between the child and the parent writes of a leaf split, by dropping the writes of interior nodes
+    auto const hdr = r_cast< const persistent_hdr_t* >(buf->raw_buffer());
+    return !hdr->leaf && iomgr_flip::instance()->test_flip("index_cp_flush_crash_before_parent_writes");
+}
+#endif
+
 void IndexWBCache::process_write_completion(IndexCPContext* cp_ctx, IndexBufferPtr buf) {
     LOGTRACEMOD(wbcache, "cp {} buf {}", cp_ctx->id(), buf->to_string());
     resource_mgr().dec_dirty_buf_size(m_node_size);
@@ -258,8 +545,7 @@ void IndexWBCache::process_write_completion(IndexCPContext* cp_ctx, IndexBufferP
         // Pick a CP Manager blocking IO fiber to execute the cp flush of vdev
         iomanager.run_on_forget(hs()->cp_mgr().pick_blocking_io_fiber(), [this, cp_ctx]() {
             LOGTRACEMOD(wbcache, "Initiating CP flush");
-            m_vdev->cp_flush(cp_ctx); // This is a blocking io call
-            cp_ctx->complete(true);
+            m_vdev->cp_flush(cp_ctx).thenValue([cp_ctx](bool success) { cp_ctx->complete(success); });
         });
     }
 }
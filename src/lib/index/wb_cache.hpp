@@ -15,52 +15,117 @@
  *********************************************************************************/
 #pragma once
 #include <memory>
+#include <unordered_map>
 
+#include <boost/fiber/future.hpp>
+#include <sisl/metrics/metrics.hpp>
 #include <iomgr/iomgr.hpp>
 #include <homestore/index/wb_cache_base.hpp>
 #include <homestore/index/index_internal.hpp>
-#include <sisl/cache/simple_cache.hpp>
+#include <homestore/superblk_handler.hpp>
 #include "index/index_cp.hpp"
+#include "index/index_node_cache.hpp"
 
 namespace sisl {
 template < typename T >
 class ThreadVector;
-
-class Evictor;
 } // namespace sisl
 
 namespace homestore {
 class VirtualDev;
 
+// Node read which is in flight from the vdev. All readers of the same blkid, which missed the cache while the read is
+// in progress, wait on this instead of issuing their own read.
+struct IndexReadCtx {
+    IndexBufferPtr m_idx_buf;
+    node_initializer_t m_node_initializer;
+    BtreeNodePtr m_node;
+    std::error_code m_err;
+    bool m_is_prefetch{false};
+    boost::fibers::promise< void > m_promise;
+    boost::fibers::shared_future< void > m_future;
+
+    IndexReadCtx(BlkId const& blkid, uint32_t buf_size, uint32_t align_size, node_initializer_t initializer) :
+            m_idx_buf{std::make_shared< IndexBuffer >(blkid, buf_size, align_size)},
+            m_node_initializer{std::move(initializer)},
+            m_future{m_promise.get_future().share()} {}
+};
+
+class IndexWBCacheMetrics : public sisl::MetricsGroup {
+public:
+    explicit IndexWBCacheMetrics() : sisl::MetricsGroup("IndexWBCache", "index_wb_cache") {
+        REGISTER_COUNTER(idx_trickle_writes, "Number of dirty index nodes written ahead of CP flush");
+        REGISTER_COUNTER(idx_cp_flush_writes, "Number of dirty index nodes written by CP flush");
+        REGISTER_COUNTER(idx_cp_flush_trickled, "Number of dirty index nodes CP flush found already trickled");
+        register_me_to_farm();
+    }
+
+    IndexWBCacheMetrics(const IndexWBCacheMetrics&) = delete;
+    IndexWBCacheMetrics(IndexWBCacheMetrics&&) noexcept = delete;
+    IndexWBCacheMetrics& operator=(const IndexWBCacheMetrics&) = delete;
+    IndexWBCacheMetrics& operator=(IndexWBCacheMetrics&&) noexcept = delete;
+    ~IndexWBCacheMetrics() { deregister_me_from_farm(); }
+};
+
 class IndexWBCache : public IndexWBCacheBase {
 private:
     std::shared_ptr< VirtualDev > m_vdev;
-    sisl::SimpleCache< BlkId, BtreeNodePtr > m_cache;
+    IndexNodeCache m_cache;
+    IndexWBCacheMetrics m_metrics;
     uint32_t m_node_size;
 
     std::vector< iomgr::io_fiber_t > m_cp_flush_fibers;
     std::mutex m_flush_mtx;
 
+    std::mutex m_read_mtx;
+    std::unordered_map< BlkId, shared< IndexReadCtx > > m_inflight_reads;
+
+    std::atomic< bool > m_trickle_in_progress{false};
+    std::atomic< uint32_t > m_trickle_fiber_idx{0};
+
+    superblk< index_cp_journal_sb > m_journal_sb{"index_cp_journal"};
+
+    mutable std::mutex m_snap_mtx;
+    mutable std::vector< std::weak_ptr< IndexSnapshot > > m_snapshots;
+    mutable std::atomic< uint32_t > m_num_snapshots{0};
+
 public:
-    IndexWBCache(const std::shared_ptr< VirtualDev >& vdev, const std::shared_ptr< sisl::Evictor >& evictor,
-                 uint32_t node_size);
+    IndexWBCache(const std::shared_ptr< VirtualDev >& vdev, uint64_t cache_size, uint32_t node_size);
 
     BtreeNodePtr alloc_buf(node_initializer_t&& node_initializer) override;
     void realloc_buf(const IndexBufferPtr& buf) override;
     void write_buf(const BtreeNodePtr& node, const IndexBufferPtr& buf, CPContext* cp_ctx) override;
     void read_buf(bnodeid_t id, BtreeNodePtr& node, node_initializer_t&& node_initializer) override;
+    void prefetch_bufs(std::vector< bnodeid_t > const& ids, node_initializer_t&& node_initializer) override;
     std::pair< bool, bool > create_chain(IndexBufferPtr& second, IndexBufferPtr& third, CPContext* cp_ctx) override;
     void prepend_to_chain(const IndexBufferPtr& first, const IndexBufferPtr& second) override;
     void free_buf(const IndexBufferPtr& buf, CPContext* cp_ctx) override;
+    uint32_t node_size() const { return m_node_size; }
 
     //////////////////// CP Related API section /////////////////////////////////
     folly::Future< bool > async_cp_flush(IndexCPContext* context);
     IndexBufferPtr copy_buffer(const IndexBufferPtr& cur_buf, const CPContext *cp_ctx) const;
+    void register_snapshot(const IndexSnapshotPtr& snap) override;
+
+    //////////////////// Recovery API section /////////////////////////////////
+    /// @brief Load the CP journal found in meta blk and return the nodes dirtied in the last CP, grouped by index
+    std::map< uuid_t, std::vector< bnodeid_t > > load_cp_journal(const sisl::byte_view& buf, void* meta_cookie);
 
 private:
     void start_flush_threads();
+    folly::Future< bool > persist_cp_journal(IndexCPContext* cp_ctx);
+    bool preserve_for_snapshots(const IndexBufferPtr& buf, cp_id_t cp_id) const;
+    void maybe_trickle_flush(IndexCPContext* cp_ctx);
+    void trickle_flush(CP* cp, IndexCPContext* cp_ctx);
+    IndexBufferPtr trickle_snapshot(const IndexBufferPtr& buf, int64_t& out_gen);
+    static bool is_chained(const IndexBufferPtr& buf);
+    void do_read_one_buf(shared< IndexReadCtx > read_ctx, bool part_of_batch);
+    void process_read_completion(const shared< IndexReadCtx >& read_ctx, std::error_code err);
     void process_write_completion(IndexCPContext* cp_ctx, IndexBufferPtr pbuf);
     void do_flush_one_buf(IndexCPContext* cp_ctx, const IndexBufferPtr buf, bool part_of_batch);
+#ifdef _PRERELEASE
+    bool simulate_crash_before_write(const IndexBufferPtr& buf);
+#endif
     std::pair< IndexBufferPtr, bool > on_buf_flush_done(IndexCPContext* cp_ctx, IndexBufferPtr& buf);
     std::pair< IndexBufferPtr, bool > on_buf_flush_done_internal(IndexCPContext* cp_ctx, IndexBufferPtr& buf);
 
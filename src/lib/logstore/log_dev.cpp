@@ -357,10 +357,13 @@ bool LogDev::flush_if_needed(int64_t threshold_size) {
             return false;
         }
 
+        // seq_cst pairs with unlock_flush() and request_flush(), see there
         bool expected_flushing{false};
-        if (!m_is_flushing.compare_exchange_strong(expected_flushing, true, std::memory_order_acq_rel)) {
+        if (!m_is_flushing.compare_exchange_strong(expected_flushing, true, std::memory_order_seq_cst)) {
             return false;
         }
+        // This flush covers everything appended so far, which includes the records of all the requests made so far
+        m_flush_requested.store(false, std::memory_order_release);
         THIS_LOGDEV_LOG(TRACE,
                         "Flushing now because either pending_size={} is greater than data_threshold={} or "
                         "elapsed time since last flush={} us is greater than max_time_between_flush={} us",
@@ -392,6 +395,13 @@ bool LogDev::flush_if_needed(int64_t threshold_size) {
         do_flush(lg);
         return true;
     } else {
+        if ((pending_sz == 0) && m_flush_requested.load(std::memory_order_acquire)) {
+            // Everything appended so far is flushed or being flushed, which serves the requests made so far. Clear
+            // it, so that the later requests schedule a flush of their own instead of coalescing into nothing.
+            m_flush_requested.store(false, std::memory_order_release);
+            // Records could have been appended (and a flush requested for them) after we looked at the size
+            if (m_pending_flush_size.load(std::memory_order_relaxed) != 0) { return flush_if_needed(1); }
+        }
         return false;
     }
 }
@@ -509,12 +519,25 @@ void LogDev::unlock_flush(bool do_flush) {
         }
         sisl::VectorPool< flush_blocked_callback >::free(flush_q);
     }
-    m_is_flushing.store(false, std::memory_order_release);
+    // Unlocking the flush and checking for a request must not be reordered against request_flush() setting it and
+    // then trying to lock the flush, otherwise each side can miss the other and the request is lost. So all of these
+    // are seq_cst.
+    m_is_flushing.store(false, std::memory_order_seq_cst);
 
-    // Try to do chain flush if its really needed.
+    // Try to do chain flush if its really needed or if any log store requested a flush while this one was on.
     THIS_LOGDEV_LOG(TRACE, "Unlocked the flush, try doing chain flushing if needed");
     // send a message to see if a new flush can be triggered
-    if (do_flush) { flush_if_needed(); }
+    bool const flush_requested = m_flush_requested.load(std::memory_order_seq_cst);
+    if (do_flush || flush_requested) { flush_if_needed(flush_requested ? 1 : -1); }
+}
+
+void LogDev::request_flush() {
+    if (m_flush_requested.exchange(true, std::memory_order_seq_cst)) {
+        // Someone already requested, it will be served by the same flush
+        COUNTER_INCREMENT(logstore_service().m_metrics, logdev_coalesced_flush_requests, 1);
+        return;
+    }
+    iomanager.run_on_forget(logstore_service().flush_thread(), [this]() { flush_if_needed(1); });
 }
 
 uint64_t LogDev::truncate(const logdev_key& key) {
@@ -686,11 +709,15 @@ logstore_id_t LogDevMetadata::reserve_store(bool persist_now) {
 }
 
 void LogDevMetadata::persist() {
-    m_sb.write();
+    // Both the superblks are written as one batch of meta blk writes. This is called from the truncate fiber, which
+    // is parked till they are written.
+    std::vector< folly::Future< bool > > futs;
+    futs.emplace_back(m_sb.async_write());
     if (m_rollback_info_dirty) {
-        m_rollback_sb.write();
+        futs.emplace_back(m_rollback_sb.async_write());
         m_rollback_info_dirty = false;
     }
+    hs_utils::fiber_wait(folly::collectAllUnsafe(futs));
 }
 
 void LogDevMetadata::unreserve_store(logstore_id_t store_id, bool persist_now) {
@@ -760,6 +760,13 @@ public:
     void get_status(int verbosity, nlohmann::json& out_json) const;
     bool flush_if_needed(int64_t threshold_size = -1);
 
+    /**
+     * @brief Request a flush of whatever is appended so far, on the flush thread. Requests from all the log stores of
+     * this logdev (say thousands of raft groups sharing it), which arrive before the flush thread gets to them or while
+     * a flush is in progress, are served by a single flush.
+     */
+    void request_flush();
+
     bool is_aligned_buf_needed(size_t size) const {
         return (log_record::is_size_inlineable(size, m_flush_size_multiple) == false);
     }
@@ -802,6 +809,7 @@ private:
     std::atomic< logid_t > m_log_idx{0};            // Generator of log idx
     std::atomic< int64_t > m_pending_flush_size{0}; // How much flushable logs are pending
     std::atomic< bool > m_is_flushing{false}; // Is LogDev currently flushing (so far supports one flusher at a time)
+    std::atomic< bool > m_flush_requested{false}; // Is a flush requested by any log store, yet to be started
     bool m_stopped{false}; // Is Logdev stopped. We don't need lock here, because it is updated under flush lock
     logstore_family_id_t m_family_id; // The family id this logdev is part of
     JournalVirtualDev* m_vdev{nullptr};
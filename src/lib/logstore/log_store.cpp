@@ -186,6 +186,24 @@ void HomeLogStore::on_write_completion(logstore_req* req, const logdev_key& ld_k
         // Sync flush is waiting for this lsn to be completed, wake up the sync flush cv
         m_sync_flush_cv.notify_one();
     }
+
+    if (lsn >= m_min_flush_waiter_lsn.load()) {
+        // Some async flush is waiting upto this lsn, call all the waiters whose lsns are completed
+        std::vector< std::function< void() > > cbs;
+        {
+            std::unique_lock lk(m_sync_flush_mtx);
+            auto it = m_flush_waiters.begin();
+            while ((it != m_flush_waiters.end()) && !m_records.status(it->first).is_active) {
+                cbs.emplace_back(std::move(it->second));
+                it = m_flush_waiters.erase(it);
+            }
+            m_min_flush_waiter_lsn.store(m_flush_waiters.empty() ? std::numeric_limits< logstore_seq_num_t >::max()
+                                                                 : m_flush_waiters.begin()->first);
+        }
+        for (auto& cb : cbs) {
+            cb();
+        }
+    }
 }
 
 void HomeLogStore::on_read_completion(logstore_req* req, const logdev_key& ld_key) {
@@ -422,6 +440,25 @@ void HomeLogStore::flush_sync(logstore_seq_num_t upto_seq_num) {
     }
 }
 
+void HomeLogStore::flush_async(logstore_seq_num_t upto_seq_num, std::function< void() > cb) {
+    {
+        // Check and register under the lock, so that a completion in between doesn't miss calling the waiter
+        std::unique_lock lk(m_sync_flush_mtx);
+        if (m_records.status(upto_seq_num).is_active) {
+            m_flush_waiters.emplace(upto_seq_num, std::move(cb));
+            m_min_flush_waiter_lsn.store(m_flush_waiters.begin()->first);
+            cb = nullptr;
+        }
+    }
+
+    if (cb) {
+        // Flushed already
+        cb();
+    } else {
+        m_logdev.request_flush();
+    }
+}
+
 uint64_t HomeLogStore::rollback_async(logstore_seq_num_t to_lsn, on_rollback_cb_t cb) {
     // Validate if the lsn to which it is rolledback to is not truncated.
     auto ret = m_records.status(to_lsn + 1);
@@ -13,21 +13,30 @@
  * specific language governing permissions and limitations under the License.
  *
  *********************************************************************************/
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <cstring>
 #include <iterator>
 #include <filesystem>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <system_error>
+#include <thread>
+#include <unordered_map>
 
+#include <folly/executors/GlobalExecutor.h>
+#include <folly/futures/Future.h>
 #include <sisl/fds/compress.hpp>
 #include <sisl/fds/utils.hpp>
 #include <iomgr/iomgr_flip.hpp>
 
 #include <homestore/meta_service.hpp>
 #include <homestore/homestore.hpp>
+#include <homestore/checkpoint/cp_mgr.hpp>
 #include "device/chunk.h"
 #include <homestore/chunk_selector.h>
 #include "common/homestore_flip.hpp"
@@ -44,6 +53,43 @@ namespace homestore {
 
 MetaBlkService& meta_service() { return hs()->meta_service(); }
 
+// Run fn for each of [0, n) on upto nthreads threads. Caller works on the items along with the helpers it hands off to
+// the global cpu executor, and waits only for the items to be done. So this never waits on an executor thread to be
+// free, even when the caller is one of them (nested calls) or the executor is busy.
+static void run_parallel(size_t n, uint32_t nthreads, const std::function< void(size_t) >& fn) {
+    nthreads = uint32_cast(std::min(uint64_cast(nthreads), uint64_cast(n)));
+    if (nthreads <= 1) {
+        for (size_t i{0}; i < n; ++i) {
+            fn(i);
+        }
+        return;
+    }
+
+    struct parallel_state {
+        std::atomic< size_t > next{0};
+        size_t ndone{0};
+        std::mutex mtx;
+        std::condition_variable cv;
+    };
+    auto state = std::make_shared< parallel_state >();
+    const auto work = [state, n, &fn]() {
+        // Helpers which start after all items are picked don't touch fn, which could be gone by then
+        for (auto i = state->next.fetch_add(1); i < n; i = state->next.fetch_add(1)) {
+            fn(i);
+            std::lock_guard< std::mutex > lg{state->mtx};
+            if (++state->ndone == n) { state->cv.notify_all(); }
+        }
+    };
+
+    for (uint32_t t{1}; t < nthreads; ++t) {
+        folly::getGlobalCPUExecutor()->add(work);
+    }
+    work();
+
+    std::unique_lock< std::mutex > lk{state->mtx};
+    state->cv.wait(lk, [&state, n]() { return state->ndone == n; });
+}
+
 MetaBlkService::MetaBlkService(const char* name) : m_metrics{name} { m_last_mblk_id = std::make_unique< BlkId >(); }
 
 void MetaBlkService::create_vdev(uint64_t size, uint32_t num_chunks) {
@@ -130,6 +176,10 @@ void MetaBlkService::cache_clear() {
 
     m_meta_blks.clear();
     m_ovf_blk_hdrs.clear();
+    {
+        std::lock_guard< decltype(m_pending_mtx) > plg{m_pending_mtx};
+        m_update_gens.clear();
+    }
 }
 
 void MetaBlkService::read(const BlkId& bid, uint8_t* dest, size_t sz) const {
@@ -195,6 +245,11 @@ void MetaBlkService::format_ssb() {
 
 // m_meta_lock should be while calling this function;
 void MetaBlkService::write_ssb() {
+    if (m_write_batch) {
+        m_write_batch->ssb_dirty = true;
+        return;
+    }
+
     // write current ovf blk to disk;
     try {
         m_sb_vdev->sync_write((const char*)m_ssb, block_size(), m_ssb->bid);
@@ -221,13 +276,57 @@ bool MetaBlkService::scan_and_load_meta_blks(meta_blk_map_t& meta_blks, ovf_hdr_
     auto prev_meta_bid = m_ssb->bid;
     auto self_recover{false};
 
+    // Meta blks and their ovf blks are mostly allocated close to each other. So instead of one read per blk while
+    // walking the chain, read a window of contiguous blks at once and serve the subsequent blks from it.
+    std::unordered_map< chunk_num_t, blk_num_t > chunk_nblks;
+    for (auto const& chunk : m_sb_vdev->get_chunks()) {
+        if (chunk) { chunk_nblks[chunk->chunk_id()] = blk_num_t(chunk->size() / block_size()); }
+    }
+    // Window grows (upto recovery_read_ahead_blks) as long as at least half of the previous window gets used, and
+    // shrinks otherwise. So a scattered chain ends up reading about a blk per miss, instead of a full window.
+    const uint64_t ra_cfg_nblks = HS_DYNAMIC_CONFIG(metablk.recovery_read_ahead_blks);
+    const auto ra_nblks = blk_count_t(std::clamp(ra_cfg_nblks, uint64_cast(1), uint64_cast(max_blks_per_blkid())));
+    uint8_t* ra_buf = hs_utils::iobuf_alloc(ra_nblks * block_size(), sisl::buftag::metablk, align_size());
+    BlkId ra_bid;          // Blks currently in ra_buf
+    blk_count_t ra_cur{1}; // Size of the next window
+    uint64_t ra_last{0};   // Size of the previous window
+    uint64_t ra_used{0};   // Blks served from the previous window
+    uint64_t nblks_scanned{0};
+    uint64_t nreads{0};
+
+    const auto read_blk = [&](BlkId const& b, uint8_t* dest) {
+        ++nblks_scanned;
+        const bool in_window = ra_bid.is_valid() && (ra_bid.chunk_num() == b.chunk_num()) &&
+            (b.blk_num() >= ra_bid.blk_num()) && (b.blk_num() < ra_bid.blk_num() + ra_bid.blk_count());
+        if (in_window) {
+            ++ra_used;
+        } else {
+            if (ra_last != 0) {
+                ra_cur = (ra_used * 2 >= ra_last) ? blk_count_t(std::min< uint32_t >(ra_cur * 2, ra_nblks))
+                                                  : blk_count_t(std::max< uint32_t >(ra_cur / 2, 1));
+            }
+            ++nreads;
+            const auto it = chunk_nblks.find(b.chunk_num());
+            const uint64_t nblks_to_end = (it == chunk_nblks.end()) ? 1 : (it->second - b.blk_num());
+            const auto nblks = blk_count_t(std::clamp(nblks_to_end, uint64_cast(1), uint64_cast(ra_cur)));
+            ra_last = nblks;
+            ra_used = 1;
+            if (nblks == 1) {
+                ra_bid.invalidate();
+                read(b, dest, block_size());
+                return;
+            }
+            ra_bid = BlkId{b.blk_num(), nblks, b.chunk_num()};
+            read(ra_bid, ra_buf, nblks * block_size());
+        }
+        std::memcpy(dest, ra_buf + uint64_cast(b.blk_num() - ra_bid.blk_num()) * block_size(), block_size());
+    };
+
     while (bid.is_valid()) {
         *last_mblk_id = bid;
 
-        // TODO: add a new API in blkstore read to by pass cache;
-        // e.g. take caller's read buf to avoid this extra memory copy;
         auto* mblk = r_cast< meta_blk* >(hs_utils::iobuf_alloc(block_size(), sisl::buftag::metablk, align_size()));
-        read(bid, uintptr_cast(mblk), block_size());
+        read_blk(bid, uintptr_cast(mblk));
 
         // add meta blk to cache;
         meta_blks[bid.to_integer()] = mblk;
@@ -285,7 +384,7 @@ bool MetaBlkService::scan_and_load_meta_blks(meta_blk_map_t& meta_blks, ovf_hdr_
             // ovf blk header occupies whole blk;
             auto* ovf_hdr =
                 r_cast< meta_blk_ovf_hdr* >(hs_utils::iobuf_alloc(block_size(), sisl::buftag::metablk, align_size()));
-            read(obid, uintptr_cast(ovf_hdr), block_size());
+            read_blk(obid, uintptr_cast(ovf_hdr));
 
             // verify self bid
             HS_REL_ASSERT_EQ(ovf_hdr->h.bid.to_integer(), obid.to_integer(), "Corrupted self-bid: {}/{}",
@@ -338,6 +437,8 @@ bool MetaBlkService::scan_and_load_meta_blks(meta_blk_map_t& meta_blks, ovf_hdr_
         bid = mblk->hdr.h.next_bid;
     }
 
+    hs_utils::iobuf_free(ra_buf, sisl::buftag::metablk);
+    LOGINFO("Scanned {} meta and ovf blks with {} reads", nblks_scanned, nreads);
     return self_recover;
 }
 
@@ -386,6 +487,10 @@ void MetaBlkService::register_handler(meta_sub_type type, const meta_blk_found_c
 
 void MetaBlkService::add_sub_sb(meta_sub_type type, const uint8_t* context_data, uint64_t sz, void*& cookie) {
     std::lock_guard< decltype(m_meta_mtx) > lg(m_meta_mtx);
+    add_sub_sb_internal(std::move(type), context_data, sz, cookie);
+}
+
+void MetaBlkService::add_sub_sb_internal(meta_sub_type type, const uint8_t* context_data, uint64_t sz, void*& cookie) {
     HS_REL_ASSERT_EQ(m_inited, true, "accessing metablk store before init is not allowed.");
     HS_REL_ASSERT_LT(type.length(), MAX_SUBSYS_TYPE_LEN, "type len: {} should not exceed len: {}", type.length(),
                      MAX_SUBSYS_TYPE_LEN);
@@ -436,9 +541,14 @@ void MetaBlkService::write_ovf_blk_to_disk(meta_blk_ovf_hdr* ovf_hdr, const uint
     HS_DBG_ASSERT_LE(ovf_hdr->h.context_sz + offset, sz);
 
     // write current ovf blk to disk;
-    try {
-        m_sb_vdev->sync_write((const char*)ovf_hdr, block_size(), ovf_hdr->h.bid);
-    } catch (std::exception& e) { HS_REL_ASSERT(false, "exception happen during write {}", e.what()); }
+    if (m_write_batch) {
+        m_write_batch->ovf_futs.push_back(m_sb_vdev->async_write(r_cast< const char* >(ovf_hdr), block_size(),
+                                                                 ovf_hdr->h.bid, true /* part_of_batch */));
+    } else {
+        try {
+            m_sb_vdev->sync_write((const char*)ovf_hdr, block_size(), ovf_hdr->h.bid);
+        } catch (std::exception& e) { HS_REL_ASSERT(false, "exception happen during write {}", e.what()); }
+    }
 
     // NOTE: The start write pointer which is context data pointer plus offset must be dma boundary aligned
     // TO DO: Might need to differentiate based on data or fast type
@@ -446,8 +556,13 @@ void MetaBlkService::write_ovf_blk_to_disk(meta_blk_ovf_hdr* ovf_hdr, const uint
     uint8_t* write_context_data = (const_cast< uint8_t* >(context_data) + offset);
     size_t write_size = ovf_hdr->h.context_sz;
     uint8_t* context_data_aligned{nullptr};
-    if (!hs_utils::mod_aligned_sz(write_size, align_sz)) {
-        HS_LOG_EVERY_N(WARN, metablk, 50, "[type={}] Unaligned address found for input context_data.", type);
+    // Batched writes are issued only after the whole batch is built, by then the context data (e.g. the compress
+    // buffer) could be reused by the next sb in the batch. So batch always writes from its own copy.
+    const bool is_unaligned = !hs_utils::mod_aligned_sz(write_size, align_sz);
+    if (is_unaligned || m_write_batch) {
+        if (is_unaligned) {
+            HS_LOG_EVERY_N(WARN, metablk, 50, "[type={}] Unaligned address found for input context_data.", type);
+        }
         const size_t aligned_write_size = uint64_cast(sisl::round_up(write_size, align_sz));
         context_data_aligned = hs_utils::iobuf_alloc(aligned_write_size, sisl::buftag::metablk, align_size());
         std::memcpy(context_data_aligned, write_context_data, write_size);
@@ -488,18 +603,35 @@ void MetaBlkService::write_ovf_blk_to_disk(meta_blk_ovf_hdr* ovf_hdr, const uint
             size_written += (ovf_hdr->h.context_sz - size_written);
         }
 
-        try {
-            m_sb_vdev->sync_write(r_cast< const char* >(cur_ptr), cur_size, data_bid[i]);
-        } catch (std::exception& e) { HS_REL_ASSERT(false, "exception happen during write {}", e.what()); }
+        if (m_write_batch) {
+            m_write_batch->ovf_futs.push_back(m_sb_vdev->async_write(r_cast< const char* >(cur_ptr), cur_size,
+                                                                     data_bid[i], true /* part_of_batch */));
+        } else {
+            try {
+                m_sb_vdev->sync_write(r_cast< const char* >(cur_ptr), cur_size, data_bid[i]);
+            } catch (std::exception& e) { HS_REL_ASSERT(false, "exception happen during write {}", e.what()); }
+        }
     }
 
     if (data_buf) { hs_utils::iobuf_free(data_buf, sisl::buftag::metablk); }
-    if (context_data_aligned) { hs_utils::iobuf_free(context_data_aligned, sisl::buftag::metablk); }
+    if (context_data_aligned) {
+        if (m_write_batch) {
+            m_write_batch->ovf_bufs.push_back(context_data_aligned);
+        } else {
+            hs_utils::iobuf_free(context_data_aligned, sisl::buftag::metablk);
+        }
+    }
 
     HS_DBG_ASSERT_EQ(size_written, ovf_hdr->h.context_sz);
 }
 
 void MetaBlkService::write_meta_blk_to_disk(meta_blk* mblk) {
+    if (m_write_batch) {
+        // Written once at the end of the batch, no matter how many times it is modified in the batch
+        m_write_batch->mblks.insert(mblk);
+        return;
+    }
+
     // write current ovf blk to disk;
     try {
         m_sb_vdev->sync_write((const char*)mblk, block_size(), mblk->hdr.h.bid);
@@ -704,6 +836,9 @@ void MetaBlkService::write_meta_blk_internal(meta_blk* mblk, const uint8_t* cont
         HS_DBG_ASSERT(obid.is_valid(), "Expected valid blkid");
         mblk->hdr.h.ovf_bid = obid;
 
+        // new full image, so any delta records on top of the previous image are no longer valid
+        reset_delta(mblk);
+
 #ifdef _PRERELEASE
         iomgr_flip::test_and_abort("write_with_ovf_abort");
 #endif
@@ -767,7 +902,13 @@ void MetaBlkService::_cookie_sanity_check(const void* cookie) const {
 // 3. free old ovf_bid if there is any
 //
 void MetaBlkService::update_sub_sb(const uint8_t* context_data, uint64_t sz, void*& cookie) {
+    auto const gen = next_update_gen(cookie);
     std::lock_guard< decltype(m_meta_mtx) > lg{m_meta_mtx};
+    if (!apply_update_gen(cookie, gen)) { return; }
+    update_sub_sb_internal(context_data, sz, cookie);
+}
+
+void MetaBlkService::update_sub_sb_internal(const uint8_t* context_data, uint64_t sz, void* cookie) {
     HS_REL_ASSERT_EQ(m_inited, true, "accessing metablk store before init is not allowed.");
 
 #ifdef _PRERELEASE
@@ -810,8 +951,12 @@ void MetaBlkService::update_sub_sb(const uint8_t* context_data, uint64_t sz, voi
     iomgr_flip::test_and_abort("update_sb_abort");
 #endif
 
-    // free the overflow bid if it is there
-    free_ovf_blk_chain(ovf_bid_to_free);
+    // free the overflow bid if it is there, batch frees it only after the updated meta blk is written.
+    if (m_write_batch) {
+        if (ovf_bid_to_free.is_valid()) { m_write_batch->ovf_to_free.push_back(ovf_bid_to_free); }
+    } else {
+        free_ovf_blk_chain(ovf_bid_to_free);
+    }
 
     HS_LOG(DEBUG, metablk, "[type={}], update_sub_sb new sb: context_sz: {}, ovf_bid: {}, mstore used size: {}",
            mblk->hdr.h.type, uint64_cast(mblk->hdr.h.context_sz), mblk->hdr.h.ovf_bid.to_string(),
@@ -833,6 +978,288 @@ void MetaBlkService::update_sub_sb(const uint8_t* context_data, uint64_t sz, voi
 #endif
 }
 
+void MetaBlkService::update_sub_sb_delta(const uint8_t* context_data, uint64_t sz, const meta_dirty_ranges_t& ranges,
+                                         void*& cookie) {
+    auto const gen = next_update_gen(cookie);
+    std::lock_guard< decltype(m_meta_mtx) > lg{m_meta_mtx};
+    HS_REL_ASSERT_EQ(m_inited, true, "accessing metablk store before init is not allowed.");
+    if (!apply_update_gen(cookie, gen)) { return; }
+
+#ifdef _PRERELEASE
+    _cookie_sanity_check(cookie);
+#endif
+    meta_blk* mblk = s_cast< meta_blk* >(cookie);
+
+    if (append_delta(mblk, context_data, sz, ranges)) {
+        COUNTER_INCREMENT(m_metrics, delta_update_cnt, 1);
+        HS_LOG(DEBUG, metablk, "[type={}], update_sub_sb_delta appended {} delta records, gen_cnt: {}",
+               mblk->hdr.h.type, ranges.size(), mblk->hdr.h.gen_cnt);
+        return;
+    }
+
+    // Either not in overflow blks or the deltas don't fit anymore, compact it to full image
+    if (mblk->hdr.h.ovf_bid.is_valid()) { COUNTER_INCREMENT(m_metrics, delta_compact_cnt, 1); }
+    update_sub_sb_internal(context_data, sz, cookie);
+}
+
+meta_dirty_ranges_t MetaBlkService::dirty_ranges(const uint8_t* prev, const uint8_t* cur, uint64_t sz) {
+    static constexpr uint64_t cmp_sz{64};
+
+    meta_dirty_ranges_t ranges;
+    for (uint64_t offset{0}; offset < sz; offset += cmp_sz) {
+        const auto len = std::min(cmp_sz, sz - offset);
+        if (std::memcmp(prev + offset, cur + offset, len) == 0) { continue; }
+
+        if (!ranges.empty() && (ranges.back().first + ranges.back().second == offset)) {
+            ranges.back().second += len;
+        } else {
+            ranges.emplace_back(offset, len);
+        }
+    }
+    return ranges;
+}
+
+bool MetaBlkService::append_delta(meta_blk* mblk, const uint8_t* context_data, uint64_t sz,
+                                  const meta_dirty_ranges_t& ranges) {
+    // context data in meta blk itself is rewritten with the same one blk write, no need of deltas
+    if (!mblk->hdr.h.ovf_bid.is_valid()) { return false; }
+
+    // Deltas are applied on the raw context data read from the overflow blks, which for a compressed sb is not the
+    // image the dirty ranges are of. Compressed sbs are always rewritten in whole.
+    if (mblk->hdr.h.compressed) { return false; }
+    if (sz != mblk->hdr.h.context_sz) { return false; }
+    if (ranges.empty()) { return true; }
+
+    auto* dhdr = r_cast< meta_blk_delta_hdr* >(mblk->get_context_data_mutable());
+    if (dhdr->magic != META_BLK_DELTA_MAGIC) { reset_delta(mblk); } // written before deltas were supported
+
+    uint64_t append_sz{0};
+    for (auto const& [offset, len] : ranges) {
+        HS_REL_ASSERT_LE(offset + len, sz, "[type={}] dirty range is beyond context size", mblk->hdr.h.type);
+        append_sz += sizeof(meta_blk_delta_rec) + len;
+    }
+
+    if ((dhdr->nrecords + ranges.size() > HS_DYNAMIC_CONFIG(metablk.max_delta_records)) ||
+        (sizeof(meta_blk_delta_hdr) + dhdr->size + append_sz > meta_blk_context_sz())) {
+        return false;
+    }
+
+    uint8_t* records = uintptr_cast(dhdr) + sizeof(meta_blk_delta_hdr);
+    uint8_t* cur = records + dhdr->size;
+    for (auto const& [offset, len] : ranges) {
+        auto* rec = r_cast< meta_blk_delta_rec* >(cur);
+        rec->offset = offset;
+        rec->len = uint32_cast(len);
+        std::memcpy(cur + sizeof(meta_blk_delta_rec), context_data + offset, len);
+        cur += sizeof(meta_blk_delta_rec) + len;
+    }
+    dhdr->nrecords += uint32_cast(ranges.size());
+    dhdr->size += uint32_cast(append_sz);
+    dhdr->crc = crc32_ieee(init_crc32, records, dhdr->size);
+    mblk->hdr.h.gen_cnt += 1;
+
+    write_meta_blk_to_disk(mblk);
+    return true;
+}
+
+void MetaBlkService::reset_delta(meta_blk* mblk) const {
+    auto* dhdr = r_cast< meta_blk_delta_hdr* >(mblk->get_context_data_mutable());
+    dhdr->magic = META_BLK_DELTA_MAGIC;
+    dhdr->nrecords = 0;
+    dhdr->size = 0;
+    dhdr->crc = 0;
+}
+
+void MetaBlkService::apply_delta(const meta_blk* mblk, uint8_t* context_data, uint64_t sz) const {
+    if (!mblk->hdr.h.ovf_bid.is_valid()) { return; }
+
+    const auto* dhdr = r_cast< const meta_blk_delta_hdr* >(mblk->get_context_data());
+    if ((dhdr->magic != META_BLK_DELTA_MAGIC) || (dhdr->nrecords == 0)) { return; }
+    HS_REL_ASSERT_EQ(mblk->hdr.h.compressed, 0, "[type={}], delta records found on compressed mblk bid: {}",
+                     mblk->hdr.h.type, mblk->hdr.h.bid.to_string());
+
+    HS_REL_ASSERT_LE(sizeof(meta_blk_delta_hdr) + dhdr->size, meta_blk_context_sz(),
+                     "[type={}], corrupted delta records size: {}", mblk->hdr.h.type, dhdr->size);
+    const uint8_t* records = r_cast< const uint8_t* >(dhdr) + sizeof(meta_blk_delta_hdr);
+    const auto crc = crc32_ieee(init_crc32, records, dhdr->size);
+    HS_REL_ASSERT_EQ(crc, dhdr->crc, "[type={}], delta records CRC mismatch on mblk bid: {}", mblk->hdr.h.type,
+                     mblk->hdr.h.bid.to_string());
+
+    const uint8_t* cur = records;
+    for (uint32_t i{0}; i < dhdr->nrecords; ++i) {
+        const auto* rec = r_cast< const meta_blk_delta_rec* >(cur);
+        HS_REL_ASSERT_LE(rec->offset + rec->len, sz, "[type={}], delta record beyond context size", mblk->hdr.h.type);
+        std::memcpy(context_data + rec->offset, cur + sizeof(meta_blk_delta_rec), rec->len);
+        cur += sizeof(meta_blk_delta_rec) + rec->len;
+    }
+    HS_LOG(DEBUG, metablk, "[type={}] applied {} delta records", mblk->hdr.h.type, dhdr->nrecords);
+}
+
+folly::Future< void* > MetaBlkService::async_add_sub_sb(meta_sub_type type, const uint8_t* context_data,
+                                                        uint64_t sz) {
+    auto req = std::make_shared< meta_write_req >();
+    req->is_add = true;
+    req->type = std::move(type);
+    req->buf = sisl::io_blob_safe{uint32_cast(sz), align_size()};
+    std::memcpy(req->buf.bytes(), context_data, sz);
+
+    auto f = req->promise.getFuture();
+    queue_write(req);
+    return f;
+}
+
+folly::Future< bool > MetaBlkService::async_update_sub_sb(const uint8_t* context_data, uint64_t sz, void* cookie) {
+    auto req = std::make_shared< meta_write_req >();
+    req->is_add = false;
+    req->cookie = cookie;
+    req->update_gen = next_update_gen(cookie);
+    req->buf = sisl::io_blob_safe{uint32_cast(sz), align_size()};
+    std::memcpy(req->buf.bytes(), context_data, sz);
+
+    auto f = req->promise.getFuture();
+    queue_write(req);
+    return std::move(f).thenValue([](void*) { return true; });
+}
+
+void MetaBlkService::queue_write(const std::shared_ptr< meta_write_req >& req) {
+    {
+        std::lock_guard< decltype(m_pending_mtx) > lg{m_pending_mtx};
+        m_pending_writes.push_back(req);
+        if (m_batch_in_progress) { return; }
+        m_batch_in_progress = true;
+    }
+
+    // No one else is writing, start a batch. Requests queued till it gets to run are written along with this one.
+    iomanager.run_on_forget(hs()->cp_mgr().pick_blocking_io_fiber(), [this]() { drain_one_batch(); });
+}
+
+uint64_t MetaBlkService::next_update_gen(void* cookie) {
+    std::lock_guard< decltype(m_pending_mtx) > lg{m_pending_mtx};
+    return ++m_update_gens[cookie].issued;
+}
+
+bool MetaBlkService::apply_update_gen(void* cookie, uint64_t gen) {
+    std::lock_guard< decltype(m_pending_mtx) > lg{m_pending_mtx};
+    auto it = m_update_gens.find(cookie);
+    if ((it == m_update_gens.end()) || (gen < it->second.applied)) { return false; }
+    it->second.applied = gen;
+    return true;
+}
+
+void MetaBlkService::drain_one_batch() {
+    std::vector< std::shared_ptr< meta_write_req > > reqs;
+    {
+        std::lock_guard< decltype(m_pending_mtx) > lg{m_pending_mtx};
+        if (m_pending_writes.empty()) {
+            m_batch_in_progress = false;
+            return;
+        }
+
+        const size_t max_batch = std::max(HS_DYNAMIC_CONFIG(metablk.max_write_batch_size), 1u);
+        if (m_pending_writes.size() <= max_batch) {
+            reqs.swap(m_pending_writes);
+        } else {
+            reqs.assign(m_pending_writes.begin(), m_pending_writes.begin() + max_batch);
+            m_pending_writes.erase(m_pending_writes.begin(), m_pending_writes.begin() + max_batch);
+        }
+    }
+    write_batch(reqs);
+
+    {
+        std::lock_guard< decltype(m_pending_mtx) > lg{m_pending_mtx};
+        if (m_pending_writes.empty()) {
+            m_batch_in_progress = false;
+            return;
+        }
+    }
+
+    // Writes queued while this batch was being written are picked up together by the next batch
+    iomanager.run_on_forget(hs()->cp_mgr().pick_blocking_io_fiber(), [this]() { drain_one_batch(); });
+}
+
+void MetaBlkService::write_batch(std::vector< std::shared_ptr< meta_write_req > >& reqs) {
+    // Batch is written on a blocking io fiber, wait for the writes by parking the fiber, like the sync writes do
+    static auto const wait_for_writes = [](std::vector< folly::Future< std::error_code > >& futs) {
+        for (auto const& t : hs_utils::fiber_wait(folly::collectAllUnsafe(futs))) {
+            HS_REL_ASSERT(t.hasValue() && !t.value(), "error happen during batched meta blk write");
+        }
+        futs.clear();
+    };
+
+    std::vector< void* > cookies;
+    cookies.reserve(reqs.size());
+    {
+        std::lock_guard< decltype(m_meta_mtx) > lg{m_meta_mtx};
+
+        // Apply all the adds and updates in-memory, which allocates the blks and collects the writes to be done.
+        meta_write_batch batch;
+        batch.link_bid = *m_last_mblk_id;
+        m_write_batch = &batch;
+        for (auto& req : reqs) {
+            void* cookie = req->cookie;
+            if (req->is_add) {
+                add_sub_sb_internal(req->type, req->buf.cbytes(), req->buf.size(), cookie);
+            } else if (apply_update_gen(cookie, req->update_gen)) {
+                update_sub_sb_internal(req->buf.cbytes(), req->buf.size(), cookie);
+            }
+            cookies.push_back(cookie);
+        }
+        m_write_batch = nullptr;
+
+        uint64_t nios = batch.ovf_futs.size();
+
+        // Step 1: All the overflow blks
+        if (!batch.ovf_futs.empty()) {
+            m_sb_vdev->submit_batch();
+            wait_for_writes(batch.ovf_futs);
+        }
+
+        // Step 2: All the new and updated meta blks, except the one linking the new meta blks to the chain
+        meta_blk* link_mblk{nullptr};
+        std::vector< folly::Future< std::error_code > > mblk_futs;
+        for (auto* mblk : batch.mblks) {
+            if (batch.link_bid.is_valid() && (mblk->hdr.h.bid.to_integer() == batch.link_bid.to_integer())) {
+                link_mblk = mblk;
+                continue;
+            }
+            mblk_futs.push_back(m_sb_vdev->async_write(r_cast< const char* >(mblk), block_size(), mblk->hdr.h.bid,
+                                                       true /* part_of_batch */));
+        }
+        nios += mblk_futs.size();
+        if (!mblk_futs.empty()) {
+            m_sb_vdev->submit_batch();
+            wait_for_writes(mblk_futs);
+        }
+
+        // Step 3: Link the new meta blks to the chain
+        if (link_mblk) {
+            write_meta_blk_to_disk(link_mblk);
+            ++nios;
+        }
+        if (batch.ssb_dirty) {
+            write_ssb();
+            ++nios;
+        }
+
+        for (auto const& obid : batch.ovf_to_free) {
+            free_ovf_blk_chain(obid);
+        }
+        for (auto* buf : batch.ovf_bufs) {
+            hs_utils::iobuf_free(buf, sisl::buftag::metablk);
+        }
+
+        COUNTER_INCREMENT(m_metrics, write_batches, 1);
+        COUNTER_INCREMENT(m_metrics, write_batch_ios, nios);
+        HISTOGRAM_OBSERVE(m_metrics, write_batch_size, reqs.size());
+        HS_LOG(DEBUG, metablk, "Written batch of {} sub sbs with {} ios, mstore used size: {}", reqs.size(), nios,
+               m_sb_vdev->used_size());
+    }
+
+    for (size_t i{0}; i < reqs.size(); ++i) {
+        reqs[i]->promise.setValue(cookies[i]);
+    }
+}
+
 std::error_condition MetaBlkService::remove_sub_sb(void* cookie) {
     std::lock_guard< decltype(m_meta_mtx) > lg{m_meta_mtx};
 #ifdef _PRERELEASE
@@ -905,6 +1332,11 @@ std::error_condition MetaBlkService::remove_sub_sb(void* cookie) {
     // free the on-disk meta blk
     free_meta_blk(rm_blk);
 
+    {
+        std::lock_guard< decltype(m_pending_mtx) > plg{m_pending_mtx};
+        m_update_gens.erase(cookie);
+    }
+
 #ifdef _PRERELEASE
     iomgr_flip::test_and_abort("remove_sb_abort");
 #endif
@@ -1095,91 +1527,186 @@ void MetaBlkService::recover(bool do_comp_cb) {
         recover_meta_sub_type(do_comp_cb, subtype);
     }
 
-    // TODO: for independent subsystems, we can use concurrent recovery if necessary.
+    // independent subsystems can be recovered concurrently, if the consumers allow it.
+    meta_subtype_vec_t independent_subtypes;
     for (auto const& x : m_sub_info) {
-        auto& reg_info = x.second;
-        if (!reg_info.has_deps) { recover_meta_sub_type(do_comp_cb, x.first); }
+        if (!x.second.has_deps) { independent_subtypes.push_back(x.first); }
     }
+    const uint32_t nthreads =
+        HS_DYNAMIC_CONFIG(metablk.recovery_parallel_handlers) ? HS_DYNAMIC_CONFIG(metablk.recovery_threads) : 1;
+    run_parallel(independent_subtypes.size(), nthreads,
+                 [this, do_comp_cb, &independent_subtypes](size_t i) {
+                     recover_meta_sub_type(do_comp_cb, independent_subtypes[i]);
+                 });
 }
 
 void MetaBlkService::recover_meta_sub_type(bool do_comp_cb, const meta_sub_type& sub_type) {
-    for (const auto& m : m_sub_info[sub_type].meta_bids) {
-        auto mblk = m_meta_blks[m];
-        recover_meta_block(mblk);
+    auto& reg_info = m_sub_info[sub_type];
+
+    // Recover in windows, so that the reads of all the meta blks in a window are in flight together, without holding
+    // the context data of all the meta blks in memory at once.
+    const uint64_t window_sz = uint64_cast(HS_DYNAMIC_CONFIG(metablk.recovery_window_size_mb)) * 1024 * 1024;
+    std::vector< meta_blk* > mblks;
+    uint64_t cur_window_sz{0};
+    for (const auto& m : reg_info.meta_bids) {
+        auto* mblk = m_meta_blks[m];
+        mblks.push_back(mblk);
+        cur_window_sz += mblk->hdr.h.context_sz;
+        if (cur_window_sz >= window_sz) {
+            recover_meta_blks(mblks);
+            mblks.clear();
+            cur_window_sz = 0;
+        }
     }
+    if (!mblks.empty()) { recover_meta_blks(mblks); }
 
-    if (do_comp_cb && m_sub_info[sub_type].comp_cb) {
-        m_sub_info[sub_type].comp_cb(true);
+    if (do_comp_cb && reg_info.comp_cb) {
+        reg_info.comp_cb(true);
         HS_LOG(DEBUG, metablk, "[type={}] completion callback sent.", sub_type);
     }
 }
 
-void MetaBlkService::recover_meta_block(meta_blk* mblk) {
-    auto buf = read_sub_sb_internal(mblk);
-    // found a meta blk and callback to sub system;
-    const auto itr = m_sub_info.find(mblk->hdr.h.type);
-    if (itr != std::end(m_sub_info)) {
-        // if subsystem registered crc protection, verify crc before sending to subsystem;
-        if (itr->second.do_crc) {
-            const auto crc = crc32_ieee(init_crc32, buf->cbytes(), mblk->hdr.h.context_sz);
-
-            HS_REL_ASSERT_EQ(crc, uint32_cast(mblk->hdr.h.crc),
-                             "[type={}], CRC mismatch: {}/{}, on mblk bid: {}, context_sz: {}", mblk->hdr.h.type, crc,
-                             uint32_cast(mblk->hdr.h.crc), mblk->hdr.h.bid.to_string(),
-                             uint64_cast(mblk->hdr.h.context_sz));
-        } else {
-            HS_LOG(DEBUG, metablk, "[type={}] meta blk found with bypassing crc.", mblk->hdr.h.type);
+void MetaBlkService::recover_meta_blks(const std::vector< meta_blk* >& mblks) {
+    auto bufs = read_sub_sbs_internal(mblks);
+
+    // verifying, decompressing and applying deltas of a meta blk is independent of others;
+    std::vector< size_t > sizes(mblks.size(), 0);
+    run_parallel(mblks.size(), HS_DYNAMIC_CONFIG(metablk.recovery_threads), [this, &mblks, &bufs, &sizes](size_t i) {
+        bufs[i] = prepare_recovered_sb(mblks[i], std::move(bufs[i]), sizes[i]);
+    });
+
+    // found a meta blk and callback to sub system in order;
+    for (size_t i{0}; i < mblks.size(); ++i) {
+        auto* mblk = mblks[i];
+        const auto itr = m_sub_info.find(mblk->hdr.h.type);
+        if (itr == std::end(m_sub_info)) {
+            HS_LOG(DEBUG, metablk, "[type={}], unregistered client found. ", mblk->hdr.h.type);
+            continue;
         }
 
-        // send the callbck;
+        // cb could be nullptr because client want to get its superblock via read api;
         auto& cb = itr->second.cb;
-        if (cb) { // cb could be nullptr because client want to get its superblock via read api;
-            // decompress if necessary
-            if (mblk->hdr.h.compressed) {
-                // HS_DBG_ASSERT_GE(mblk->hdr.h.context_sz, META_BLK_CONTEXT_SZ);
-                // TO DO: Might need to address alignment based on data or fast type
-                auto decompressed_buf{hs_utils::make_byte_array(mblk->hdr.h.src_context_sz, true /* aligned */,
-                                                                sisl::buftag::compression, align_size())};
-                size_t decompressed_size = mblk->hdr.h.src_context_sz;
-                const auto ret{sisl::Compress::decompress(r_cast< const char* >(buf->cbytes()),
-                                                          r_cast< char* >(decompressed_buf->bytes()),
-                                                          mblk->hdr.h.compressed_sz, &decompressed_size)};
-                if (ret != 0) {
-                    LOGERROR("[type={}], negative result: {} from decompress trying to decompress the "
-                             "data. compressed_sz: {}, src_context_sz: {}",
-                             mblk->hdr.h.type, ret, uint64_cast(mblk->hdr.h.compressed_sz),
-                             uint64_cast(mblk->hdr.h.src_context_sz));
-                    HS_REL_ASSERT(false, "failed to decompress");
-                } else {
-                    // decompressed_size must equal to input sz before compress
-                    HS_REL_ASSERT_EQ(uint64_cast(mblk->hdr.h.src_context_sz),
-                                     uint64_cast(decompressed_size)); /* since decompressed_size is >=0 it
-                                                                         is safe to cast to uint64_t */
-                    HS_LOG(DEBUG, metablk,
-                           "[type={}] Successfully decompressed, compressed_sz: {}, src_context_sz: {}, "
-                           "decompressed_size: {}",
-                           mblk->hdr.h.type, uint64_cast(mblk->hdr.h.compressed_sz),
-                           uint64_cast(mblk->hdr.h.src_context_sz), decompressed_size);
-                }
+        if (cb) {
+            cb(mblk, bufs[i], sizes[i]);
+            HS_LOG(DEBUG, metablk, "[type={}] meta blk sent with size: {}.", mblk->hdr.h.type, sizes[i]);
+        }
+    }
+}
 
-                cb(mblk, decompressed_buf, mblk->hdr.h.src_context_sz);
-            } else {
-                // There is use case that cb could be nullptr because client want to get its superblock via
-                // read api;
-                cb(mblk, buf, mblk->hdr.h.context_sz);
-            }
+std::vector< sisl::byte_array > MetaBlkService::read_sub_sbs_internal(const std::vector< meta_blk* >& mblks) const {
+    std::vector< sisl::byte_array > bufs;
+    bufs.reserve(mblks.size());
 
-            HS_LOG(DEBUG, metablk, "[type={}] meta blk sent with size: {}.", mblk->hdr.h.type,
-                   uint64_cast(mblk->hdr.h.context_sz));
+    const size_t qdepth = std::max(HS_DYNAMIC_CONFIG(metablk.recovery_queue_depth), 1u);
+    std::vector< folly::Future< std::error_code > > futs;
+    const auto wait_for_reads = [this, &futs]() {
+        m_sb_vdev->submit_batch();
+        for (auto const& t : folly::collectAllUnsafe(futs).get()) {
+            HS_REL_ASSERT(t.hasValue() && !t.value(), "error happen during meta blk read");
         }
+        futs.clear();
+    };
+
+    for (auto* mblk : mblks) {
+        if (mblk->hdr.h.context_sz <= meta_blk_context_sz()) {
+            bufs.push_back(read_sub_sb_internal(mblk));
+            continue;
+        }
+
+        // same as read_sub_sb_internal, except that all the data blk reads of all the meta blks are issued together
+        auto buf =
+            hs_utils::make_byte_array(mblk->hdr.h.context_sz, true /* aligned */, sisl::buftag::metablk, align_size());
+        const auto total_sz = mblk->hdr.h.context_sz;
+        uint64_t read_offset{0}; // read offset in overall context data;
+
+        auto obid = mblk->hdr.h.ovf_bid;
+        while (read_offset < total_sz) {
+            HS_REL_ASSERT_EQ(obid.is_valid(), true, "[type={}], corrupted ovf_bid: {}", mblk->hdr.h.type,
+                             obid.to_string());
+            const auto* ovf_hdr = m_ovf_blk_hdrs.find(obid.to_integer())->second;
+            HS_REL_ASSERT_EQ(ovf_hdr->h.bid.to_integer(), obid.to_integer(), "[type={}], Corrupted self-bid: {}/{}",
+                             mblk->hdr.h.type, ovf_hdr->h.bid.to_string(), obid.to_string());
+
+            uint64_t read_offset_in_this_ovf{0}; // read offset in data covered by this overflow blk;
+            const auto* data_bid = ovf_hdr->get_data_bid();
+            for (decltype(ovf_hdr->h.nbids) i{0}; i < ovf_hdr->h.nbids; ++i) {
+                const size_t read_sz_per_db = (i < ovf_hdr->h.nbids - 1)
+                    ? data_bid[i].blk_count() * block_size()
+                    : ovf_hdr->h.context_sz - read_offset_in_this_ovf;
+
+                futs.push_back(m_sb_vdev->async_read(r_cast< char* >(buf->bytes() + read_offset),
+                                                     sisl::round_up(read_sz_per_db, align_size()), data_bid[i],
+                                                     true /* part_of_batch */));
+                if (futs.size() >= qdepth) { wait_for_reads(); }
+
+                read_offset_in_this_ovf += read_sz_per_db;
+                read_offset += read_sz_per_db;
+            }
+            HS_DBG_ASSERT_EQ(read_offset_in_this_ovf, ovf_hdr->h.context_sz);
+            obid = ovf_hdr->h.next_bid;
+        }
+
+        HS_REL_ASSERT_EQ(read_offset, total_sz, "[type={}], incorrect data read from disk: {}, total_sz: {}",
+                         mblk->hdr.h.type, read_offset, total_sz);
+        bufs.push_back(std::move(buf));
+    }
+
+    if (!futs.empty()) { wait_for_reads(); }
+    return bufs;
+}
+
+sisl::byte_array MetaBlkService::prepare_recovered_sb(const meta_blk* mblk, sisl::byte_array buf,
+                                                      size_t& out_size) const {
+    out_size = mblk->hdr.h.context_sz;
+    const auto itr = m_sub_info.find(mblk->hdr.h.type);
+    if (itr == std::end(m_sub_info)) { return buf; }
+
+    // if subsystem registered crc protection, verify crc before sending to subsystem;
+    if (itr->second.do_crc) {
+        const auto crc = crc32_ieee(init_crc32, buf->cbytes(), mblk->hdr.h.context_sz);
+
+        HS_REL_ASSERT_EQ(crc, uint32_cast(mblk->hdr.h.crc),
+                         "[type={}], CRC mismatch: {}/{}, on mblk bid: {}, context_sz: {}", mblk->hdr.h.type, crc,
+                         uint32_cast(mblk->hdr.h.crc), mblk->hdr.h.bid.to_string(),
+                         uint64_cast(mblk->hdr.h.context_sz));
     } else {
-        HS_LOG(DEBUG, metablk, "[type={}], unregistered client found. ");
-#if 0
-            // should never arrive here since we do assert on type before write to disk;
-            HS_LOG_ASSERT( false, "[type={}] not registered for mblk found on disk. Skip this meta blk. ",
-                      mblk->hdr.h.type);
-#endif
+        HS_LOG(DEBUG, metablk, "[type={}] meta blk found with bypassing crc.", mblk->hdr.h.type);
+    }
+
+    if (!itr->second.cb) { return buf; }
+
+    // decompress if necessary
+    if (mblk->hdr.h.compressed) {
+        // TO DO: Might need to address alignment based on data or fast type
+        auto decompressed_buf{hs_utils::make_byte_array(mblk->hdr.h.src_context_sz, true /* aligned */,
+                                                        sisl::buftag::compression, align_size())};
+        size_t decompressed_size = mblk->hdr.h.src_context_sz;
+        const auto ret{sisl::Compress::decompress(r_cast< const char* >(buf->cbytes()),
+                                                  r_cast< char* >(decompressed_buf->bytes()),
+                                                  mblk->hdr.h.compressed_sz, &decompressed_size)};
+        if (ret != 0) {
+            LOGERROR("[type={}], negative result: {} from decompress trying to decompress the "
+                     "data. compressed_sz: {}, src_context_sz: {}",
+                     mblk->hdr.h.type, ret, uint64_cast(mblk->hdr.h.compressed_sz),
+                     uint64_cast(mblk->hdr.h.src_context_sz));
+            HS_REL_ASSERT(false, "failed to decompress");
+        } else {
+            // decompressed_size must equal to input sz before compress
+            HS_REL_ASSERT_EQ(uint64_cast(mblk->hdr.h.src_context_sz),
+                             uint64_cast(decompressed_size)); /* since decompressed_size is >=0 it
+                                                                 is safe to cast to uint64_t */
+            HS_LOG(DEBUG, metablk,
+                   "[type={}] Successfully decompressed, compressed_sz: {}, src_context_sz: {}, "
+                   "decompressed_size: {}",
+                   mblk->hdr.h.type, uint64_cast(mblk->hdr.h.compressed_sz), uint64_cast(mblk->hdr.h.src_context_sz),
+                   decompressed_size);
+        }
+        buf = std::move(decompressed_buf);
+        out_size = mblk->hdr.h.src_context_sz;
     }
+
+    apply_delta(mblk, buf->bytes(), out_size);
+    return buf;
 }
 
 //
@@ -1205,6 +1732,7 @@ void MetaBlkService::read_sub_sb(meta_sub_type type) {
         // back;
         //
         sisl::byte_array buf = read_sub_sb_internal(mblk);
+        apply_delta(mblk, buf->bytes(), mblk->hdr.h.context_sz);
 
         // if consumer is reading its sbs with this api, the blk found cb should already be registered;
         HS_REL_ASSERT_EQ(it_s->second.cb.operator bool(), true);
@@ -1507,6 +2035,9 @@ nlohmann::json MetaBlkService::populate_json(int log_level, meta_blk_map_t& meta
                         }
 
                         sisl::byte_array buf = read_sub_sb_internal(it->second);
+                        if (!it->second->hdr.h.compressed) {
+                            apply_delta(it->second, buf->bytes(), it->second->hdr.h.context_sz);
+                        }
                         if (free_space < buf->size()) {
                             j[x.first]["meta_bids"][std::to_string(bid_cnt)] =
                                 "Not_able_to_dump_to_file_exceeding_allowed_space";
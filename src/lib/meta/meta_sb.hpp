@@ -22,7 +22,10 @@
 #include <set>
 #include <sstream>
 #include <string>
+#include <vector>
 
+#include <folly/futures/Future.h>
+#include <sisl/fds/buffer.hpp>
 #include <homestore/blk.h>
 #include <homestore/homestore.hpp>
 
@@ -31,6 +34,7 @@ static constexpr uint32_t META_BLK_HDR_MAX_SZ{512}; // max meta_blk_hdr size
 static constexpr uint32_t META_BLK_MAGIC{0xCEEDBEED};
 static constexpr uint32_t META_BLK_OVF_MAGIC{0xDEADBEEF};
 static constexpr uint32_t META_BLK_SB_MAGIC{0xABCDCEED};
+static constexpr uint32_t META_BLK_DELTA_MAGIC{0xCEEDDE17};
 static constexpr uint32_t META_BLK_SB_VERSION{0x1};
 static constexpr uint32_t META_BLK_VERSION{0x1};
 static constexpr uint32_t MAX_SUBSYS_TYPE_LEN{64};
@@ -230,6 +234,52 @@ struct meta_vdev_context : public hs_vdev_context {
 };
 #pragma pack()
 
+//
+// Delta records of a meta blk whose context data is in overflow blks, and hence its own context data area is free.
+// Each record patches [offset, offset + len) of the context data and is applied in order on top of the image read
+// from the overflow blks. A partial update of a large sub sb thus costs a single meta blk write. Full update of the sub
+// sb (compaction) writes a new image to overflow blks and empties the delta records.
+//
+#pragma pack(1)
+struct meta_blk_delta_hdr {
+    uint32_t magic;
+    uint32_t nrecords; // number of delta records following this header
+    uint32_t size;     // total size of the delta records following this header
+    crc32_t crc;       // crc of the delta records
+};
+
+struct meta_blk_delta_rec {
+    uint64_t offset; // offset in the context data
+    uint32_t len;    // len bytes of data follows this record
+};
+#pragma pack()
+
+// in-memory only, an async add or update of a sub sb waiting to be written as part of a batch
+struct meta_write_req {
+    bool is_add;
+    meta_sub_type type;     // Only for add
+    void* cookie{nullptr};  // Only for update
+    uint64_t update_gen{0}; // Only for update, skipped if the sb is updated again before this is written
+    sisl::io_blob_safe buf; // Copy of the caller's context data
+    folly::Promise< void* > promise;
+};
+
+// in-memory only, writes deferred while a batch of async adds/updates are applied. The writes are issued in 3 steps,
+// each one waiting for the previous to complete, so that a crash at any point leaves the on-disk chain consistent:
+// 1. overflow blks (headers and data) of all the sbs in the batch
+// 2. all new and updated meta blks (new ones are not reachable from the chain yet)
+// 3. the meta blk which was last before the batch (or ssb), which links the new meta blks into the chain
+// Overflow blks replaced by updates are freed only after all the steps are done, so that they are not reused while
+// the on-disk meta blk still points to them.
+struct meta_write_batch {
+    BlkId link_bid;                                           // meta blk which was the last when the batch started
+    std::vector< folly::Future< std::error_code > > ovf_futs; // Writes of step 1
+    std::vector< uint8_t* > ovf_bufs;                         // Aligned copies of the context data, owned by batch
+    std::set< meta_blk* > mblks;                              // Meta blks to be written in step 2 or 3
+    bool ssb_dirty{false};
+    std::vector< BlkId > ovf_to_free;
+};
+
 // static assert to make sure no field to be between padding and data_bid.
 static_assert(sizeof(meta_blk_ovf_hdr) == MAX_BLK_OVF_HDR_MAX_SZ);
 static_assert(META_BLK_HDR_MAX_SZ % CONTEXT_DATA_OFFSET_ALIGNMENT == 0);
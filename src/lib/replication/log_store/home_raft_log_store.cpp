@@ -38,24 +38,26 @@ static constexpr store_lsn_t to_store_lsn(uint64_t raft_lsn) { return s_cast< st
 static constexpr store_lsn_t to_store_lsn(repl_lsn_t repl_lsn) { return repl_lsn - 1; }
 static constexpr repl_lsn_t to_repl_lsn(store_lsn_t store_lsn) { return store_lsn + 1; }
 
-static nuraft::ptr< nuraft::log_entry > to_nuraft_log_entry(const log_buffer& log_bytes) {
-    uint8_t const* raw_ptr = log_bytes.bytes();
+static nuraft::ptr< nuraft::log_entry > to_nuraft_log_entry(uint8_t const* raw_ptr, size_t size) {
     uint64_t term = *r_cast< uint64_t const* >(raw_ptr);
     raw_ptr += sizeof(uint64_t);
     nuraft::log_val_type type = static_cast< nuraft::log_val_type >(*raw_ptr);
     raw_ptr += sizeof(nuraft::log_val_type);
 
-    size_t data_len = log_bytes.size() - sizeof(uint64_t) - sizeof(nuraft::log_val_type);
+    size_t data_len = size - sizeof(uint64_t) - sizeof(nuraft::log_val_type);
     auto nb = nuraft::buffer::alloc(data_len);
     nb->put_raw(raw_ptr, data_len);
     return nuraft::cs_new< nuraft::log_entry >(term, nb, type);
 }
 
-static uint64_t extract_term(const log_buffer& log_bytes) {
-    uint8_t const* raw_ptr = log_bytes.bytes();
-    return (*r_cast< uint64_t const* >(raw_ptr));
+static nuraft::ptr< nuraft::log_entry > to_nuraft_log_entry(const log_buffer& log_bytes) {
+    return to_nuraft_log_entry(log_bytes.bytes(), log_bytes.size());
 }
 
+static uint64_t extract_term(uint8_t const* raw_ptr) { return (*r_cast< uint64_t const* >(raw_ptr)); }
+
+static uint64_t extract_term(const log_buffer& log_bytes) { return extract_term(log_bytes.bytes()); }
+
 HomeRaftLogStore::HomeRaftLogStore(logstore_id_t logstore_id) {
     m_dummy_log_entry = nuraft::cs_new< nuraft::log_entry >(0, nuraft::buffer::alloc(0), nuraft::log_val_type::app_log);
 
@@ -72,11 +74,22 @@ HomeRaftLogStore::HomeRaftLogStore(logstore_id_t logstore_id) {
                                               m_log_store = std::move(log_store);
                                               DEBUG_ASSERT_EQ(m_logstore_id, m_log_store->get_store_id(),
                                                               "Mismatch in passed and create logstore id");
+                                              m_log_store->register_log_found_cb(
+                                                  [this](store_lsn_t lsn, log_buffer buf, void*) {
+                                                      on_log_found(lsn, std::move(buf));
+                                                  });
                                               REPL_STORE_LOG(DEBUG, "Home Log store created/opened successfully");
                                           });
     }
 }
 
+void HomeRaftLogStore::on_log_found(store_lsn_t lsn, log_buffer buf) {
+    // Rebuild the term index as the logs are replayed
+    std::unique_lock lg{m_index_mtx};
+    index_append(to_repl_lsn(lsn), extract_term(buf));
+    m_last_log_bytes = std::move(buf);
+}
+
 void HomeRaftLogStore::remove_store() {
     REPL_STORE_LOG(DEBUG, "Logstore is being physically removed");
     logstore_service().remove_log_store(LogStoreService::DATA_LOG_FAMILY_IDX, m_logstore_id);
@@ -101,6 +114,15 @@ nuraft::ptr< nuraft::log_entry > HomeRaftLogStore::last_entry() const {
     REPL_STORE_LOG(DEBUG, "last_entry() store seqnum={}", max_seq);
     if (max_seq < 0) { return m_dummy_log_entry; }
 
+    {
+        // Build the entry from the copy of last appended or replayed entry we hold, which avoids the read
+        std::unique_lock lg{m_index_mtx};
+        if (to_repl_lsn(max_seq) == m_index_last_lsn) {
+            if (m_last_buf) { return to_nuraft_log_entry(m_last_buf->data_begin(), m_last_buf->size()); }
+            if (m_last_log_bytes.size()) { return to_nuraft_log_entry(m_last_log_bytes); }
+        }
+    }
+
     nuraft::ptr< nuraft::log_entry > nle;
     try {
         auto log_bytes = m_log_store->read_sync(max_seq);
@@ -124,6 +146,10 @@ ulong HomeRaftLogStore::append(raft_buf_ptr_t& buffer) {
     auto next_seq = m_log_store->append_async(
         sisl::io_blob{buffer->data_begin(), uint32_cast(buffer->size()), false /* is_aligned */}, nullptr /* cookie */,
         [buffer](int64_t, sisl::io_blob&, logdev_key, void*) {});
+
+    std::unique_lock lg{m_index_mtx};
+    index_append(to_repl_lsn(next_seq), extract_term(buffer->data_begin()));
+    m_last_buf = buffer;
     return to_repl_lsn(next_seq);
 }
 
@@ -134,6 +160,10 @@ void HomeRaftLogStore::write_at(ulong index, nuraft::ptr< nuraft::log_entry >& e
 
 void HomeRaftLogStore::write_at(ulong index, raft_buf_ptr_t& buffer) {
     m_log_store->rollback_async(to_store_lsn(index) - 1, nullptr);
+    {
+        std::unique_lock lg{m_index_mtx};
+        index_rollback(s_cast< repl_lsn_t >(index) - 1);
+    }
     // we need to reset the durable lsn, because its ok to set to lower number as it will be updated on next flush
     // calls, but it is dangerous to set higher number.
     m_last_durable_lsn = -1;
@@ -146,6 +176,10 @@ void HomeRaftLogStore::end_of_append_batch(ulong start, ulong cnt) {
     m_last_durable_lsn = end_lsn;
 }
 
+void HomeRaftLogStore::flush_async(ulong upto_index, std::function< void() > cb) {
+    m_log_store->flush_async(to_store_lsn(upto_index), std::move(cb));
+}
+
 nuraft::ptr< std::vector< nuraft::ptr< nuraft::log_entry > > > HomeRaftLogStore::log_entries(ulong start, ulong end) {
     auto out_vec = std::make_shared< std::vector< nuraft::ptr< nuraft::log_entry > > >();
     m_log_store->foreach (to_store_lsn(start), [end, &out_vec](store_lsn_t cur, const log_buffer& entry) -> bool {
@@ -170,6 +204,11 @@ nuraft::ptr< nuraft::log_entry > HomeRaftLogStore::entry_at(ulong index) {
 
 ulong HomeRaftLogStore::term_at(ulong index) {
     ulong term;
+    {
+        std::unique_lock lg{m_index_mtx};
+        if (index_lookup(s_cast< repl_lsn_t >(index), term)) { return term; }
+    }
+
     try {
         auto log_bytes = m_log_store->read_sync(to_store_lsn(index));
         term = extract_term(log_bytes);
@@ -220,6 +259,8 @@ void HomeRaftLogStore::apply_pack(ulong index, nuraft::buffer& pack) {
     if (index < slot) {
         // We are asked to apply/insert data behind next slot, so we must rollback before index and then append
         m_log_store->rollback_async(to_store_lsn(index) - 1, nullptr);
+        std::unique_lock lg{m_index_mtx};
+        index_rollback(s_cast< repl_lsn_t >(index) - 1);
     } else if (index > slot) {
         // We are asked to apply/insert data after next slot, so we need to fill in with dummy entries upto the slot
         // before append the entries
@@ -238,6 +279,15 @@ void HomeRaftLogStore::apply_pack(ulong index, nuraft::buffer& pack) {
         [[maybe_unused]] auto store_sn =
             m_log_store->append_async(sisl::io_blob{entry, uint32_cast(entry_len), false}, nullptr, nullptr);
         REPL_STORE_LOG(TRACE, "unpacking nth_entry={} of size={}, lsn={}", i + 1, entry_len, to_repl_lsn(store_sn));
+
+        std::unique_lock lg{m_index_mtx};
+        index_append(to_repl_lsn(store_sn), extract_term(entry));
+        if (i == num_entries - 1) {
+            // pack is owned by the caller, so keep a copy of the last entry
+            m_last_buf = nuraft::buffer::alloc(entry_len);
+            m_last_buf->put_raw(entry, entry_len);
+            m_last_buf->pos(0);
+        }
     }
     m_log_store->flush_sync(to_store_lsn(index) + num_entries - 1);
 }
@@ -252,6 +302,9 @@ bool HomeRaftLogStore::compact(ulong compact_lsn) {
     }
     m_log_store->flush_sync(to_store_lsn(compact_lsn));
     m_log_store->truncate(to_store_lsn(compact_lsn));
+
+    std::unique_lock lg{m_index_mtx};
+    index_compact(s_cast< repl_lsn_t >(compact_lsn));
     return true;
 }
 
@@ -264,4 +317,54 @@ ulong HomeRaftLogStore::last_durable_index() {
     m_last_durable_lsn = m_log_store->get_contiguous_completed_seq_num(m_last_durable_lsn);
     return to_repl_lsn(m_last_durable_lsn);
 }
+
+void HomeRaftLogStore::index_append(repl_lsn_t lsn, ulong term) {
+    if (lsn <= m_index_last_lsn) { index_rollback(lsn - 1); }
+    if (lsn != m_index_last_lsn + 1) {
+        // There is a hole in the lsns, index can only cover the contiguous lsns from here on
+        m_term_runs.clear();
+        m_index_start_lsn = lsn;
+    }
+    if (m_term_runs.empty() || (std::prev(m_term_runs.end())->second != term)) { m_term_runs.emplace(lsn, term); }
+    m_index_last_lsn = lsn;
+    m_last_buf.reset();
+    m_last_log_bytes = log_buffer{};
+}
+
+void HomeRaftLogStore::index_rollback(repl_lsn_t to_lsn) {
+    if (to_lsn >= m_index_last_lsn) { return; }
+    m_term_runs.erase(m_term_runs.upper_bound(to_lsn), m_term_runs.end());
+    if (to_lsn < m_index_start_lsn) {
+        m_term_runs.clear();
+        m_index_start_lsn = to_lsn + 1;
+    }
+    m_index_last_lsn = to_lsn;
+    m_last_buf.reset();
+    m_last_log_bytes = log_buffer{};
+}
+
+void HomeRaftLogStore::index_compact(repl_lsn_t upto_lsn) {
+    if (upto_lsn < m_index_start_lsn) { return; }
+    if (upto_lsn >= m_index_last_lsn) {
+        m_term_runs.clear();
+        m_index_start_lsn = upto_lsn + 1;
+        m_index_last_lsn = upto_lsn;
+        m_last_buf.reset();
+        m_last_log_bytes = log_buffer{};
+        return;
+    }
+
+    // Trim the run containing the new start lsn and drop all runs before it
+    auto it = std::prev(m_term_runs.upper_bound(upto_lsn + 1));
+    auto const term = it->second;
+    m_term_runs.erase(m_term_runs.begin(), std::next(it));
+    m_term_runs.emplace(upto_lsn + 1, term);
+    m_index_start_lsn = upto_lsn + 1;
+}
+
+bool HomeRaftLogStore::index_lookup(repl_lsn_t lsn, ulong& out_term) const {
+    if ((lsn < m_index_start_lsn) || (lsn > m_index_last_lsn)) { return false; }
+    out_term = std::prev(m_term_runs.upper_bound(lsn))->second;
+    return true;
+}
 } // namespace homestore
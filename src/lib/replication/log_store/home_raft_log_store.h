@@ -14,6 +14,9 @@
  *********************************************************************************/
 #pragma once
 
+#include <map>
+#include <mutex>
+
 #include <homestore/replication/repl_decls.h>
 #include <homestore/logstore_service.hpp>
 
@@ -95,6 +98,14 @@ public:
      */
     virtual void end_of_append_batch(ulong start, ulong cnt) override;
 
+    /**
+     * Asynchronously flush the log entries upto the given log index.
+     *
+     * @param upto_index Log index number upto which entries are to be flushed (inclusive)
+     * @param cb Callback once they are flushed
+     */
+    void flush_async(ulong upto_index, std::function< void() > cb);
+
     /**
      * Get log entries with index [start, end).
      *
@@ -171,10 +182,29 @@ public:
 
     logstore_id_t logstore_id() const { return m_logstore_id; }
 
+private:
+    void on_log_found(store_lsn_t lsn, log_buffer buf);
+
+    // Term index related methods, all of them expect m_index_mtx to be held
+    void index_append(repl_lsn_t lsn, ulong term);
+    void index_rollback(repl_lsn_t to_lsn);
+    void index_compact(repl_lsn_t upto_lsn);
+    bool index_lookup(repl_lsn_t lsn, ulong& out_term) const;
+
 private:
     logstore_id_t m_logstore_id;
     shared< HomeLogStore > m_log_store;
     nuraft::ptr< nuraft::log_entry > m_dummy_log_entry;
     store_lsn_t m_last_durable_lsn{-1};
+
+    // In memory run length index of lsn -> term, to serve term_at and last_entry without reading the log store.
+    // Terms change rarely, so a handful of runs cover the entire log. It covers the contiguous range of lsns
+    // [m_index_start_lsn, m_index_last_lsn], lookups outside of it fall back to reading the log store.
+    mutable std::mutex m_index_mtx;
+    std::map< repl_lsn_t, ulong > m_term_runs; // Start lsn of a run -> term of all lsns in the run
+    repl_lsn_t m_index_start_lsn{1};
+    repl_lsn_t m_index_last_lsn{0};
+    raft_buf_ptr_t m_last_buf;   // Serialized entry at m_index_last_lsn, if it was appended since start
+    log_buffer m_last_log_bytes; // Serialized entry at m_index_last_lsn, if it was found during log replay
 };
 } // namespace homestore
\ No newline at end of file
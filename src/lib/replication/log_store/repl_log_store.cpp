@@ -1,11 +1,44 @@
+#include <folly/executors/InlineExecutor.h>
 #include <sisl/fds/vector_pool.hpp>
 #include "replication/log_store/repl_log_store.h"
 #include "replication/repl_dev/raft_state_machine.h"
 #include "replication/repl_dev/raft_repl_dev.h"
+#include "replication/service/raft_repl_service.h"
 #include "replication/repl_dev/common.h"
 
 namespace homestore {
 
+uint64_t PendingAppendBatches::add(ulong start_lsn, ulong end_lsn) {
+    std::unique_lock lg{m_mtx};
+    auto const batch_id = ++m_next_batch_id;
+    m_batches.insert_or_assign(start_lsn, batch_info{.end_lsn = end_lsn, .batch_id = batch_id});
+    return batch_id;
+}
+
+void PendingAppendBatches::complete(ulong start_lsn, uint64_t batch_id) {
+    std::unique_lock lg{m_mtx};
+    if (auto const it = m_batches.find(start_lsn); (it != m_batches.end()) && (it->second.batch_id == batch_id)) {
+        m_batches.erase(it);
+    }
+}
+
+void PendingAppendBatches::truncate(ulong from_lsn) {
+    std::unique_lock lg{m_mtx};
+    auto it = m_batches.lower_bound(from_lsn);
+    m_batches.erase(it, m_batches.end());
+
+    // Batch which straddles the truncation point is still pending for the entries before it
+    if (!m_batches.empty()) {
+        auto& last = m_batches.rbegin()->second;
+        last.end_lsn = std::min(last.end_lsn, from_lsn - 1);
+    }
+}
+
+ulong PendingAppendBatches::durable_upto(ulong durable_lsn) const {
+    std::unique_lock lg{m_mtx};
+    return m_batches.empty() ? durable_lsn : std::min(durable_lsn, m_batches.begin()->first - 1);
+}
+
 uint64_t ReplLogStore::append(nuraft::ptr< nuraft::log_entry >& entry) {
     repl_req_ptr_t rreq = m_sm.transform_journal_entry(entry);
     ulong lsn;
@@ -20,6 +53,9 @@ uint64_t ReplLogStore::append(nuraft::ptr< nuraft::log_entry >& entry) {
 }
 
 void ReplLogStore::write_at(ulong index, nuraft::ptr< nuraft::log_entry >& entry) {
+    // Log from index is being overwritten, batches appended there earlier are not going to be durable
+    m_pending_batches.truncate(index);
+
     repl_req_ptr_t rreq = m_sm.transform_journal_entry(entry);
     if (rreq) {
         HomeRaftLogStore::write_at(index, rreq->raft_journal_buf());
@@ -31,38 +67,65 @@ void ReplLogStore::write_at(ulong index, nuraft::ptr< nuraft::log_entry >& entry
 }
 
 void ReplLogStore::end_of_append_batch(ulong start_lsn, ulong count) {
-    // Skip this call in leader, since this method will synchronously flush the data, which is not required for
-    // leader. Leader will call the flush as part of commit after receiving quorum, upon which time, there is a high
-    // possibility the log entry is already flushed.
-    if (!m_rd.is_leader()) {
-        int64_t end_lsn = int64_cast(start_lsn + count - 1);
-
-        // Start fetch the batch of data for this lsn range from remote if its not available yet.
-        auto reqs = sisl::VectorPool< repl_req_ptr_t >::alloc();
-        for (int64_t lsn = int64_cast(start_lsn); lsn <= end_lsn; ++lsn) {
-            reqs->emplace_back(m_sm.lsn_to_req(lsn));
-        }
-
-        // Check the map if data corresponding to all of these requsts have been received and written. If not, schedule
-        // a fetch and write. Once all requests are completed and written, these requests are poped out of the map and
-        // the future will be ready.
-        auto fut = m_rd.notify_after_data_written(reqs);
-
-        // In the meanwhile, we can flush the journal for this lsn batch. It is ok to flush the entries in log before
-        // actual data is written, because, even if we have the log, it doesn't mean data is committed, until state
-        // machine reports that. This way the flush and fetch both can run in parallel.
-        HomeRaftLogStore::end_of_append_batch(start_lsn, count);
-
-        // Wait for the fetch and write to be completed successfully.
-        std::move(fut).get();
-
-        // Mark all the pbas also completely written
-        for (auto const& rreq : *reqs) {
-            if (rreq) { rreq->state.fetch_or(uint32_cast(repl_req_state_t::LOG_FLUSHED)); }
-        }
-
-        sisl::VectorPool< repl_req_ptr_t >::free(reqs);
+    // Appended entries are acked to raft asynchronously (parallel log appending), through last_durable_index() and
+    // notify_log_append_completion() once they are durable, so that the append thread is not held for the flush.
+    ulong const end_lsn = start_lsn + count - 1;
+    if (m_rd.is_leader()) {
+        // Leader has the data written by itself before the commit, it only needs the log to be flushed. Let it flush
+        // in parallel to the followers appending them.
+        HomeRaftLogStore::flush_async(end_lsn, [this, start_lsn, end_lsn]() {
+            for (auto lsn = int64_cast(start_lsn); lsn <= int64_cast(end_lsn); ++lsn) {
+                auto const rreq = m_sm.lsn_to_req(lsn);
+                if (rreq == nullptr) { continue; }
+                rreq->state.fetch_or(uint32_cast(repl_req_state_t::LOG_FLUSHED));
+                HISTOGRAM_OBSERVE(m_rd.metrics(), rdev_leader_log_flush_latency,
+                                  get_elapsed_time_us(rreq->propose_time));
+            }
+            m_rd.raft_server()->notify_log_append_completion(true);
+        });
+        return;
+    }
+
+    // Start fetch the batch of data for this lsn range from remote if its not available yet.
+    auto reqs = sisl::VectorPool< repl_req_ptr_t >::alloc();
+    for (auto lsn = int64_cast(start_lsn); lsn <= int64_cast(end_lsn); ++lsn) {
+        reqs->emplace_back(m_sm.lsn_to_req(lsn));
     }
+
+    auto const batch_id = m_pending_batches.add(start_lsn, end_lsn);
+
+    // Check the map if data corresponding to all of these requsts have been received and written. If not, schedule
+    // a fetch and write. Once all requests are completed and written, these requests are poped out of the map and
+    // the future will be ready.
+    auto data_fut = m_rd.notify_after_data_written(reqs);
+
+    // In the meanwhile, we can flush the journal for this lsn batch. It is ok to flush the entries in log before
+    // actual data is written, because, even if we have the log, it doesn't mean data is committed, until state
+    // machine reports that. This way the flush and fetch both can run in parallel.
+    auto flush_promise = std::make_shared< folly::Promise< folly::Unit > >();
+    auto flush_fut = flush_promise->getSemiFuture();
+    HomeRaftLogStore::flush_async(end_lsn, [flush_promise]() { flush_promise->setValue(); });
+
+    // Once both are done, the batch is durable, let raft know so that it acks the leader
+    folly::collectAll(std::move(data_fut), std::move(flush_fut))
+        .via(&folly::InlineExecutor::instance())
+        .thenValue([this, reqs, start_lsn, batch_id](auto&&) {
+            // Mark all the pbas also completely written
+            for (auto const& rreq : *reqs) {
+                if (rreq) { rreq->state.fetch_or(uint32_cast(repl_req_state_t::LOG_FLUSHED)); }
+            }
+            sisl::VectorPool< repl_req_ptr_t >::free(reqs);
+
+            m_pending_batches.complete(start_lsn, batch_id);
+            m_rd.raft_server()->notify_log_append_completion(true);
+        });
+}
+
+ulong ReplLogStore::last_durable_index() {
+    auto durable_lsn = HomeRaftLogStore::last_durable_index();
+
+    // Log could be flushed ahead of the data of a batch, in which case durable only upto the batch
+    return m_pending_batches.durable_upto(durable_lsn);
 }
 
 std::string ReplLogStore::rdev_name() const { return m_rd.rdev_name(); }
@@ -1,7 +1,7 @@
 #pragma once
 
+#include <map>
 #include <mutex>
-#include <condition_variable>
 #include "replication/log_store/home_raft_log_store.h"
 
 namespace homestore {
@@ -9,13 +9,31 @@ namespace homestore {
 class RaftReplDev;
 class RaftStateMachine;
 
+// Append batches of a follower whose data or log is not durable yet, log is durable only upto the first of them. Each
+// batch gets an id, so that the completion of a batch truncated by raft doesn't remove a newer one at the same lsn.
+class PendingAppendBatches {
+public:
+    uint64_t add(ulong start_lsn, ulong end_lsn);
+    void complete(ulong start_lsn, uint64_t batch_id);
+    void truncate(ulong from_lsn);
+    ulong durable_upto(ulong durable_lsn) const;
+
+private:
+    struct batch_info {
+        ulong end_lsn;
+        uint64_t batch_id;
+    };
+
+    mutable std::mutex m_mtx;
+    std::map< ulong, batch_info > m_batches; // Start lsn -> batch
+    uint64_t m_next_batch_id{0};
+};
+
 class ReplLogStore : public HomeRaftLogStore {
 private:
     RaftReplDev& m_rd;
     RaftStateMachine& m_sm;
-    std::mutex m_batch_mtx;
-    std::condition_variable m_batch_cv;
-    int64_t m_batch_lsn{0};
+    PendingAppendBatches m_pending_batches;
 
 public:
     template < typename... Args >
@@ -25,6 +43,10 @@ public:
     uint64_t append(nuraft::ptr< nuraft::log_entry >& entry) override;
     void write_at(ulong index, nuraft::ptr< nuraft::log_entry >& entry) override;
     void end_of_append_batch(ulong start_lsn, ulong count) override;
+    ulong last_durable_index() override;
+
+    // Raft rolled back the log at lsn, batches from there on are not going to be durable
+    void on_rollback(ulong lsn) { m_pending_batches.truncate(lsn); }
 
 private:
     std::string rdev_name() const;
@@ -1,4 +1,5 @@
 #include <boost/smart_ptr/intrusive_ref_counter.hpp>
+#include <folly/MPMCQueue.h>
 #include <sisl/grpc/generic_service.hpp>
 #include <sisl/grpc/rpc_call.hpp>
 #include <homestore/replication/repl_dev.h>
@@ -21,6 +22,31 @@ repl_req_ctx::~repl_req_ctx() {
     if (journal_entry) { journal_entry->~repl_journal_entry(); }
 }
 
+// Followers create the reqs on the data channel or raft threads and release them on the commit thread, so the cache of
+// free reqs is shared by all threads, unlike a per thread freelist which would only fill up on the releasing thread.
+static constexpr uint32_t s_max_cached_reqs{4096};
+static struct free_req_cache {
+    folly::MPMCQueue< void* > reqs{s_max_cached_reqs};
+
+    ~free_req_cache() {
+        void* ptr;
+        while (reqs.read(ptr)) {
+            ::operator delete(ptr);
+        }
+    }
+} s_free_reqs;
+
+void* repl_req_ctx::operator new(size_t size) {
+    void* ptr;
+    if ((size == sizeof(repl_req_ctx)) && s_free_reqs.reqs.read(ptr)) { return ptr; }
+    return ::operator new(size);
+}
+
+void repl_req_ctx::operator delete(void* ptr, size_t size) {
+    if ((size == sizeof(repl_req_ctx)) && s_free_reqs.reqs.write(ptr)) { return; }
+    ::operator delete(ptr);
+}
+
 raft_buf_ptr_t& repl_req_ctx::raft_journal_buf() { return std::get< raft_buf_ptr_t >(journal_buf); }
 uint8_t* repl_req_ctx::raw_journal_buf() { return std::get< std::unique_ptr< uint8_t[] > >(journal_buf).get(); }
 
@@ -32,7 +58,8 @@ static std::string req_state_name(uint32_t state) {
     if (state & (uint32_t)repl_req_state_t::DATA_RECEIVED) { ret += "DATA_RECEIVED | "; }
     if (state & (uint32_t)repl_req_state_t::DATA_WRITTEN) { ret += "DATA_WRITTEN | "; }
     if (state & (uint32_t)repl_req_state_t::LOG_RECEIVED) { ret += "LOG_RECEIVED | "; }
-    if (state & (uint32_t)repl_req_state_t::LOG_FLUSHED) { ret += "LOG_FLUSHED"; }
+    if (state & (uint32_t)repl_req_state_t::LOG_FLUSHED) { ret += "LOG_FLUSHED | "; }
+    if (state & (uint32_t)repl_req_state_t::ROLLED_BACK) { ret += "ROLLED_BACK"; }
     return ret;
 }
 
@@ -15,6 +15,7 @@
 #pragma once
 
 #include <boost/intrusive_ptr.hpp>
+#include <folly/concurrency/ConcurrentHashMap.h>
 
 #include <homestore/replication_service.hpp>
 #include <homestore/replication/repl_dev.h>
@@ -22,7 +23,15 @@
 #include <homestore/superblk_handler.hpp>
 
 namespace homestore {
-VENUM(journal_type_t, uint16_t, HS_LARGE_DATA = 0, HS_HEADER_ONLY = 1)
+// Map of the requests in flight on a follower by their repl_key, accessed concurrently by the data channel and raft
+// append threads. It is sharded on the hash, lookups are lock free and erased entries are reclaimed via hazard
+// pointers once no reader can be referring to them.
+using repl_key_req_map_t = folly::ConcurrentHashMap< repl_key, repl_req_ptr_t, repl_key::Hasher >;
+
+// HS_DATA_BATCH is a record of SoloReplDev carrying multiple entries. Its repl_journal_entry is followed by value_size
+// number of entries, each of them a uint32_t size followed by a repl_journal_entry (with its header, key and blkid) of
+// that size. The dsn of the record is the lsn of its first entry, the rest of them take the lsns following it.
+VENUM(journal_type_t, uint16_t, HS_LARGE_DATA = 0, HS_HEADER_ONLY = 1, HS_DATA_BATCH = 2)
 
 struct repl_journal_entry {
     static constexpr uint16_t JOURNAL_ENTRY_MAJOR = 1;
@@ -1,17 +1,24 @@
 #include <flatbuffers/idl.h>
 #include <flatbuffers/minireflect.h>
+#include <boost/uuid/string_generator.hpp>
 #include <folly/executors/InlineExecutor.h>
+#include <iomgr/iomgr_flip.hpp>
 
 #include <sisl/fds/buffer.hpp>
 #include <sisl/grpc/generic_service.hpp>
 #include <homestore/blkdata_service.hpp>
+#include <homestore/homestore.hpp>
+#include <homestore/checkpoint/cp_mgr.hpp>
 #include <homestore/logstore_service.hpp>
 #include <homestore/superblk_handler.hpp>
 
 #include "common/homestore_assert.hpp"
+#include "common/homestore_config.hpp"
 #include "replication/service/raft_repl_service.h"
 #include "replication/repl_dev/raft_repl_dev.h"
 #include "push_data_rpc_generated.h"
+#include "fetch_data_rpc_generated.h"
+#include "snapshot_data_generated.h"
 
 namespace homestore {
 std::atomic< uint64_t > RaftReplDev::s_next_group_ordinal{1};
@@ -30,6 +37,8 @@ RaftReplDev::RaftReplDev(RaftReplService& svc, superblk< raft_repl_dev_superblk
         m_next_dsn = m_rd_sb->last_applied_dsn + 1;
         m_commit_upto_lsn = m_rd_sb->commit_lsn;
         m_last_flushed_commit_lsn = m_commit_upto_lsn;
+        m_resync_upto_lsn = m_rd_sb->resync_lsn;
+        m_last_flushed_resync_lsn = m_rd_sb->resync_lsn;
         m_rdev_name = fmt::format("rdev{}", m_rd_sb->group_ordinal);
 
         // Its ok not to do compare exchange, because loading is always single threaded as of now
@@ -63,22 +72,87 @@ RaftReplDev::RaftReplDev(RaftReplService& svc, superblk< raft_repl_dev_superblk
            (load_existing ? "Existing" : "New"), group_id_str(), my_replica_id_str(), m_raft_server_id,
            m_commit_upto_lsn.load(), m_next_dsn.load());
     m_msg_mgr.bind_data_service_request(PUSH_DATA, m_group_id, bind_this(RaftReplDev::on_push_data_received, 1));
-    // m_msg_mgr.bind_data_service_request(FETCH_DATA, m_group_id, bind_this(RaftReplDev::on_fetch_data_received, 2));
+    m_msg_mgr.bind_data_service_request(PUSH_DATA_BATCH, m_group_id,
+                                        bind_this(RaftReplDev::on_push_data_batch_received, 1));
+    m_msg_mgr.bind_data_service_request(FETCH_DATA, m_group_id, bind_this(RaftReplDev::on_fetch_data_received, 1));
 }
 
 void RaftReplDev::use_config(json_superblk raft_config_sb) { m_raft_config_sb = std::move(raft_config_sb); }
 
 void RaftReplDev::async_alloc_write(sisl::blob const& header, sisl::blob const& key, sisl::sg_list const& value,
                                     repl_req_ptr_t rreq) {
-    if (!rreq) { auto rreq = repl_req_ptr_t(new repl_req_ctx{}); }
+    if (!rreq) { rreq = repl_req_ptr_t(new repl_req_ctx{}); }
     rreq->header = header;
     rreq->key = key;
     rreq->value = value;
+    rreq->created_time = Clock::now();
 
+    if (!admit_to_write_window(rreq)) {
+        // It will be started once the writes ahead of it are committed and make room for it
+        COUNTER_INCREMENT(metrics(), rdev_leader_window_waits, 1);
+        return;
+    }
+    start_leader_write(std::move(rreq));
+}
+
+bool RaftReplDev::admit_to_write_window(repl_req_ptr_t const& rreq) {
+    auto const max_bytes = uint64_cast(HS_DYNAMIC_CONFIG(consensus.leader_inflight_write_kb)) * 1024;
+    auto const max_writes = std::max(HS_DYNAMIC_CONFIG(consensus.leader_max_inflight_writes), 1u);
+
+    std::unique_lock lg{m_write_window_mtx};
+    // Always admit when nothing is in flight, so that a write larger than the window still makes progress. Once
+    // someone is waiting, everyone else waits behind it, to keep the writes in order of submission.
+    bool const has_room = (m_inflight_writes == 0) ||
+        (m_window_waiters.empty() && (m_inflight_writes < max_writes) &&
+         (m_inflight_write_bytes + rreq->value.size <= max_bytes));
+    if (!has_room) {
+        m_window_waiters.push_back(rreq);
+        return false;
+    }
+    ++m_inflight_writes;
+    m_inflight_write_bytes += rreq->value.size;
+    return true;
+}
+
+void RaftReplDev::release_write_window(repl_req_ctx const& rreq) {
+    auto const max_bytes = uint64_cast(HS_DYNAMIC_CONFIG(consensus.leader_inflight_write_kb)) * 1024;
+    auto const max_writes = std::max(HS_DYNAMIC_CONFIG(consensus.leader_max_inflight_writes), 1u);
+
+    std::vector< repl_req_ptr_t > admitted;
+    {
+        std::unique_lock lg{m_write_window_mtx};
+        --m_inflight_writes;
+        m_inflight_write_bytes -= rreq.value.size;
+        while (!m_window_waiters.empty()) {
+            auto const& next = m_window_waiters.front();
+            if ((m_inflight_writes != 0) &&
+                ((m_inflight_writes >= max_writes) || (m_inflight_write_bytes + next->value.size > max_bytes))) {
+                break;
+            }
+            ++m_inflight_writes;
+            m_inflight_write_bytes += next->value.size;
+            admitted.push_back(std::move(m_window_waiters.front()));
+            m_window_waiters.pop_front();
+        }
+    }
+
+    if (admitted.empty()) { return; }
+
+    // Window is released from the raft commit (or rollback) path, which should not be held up by the data writes and
+    // pushes of the admitted ones. Start them on a worker instead, in the order they were admitted.
+    iomanager.run_on_forget(iomgr::reactor_regex::random_worker, [this, admitted = std::move(admitted)]() mutable {
+        for (auto& next : admitted) {
+            start_leader_write(std::move(next));
+        }
+    });
+}
+
+void RaftReplDev::start_leader_write(repl_req_ptr_t rreq) {
     // If it is header only entry, directly propose to the raft
     if (rreq->value.size) {
         rreq->rkey =
             repl_key{.server_id = server_id(), .term = raft_server()->get_term(), .dsn = m_next_dsn.fetch_add(1)};
+        rreq->push_time = Clock::now();
         push_data_to_all_followers(rreq);
 
         // Step 1: Alloc Blkid
@@ -86,11 +160,15 @@ void RaftReplDev::async_alloc_write(sisl::blob const& header, sisl::blob const&
                                                 m_listener->get_blk_alloc_hints(rreq->header, rreq->value.size),
                                                 rreq->local_blkid);
         HS_REL_ASSERT_EQ(status, BlkAllocStatus::SUCCESS);
+        rreq->data_write_time = Clock::now();
+        HISTOGRAM_OBSERVE(metrics(), rdev_leader_alloc_latency,
+                          get_elapsed_time_us(rreq->created_time, rreq->data_write_time));
 
         // Write the data
         data_service().async_write(rreq->value, rreq->local_blkid).thenValue([this, rreq](auto&& err) {
             HS_REL_ASSERT(!err, "Error in writing data"); // TODO: Find a way to return error to the Listener
             rreq->state.fetch_or(uint32_cast(repl_req_state_t::DATA_WRITTEN));
+            HISTOGRAM_OBSERVE(metrics(), rdev_leader_data_write_latency, get_elapsed_time_us(rreq->data_write_time));
             m_state_machine->propose_to_raft(std::move(rreq));
         });
     } else {
@@ -101,83 +179,581 @@ void RaftReplDev::async_alloc_write(sisl::blob const& header, sisl::blob const&
 }
 
 void RaftReplDev::push_data_to_all_followers(repl_req_ptr_t rreq) {
-    auto& builder = rreq->fb_builder;
+    std::vector< repl_req_ptr_t > rreqs;
+    {
+        std::unique_lock lg{m_push_mtx};
+        m_pending_pushes.push_back(std::move(rreq));
+        if (m_pushes_in_flight >= std::max(HS_DYNAMIC_CONFIG(consensus.data_push_max_inflight), 1u)) {
+            // It will be pushed along with others, once one of the pushes in flight completes
+            return;
+        }
+        rreqs = pick_push_batch();
+        ++m_pushes_in_flight;
+    }
+    send_push_batch(std::move(rreqs));
+}
 
-    // Prepare the rpc request packet with all repl_reqs details
-    builder.FinishSizePrefixed(CreatePushDataRequest(builder, server_id(), rreq->rkey.term, rreq->rkey.dsn,
-                                                     builder.CreateVector(rreq->header.cbytes(), rreq->header.size()),
-                                                     builder.CreateVector(rreq->key.cbytes(), rreq->key.size()),
-                                                     rreq->value.size));
+// Expects m_push_mtx to be held
+std::vector< repl_req_ptr_t > RaftReplDev::pick_push_batch() {
+    auto const max_count = std::max(HS_DYNAMIC_CONFIG(consensus.data_push_batch_size), 1u);
+    auto const max_bytes = uint64_cast(HS_DYNAMIC_CONFIG(consensus.data_push_batch_bytes));
+
+    std::vector< repl_req_ptr_t > rreqs;
+    uint64_t batch_bytes{0};
+    auto it = m_pending_pushes.begin();
+    for (; (it != m_pending_pushes.end()) && (rreqs.size() < max_count); ++it) {
+        if (!rreqs.empty() && (batch_bytes + (*it)->value.size > max_bytes)) { break; }
+        batch_bytes += (*it)->value.size;
+        rreqs.push_back(std::move(*it));
+    }
+    m_pending_pushes.erase(m_pending_pushes.begin(), it);
+    return rreqs;
+}
 
-    rreq->pkts = sisl::io_blob::sg_list_to_ioblob_list(rreq->value);
-    rreq->pkts.insert(rreq->pkts.begin(), sisl::io_blob{builder.GetBufferPointer(), builder.GetSize(), false});
+void RaftReplDev::send_push_batch(std::vector< repl_req_ptr_t > rreqs) {
+    struct push_batch_pkt {
+        flatbuffers::FlatBufferBuilder builder;
+        sisl::io_blob_list_t pkts;
+        std::vector< repl_req_ptr_t > rreqs;
+    };
+    if (!HS_DYNAMIC_CONFIG(consensus.data_push_batch_rpc)) {
+        send_push_per_req(std::move(rreqs));
+        return;
+    }
 
-    /*RD_LOG(INFO, "Data Channel: Pushing data to all followers: rreq=[{}] data=[{}]", rreq->to_string(),
-           flatbuffers::FlatBufferToString(builder.GetBufferPointer() + sizeof(flatbuffers::uoffset_t),
-                                           PushDataRequestTypeTable()));*/
+    auto pkt = std::make_shared< push_batch_pkt >();
+    pkt->rreqs = std::move(rreqs);
+
+    // Prepare the rpc request packet with all repl_reqs details
+    auto& builder = pkt->builder;
+    auto const align_size = data_service().get_align_size();
+    std::vector< flatbuffers::Offset< PushDataRequest > > reqs;
+    reqs.reserve(pkt->rreqs.size());
+    for (auto const& rreq : pkt->rreqs) {
+        reqs.push_back(CreatePushDataRequest(builder, server_id(), rreq->rkey.term, rreq->rkey.dsn,
+                                             builder.CreateVector(rreq->header.cbytes(), rreq->header.size()),
+                                             builder.CreateVector(rreq->key.cbytes(), rreq->key.size()),
+                                             rreq->value.size));
+    }
+    builder.FinishSizePrefixed(CreatePushDataBatch(builder, builder.CreateVector(reqs), align_size));
+    pkt->pkts.emplace_back(sisl::io_blob{builder.GetBufferPointer(), builder.GetSize(), false});
+
+    // Data of each request starts at an aligned offset in the packet, padded with zeros. So if the rpc buffer on the
+    // follower is aligned, it can write the data directly from the rpc buffer.
+    static std::vector< uint8_t > s_zero_pad(align_size, 0);
+    uint64_t offset = builder.GetSize();
+    for (auto const& rreq : pkt->rreqs) {
+        auto const pad_size = sisl::round_up(offset, align_size) - offset;
+        if (pad_size) { pkt->pkts.emplace_back(sisl::io_blob{s_zero_pad.data(), uint32_cast(pad_size), false}); }
+
+        auto data_pkts = sisl::io_blob::sg_list_to_ioblob_list(rreq->value);
+        pkt->pkts.insert(pkt->pkts.end(), data_pkts.begin(), data_pkts.end());
+        offset += pad_size + rreq->value.size;
+    }
 
-    RD_LOG(INFO, "Data Channel: Pushing data to all followers: rreq=[{}]", rreq->to_compact_string());
+    RD_LOG(DEBUG, "Data Channel: Pushing batch of {} rreqs of size={} to all followers", pkt->rreqs.size(), offset);
 
     group_msg_service()
-        ->data_service_request_unidirectional(nuraft_mesg::role_regex::ALL, PUSH_DATA, rreq->pkts)
+        ->data_service_request_unidirectional(nuraft_mesg::role_regex::ALL, PUSH_DATA_BATCH, pkt->pkts)
         .via(&folly::InlineExecutor::instance())
-        .thenValue([this, rreq = std::move(rreq)](auto e) {
+        .thenValue([this, pkt](auto e) {
             // Release the buffer which holds the packets
-            RD_LOG(INFO, "Data Channel: Data push completed for rreq=[{}]", rreq->to_compact_string());
-            rreq->fb_builder.Release();
-            rreq->pkts.clear();
+            RD_LOG(DEBUG, "Data Channel: Data push completed for batch of {} rreqs", pkt->rreqs.size());
+            for (auto const& rreq : pkt->rreqs) {
+                HISTOGRAM_OBSERVE(metrics(), rdev_leader_push_latency, get_elapsed_time_us(rreq->push_time));
+            }
+            pkt->builder.Release();
+            pkt->pkts.clear();
+            pkt->rreqs.clear();
+            on_push_batch_done();
         });
 }
 
+// Followers on older versions only understand PUSH_DATA, so each request of the batch is sent as its own rpc, with the
+// data right after the flatbuffer. The batch slot is released once all of them are pushed.
+void RaftReplDev::send_push_per_req(std::vector< repl_req_ptr_t > rreqs) {
+    RD_LOG(DEBUG, "Data Channel: Pushing {} rreqs to all followers on push_data rpc", rreqs.size());
+
+    std::vector< folly::Future< folly::Unit > > futs;
+    futs.reserve(rreqs.size());
+    for (auto& rreq : rreqs) {
+        auto& builder = rreq->fb_builder;
+        builder.FinishSizePrefixed(CreatePushDataRequest(
+            builder, server_id(), rreq->rkey.term, rreq->rkey.dsn,
+            builder.CreateVector(rreq->header.cbytes(), rreq->header.size()),
+            builder.CreateVector(rreq->key.cbytes(), rreq->key.size()), rreq->value.size));
+
+        rreq->pkts = sisl::io_blob::sg_list_to_ioblob_list(rreq->value);
+        rreq->pkts.insert(rreq->pkts.begin(), sisl::io_blob{builder.GetBufferPointer(), builder.GetSize(), false});
+
+        futs.push_back(group_msg_service()
+                           ->data_service_request_unidirectional(nuraft_mesg::role_regex::ALL, PUSH_DATA, rreq->pkts)
+                           .via(&folly::InlineExecutor::instance())
+                           .thenValue([this, rreq](auto e) {
+                               // Release the buffer which holds the packets
+                               HISTOGRAM_OBSERVE(metrics(), rdev_leader_push_latency,
+                                                 get_elapsed_time_us(rreq->push_time));
+                               rreq->fb_builder.Release();
+                               rreq->pkts.clear();
+                           }));
+    }
+
+    folly::collectAllUnsafe(futs).via(&folly::InlineExecutor::instance()).thenValue([this](auto&&) {
+        on_push_batch_done();
+    });
+}
+
+void RaftReplDev::on_push_batch_done() {
+    std::vector< repl_req_ptr_t > rreqs;
+    {
+        std::unique_lock lg{m_push_mtx};
+        if (m_pending_pushes.empty()) {
+            --m_pushes_in_flight;
+            return;
+        }
+        // Reuse the slot for the requests which got queued while the pushes were in flight
+        rreqs = pick_push_batch();
+    }
+    send_push_batch(std::move(rreqs));
+}
+
+// Data of each request follows the flatbuffer in the rpc buffer, each one starting at sender's align_size offset.
+// Returns the location of the data of each request, after copying them into aligned_buf if they are not aligned for
+// local writes, or if the caller needs the data past the lifetime of buf (always_copy).
+static std::vector< uint8_t const* > locate_rpc_data(uint8_t const* buf, uint64_t buf_size, uint32_t sender_align_size,
+                                                     std::vector< uint32_t > const& sizes,
+                                                     sisl::io_blob_safe& aligned_buf, bool always_copy = false) {
+    auto const fb_size = flatbuffers::ReadScalar< flatbuffers::uoffset_t >(buf) + sizeof(flatbuffers::uoffset_t);
+    auto const align_size = data_service().get_align_size();
+
+    std::vector< uint8_t const* > data_ptrs;
+    data_ptrs.reserve(sizes.size());
+    uint64_t offset = fb_size;
+    uint64_t aligned_size{0};
+    bool is_aligned{true};
+    for (auto const size : sizes) {
+        offset = sisl::round_up(offset, sender_align_size);
+        data_ptrs.push_back(buf + offset);
+        is_aligned = is_aligned && ((r_cast< uintptr_t >(data_ptrs.back()) % align_size) == 0);
+        offset += size;
+        aligned_size += sisl::round_up(size, align_size);
+    }
+    HS_DBG_ASSERT_EQ(offset, buf_size, "Size mismatch of data size vs buffer size");
+
+    if (!is_aligned || always_copy) {
+        // Unaligned buffer, copy the data of all requests into one aligned buffer
+        aligned_buf = sisl::io_blob_safe(uint32_cast(aligned_size), align_size);
+        uint64_t dest_offset{0};
+        for (size_t i{0}; i < sizes.size(); ++i) {
+            std::memcpy(aligned_buf.bytes() + dest_offset, data_ptrs[i], sizes[i]);
+            data_ptrs[i] = aligned_buf.cbytes() + dest_offset;
+            dest_offset += sisl::round_up(sizes[i], align_size);
+        }
+    }
+    return data_ptrs;
+}
+
 void RaftReplDev::on_push_data_received(intrusive< sisl::GenericRpcData >& rpc_data) {
+    // Leaders which don't batch the pushes send a single request, with its data right after the flatbuffer
     auto const& incoming_buf = rpc_data->request_blob();
-    auto const fb_size =
-        flatbuffers::ReadScalar< flatbuffers::uoffset_t >(incoming_buf.cbytes()) + sizeof(flatbuffers::uoffset_t);
-    auto push_req = GetSizePrefixedPushDataRequest(incoming_buf.cbytes());
-    sisl::blob header = sisl::blob{push_req->user_header()->Data(), push_req->user_header()->size()};
-    sisl::blob key = sisl::blob{push_req->user_key()->Data(), push_req->user_key()->size()};
+    auto const* push_req = flatbuffers::GetSizePrefixedRoot< PushDataRequest >(incoming_buf.cbytes());
 
     RD_LOG(TRACE, "PushData received on data channel: {}",
            flatbuffers::FlatBufferToString(incoming_buf.cbytes() + sizeof(flatbuffers::uoffset_t),
                                            PushDataRequestTypeTable()));
+    handle_pushed_data(rpc_data, {push_req}, 1 /* sender_align_size */);
+}
 
-    auto rreq = follower_create_req(
-        repl_key{.server_id = push_req->issuer_replica_id(), .term = push_req->raft_term(), .dsn = push_req->dsn()},
-        header, key, push_req->data_size());
-    rreq->rpc_data = rpc_data;
+void RaftReplDev::on_push_data_batch_received(intrusive< sisl::GenericRpcData >& rpc_data) {
+    auto const& incoming_buf = rpc_data->request_blob();
+    auto push_batch = GetSizePrefixedPushDataBatch(incoming_buf.cbytes());
 
-    RD_LOG(INFO, "Data Channel: Received data rreq=[{}]", rreq->to_compact_string());
+    RD_LOG(TRACE, "PushDataBatch received on data channel: {}",
+           flatbuffers::FlatBufferToString(incoming_buf.cbytes() + sizeof(flatbuffers::uoffset_t),
+                                           PushDataBatchTypeTable()));
+    std::vector< PushDataRequest const* > push_reqs{push_batch->requests()->begin(), push_batch->requests()->end()};
+    handle_pushed_data(rpc_data, push_reqs, push_batch->align_size());
+}
 
-    if (rreq->state.fetch_or(uint32_cast(repl_req_state_t::DATA_RECEIVED)) &
-        uint32_cast(repl_req_state_t::DATA_RECEIVED)) {
-        // We already received the data before, just ignore this data
-        // TODO: Should we forcibly overwrite the data with new data?
+void RaftReplDev::handle_pushed_data(intrusive< sisl::GenericRpcData >& rpc_data,
+                                     std::vector< PushDataRequest const* > const& push_reqs,
+                                     uint32_t sender_align_size) {
+#ifdef _PRERELEASE
+    if (iomgr_flip::instance()->test_flip("drop_push_data")) {
+        // Simulate a push lost on the way, data of these requests has to be fetched from the originator
+        RD_LOG(INFO, "Data Channel: Dropping pushed data of {} rreqs, flip is set", push_reqs.size());
+        rpc_data->send_response();
         return;
     }
+#endif
+    auto const& incoming_buf = rpc_data->request_blob();
+    std::vector< uint32_t > sizes;
+    sizes.reserve(push_reqs.size());
+    for (auto const* push_req : push_reqs) {
+        sizes.push_back(push_req->data_size());
+    }
 
-    // Get the data portion from the buffer
-    HS_DBG_ASSERT_EQ(fb_size + push_req->data_size(), incoming_buf.size(), "Size mismatch of data size vs buffer size");
-    uint8_t const* data = incoming_buf.cbytes() + fb_size;
+    auto rpc_ctx = intrusive< data_rpc_ctx >(new data_rpc_ctx{});
+    rpc_ctx->rpc_data = rpc_data;
+    auto const data_ptrs =
+        locate_rpc_data(incoming_buf.cbytes(), incoming_buf.size(), sender_align_size, sizes, rpc_ctx->aligned_buf);
+
+    // Blks for the whole batch are allocated upfront in one go, leaving out the ones whose log arrived earlier and
+    // already have them allocated.
+    std::vector< repl_key > rkeys;
+    std::vector< sisl::blob > headers;
+    std::vector< sisl::blob > keys;
+    std::vector< uint32_t > alloc_sizes;
+    for (auto const* push_req : push_reqs) {
+        rkeys.push_back(repl_key{
+            .server_id = push_req->issuer_replica_id(), .term = push_req->raft_term(), .dsn = push_req->dsn()});
+        headers.emplace_back(push_req->user_header()->Data(), push_req->user_header()->size());
+        keys.emplace_back(push_req->user_key()->Data(), push_req->user_key()->size());
+
+        auto const it = m_repl_key_req_map.find(rkeys.back());
+        bool const allocated = (it != m_repl_key_req_map.cend()) &&
+            (it->second->state.load() & uint32_cast(repl_req_state_t::BLK_ALLOCATED));
+        alloc_sizes.push_back(allocated ? 0 : sisl::round_up(push_req->data_size(), get_blk_size()));
+    }
+    auto blkids = batch_alloc_blks(headers, alloc_sizes);
+
+    std::vector< repl_req_ptr_t > rreqs;
+    rreqs.reserve(push_reqs.size());
+    for (size_t i{0}; i < push_reqs.size(); ++i) {
+        auto rreq = follower_create_req(rkeys[i], headers[i], keys[i], sizes[i], &blkids[i]);
+        if (blkids[i].is_valid()) {
+            // Log raced with us and allocated the blks in the meantime, give back the ones allocated for it
+            data_service().async_free_blk(blkids[i]);
+        }
+        rreq->rpc_data = rpc_ctx;
+        RD_LOG(INFO, "Data Channel: Received data rreq=[{}]", rreq->to_compact_string());
+        rreqs.push_back(std::move(rreq));
+    }
+    write_received_data(rreqs, data_ptrs, sizes, nullptr /* data_holder */);
+}
 
-    if (((uintptr_t)data % data_service().get_align_size()) != 0) {
-        // Unaligned buffer, create a new buffer and copy the entire buf
-        rreq->buf_for_unaligned_data =
-            std::move(sisl::io_blob_safe(push_req->data_size(), data_service().get_align_size()));
-        std::memcpy(rreq->buf_for_unaligned_data.bytes(), data, push_req->data_size());
-        data = rreq->buf_for_unaligned_data.cbytes();
+std::vector< MultiBlkId > RaftReplDev::batch_alloc_blks(std::vector< sisl::blob > const& headers,
+                                                        std::vector< uint32_t > const& sizes) {
+    std::vector< MultiBlkId > blkids(sizes.size());
+    std::vector< size_t > group_idxs;
+    std::vector< uint32_t > group_sizes;
+    blk_alloc_hints group_hints;
+
+    // Consecutive entries with the same hints are allocated in one call, which attempts to place them back to back
+    auto const alloc_group = [&]() {
+        if (group_idxs.empty()) { return; }
+        std::vector< MultiBlkId > group_blkids;
+        auto const status = data_service().alloc_blks(group_sizes, group_hints, group_blkids);
+        RELEASE_ASSERT_EQ(status, BlkAllocStatus::SUCCESS, "alloc_blks returned null, no space left!");
+        for (size_t j{0}; j < group_idxs.size(); ++j) {
+            blkids[group_idxs[j]] = group_blkids[j];
+        }
+        group_idxs.clear();
+        group_sizes.clear();
+    };
+
+    for (size_t i{0}; i < sizes.size(); ++i) {
+        if (sizes[i] == 0) { continue; } // Entry doesn't need any blks
+        auto const hints = m_listener->get_blk_alloc_hints(headers[i], sizes[i]);
+        if (!group_idxs.empty() && !(hints == group_hints)) { alloc_group(); }
+        group_hints = hints;
+        group_idxs.push_back(i);
+        group_sizes.push_back(sisl::round_up(sizes[i], get_blk_size()));
     }
+    alloc_group();
+    return blkids;
+}
 
-    // Schedule a write and upon completion, mark the data as written.
-    data_service()
-        .async_write(r_cast< const char* >(data), push_req->data_size(), rreq->local_blkid)
-        .thenValue([this, rreq](auto&& err) {
-            RD_REL_ASSERT(!err, "Error in writing data"); // TODO: Find a way to return error to the Listener
-            rreq->state.fetch_or(uint32_cast(repl_req_state_t::DATA_WRITTEN));
-            rreq->data_written_promise.setValue();
-            RD_LOG(INFO, "Data Channel: Data Write completed rreq=[{}]", rreq->to_compact_string());
+void RaftReplDev::write_received_data(std::vector< repl_req_ptr_t > const& rreqs,
+                                      std::vector< uint8_t const* > const& data_ptrs,
+                                      std::vector< uint32_t > const& sizes, std::shared_ptr< void > data_holder) {
+    // Consecutive rreqs whose blks are adjacent on the device and whose data is adjacent in the buffer (which is
+    // typical when their blks were allocated as a batch) are written with a single io.
+    std::vector< repl_req_ptr_t > run;
+    uint8_t const* run_data{nullptr};
+    uint32_t run_size{0};
+    BlkId run_blkid;
+
+    auto const write_run = [&]() {
+        if (run.empty()) { return; }
+        MultiBlkId const blkid =
+            (run.size() == 1) ? run[0]->local_blkid : MultiBlkId{run_blkid.blk_num(), run_blkid.blk_count(),
+                                                                 run_blkid.chunk_num()};
+        data_service()
+            .async_write(r_cast< const char* >(run_data), run_size, blkid)
+            .thenValue([this, run = std::move(run), data_holder](auto&& err) {
+                RD_REL_ASSERT(!err, "Error in writing data"); // TODO: Find a way to return error to the Listener
+                for (auto const& rreq : run) {
+                    auto const prev = rreq->state.fetch_or(uint32_cast(repl_req_state_t::DATA_WRITTEN));
+                    if (prev & uint32_cast(repl_req_state_t::ROLLED_BACK)) {
+                        // Raft rolled back the log while its data was being written, blks are ours to free now
+                        data_service().async_free_blk(rreq->local_blkid);
+                    }
+                    rreq->data_written_promise.setValue();
+                    RD_LOG(INFO, "Data Channel: Data Write completed rreq=[{}]", rreq->to_compact_string());
+                }
+            });
+        run = std::vector< repl_req_ptr_t >{};
+        run_size = 0;
+    };
+
+    for (size_t i{0}; i < rreqs.size(); ++i) {
+        auto const& rreq = rreqs[i];
+        auto const prev = rreq->state.fetch_or(uint32_cast(repl_req_state_t::DATA_RECEIVED));
+        if (prev & uint32_cast(repl_req_state_t::DATA_RECEIVED)) {
+            // We already received the data before (either pushed or fetched), just ignore this data
+            // TODO: Should we forcibly overwrite the data with new data?
+            continue;
+        }
+        if (prev & uint32_cast(repl_req_state_t::ROLLED_BACK)) {
+            // Log is rolled back and its blks are already freed, nothing to write. Rollback has already released
+            // anyone waiting for the data.
+            continue;
+        }
+
+        auto const& bid = rreq->local_blkid;
+        bool const extends_run = !run.empty() && (bid.num_pieces() == 1) &&
+            (sizes[i] == bid.blk_count() * get_blk_size()) && (run_size == run_blkid.blk_count() * get_blk_size()) &&
+            (data_ptrs[i] == run_data + run_size) && (bid.chunk_num() == run_blkid.chunk_num()) &&
+            (bid.blk_num() == run_blkid.blk_num() + run_blkid.blk_count()) &&
+            (size_t{run_blkid.blk_count()} + bid.blk_count() <= max_blks_per_blkid());
+        if (extends_run) {
+            run_blkid = BlkId{run_blkid.blk_num(), blk_count_t(run_blkid.blk_count() + bid.blk_count()),
+                              run_blkid.chunk_num()};
+            run_size += sizes[i];
+        } else {
+            write_run();
+            run_data = data_ptrs[i];
+            run_size = sizes[i];
+            run_blkid = (bid.num_pieces() == 1) ? BlkId{bid.blk_num(), bid.blk_count(), bid.chunk_num()} : BlkId{};
+        }
+        run.push_back(rreq);
+    }
+    write_run();
+}
+
+void RaftReplDev::schedule_data_fetch(std::vector< repl_req_ptr_t > const& rreqs) {
+    std::unique_lock lg{m_fetch_mtx};
+    if (m_fetch_stopped) { return; }
+
+    // Only the ones whose data is yet to be received need a fetch, rest of them need not be held by the timer
+    for (auto const& rreq : rreqs) {
+        if (!(rreq->state.load() &
+              (uint32_cast(repl_req_state_t::DATA_RECEIVED) | uint32_cast(repl_req_state_t::ROLLED_BACK)))) {
+            m_pending_fetches.push_back(rreq);
+        }
+    }
+    if (m_pending_fetches.empty() || m_fetch_timer_armed) { return; }
+
+    // One timer per repl dev serves all the pending ones, which is cancelled when the repl dev is destroyed
+    m_fetch_timer_armed = true;
+    m_fetch_timer_hdl = iomanager.schedule_global_timer(
+        uint64_cast(HS_DYNAMIC_CONFIG(consensus.wait_data_write_timer_ms)) * 1000 * 1000, false /* recurring */,
+        nullptr /* cookie */, iomgr::reactor_regex::all_worker, [this](void*) { on_data_fetch_timer(); },
+        true /* wait_to_schedule */);
+}
+
+void RaftReplDev::on_data_fetch_timer() {
+    std::vector< repl_req_ptr_t > rreqs;
+    {
+        std::unique_lock lg{m_fetch_mtx};
+        m_fetch_timer_armed = false;
+        if (m_fetch_stopped) { return; }
+        rreqs.swap(m_pending_fetches);
+    }
+    check_and_fetch_remote_data(std::move(rreqs));
+}
+
+void RaftReplDev::destroy() {
+    bool timer_armed;
+    {
+        std::unique_lock lg{m_fetch_mtx};
+        m_fetch_stopped = true;
+        timer_armed = m_fetch_timer_armed;
+        m_fetch_timer_armed = false;
+        m_pending_fetches.clear();
+    }
+    if (timer_armed) { iomanager.cancel_timer(m_fetch_timer_hdl, true /* wait */); }
+}
+
+void RaftReplDev::check_and_fetch_remote_data(std::vector< repl_req_ptr_t > rreqs) {
+    // Data of some of them could have been pushed in the meantime, or raft could have rolled them back
+    rreqs.erase(std::remove_if(rreqs.begin(), rreqs.end(),
+                               [](repl_req_ptr_t const& rreq) {
+                                   return (rreq->state.load() &
+                                           (uint32_cast(repl_req_state_t::DATA_RECEIVED) |
+                                            uint32_cast(repl_req_state_t::ROLLED_BACK)));
+                               }),
+                rreqs.end());
+    if (rreqs.empty()) { return; }
+
+    // Fetch from the replica which originated the data, batching as many of them as possible in one rpc
+    std::map< int32_t, std::vector< repl_req_ptr_t > > originator_rreqs;
+    for (auto& rreq : rreqs) {
+        originator_rreqs[rreq->remote_blkid.server_id].push_back(std::move(rreq));
+    }
+
+    auto const max_batch_size = uint64_cast(HS_DYNAMIC_CONFIG(consensus.data_fetch_max_size_kb)) * 1024;
+    for (auto& [originator, reqs] : originator_rreqs) {
+        std::vector< repl_req_ptr_t > batch;
+        uint64_t batch_size{0};
+        for (auto& rreq : reqs) {
+            auto const size = uint64_cast(rreq->remote_blkid.blkid.blk_count()) * get_blk_size();
+            if (!batch.empty() && (batch_size + size > max_batch_size)) {
+                fetch_data_from_remote(originator, std::move(batch));
+                batch = std::vector< repl_req_ptr_t >{};
+                batch_size = 0;
+            }
+            batch.push_back(std::move(rreq));
+            batch_size += size;
+        }
+        if (!batch.empty()) { fetch_data_from_remote(originator, std::move(batch)); }
+    }
+}
+
+void RaftReplDev::fetch_data_from_remote(int32_t originator, std::vector< repl_req_ptr_t > rreqs) {
+    auto const srv_config = raft_server()->get_srv_config(originator);
+    if (srv_config == nullptr) {
+        RD_LOG(ERROR, "Data Channel: Originator server_id={} of data is not in the group, retrying fetch later",
+               originator);
+        schedule_data_fetch(rreqs);
+        return;
+    }
+    auto const originator_id = boost::uuids::string_generator()(srv_config->get_endpoint());
+
+    auto builder = std::make_shared< flatbuffers::FlatBufferBuilder >();
+    std::vector< flatbuffers::Offset< RequestEntry > > entries;
+    entries.reserve(rreqs.size());
+    for (auto const& rreq : rreqs) {
+        auto const blkid = rreq->remote_blkid.blkid.serialize();
+        entries.push_back(CreateRequestEntry(*builder, rreq->lsn, rreq->term(), rreq->dsn(), 0 /* user_header */,
+                                             0 /* user_key */, rreq->remote_blkid.server_id,
+                                             builder->CreateVector(blkid.cbytes(), blkid.size())));
+    }
+    builder->FinishSizePrefixed(
+        CreateFetchData(*builder, CreateFetchDataRequest(*builder, builder->CreateVector(entries)), 0 /* response */));
+
+    RD_LOG(INFO, "Data Channel: Fetching data of {} rreqs from originator server_id={}", rreqs.size(), originator);
+
+    group_msg_service()
+        ->data_service_request_bidirectional(
+            originator_id, FETCH_DATA,
+            sisl::io_blob_list_t{sisl::io_blob{builder->GetBufferPointer(), builder->GetSize(), false}})
+        .via(&folly::InlineExecutor::instance())
+        .thenValue([this, builder, rreqs = std::move(rreqs)](auto e) mutable {
+            if (!e) {
+                RD_LOG(ERROR, "Data Channel: Fetch data rpc of {} rreqs failed, retrying fetch later", rreqs.size());
+                schedule_data_fetch(rreqs);
+                return;
+            }
+            handle_fetch_data_response(std::move(e.value()), std::move(rreqs));
+        });
+}
+
+void RaftReplDev::on_fetch_data_received(intrusive< sisl::GenericRpcData >& rpc_data) {
+    auto const& incoming_buf = rpc_data->request_blob();
+    auto const* fetch_req = GetSizePrefixedFetchData(incoming_buf.cbytes())->request();
+    auto const& entries = *fetch_req->entries();
+    RD_LOG(DEBUG, "Data Channel: FetchData received for {} entries", entries.size());
+
+    // Read the data of all entries concurrently into one buffer, each one at an aligned offset, so that the response
+    // can be sent from it directly.
+    auto const align_size = data_service().get_align_size();
+    auto builder = std::make_shared< flatbuffers::FlatBufferBuilder >();
+    std::vector< flatbuffers::Offset< ResponseEntry > > resp_entries;
+    std::vector< MultiBlkId > blkids;
+    std::vector< uint32_t > sizes;
+    uint64_t total_size{0};
+    for (auto const* entry : entries) {
+        MultiBlkId blkid;
+        blkid.deserialize(sisl::blob{entry->remote_blkid()->Data(), entry->remote_blkid()->size()}, true /* copy */);
+        auto const size = uint32_cast(blkid.blk_count() * get_blk_size());
+        resp_entries.push_back(CreateResponseEntry(*builder, entry->lsn(), entry->dsn(), entry->raft_term(), size));
+        blkids.push_back(blkid);
+        sizes.push_back(size);
+        total_size += sisl::round_up(size, align_size);
+    }
+
+    auto data_buf = std::make_shared< sisl::io_blob_safe >(uint32_cast(total_size), align_size);
+    std::vector< folly::Future< std::error_code > > futs;
+    futs.reserve(blkids.size());
+    uint64_t offset{0};
+    for (size_t i{0}; i < blkids.size(); ++i) {
+        futs.emplace_back(data_service().async_read(blkids[i], data_buf->bytes() + offset, sizes[i]));
+        offset += sisl::round_up(sizes[i], align_size);
+    }
+
+    folly::collectAllUnsafe(futs).thenValue(
+        [this, rpc_data, builder, data_buf, resp_entries = std::move(resp_entries), align_size](auto&& vf) {
+            bool success{true};
+            for (auto const& err_c : vf) {
+                if (err_c.hasException() || err_c.value()) { success = false; }
+            }
+
+            sisl::io_blob_list_t pkts;
+            if (success) {
+                builder->FinishSizePrefixed(CreateFetchData(
+                    *builder, 0 /* request */,
+                    CreateFetchDataResponse(*builder, server_id(), builder->CreateVector(resp_entries), align_size)));
+                pkts.emplace_back(sisl::io_blob{builder->GetBufferPointer(), builder->GetSize(), false});
+
+                static std::vector< uint8_t > s_zero_pad(align_size, 0);
+                auto const pad_size = sisl::round_up(builder->GetSize(), align_size) - builder->GetSize();
+                if (pad_size) { pkts.emplace_back(sisl::io_blob{s_zero_pad.data(), uint32_cast(pad_size), false}); }
+                pkts.emplace_back(sisl::io_blob{data_buf->bytes(), data_buf->size(), false});
+            } else {
+                // Respond with no entries, requester will retry the fetch
+                RD_LOG(ERROR, "Data Channel: Error in reading data for fetch data request, responding with no data");
+                std::vector< flatbuffers::Offset< ResponseEntry > > no_entries;
+                builder->FinishSizePrefixed(CreateFetchData(
+                    *builder, 0 /* request */,
+                    CreateFetchDataResponse(*builder, server_id(), builder->CreateVector(no_entries), align_size)));
+                pkts.emplace_back(sisl::io_blob{builder->GetBufferPointer(), builder->GetSize(), false});
+            }
+
+            // Hold the buffers until the response is sent
+            rpc_data->set_comp_cb([builder, data_buf](boost::intrusive_ptr< sisl::GenericRpcData >&) {});
+            rpc_data->send_response(pkts);
         });
 }
 
+void RaftReplDev::handle_fetch_data_response(sisl::GenericClientResponse response,
+                                             std::vector< repl_req_ptr_t > rreqs) {
+    struct fetched_data {
+        sisl::GenericClientResponse response;
+        sisl::io_blob_safe aligned_buf;
+    };
+    auto fetched = std::make_shared< fetched_data >();
+    fetched->response = std::move(response);
+
+    auto const& resp_buf = fetched->response.response_blob();
+    auto const* fetch_resp = GetSizePrefixedFetchData(resp_buf.cbytes())->response();
+    auto const& entries = *fetch_resp->entries();
+
+    std::vector< uint32_t > sizes;
+    sizes.reserve(entries.size());
+    for (auto const* entry : entries) {
+        sizes.push_back(entry->data_size());
+    }
+    auto const data_ptrs =
+        locate_rpc_data(resp_buf.cbytes(), resp_buf.size(), fetch_resp->align_size(), sizes, fetched->aligned_buf);
+
+    // Response entries are in the same order as the requested ones, write them directly to the allocated blks
+    std::vector< repl_req_ptr_t > fetched_rreqs(rreqs.begin(), rreqs.begin() + entries.size());
+    for (flatbuffers::uoffset_t i{0}; i < entries.size(); ++i) {
+        RD_DBG_ASSERT_EQ(entries.Get(i)->dsn(), fetched_rreqs[i]->dsn(),
+                         "Fetch data response is not in the order of request");
+        RD_LOG(INFO, "Data Channel: Fetched data rreq=[{}]", fetched_rreqs[i]->to_compact_string());
+    }
+    write_received_data(fetched_rreqs, data_ptrs, sizes, fetched);
+
+    if (entries.size() < rreqs.size()) {
+        RD_LOG(ERROR, "Data Channel: Fetched data of only {} out of {} rreqs, retrying fetch later", entries.size(),
+               rreqs.size());
+        schedule_data_fetch(std::vector< repl_req_ptr_t >(rreqs.begin() + entries.size(), rreqs.end()));
+    }
+}
+
 static bool blob_equals(sisl::blob const& a, sisl::blob const& b) {
     if (a.size() != b.size()) { return false; }
     return (std::memcmp(a.cbytes(), b.cbytes(), a.size()) == 0);
@@ -191,10 +767,20 @@ static MultiBlkId do_alloc_blk(uint32_t size, blk_alloc_hints const& hints) {
 }
 
 repl_req_ptr_t RaftReplDev::follower_create_req(repl_key const& rkey, sisl::blob const& user_header,
-                                                sisl::blob const& user_key, uint32_t data_size) {
-    auto const [it, happened] = m_repl_key_req_map.try_emplace(rkey, repl_req_ptr_t(new repl_req_ctx()));
-    RD_DBG_ASSERT((it != m_repl_key_req_map.end()), "Unexpected error in map_repl_key_to_req");
-    auto rreq = it->second;
+                                                sisl::blob const& user_key, uint32_t data_size,
+                                                MultiBlkId* preallocated_blkid) {
+    // Data and log for the same key typically arrive close to each other, so the lookup is attempted first (which is
+    // lock free) instead of creating a new req upfront for every insert attempt.
+    repl_req_ptr_t rreq;
+    bool happened{false};
+    if (auto const it = m_repl_key_req_map.find(rkey); it != m_repl_key_req_map.cend()) {
+        rreq = it->second;
+    } else {
+        auto const [new_it, inserted] = m_repl_key_req_map.try_emplace(rkey, repl_req_ptr_t(new repl_req_ctx()));
+        RD_DBG_ASSERT((new_it != m_repl_key_req_map.end()), "Unexpected error in map_repl_key_to_req");
+        rreq = new_it->second;
+        happened = inserted;
+    }
 
     if (!happened) {
         // We already have the entry in the map, check if we are already allocated the blk by previous caller, in that
@@ -216,12 +802,39 @@ repl_req_ptr_t RaftReplDev::follower_create_req(repl_key const& rkey, sisl::blob
     rreq->rkey = rkey;
     rreq->header = user_header;
     rreq->key = user_key;
-    rreq->local_blkid = do_alloc_blk(data_size, m_listener->get_blk_alloc_hints(user_header, data_size));
+    if (preallocated_blkid && preallocated_blkid->is_valid()) {
+        // Caller allocated it as part of a batch, take the ownership of it
+        rreq->local_blkid = *preallocated_blkid;
+        *preallocated_blkid = MultiBlkId{};
+    } else {
+        rreq->local_blkid = do_alloc_blk(data_size, m_listener->get_blk_alloc_hints(user_header, data_size));
+    }
     rreq->state.fetch_or(uint32_cast(repl_req_state_t::BLK_ALLOCATED));
 
     return rreq;
 }
 
+void RaftReplDev::rollback_req(repl_req_ptr_t const& rreq) {
+    RD_LOG(INFO, "Raft channel: Rollback rreq=[{}]", rreq->to_compact_string());
+    m_listener->on_rollback(rreq->lsn, rreq->header, rreq->key, rreq);
+    m_repl_key_req_map.erase(rreq->rkey);
+
+    // Blks can be freed right away unless the data is being written to them, in which case the write completion
+    // frees them.
+    auto const prev = rreq->state.fetch_or(uint32_cast(repl_req_state_t::ROLLED_BACK));
+    bool const write_in_progress = (prev & uint32_cast(repl_req_state_t::DATA_RECEIVED)) &&
+        !(prev & uint32_cast(repl_req_state_t::DATA_WRITTEN));
+    if (rreq->local_blkid.is_valid() && !write_in_progress) { data_service().async_free_blk(rreq->local_blkid); }
+
+    // Data is not going to be written anymore, release anyone waiting for it. If the data was received, the write
+    // completion raises the promise instead.
+    if (!(prev & (uint32_cast(repl_req_state_t::DATA_RECEIVED) | uint32_cast(repl_req_state_t::DATA_WRITTEN)))) {
+        rreq->data_written_promise.setValue();
+    }
+
+    if (rreq->is_proposer) { release_write_window(*rreq); }
+}
+
 AsyncNotify RaftReplDev::notify_after_data_written(std::vector< repl_req_ptr_t >* rreqs) {
     std::vector< folly::SemiFuture< folly::Unit > > futs;
     futs.reserve(rreqs->size());
@@ -248,26 +861,14 @@ AsyncNotify RaftReplDev::notify_after_data_written(std::vector< repl_req_ptr_t >
     // All the entries are done already, no need to wait
     if (rreqs->size() == 0) { return folly::makeFuture< folly::Unit >(folly::Unit{}); }
 
-#if 0
-    // We are yet to support reactive fetch from remote.
-    if (m_resync_mode) {
-        // if in resync mode, fetch data from remote immediately;
-        check_and_fetch_remote_data(std::move(rreqs));
-    } else {
-        // some blkids are not in completed state, let's schedule a timer to check it again;
-        // we wait for data channel to fill in the data. Still if its not done we trigger a fetch from remote;
-        m_wait_blkid_write_timer_hdl = iomanager.schedule_thread_timer( // timer wakes up in current thread;
-            HS_DYNAMIC_CONFIG(repl->wait_blkid_write_timer_sec) * 1000 * 1000 * 1000, false /* recurring */,
-            nullptr /* cookie */, [this, std::move(rreqs)](auto) {
-                check_and_fetch_remote_data(std::move(rreqs));
-            });
-    }
-    return ret;
-#endif
+    // Data is expected to be pushed by the leader. If it doesn't arrive within a while, fetch it from the originator,
+    // so that a lost push doesn't stall the follower.
+    schedule_data_fetch(*rreqs);
 
     return folly::collectAll(futs).deferValue([this, rreqs](auto&& e) {
         for (auto const& rreq : *rreqs) {
-            HS_DBG_ASSERT(rreq->state.load() & uint32_cast(repl_req_state_t::DATA_WRITTEN),
+            auto const done = uint32_cast(repl_req_state_t::DATA_WRITTEN) | uint32_cast(repl_req_state_t::ROLLED_BACK);
+            HS_DBG_ASSERT(rreq->state.load() & done,
                           "Data written promise raised without updating DATA_WRITTEN state for rkey={}",
                           rreq->rkey.to_string());
             RD_LOG(INFO, "Raft Channel: Data write completed and blkid mapped, removing from map: rreq=[{}]",
@@ -289,6 +890,8 @@ void RaftReplDev::async_free_blks(int64_t, MultiBlkId const& bid) {
     data_service().async_free_blk(bid);
 }
 
+RaftReplDevMetrics& RaftReplDev::metrics() { return m_repl_svc.rdev_metrics(); }
+
 bool RaftReplDev::is_leader() const { return m_repl_svc_ctx->is_raft_leader(); }
 
 uint32_t RaftReplDev::get_blk_size() const { return data_service().get_blk_size(); }
@@ -404,6 +1007,229 @@ nuraft::ptr< nuraft::log_store > RaftReplDev::load_log_store() { return m_data_j
 
 int32_t RaftReplDev::server_id() { return m_raft_server_id; }
 
+///////////////////////////////////  Snapshot related methods ////////////////////////////////////
+// A snapshot is not a copy of the state, it is served from the listener's current state when a replica behind the
+// compacted log needs it. Each object of the snapshot after the first one is a chunk of entries from the listener along
+// with their data, where obj_id is 1 + the lsn upto which the replica already has the entries. This lets the replica
+// resync incrementally from its commit lsn, and resume from where it left off if the resync is interrupted.
+nuraft::ptr< nuraft::snapshot > RaftReplDev::last_snapshot() {
+    std::unique_lock lg{m_snapshot_mtx};
+    if ((m_last_snapshot == nullptr) && (m_rd_sb->snapshot_lsn > 0)) {
+        m_last_snapshot = nuraft::cs_new< nuraft::snapshot >(m_rd_sb->snapshot_lsn, m_rd_sb->snapshot_term,
+                                                             load_config(), 0 /* size */,
+                                                             nuraft::snapshot::type::logical_object);
+    }
+    return m_last_snapshot;
+}
+
+void RaftReplDev::create_snapshot(nuraft::snapshot& s, nuraft::async_result< bool >::handler_type& when_done) {
+    // Logs upto the snapshot are compacted once it is created, so the state they carry has to be persisted by then.
+    auto snp = nuraft::snapshot::deserialize(*s.serialize());
+    hs()->cp_mgr().trigger_cp_flush(true /* force */).thenValue([this, snp, when_done](bool success) mutable {
+        if (success) {
+            {
+                std::unique_lock lg{m_sb_lock};
+                m_rd_sb->snapshot_lsn = s_cast< int64_t >(snp->get_last_log_idx());
+                m_rd_sb->snapshot_term = snp->get_last_log_term();
+                m_rd_sb.write();
+            }
+            std::unique_lock lg{m_snapshot_mtx};
+            m_last_snapshot = snp;
+        }
+        RD_LOG(INFO, "Snapshot: Created snapshot lsn={} term={} success={}", snp->get_last_log_idx(),
+               snp->get_last_log_term(), success);
+
+        auto null_except = std::shared_ptr< std::exception >();
+        if (when_done) { when_done(success, null_except); }
+    });
+}
+
+int RaftReplDev::read_snapshot_obj(nuraft::snapshot& s, ulong obj_id, raft_buf_ptr_t& data_out, bool& is_last_obj) {
+    auto const align_size = data_service().get_align_size();
+    flatbuffers::FlatBufferBuilder builder;
+    std::vector< flatbuffers::Offset< SnapshotEntry > > fb_entries;
+
+    if (obj_id == 0) {
+        // First object is a handshake without any entries, replica responds with the lsn it needs the entries from
+        builder.FinishSizePrefixed(CreateSnapshotChunk(builder, builder.CreateVector(fb_entries), align_size));
+        data_out = nuraft::buffer::alloc(builder.GetSize());
+        std::memcpy(data_out->data_begin(), builder.GetBufferPointer(), builder.GetSize());
+        is_last_obj = false;
+        return 0;
+    }
+
+    auto const from_lsn = s_cast< int64_t >(obj_id - 1);
+    std::vector< snapshot_entry > entries;
+    bool const done =
+        m_listener->get_snapshot_entries(from_lsn, s_cast< int64_t >(s.get_last_log_idx()),
+                                         uint64_cast(HS_DYNAMIC_CONFIG(consensus.snapshot_chunk_size_kb)) * 1024,
+                                         entries);
+
+    // Read the data of all the entries into one buffer, keeping queue depth number of reads outstanding
+    std::vector< uint32_t > sizes;
+    sizes.reserve(entries.size());
+    uint64_t data_size{0};
+    for (auto const& entry : entries) {
+        sizes.push_back(entry.blkid.is_valid() ? uint32_cast(entry.blkid.blk_count() * get_blk_size()) : 0);
+        data_size += sisl::round_up(sizes.back(), align_size);
+    }
+
+    sisl::io_blob_safe data_buf;
+    if (data_size) {
+        data_buf = sisl::io_blob_safe(uint32_cast(data_size), align_size);
+
+        auto const queue_depth = std::max(HS_DYNAMIC_CONFIG(consensus.snapshot_read_queue_depth), 1u);
+        std::vector< folly::Future< std::error_code > > futs;
+        bool success{true};
+        auto const wait_for_reads = [&futs, &success]() {
+            for (auto const& err_c : folly::collectAllUnsafe(futs).get()) {
+                if (err_c.hasException() || err_c.value()) { success = false; }
+            }
+            futs.clear();
+        };
+
+        uint64_t offset{0};
+        for (size_t i{0}; i < entries.size(); ++i) {
+            if (sizes[i] == 0) { continue; }
+            futs.emplace_back(data_service().async_read(entries[i].blkid, data_buf.bytes() + offset, sizes[i]));
+            offset += sisl::round_up(sizes[i], align_size);
+            if (futs.size() >= queue_depth) { wait_for_reads(); }
+        }
+        wait_for_reads();
+
+        if (!success) {
+            RD_LOG(ERROR, "Snapshot: Error in reading data of snapshot entries from lsn={}", from_lsn);
+            return -1;
+        }
+    }
+
+    for (size_t i{0}; i < entries.size(); ++i) {
+        auto const& entry = entries[i];
+        fb_entries.push_back(CreateSnapshotEntry(builder, entry.lsn,
+                                                 builder.CreateVector(entry.header.cbytes(), entry.header.size()),
+                                                 builder.CreateVector(entry.key.cbytes(), entry.key.size()), sizes[i]));
+    }
+    builder.FinishSizePrefixed(CreateSnapshotChunk(builder, builder.CreateVector(fb_entries), align_size));
+
+    // Layout is same as the data channel rpcs, chunk followed by data of each entry at an aligned offset
+    auto const fb_size = sisl::round_up(builder.GetSize(), align_size);
+    data_out = nuraft::buffer::alloc(fb_size + data_size);
+    std::memcpy(data_out->data_begin(), builder.GetBufferPointer(), builder.GetSize());
+    std::memset(data_out->data_begin() + builder.GetSize(), 0, fb_size - builder.GetSize());
+    if (data_size) { std::memcpy(data_out->data_begin() + fb_size, data_buf.cbytes(), data_size); }
+
+    is_last_obj = (done || entries.empty());
+    RD_LOG(INFO, "Snapshot: Sending {} entries from lsn={} with {} bytes of data, is_last={}", entries.size(),
+           from_lsn, data_size, is_last_obj);
+    return 0;
+}
+
+static sisl::io_blob_safe to_blob_safe(flatbuffers::Vector< uint8_t > const* v) {
+    sisl::io_blob_safe b;
+    if (v && v->size()) {
+        b = sisl::io_blob_safe(v->size());
+        std::memcpy(b.bytes(), v->Data(), v->size());
+    }
+    return b;
+}
+
+void RaftReplDev::save_snapshot_obj(nuraft::snapshot& s, ulong& obj_id, nuraft::buffer& data) {
+    // Data of the previous chunk is written while this one is on the wire. Wait for it, if not done yet, so that
+    // entries reach the listener in lsn order and at most two chunks are held in memory.
+    wait_for_resync_writes();
+
+    if (obj_id == 0) {
+        // Ask for the entries after what we have, either from our commit lsn or from the last resync which got
+        // interrupted in between.
+        auto const resync_lsn = std::max(m_commit_upto_lsn.load(), m_resync_upto_lsn.load());
+        RD_LOG(INFO, "Snapshot: Resyncing to snapshot lsn={} term={}, entries needed from lsn={}",
+               s.get_last_log_idx(), s.get_last_log_term(), resync_lsn);
+        obj_id = uint64_cast(resync_lsn) + 1;
+        return;
+    }
+
+    auto const* chunk = GetSizePrefixedSnapshotChunk(data.data_begin());
+    auto const& fb_entries = *chunk->entries();
+    if (fb_entries.size() == 0) { return; }
+
+    std::vector< uint32_t > sizes;
+    sizes.reserve(fb_entries.size());
+    for (auto const* fb_entry : fb_entries) {
+        sizes.push_back(fb_entry->data_size());
+    }
+    // Chunk buffer is owned by raft, which releases it once we return, so the data is always copied
+    auto aligned_buf = std::make_shared< sisl::io_blob_safe >();
+    auto const data_ptrs =
+        locate_rpc_data(data.data_begin(), data.size(), chunk->align_size(), sizes, *aligned_buf, true);
+
+    // Write the data of all entries to locally allocated blks, before handing them over to the listener. Blks of the
+    // whole chunk are allocated in one go.
+    auto entries = std::make_shared< std::vector< snapshot_entry > >(fb_entries.size());
+    std::vector< sisl::blob > headers;
+    headers.reserve(fb_entries.size());
+    for (flatbuffers::uoffset_t i{0}; i < fb_entries.size(); ++i) {
+        auto const* fb_entry = fb_entries.Get(i);
+        auto& entry = (*entries)[i];
+        entry.lsn = fb_entry->lsn();
+        entry.header = to_blob_safe(fb_entry->user_header());
+        entry.key = to_blob_safe(fb_entry->user_key());
+        headers.emplace_back(entry.header.cbytes(), entry.header.size());
+    }
+    auto blkids = batch_alloc_blks(headers, sizes);
+
+    std::vector< folly::Future< std::error_code > > futs;
+    for (size_t i{0}; i < entries->size(); ++i) {
+        if (sizes[i] == 0) { continue; }
+        (*entries)[i].blkid = std::move(blkids[i]);
+        futs.emplace_back(
+            data_service().async_write(r_cast< const char* >(data_ptrs[i]), sizes[i], (*entries)[i].blkid));
+    }
+
+    // Listener gets the entries once their data is written. The progress is persisted by the next cp, along with the
+    // listener's state of these entries, so that an interrupted resync doesn't need to start over.
+    auto const last_lsn = entries->back().lsn;
+    m_resync_write_fut = folly::collectAllUnsafe(futs)
+                             .via(&folly::InlineExecutor::instance())
+                             .thenValue([this, entries, aligned_buf, last_lsn](auto&& err_cs) {
+                                 for (auto const& err_c : err_cs) {
+                                     RD_REL_ASSERT(!err_c.hasException() && !err_c.value(),
+                                                   "Error in writing snapshot data");
+                                 }
+                                 for (auto const& entry : *entries) {
+                                     m_listener->on_snapshot_entry(entry);
+                                 }
+                                 m_resync_upto_lsn.store(last_lsn);
+                             });
+    obj_id = uint64_cast(last_lsn) + 1;
+    RD_LOG(DEBUG, "Snapshot: Received {} entries upto lsn={}", entries->size(), last_lsn);
+}
+
+void RaftReplDev::wait_for_resync_writes() {
+    if (m_resync_write_fut.valid()) { std::move(m_resync_write_fut).get(); }
+    m_resync_write_fut = folly::Future< folly::Unit >::makeEmpty();
+}
+
+bool RaftReplDev::apply_snapshot(nuraft::snapshot& s) {
+    wait_for_resync_writes();
+
+    auto const lsn = s_cast< repl_lsn_t >(s.get_last_log_idx());
+    m_commit_upto_lsn.store(lsn);
+    {
+        std::unique_lock lg{m_sb_lock};
+        m_rd_sb->commit_lsn = lsn;
+        m_rd_sb->snapshot_lsn = lsn;
+        m_rd_sb->snapshot_term = s.get_last_log_term();
+        m_rd_sb->resync_lsn = 0;
+        m_resync_upto_lsn.store(0);
+        m_rd_sb.write();
+    }
+
+    std::unique_lock lg{m_snapshot_mtx};
+    m_last_snapshot = nuraft::snapshot::deserialize(*s.serialize());
+    RD_LOG(INFO, "Snapshot: Resync completed upto snapshot lsn={} term={}", lsn, s.get_last_log_term());
+    return true;
+}
+
 ///////////////////////////////////  nuraft_mesg::mesg_state_mgr overrides ////////////////////////////////////
 uint32_t RaftReplDev::get_logstore_id() const { return m_data_journal->logstore_id(); }
 
@@ -422,30 +1248,41 @@ void RaftReplDev::report_committed(repl_req_ptr_t rreq) {
     RD_DBG_ASSERT_GT(rreq->lsn, prev_lsn, "Out of order commit of lsns, it is not expected in RaftReplDev");
 
     RD_LOG(INFO, "Raft channel: Commit rreq=[{}]", rreq->to_compact_string());
+    auto const commit_start_time = Clock::now();
     m_listener->on_commit(rreq->lsn, rreq->header, rreq->key, rreq->local_blkid, rreq);
 
+    if (rreq->is_proposer) {
+        HISTOGRAM_OBSERVE(metrics(), rdev_leader_commit_latency, get_elapsed_time_us(commit_start_time));
+        HISTOGRAM_OBSERVE(metrics(), rdev_leader_write_latency, get_elapsed_time_us(rreq->created_time));
+        release_write_window(*rreq);
+    }
+
     if (!rreq->is_proposer) {
         rreq->header = sisl::blob{};
         rreq->key = sisl::blob{};
         rreq->pkts = sisl::io_blob_list_t{};
-        if (rreq->rpc_data) {
-            rreq->rpc_data->send_response();
-            rreq->rpc_data = nullptr;
-        }
+        rreq->rpc_data = nullptr; // Response to the push rpc is sent once all rreqs pushed with it are done
     }
 }
 
-void RaftReplDev::cp_flush(CP*) {
+folly::Future< bool > RaftReplDev::cp_flush(CP*) {
     auto lsn = m_commit_upto_lsn.load();
-    if (lsn == m_last_flushed_commit_lsn) {
-        // Not dirtied since last flush ignore
-        return;
+    auto fut = folly::Future< bool >::makeEmpty();
+    {
+        std::unique_lock lg{m_sb_lock};
+        auto const resync_lsn = m_resync_upto_lsn.load();
+        if ((lsn == m_last_flushed_commit_lsn) && (resync_lsn == m_last_flushed_resync_lsn)) {
+            // Not dirtied since last flush ignore
+            return folly::makeFuture< bool >(true);
+        }
+        m_rd_sb->commit_lsn = lsn;
+        m_rd_sb->checkpoint_lsn = lsn;
+        m_rd_sb->resync_lsn = resync_lsn;
+        fut = m_rd_sb.async_write();
+        m_last_flushed_resync_lsn = resync_lsn;
     }
-
-    m_rd_sb->commit_lsn = lsn;
-    m_rd_sb->checkpoint_lsn = lsn;
-    m_rd_sb.write();
     m_last_flushed_commit_lsn = lsn;
+    return fut;
 }
 
 void RaftReplDev::cp_cleanup(CP*) {}
@@ -1,10 +1,12 @@
 #pragma once
 
+#include <deque>
 #include <string>
 
 #include <nuraft_mesg/nuraft_mesg.hpp>
 #include <nuraft_mesg/mesg_state_mgr.hpp>
 #include <sisl/fds/buffer.hpp>
+#include <sisl/grpc/rpc_client.hpp>
 #include <homestore/replication/repl_dev.h>
 #include <homestore/superblk_handler.hpp>
 #include <homestore/logstore/log_store.hpp>
@@ -16,12 +18,15 @@ namespace homestore {
 
 #pragma pack(1)
 struct raft_repl_dev_superblk : public repl_dev_superblk {
-    static constexpr uint32_t RAFT_REPL_DEV_SB_VERSION = 1;
+    static constexpr uint32_t RAFT_REPL_DEV_SB_VERSION = 2;
 
     uint32_t raft_sb_version{RAFT_REPL_DEV_SB_VERSION};
     logstore_id_t free_blks_journal_id; // Logstore id for storing free blkid records
     uint8_t is_timeline_consistent; // Flag to indicate whether the recovery of followers need to be timeline consistent
     uint64_t last_applied_dsn;      // Last applied data sequence number
+    int64_t snapshot_lsn{0};        // Lsn of the last snapshot, logs upto which can be compacted
+    uint64_t snapshot_term{0};      // Raft term of the last snapshot
+    int64_t resync_lsn{0};          // Entries upto this lsn are received, while resyncing from leader's snapshot
 
     uint32_t get_raft_sb_version() const { return raft_sb_version; }
 };
@@ -30,12 +35,14 @@ struct raft_repl_dev_superblk : public repl_dev_superblk {
 using raft_buf_ptr_t = nuraft::ptr< nuraft::buffer >;
 
 class RaftReplService;
+class RaftReplDevMetrics;
 class CP;
+struct PushDataRequest;
 class RaftReplDev : public ReplDev, public nuraft_mesg::mesg_state_mgr {
 private:
     shared< RaftStateMachine > m_state_machine;
     RaftReplService& m_repl_svc;
-    folly::ConcurrentHashMap< repl_key, repl_req_ptr_t, repl_key::Hasher > m_repl_key_req_map;
+    repl_key_req_map_t m_repl_key_req_map;
     nuraft_mesg::Manager& m_msg_mgr;
     group_id_t m_group_id;     // Replication Group id
     std::string m_rdev_name;   // Short name for the group for easy debugging
@@ -52,18 +59,42 @@ private:
 
     std::atomic< repl_lsn_t > m_commit_upto_lsn{0}; // LSN which was lastly written, to track flushes
     repl_lsn_t m_last_flushed_commit_lsn{0};        // LSN upto which it was flushed to persistent store
+    std::atomic< repl_lsn_t > m_resync_upto_lsn{0}; // LSN upto which snapshot entries are handed over to listener
+    repl_lsn_t m_last_flushed_resync_lsn{0};        // Resync LSN which was last flushed to persistent store
+    folly::Future< folly::Unit > m_resync_write_fut{folly::Future< folly::Unit >::makeEmpty()}; // Last chunk's writes
     iomgr::timer_handle_t m_sb_flush_timer_hdl;
 
     std::atomic< uint64_t > m_next_dsn{0}; // Data Sequence Number that will keep incrementing for each data entry
 
+    std::mutex m_snapshot_mtx;
+    nuraft::ptr< nuraft::snapshot > m_last_snapshot; // Last snapshot created or applied, logs upto it are compacted
+
+    std::mutex m_push_mtx;
+    std::deque< repl_req_ptr_t > m_pending_pushes; // Requests waiting for a push rpc slot to send their data
+    uint32_t m_pushes_in_flight{0};
+
+    // Window of leader's writes in flight, from blk allocation till commit
+    std::mutex m_write_window_mtx;
+    std::deque< repl_req_ptr_t > m_window_waiters; // Writes waiting for room in the window
+    uint64_t m_inflight_write_bytes{0};
+    uint32_t m_inflight_writes{0};
+
+    // Requests whose data is not pushed yet, for which the data is fetched from the originator when the timer fires
+    std::mutex m_fetch_mtx;
+    std::vector< repl_req_ptr_t > m_pending_fetches;
+    iomgr::timer_handle_t m_fetch_timer_hdl;
+    bool m_fetch_timer_armed{false};
+    bool m_fetch_stopped{false};
+
     static std::atomic< uint64_t > s_next_group_ordinal;
 
 public:
     friend class RaftStateMachine;
 
     RaftReplDev(RaftReplService& svc, superblk< raft_repl_dev_superblk >&& rd_sb, bool load_existing);
-    virtual ~RaftReplDev() = default;
+    virtual ~RaftReplDev() { destroy(); }
 
+    // Stops the background activities of the repl dev, like the fetch of the data not pushed by the leader
     void destroy();
 
     //////////////// All ReplDev overrides/implementation ///////////////////////
@@ -83,16 +114,25 @@ public:
     //////////////// Accessor/shortcut methods ///////////////////////
     nuraft_mesg::repl_service_ctx* group_msg_service();
     nuraft::raft_server* raft_server();
+    RaftReplDevMetrics& metrics();
 
     //////////////// Methods needed for other Raft classes to access /////////////////
     void use_config(json_superblk raft_config_sb);
     void report_committed(repl_req_ptr_t rreq);
     repl_req_ptr_t follower_create_req(repl_key const& rkey, sisl::blob const& user_header, sisl::blob const& user_key,
-                                       uint32_t data_size);
+                                       uint32_t data_size, MultiBlkId* preallocated_blkid = nullptr);
+    void rollback_req(repl_req_ptr_t const& rreq);
     AsyncNotify notify_after_data_written(std::vector< repl_req_ptr_t >* rreqs);
-    void cp_flush(CP* cp);
+    folly::Future< bool > cp_flush(CP* cp);
     void cp_cleanup(CP* cp);
 
+    //////////////// Snapshot related methods, needed by RaftStateMachine /////////////////
+    nuraft::ptr< nuraft::snapshot > last_snapshot();
+    void create_snapshot(nuraft::snapshot& s, nuraft::async_result< bool >::handler_type& when_done);
+    int read_snapshot_obj(nuraft::snapshot& s, ulong obj_id, raft_buf_ptr_t& data_out, bool& is_last_obj);
+    void save_snapshot_obj(nuraft::snapshot& s, ulong& obj_id, nuraft::buffer& data);
+    bool apply_snapshot(nuraft::snapshot& s);
+
 protected:
     //////////////// All nuraft::state_mgr overrides ///////////////////////
     nuraft::ptr< nuraft::cluster_config > load_config() override;
@@ -111,8 +151,29 @@ protected:
 
 private:
     shared< nuraft::log_store > data_journal() { return m_data_journal; }
+    bool admit_to_write_window(repl_req_ptr_t const& rreq);
+    void release_write_window(repl_req_ctx const& rreq);
+    void start_leader_write(repl_req_ptr_t rreq);
     void push_data_to_all_followers(repl_req_ptr_t rreq);
+    std::vector< repl_req_ptr_t > pick_push_batch();
+    void send_push_batch(std::vector< repl_req_ptr_t > rreqs);
+    void send_push_per_req(std::vector< repl_req_ptr_t > rreqs);
+    void on_push_batch_done();
+    void wait_for_resync_writes();
     void on_push_data_received(intrusive< sisl::GenericRpcData >& rpc_data);
+    void on_push_data_batch_received(intrusive< sisl::GenericRpcData >& rpc_data);
+    void handle_pushed_data(intrusive< sisl::GenericRpcData >& rpc_data,
+                            std::vector< PushDataRequest const* > const& push_reqs, uint32_t sender_align_size);
+    void on_fetch_data_received(intrusive< sisl::GenericRpcData >& rpc_data);
+    std::vector< MultiBlkId > batch_alloc_blks(std::vector< sisl::blob > const& headers,
+                                               std::vector< uint32_t > const& sizes);
+    void write_received_data(std::vector< repl_req_ptr_t > const& rreqs, std::vector< uint8_t const* > const& data_ptrs,
+                             std::vector< uint32_t > const& sizes, std::shared_ptr< void > data_holder);
+    void schedule_data_fetch(std::vector< repl_req_ptr_t > const& rreqs);
+    void on_data_fetch_timer();
+    void check_and_fetch_remote_data(std::vector< repl_req_ptr_t > rreqs);
+    void fetch_data_from_remote(int32_t originator, std::vector< repl_req_ptr_t > rreqs);
+    void handle_fetch_data_response(sisl::GenericClientResponse response, std::vector< repl_req_ptr_t > rreqs);
 };
 
 } // namespace homestore
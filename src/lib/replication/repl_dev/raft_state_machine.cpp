@@ -3,8 +3,10 @@
 #include <sisl/fds/utils.hpp>
 #include <sisl/fds/vector_pool.hpp>
 
+#include "common/homestore_config.hpp"
 #include "repl_dev/raft_state_machine.h"
 #include "repl_dev/raft_repl_dev.h"
+#include "replication/service/raft_repl_service.h"
 
 SISL_LOGGING_DECL(replication)
 
@@ -16,25 +18,34 @@ RaftStateMachine::RaftStateMachine(RaftReplDev& rd) : m_rd{rd} {
 }
 
 raft_buf_ptr_t RaftStateMachine::pre_commit_ext(nuraft::state_machine::ext_op_params const& params) {
-    // Leader precommit is processed in next callback, because this callback doesn't provide a way to stick a context
-    // which could contain the req structure in it.
-    if (!m_rd.is_leader()) {
-        int64_t lsn = s_cast< int64_t >(params.log_idx);
-        raft_buf_ptr_t data = params.data;
+    int64_t lsn = s_cast< int64_t >(params.log_idx);
+    repl_req_ptr_t rreq;
+
+    // Leader pre-commits the entries while they are being appended by append_to_raft(), in the same order and on the
+    // same thread. That is the only place which knows which rreq the lsn is assigned to.
+    if (m_proposing_thread.load(std::memory_order_relaxed) == std::this_thread::get_id()) {
+        auto const* entry = r_cast< repl_journal_entry const* >(params.data->data_begin());
+        auto const next = (m_proposing_cursor < m_proposing_batch->size()) ? (*m_proposing_batch)[m_proposing_cursor]
+                                                                             : nullptr;
+        if (next && (entry->server_id == next->rkey.server_id) && (entry->dsn == next->dsn())) {
+            rreq = next;
+            ++m_proposing_cursor;
+            link_lsn_to_req(rreq, lsn);
+            RD_LOG(INFO, "Raft Channel: Proposed rreq=[{}]", rreq->to_compact_string());
+        } else {
+            RD_LOG(WARN, "Raft Channel: Precommit of lsn={} server_id={} dsn={} is not in the order of proposal",
+                   lsn, entry->server_id, entry->dsn);
+        }
+    }
 
-        repl_req_ptr_t rreq = lsn_to_req(lsn);
+    if (rreq == nullptr) {
+        // Entries appended while this replica was a follower could be pre-committed after it became the leader.
+        rreq = lsn_to_req(lsn);
+        RD_REL_ASSERT(rreq != nullptr, "Precommit of lsn={} which is neither proposed nor appended here", lsn);
         RD_LOG(INFO, "Raft channel: Precommit rreq=[{}]", rreq->to_compact_string());
-        m_rd.m_listener->on_pre_commit(rreq->lsn, rreq->header, rreq->key, rreq);
     }
-    return m_success_ptr;
-}
-
-void RaftStateMachine::after_precommit_in_leader(nuraft::raft_server::req_ext_cb_params const& params) {
-    repl_req_ptr_t rreq = repl_req_ptr_t(r_cast< repl_req_ctx* >(params.context));
-    link_lsn_to_req(rreq, int64_cast(params.log_idx));
-
-    RD_LOG(INFO, "Raft Channel: Proposed rreq=[{}]", rreq->to_compact_string());
     m_rd.m_listener->on_pre_commit(rreq->lsn, rreq->header, rreq->key, rreq);
+    return m_success_ptr;
 }
 
 raft_buf_ptr_t RaftStateMachine::commit_ext(nuraft::state_machine::ext_op_params const& params) {
@@ -45,6 +56,9 @@ raft_buf_ptr_t RaftStateMachine::commit_ext(nuraft::state_machine::ext_op_params
     if (rreq == nullptr) { return m_success_ptr; }
 
     RD_LOG(INFO, "Raft channel: Received Commit message rreq=[{}]", rreq->to_compact_string());
+    if (rreq->is_proposer) {
+        HISTOGRAM_OBSERVE(m_rd.metrics(), rdev_leader_quorum_latency, get_elapsed_time_us(rreq->propose_time));
+    }
     if (m_rd.is_leader()) {
         // This is the time to ensure flushing of journal happens in leader
         if (m_rd.m_data_journal->last_durable_index() < uint64_cast(lsn)) { m_rd.m_data_journal->flush(); }
@@ -57,49 +71,114 @@ raft_buf_ptr_t RaftStateMachine::commit_ext(nuraft::state_machine::ext_op_params
     return m_success_ptr;
 }
 
+void RaftStateMachine::rollback(uint64_t lsn, nuraft::buffer&) {
+    // Raft is truncating a log which was appended (and pre-committed) but not committed, typically because a new
+    // leader overwrote it. Undo whatever was done for it, including the blks allocated for its data.
+    m_rd.m_data_journal->on_rollback(lsn);
+
+    repl_req_ptr_t rreq = lsn_to_req(s_cast< int64_t >(lsn));
+    if (rreq == nullptr) { return; }
+
+    m_lsn_req_map.erase(rreq->lsn);
+    m_rd.rollback_req(rreq);
+}
+
 uint64_t RaftStateMachine::last_commit_index() { return uint64_cast(m_rd.get_last_commit_lsn()); }
 
 void RaftStateMachine::propose_to_raft(repl_req_ptr_t rreq) {
-    uint32_t val_size = rreq->value.size ? rreq->local_blkid.serialized_size() : 0;
-    uint32_t entry_size = sizeof(repl_journal_entry) + rreq->header.size() + rreq->key.size() + val_size;
-    rreq->alloc_journal_entry(entry_size, true /* raft_buf */);
-    rreq->journal_entry->code = (rreq->value.size) ? journal_type_t::HS_LARGE_DATA : journal_type_t::HS_HEADER_ONLY;
-    rreq->journal_entry->server_id = m_rd.server_id();
-    rreq->journal_entry->dsn = rreq->dsn();
-    rreq->journal_entry->user_header_size = rreq->header.size();
-    rreq->journal_entry->key_size = rreq->key.size();
-    rreq->journal_entry->value_size = val_size;
-
-    rreq->is_proposer = true;
-    uint8_t* raw_ptr = uintptr_cast(rreq->journal_entry) + sizeof(repl_journal_entry);
-    if (rreq->header.size()) {
-        std::memcpy(raw_ptr, rreq->header.cbytes(), rreq->header.size());
-        raw_ptr += rreq->header.size();
-    }
-
-    if (rreq->key.size()) {
-        std::memcpy(raw_ptr, rreq->key.cbytes(), rreq->key.size());
-        raw_ptr += rreq->key.size();
+    prepare_journal_entry(*rreq);
+    rreq->propose_time = Clock::now();
+
+    {
+        std::unique_lock lg{m_propose_mtx};
+        m_pending_proposals.push_back(std::move(rreq));
+        if (m_proposing) {
+            // Thread proposing right now will pick it up along with others which queue up meanwhile
+            return;
+        }
+        m_proposing = true;
     }
 
-    if (rreq->value.size) {
-        auto const b = rreq->local_blkid.serialize();
-        std::memcpy(raw_ptr, b.cbytes(), b.size());
-        raw_ptr += b.size();
+    auto const max_batch = std::max(HS_DYNAMIC_CONFIG(consensus.propose_batch_size), 1u);
+    while (true) {
+        std::vector< repl_req_ptr_t > rreqs;
+        {
+            std::unique_lock lg{m_propose_mtx};
+            if (m_pending_proposals.empty()) {
+                m_proposing = false;
+                return;
+            }
+            if (m_pending_proposals.size() <= max_batch) {
+                rreqs.swap(m_pending_proposals);
+            } else {
+                rreqs.assign(std::make_move_iterator(m_pending_proposals.begin()),
+                             std::make_move_iterator(m_pending_proposals.begin() + max_batch));
+                m_pending_proposals.erase(m_pending_proposals.begin(), m_pending_proposals.begin() + max_batch);
+            }
+        }
+        append_to_raft(rreqs);
     }
+}
 
+void RaftStateMachine::append_to_raft(std::vector< repl_req_ptr_t > const& rreqs) {
     auto* vec = sisl::VectorPool< raft_buf_ptr_t >::alloc();
-    vec->push_back(rreq->raft_journal_buf());
+    for (auto const& rreq : rreqs) {
+        vec->push_back(rreq->raft_journal_buf());
+        RD_LOG(TRACE, "Raft Channel: journal_entry=[{}] ", rreq->journal_entry->to_string());
+    }
+    HISTOGRAM_OBSERVE(m_rd.metrics(), rdev_propose_batch_size, rreqs.size());
 
     nuraft::raft_server::req_ext_params param;
-    param.after_precommit_ = bind_this(RaftStateMachine::after_precommit_in_leader, 1);
     param.expected_term_ = 0;
-    param.context_ = voidptr_cast(rreq.get());
-
-    RD_LOG(TRACE, "Raft Channel: journal_entry=[{}] ", rreq->journal_entry->to_string());
 
-    m_rd.raft_server()->append_entries_ext(*vec, param);
+    // Raft appends and pre-commits all the entries within this call, see pre_commit_ext()
+    m_proposing_batch = &rreqs;
+    m_proposing_cursor = 0;
+    m_proposing_thread.store(std::this_thread::get_id(), std::memory_order_relaxed);
+    auto const ret = m_rd.raft_server()->append_entries_ext(*vec, param);
+    m_proposing_thread.store(std::thread::id{}, std::memory_order_relaxed);
+    auto const num_appended = m_proposing_cursor;
+    m_proposing_batch = nullptr;
     sisl::VectorPool< raft_buf_ptr_t >::free(vec);
+
+    if (num_appended < rreqs.size()) {
+        // Raft didn't take them (typically because this replica is no longer the leader), treat them as rolled back
+        RD_LOG(ERROR, "Raft Channel: Proposal of {} rreqs not accepted by raft, accepted={} result_code={}",
+               rreqs.size() - num_appended, ret->get_accepted(), ret->get_result_code());
+        for (auto i = num_appended; i < rreqs.size(); ++i) {
+            m_rd.rollback_req(rreqs[i]);
+        }
+    }
+}
+
+void RaftStateMachine::prepare_journal_entry(repl_req_ctx& rreq) {
+    uint32_t val_size = rreq.value.size ? rreq.local_blkid.serialized_size() : 0;
+    uint32_t entry_size = sizeof(repl_journal_entry) + rreq.header.size() + rreq.key.size() + val_size;
+    rreq.alloc_journal_entry(entry_size, true /* raft_buf */);
+    rreq.journal_entry->code = (rreq.value.size) ? journal_type_t::HS_LARGE_DATA : journal_type_t::HS_HEADER_ONLY;
+    rreq.journal_entry->server_id = m_rd.server_id();
+    rreq.journal_entry->dsn = rreq.dsn();
+    rreq.journal_entry->user_header_size = rreq.header.size();
+    rreq.journal_entry->key_size = rreq.key.size();
+    rreq.journal_entry->value_size = val_size;
+
+    rreq.is_proposer = true;
+    uint8_t* raw_ptr = uintptr_cast(rreq.journal_entry) + sizeof(repl_journal_entry);
+    if (rreq.header.size()) {
+        std::memcpy(raw_ptr, rreq.header.cbytes(), rreq.header.size());
+        raw_ptr += rreq.header.size();
+    }
+
+    if (rreq.key.size()) {
+        std::memcpy(raw_ptr, rreq.key.cbytes(), rreq.key.size());
+        raw_ptr += rreq.key.size();
+    }
+
+    if (rreq.value.size) {
+        auto const b = rreq.local_blkid.serialize();
+        std::memcpy(raw_ptr, b.cbytes(), b.size());
+        raw_ptr += b.size();
+    }
 }
 
 repl_req_ptr_t RaftStateMachine::transform_journal_entry(nuraft::ptr< nuraft::log_entry >& lentry) {
@@ -122,15 +201,16 @@ repl_req_ptr_t RaftStateMachine::transform_journal_entry(nuraft::ptr< nuraft::lo
     sisl::blob const key = sisl::blob{header.cbytes() + header.size(), jentry->key_size};
     DEBUG_ASSERT_GT(jentry->value_size, 0, "Entry marked as large data, but value size is notified as 0");
 
+    // Value in the journal is the blkid on the originator, which tells how much data we need to allocate for
+    MultiBlkId entry_blkid;
+    entry_blkid.deserialize(sisl::blob{key.cbytes() + key.size(), jentry->value_size}, true /* copy */);
+
     // From the repl_key, get the repl_req. In cases where log stream got here first, this method will create a new
     // repl_req and return that back. Fill up all of the required journal entry inside the repl_req
     auto rreq = m_rd.follower_create_req(
         repl_key{.server_id = jentry->server_id, .term = lentry->get_term(), .dsn = jentry->dsn}, header, key,
-        jentry->value_size);
+        entry_blkid.blk_count() * m_rd.get_blk_size());
     rreq->journal_buf = lentry->serialize();
-
-    MultiBlkId entry_blkid;
-    entry_blkid.deserialize(sisl::blob{key.cbytes() + key.size(), jentry->value_size}, true /* copy */);
     rreq->remote_blkid = RemoteBlkId{jentry->server_id, entry_blkid};
 
     auto const local_size = rreq->local_blkid.serialized_size();
@@ -175,9 +255,23 @@ nuraft_mesg::repl_service_ctx* RaftStateMachine::group_msg_service() { return m_
 
 void RaftStateMachine::create_snapshot(nuraft::snapshot& s, nuraft::async_result< bool >::handler_type& when_done) {
     RD_LOG(DEBUG, "create_snapshot {}/{}", s.get_last_log_idx(), s.get_last_log_term());
-    auto null_except = std::shared_ptr< std::exception >();
-    auto ret_val{false};
-    if (when_done) when_done(ret_val, null_except);
+    m_rd.create_snapshot(s, when_done);
+}
+
+nuraft::ptr< nuraft::snapshot > RaftStateMachine::last_snapshot() { return m_rd.last_snapshot(); }
+
+int RaftStateMachine::read_logical_snp_obj(nuraft::snapshot& s, void*&, ulong obj_id, raft_buf_ptr_t& data_out,
+                                           bool& is_last_obj) {
+    return m_rd.read_snapshot_obj(s, obj_id, data_out, is_last_obj);
+}
+
+void RaftStateMachine::save_logical_snp_obj(nuraft::snapshot& s, ulong& obj_id, nuraft::buffer& data, bool, bool) {
+    m_rd.save_snapshot_obj(s, obj_id, data);
+}
+
+bool RaftStateMachine::apply_snapshot(nuraft::snapshot& s) {
+    RD_LOG(INFO, "apply_snapshot {}/{}", s.get_last_log_idx(), s.get_last_log_term());
+    return m_rd.apply_snapshot(s);
 }
 
 std::string RaftStateMachine::rdev_name() const { return m_rd.rdev_name(); }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+#include <thread>
 #include <vector>
 #include <functional>
 #include <iomgr/iomgr.hpp>
@@ -91,6 +93,16 @@ private:
     // iomgr::timer_handle_t m_wait_blkid_write_timer_hdl{iomgr::null_timer_handle};
     bool m_resync_mode{false};
 
+    // Journal entries are proposed to raft in batches, by one thread at a time, while others queue up behind it
+    std::mutex m_propose_mtx;
+    std::vector< repl_req_ptr_t > m_pending_proposals;
+    bool m_proposing{false};
+    // Batch being appended to raft right now and its next entry to be pre-committed. Accessed only by the thread
+    // which is appending, identified by m_proposing_thread.
+    std::vector< repl_req_ptr_t > const* m_proposing_batch{nullptr};
+    size_t m_proposing_cursor{0};
+    std::atomic< std::thread::id > m_proposing_thread{};
+
 public:
     RaftStateMachine(RaftReplDev& rd);
     ~RaftStateMachine() override = default;
@@ -101,11 +113,15 @@ public:
     uint64_t last_commit_index() override;
     raft_buf_ptr_t pre_commit_ext(const nuraft::state_machine::ext_op_params& params) override;
     raft_buf_ptr_t commit_ext(const nuraft::state_machine::ext_op_params& params) override;
-    void rollback(uint64_t lsn, nuraft::buffer&) override { LOGCRITICAL("Unimplemented rollback on: [{}]", lsn); }
+    void rollback(uint64_t lsn, nuraft::buffer&) override;
 
-    bool apply_snapshot(nuraft::snapshot&) override { return false; }
+    bool apply_snapshot(nuraft::snapshot& s) override;
     void create_snapshot(nuraft::snapshot& s, nuraft::async_result< bool >::handler_type& when_done) override;
-    nuraft::ptr< nuraft::snapshot > last_snapshot() override { return nullptr; }
+    nuraft::ptr< nuraft::snapshot > last_snapshot() override;
+    int read_logical_snp_obj(nuraft::snapshot& s, void*& user_snp_ctx, ulong obj_id, raft_buf_ptr_t& data_out,
+                             bool& is_last_obj) override;
+    void save_logical_snp_obj(nuraft::snapshot& s, ulong& obj_id, nuraft::buffer& data, bool is_first_obj,
+                              bool is_last_obj) override;
 
     ////////// APIs outside of nuraft::state_machine requirements ////////////////////
     void propose_to_raft(repl_req_ptr_t rreq);
@@ -117,7 +133,8 @@ public:
     std::string rdev_name() const;
 
 private:
-    void after_precommit_in_leader(const nuraft::raft_server::req_ext_cb_params& params);
+    void prepare_journal_entry(repl_req_ctx& rreq);
+    void append_to_raft(std::vector< repl_req_ptr_t > const& rreqs);
 };
 
 } // namespace homestore
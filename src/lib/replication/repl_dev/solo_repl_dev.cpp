@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <boost/smart_ptr/intrusive_ref_counter.hpp>
 #include "replication/repl_dev/solo_repl_dev.h"
 #include "replication/repl_dev/common.h"
@@ -5,11 +6,14 @@
 #include <homestore/logstore_service.hpp>
 #include <homestore/superblk_handler.hpp>
 #include "common/homestore_assert.hpp"
+#include "common/homestore_config.hpp"
 
 namespace homestore {
 SoloReplDev::SoloReplDev(superblk< repl_dev_superblk >&& rd_sb, bool load_existing) :
         m_rd_sb{std::move(rd_sb)}, m_group_id{m_rd_sb->group_id} {
     if (load_existing) {
+        // Replay of the journal moves it past the lsns found there
+        m_next_lsn = std::max(m_rd_sb->commit_lsn + 1, int64_t{0});
         logstore_service().open_log_store(LogStoreService::DATA_LOG_FAMILY_IDX, m_rd_sb->data_journal_id, true,
                                           bind_this(SoloReplDev::on_data_journal_created, 1));
     } else {
@@ -28,7 +32,7 @@ void SoloReplDev::on_data_journal_created(shared< HomeLogStore > log_store) {
 
 void SoloReplDev::async_alloc_write(sisl::blob const& header, sisl::blob const& key, sisl::sg_list const& value,
                                     repl_req_ptr_t rreq) {
-    if (!rreq) { auto rreq = repl_req_ptr_t(new repl_req_ctx{}); }
+    if (!rreq) { rreq = repl_req_ptr_t(new repl_req_ctx{}); }
     rreq->header = header;
     rreq->key = key;
     rreq->value = std::move(value);
@@ -53,10 +57,13 @@ void SoloReplDev::async_alloc_write(sisl::blob const& header, sisl::blob const&
     }
 }
 
+static uint32_t journal_entry_size(repl_req_ctx const& rreq) {
+    return sizeof(repl_journal_entry) + rreq.header.size() + rreq.key.size() +
+        (rreq.value.size ? rreq.local_blkid.serialized_size() : 0);
+}
+
 void SoloReplDev::write_journal(repl_req_ptr_t rreq) {
-    uint32_t entry_size = sizeof(repl_journal_entry) + rreq->header.size() + rreq->key.size() +
-        (rreq->value.size ? rreq->local_blkid.serialized_size() : 0);
-    rreq->alloc_journal_entry(entry_size, false /* is_raft_buf */);
+    rreq->alloc_journal_entry(journal_entry_size(*rreq), false /* is_raft_buf */);
     rreq->journal_entry->code = journal_type_t::HS_LARGE_DATA;
     rreq->journal_entry->user_header_size = rreq->header.size();
     rreq->journal_entry->key_size = rreq->key.size();
@@ -78,23 +85,124 @@ void SoloReplDev::write_journal(repl_req_ptr_t rreq) {
         raw_ptr += b.size();
     }
 
-    m_data_journal->append_async(sisl::io_blob{rreq->raw_journal_buf(), entry_size, false /* is_aligned */},
-                                 nullptr /* cookie */,
-                                 [this, rreq](int64_t lsn, sisl::io_blob&, homestore::logdev_key, void*) mutable {
-                                     rreq->lsn = lsn;
-                                     m_listener->on_pre_commit(rreq->lsn, rreq->header, rreq->key, rreq);
+    bool const group_commit = (HS_DYNAMIC_CONFIG(consensus.solo_journal_batch_size) > 1);
+    {
+        std::unique_lock lg(m_journal_mtx);
+        if (group_commit && (m_journal_records_in_flight != 0)) {
+            // Written along with the others queued meanwhile, once the records in flight are flushed
+            m_pending_journal_reqs.push_back(std::move(rreq));
+            return;
+        }
+        ++m_journal_records_in_flight;
+    }
+    append_journal_record(std::vector< repl_req_ptr_t >{std::move(rreq)});
+}
+
+void SoloReplDev::append_journal_record(std::vector< repl_req_ptr_t > rreqs) {
+    uint32_t record_size = sizeof(repl_journal_entry);
+    for (auto const& rreq : rreqs) {
+        record_size += sizeof(uint32_t) + journal_entry_size(*rreq);
+    }
+
+    auto buf = std::shared_ptr< uint8_t[] >(new uint8_t[record_size]);
+    auto record = new (buf.get()) repl_journal_entry();
+    record->code = journal_type_t::HS_DATA_BATCH;
+    record->value_size = uint32_cast(rreqs.size());
+
+    uint8_t* raw_ptr = buf.get() + sizeof(repl_journal_entry);
+    for (auto const& rreq : rreqs) {
+        uint32_t const entry_size = journal_entry_size(*rreq);
+        std::memcpy(raw_ptr, &entry_size, sizeof(uint32_t));
+        raw_ptr += sizeof(uint32_t);
+        std::memcpy(raw_ptr, rreq->raw_journal_buf(), entry_size);
+        raw_ptr += entry_size;
+    }
+
+    // Every request gets its own lsn, consecutive within the record. Records could be appended by several threads at
+    // once (without group commit), so the lsns are reserved and the record appended under the same lock, to keep the
+    // lsns in the order of the records in the journal.
+    std::unique_lock lg(m_journal_append_mtx);
+    auto const first_lsn = m_next_lsn;
+    m_next_lsn += s_cast< int64_t >(rreqs.size());
+    for (size_t i{0}; i < rreqs.size(); ++i) {
+        rreqs[i]->lsn = first_lsn + s_cast< int64_t >(i);
+    }
+    record->dsn = uint64_cast(first_lsn);
+
+    m_data_journal->append_async(
+        sisl::io_blob{buf.get(), record_size, false /* is_aligned */}, nullptr /* cookie */,
+        [this, buf, rreqs = std::move(rreqs)](int64_t, sisl::io_blob&, homestore::logdev_key, void*) {
+            on_journal_record_written(rreqs);
+        });
+}
+
+void SoloReplDev::on_journal_record_written(std::vector< repl_req_ptr_t > const& rreqs) {
+    // Requests queued while the records were being flushed go out together now. They are only appended here, logdev
+    // flushes them after the completions of the current flush (this one included) return.
+    std::vector< std::vector< repl_req_ptr_t > > next_records;
+    {
+        std::unique_lock lg(m_journal_mtx);
+        if ((--m_journal_records_in_flight == 0) && !m_pending_journal_reqs.empty()) {
+            auto const max_batch = std::max(HS_DYNAMIC_CONFIG(consensus.solo_journal_batch_size), 1u);
+            auto const nreqs = m_pending_journal_reqs.size();
+            for (size_t i{0}; i < nreqs; i += max_batch) {
+                auto const it = m_pending_journal_reqs.begin();
+                next_records.emplace_back(std::make_move_iterator(it + i),
+                                          std::make_move_iterator(it + std::min(i + max_batch, nreqs)));
+            }
+            m_pending_journal_reqs.clear();
+            m_journal_records_in_flight = uint32_cast(next_records.size());
+        }
+    }
+
+    for (auto& record : next_records) {
+        append_journal_record(std::move(record));
+    }
 
-                                     auto cur_lsn = m_commit_upto.load();
-                                     if (cur_lsn < lsn) { m_commit_upto.compare_exchange_strong(cur_lsn, lsn); }
+    for (auto const& rreq : rreqs) {
+        m_listener->on_pre_commit(rreq->lsn, rreq->header, rreq->key, rreq);
+    }
 
-                                     data_service().commit_blk(rreq->local_blkid);
-                                     m_listener->on_commit(rreq->lsn, rreq->header, rreq->key, rreq->local_blkid, rreq);
-                                 });
+    auto const lsn = rreqs.back()->lsn;
+    auto cur_lsn = m_commit_upto.load();
+    if (cur_lsn < lsn) { m_commit_upto.compare_exchange_strong(cur_lsn, lsn); }
+
+    for (auto const& rreq : rreqs) {
+        data_service().commit_blk(rreq->local_blkid);
+        m_listener->on_commit(rreq->lsn, rreq->header, rreq->key, rreq->local_blkid, rreq);
+    }
 }
 
 void SoloReplDev::on_log_found(logstore_seq_num_t lsn, log_buffer buf, void* ctx) {
-    repl_journal_entry const* entry = r_cast< repl_journal_entry const* >(buf.bytes());
+    repl_journal_entry const* record = r_cast< repl_journal_entry const* >(buf.bytes());
+    HS_REL_ASSERT_EQ(record->major_version, repl_journal_entry::JOURNAL_ENTRY_MAJOR,
+                     "Mismatched version of journal entry found");
+    if (record->code != journal_type_t::HS_DATA_BATCH) {
+        // Record of a journal written before group commit, its only entry took the lsn of the record
+        replay_journal_entry(lsn, record, buf.size());
+        return;
+    }
+
+    // Group committed record, replay each of its entries in the order they were written, with their own lsns
+    auto const first_lsn = s_cast< int64_t >(record->dsn);
+    uint8_t const* raw_ptr = buf.bytes() + sizeof(repl_journal_entry);
     uint32_t remain_size = buf.size() - sizeof(repl_journal_entry);
+    for (uint32_t i{0}; i < record->value_size; ++i) {
+        HS_REL_ASSERT_GE(remain_size, sizeof(uint32_t), "Invalid journal record, entry count mismatch");
+        uint32_t entry_size;
+        std::memcpy(&entry_size, raw_ptr, sizeof(uint32_t));
+        raw_ptr += sizeof(uint32_t);
+        remain_size -= sizeof(uint32_t);
+
+        HS_REL_ASSERT_GE(remain_size, entry_size, "Invalid journal record, entry_size mismatch");
+        replay_journal_entry(first_lsn + i, r_cast< repl_journal_entry const* >(raw_ptr), entry_size);
+        raw_ptr += entry_size;
+        remain_size -= entry_size;
+    }
+}
+
+void SoloReplDev::replay_journal_entry(logstore_seq_num_t lsn, repl_journal_entry const* entry, uint32_t size) {
+    uint32_t remain_size = size - sizeof(repl_journal_entry);
     HS_REL_ASSERT_EQ(entry->major_version, repl_journal_entry::JOURNAL_ENTRY_MAJOR,
                      "Mismatched version of journal entry found");
     HS_REL_ASSERT_EQ(entry->code, journal_type_t::HS_LARGE_DATA, "Found a journal entry which is not data");
@@ -116,6 +224,10 @@ void SoloReplDev::on_log_found(logstore_seq_num_t lsn, log_buffer buf, void* ctx
 
     m_listener->on_pre_commit(lsn, header, key, nullptr);
 
+    {
+        std::unique_lock lg(m_journal_append_mtx);
+        m_next_lsn = std::max(m_next_lsn, lsn + 1);
+    }
     auto cur_lsn = m_commit_upto.load();
     if (cur_lsn < lsn) { m_commit_upto.compare_exchange_strong(cur_lsn, lsn); }
 
@@ -131,11 +243,11 @@ void SoloReplDev::async_free_blks(int64_t, MultiBlkId const& bid) { data_service
 
 uint32_t SoloReplDev::get_blk_size() const { return data_service().get_blk_size(); }
 
-void SoloReplDev::cp_flush(CP*) {
+folly::Future< bool > SoloReplDev::cp_flush(CP*) {
     auto lsn = m_commit_upto.load();
     m_rd_sb->commit_lsn = lsn;
     m_rd_sb->checkpoint_lsn = lsn;
-    m_rd_sb.write();
+    return m_rd_sb.async_write();
 }
 
 void SoloReplDev::cp_cleanup(CP*) { /* m_data_journal->truncate(m_rd_sb->checkpoint_lsn); */ }
@@ -14,6 +14,9 @@
  *********************************************************************************/
 #pragma once
 
+#include <mutex>
+#include <vector>
+
 #include <boost/smart_ptr/intrusive_ref_counter.hpp>
 #include <boost/intrusive_ptr.hpp>
 
@@ -34,6 +37,15 @@ private:
     uuid_t m_group_id;
     std::atomic< logstore_seq_num_t > m_commit_upto{-1};
 
+    // Group commit of the journal: Requests whose entry is built while a record is being flushed are queued and written
+    // together in the next record. All the requests in a record are completed on its flush, each with its own lsn.
+    std::mutex m_journal_mtx;
+    std::vector< repl_req_ptr_t > m_pending_journal_reqs;
+    uint32_t m_journal_records_in_flight{0};
+
+    std::mutex m_journal_append_mtx; // Serializes the lsn reservation and append of the records
+    int64_t m_next_lsn{0};           // Lsn of the next request, a record takes as many consecutive lsns as its entries
+
 public:
     SoloReplDev(superblk< repl_dev_superblk >&& rd_sb, bool load_existing);
     virtual ~SoloReplDev() = default;
@@ -52,13 +64,16 @@ public:
 
     uint32_t get_blk_size() const override;
 
-    void cp_flush(CP* cp);
+    folly::Future< bool > cp_flush(CP* cp);
     void cp_cleanup(CP* cp);
 
 private:
     void on_data_journal_created(shared< HomeLogStore > log_store);
     void write_journal(repl_req_ptr_t rreq);
+    void append_journal_record(std::vector< repl_req_ptr_t > rreqs);
+    void on_journal_record_written(std::vector< repl_req_ptr_t > const& rreqs);
     void on_log_found(logstore_seq_num_t lsn, log_buffer buf, void* ctx);
+    void replay_journal_entry(logstore_seq_num_t lsn, repl_journal_entry const* entry, uint32_t size);
 };
 
 } // namespace homestore
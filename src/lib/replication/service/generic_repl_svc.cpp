@@ -133,10 +133,12 @@ AsyncReplResult<> SoloReplService::replace_member(group_id_t group_id, replica_i
 std::unique_ptr< CPContext > SoloReplServiceCPHandler::on_switchover_cp(CP* cur_cp, CP* new_cp) { return nullptr; }
 
 folly::Future< bool > SoloReplServiceCPHandler::cp_flush(CP* cp) {
-    repl_service().iterate_repl_devs([cp](cshared< ReplDev >& repl_dev) {
-        if (repl_dev) { std::dynamic_pointer_cast< SoloReplDev >(repl_dev)->cp_flush(cp); }
+    // Superblks of all the repl devs are written together as one batch of meta blk writes
+    std::vector< folly::Future< bool > > futs;
+    repl_service().iterate_repl_devs([cp, &futs](cshared< ReplDev >& repl_dev) {
+        if (repl_dev) { futs.emplace_back(std::dynamic_pointer_cast< SoloReplDev >(repl_dev)->cp_flush(cp)); }
     });
-    return folly::makeFuture< bool >(true);
+    return folly::collectAllUnsafe(futs).thenValue([](auto&&) { return true; });
 }
 
 void SoloReplServiceCPHandler::cp_cleanup(CP* cp) {
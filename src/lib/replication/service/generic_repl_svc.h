@@ -31,7 +31,8 @@
 
 namespace homestore {
 
-static std::string const PUSH_DATA{"push_data"};
+static std::string const PUSH_DATA{"push_data"};             // Single PushDataRequest, from older leaders
+static std::string const PUSH_DATA_BATCH{"push_data_batch"}; // PushDataBatch
 static std::string const FETCH_DATA{"fetch_data"};
 
 struct repl_dev_superblk;
@@ -48,6 +49,9 @@ public:
     GenericReplService(cshared< ReplApplication >& repl_app);
     virtual void start() = 0;
     virtual void stop();
+
+    // Called once the log service has recovered the log stores of the repl devs, after start()
+    virtual void on_logs_recovered() {}
     meta_sub_type get_meta_blk_name() const override { return "repl_dev"; }
 
     ReplResult< shared< ReplDev > > get_repl_dev(group_id_t group_id) const override;
@@ -98,12 +98,53 @@ void RaftReplService::start() {
                         .with_reserved_log_items(0) // In reality ReplLogStore retains much more than this
                         .with_auto_forwarding(false);
     r_params.return_method_ = nuraft::raft_params::async_handler;
+    r_params.parallel_log_appending_ = true; // Log store acks the appends once they are durable, see ReplLogStore
     m_msg_mgr->register_mgr_type(params.default_group_type_, r_params);
 
     hs()->cp_mgr().register_consumer(cp_consumer_t::REPLICATION_SVC, std::make_unique< RaftReplServiceCPHandler >());
+
+    // Repl devs found while recovering the meta blks are created now that the messaging is up. They join their raft
+    // groups once their logs are recovered, see on_logs_recovered().
+    for (auto const& [buf, meta_cookie] : m_loaded_sbs) {
+        open_repl_dev(buf, meta_cookie);
+    }
+    m_loaded_sbs.clear();
+    for (auto const& [buf, meta_cookie] : m_loaded_config_sbs) {
+        apply_raft_group_config(buf, meta_cookie);
+    }
+    m_loaded_config_sbs.clear();
+}
+
+void RaftReplService::on_logs_recovered() {
+    std::vector< shared< ReplDev > > rdevs;
+    iterate_repl_devs([&rdevs](cshared< ReplDev >& rdev) { rdevs.push_back(rdev); });
+    for (auto const& rdev : rdevs) {
+        auto const raft_result = m_msg_mgr->join_group(
+            rdev->group_id(), "homestore_replication", std::dynamic_pointer_cast< nuraft_mesg::mesg_state_mgr >(rdev));
+        if (!raft_result) {
+            HS_DBG_ASSERT(false, "Unable to join the group_id={} with error={}",
+                          boost::uuids::to_string(rdev->group_id()).c_str(), raft_result.error());
+        }
+    }
+}
+
+void RaftReplService::stop() {
+    {
+        // Repl devs could still be referred by raft after this, so stop their timers before the services go down
+        std::shared_lock lg{m_rd_map_mtx};
+        for (auto const& [gid, rdev] : m_rd_map) {
+            std::dynamic_pointer_cast< RaftReplDev >(rdev)->destroy();
+        }
+    }
+    GenericReplService::stop();
 }
 
 void RaftReplService::raft_group_config_found(sisl::byte_view const& buf, void* meta_cookie) {
+    // Applied to its repl dev once the repl dev is created in start()
+    m_loaded_config_sbs.emplace_back(buf, meta_cookie);
+}
+
+void RaftReplService::apply_raft_group_config(sisl::byte_view const& buf, void* meta_cookie) {
     json_superblk group_config;
     auto& js = group_config.load(buf, meta_cookie);
     std::string gid_str = js["group_id"];
@@ -186,13 +227,30 @@ AsyncReplResult< shared< ReplDev > > RaftReplService::create_repl_dev(group_id_t
 }
 
 void RaftReplService::load_repl_dev(sisl::byte_view const& buf, void* meta_cookie) {
+    // Meta blks are recovered before the service is started, but a repl dev can't be created before the messaging is
+    // initialized in start(). Hold on to the superblk till then.
+    m_loaded_sbs.emplace_back(buf, meta_cookie);
+}
+
+void RaftReplService::open_repl_dev(sisl::byte_view const& buf, void* meta_cookie) {
     // Load the superblk
     superblk< raft_repl_dev_superblk > rd_sb{get_meta_blk_name()};
     rd_sb.load(buf, meta_cookie);
     HS_DBG_ASSERT_EQ(rd_sb->get_magic(), repl_dev_superblk::REPL_DEV_SB_MAGIC, "Invalid rdev metablk, magic mismatch");
+    group_id_t group_id = rd_sb->group_id;
+    if (rd_sb->get_raft_sb_version() == 1) {
+        // Version 2 appended the snapshot and resync lsns, which an upgraded repl dev starts without
+        LOGINFOMOD(replication, "Upgrading raft repl dev superblk of group_id={} from version=1 to version={}",
+                   boost::uuids::to_string(group_id), raft_repl_dev_superblk::RAFT_REPL_DEV_SB_VERSION);
+        rd_sb.resize(sizeof(raft_repl_dev_superblk));
+        rd_sb->snapshot_lsn = 0;
+        rd_sb->snapshot_term = 0;
+        rd_sb->resync_lsn = 0;
+        rd_sb->raft_sb_version = raft_repl_dev_superblk::RAFT_REPL_DEV_SB_VERSION;
+        rd_sb.write();
+    }
     HS_DBG_ASSERT_EQ(rd_sb->get_raft_sb_version(), raft_repl_dev_superblk::RAFT_REPL_DEV_SB_VERSION,
                      "Invalid version of raft rdev metablk");
-    group_id_t group_id = rd_sb->group_id;
 
     // Validate if the repl_dev for this group is already loaded.
     auto rdev_result = get_repl_dev(group_id);
@@ -205,15 +263,12 @@ void RaftReplService::load_repl_dev(sisl::byte_view const& buf, void* meta_cooki
     // Create an instance of ReplDev from loaded superblk
     auto rdev = std::make_shared< RaftReplDev >(*this, std::move(rd_sb), true /* load_existing */);
 
-    // Try to join the RAFT group
-    auto raft_result = m_msg_mgr->join_group(group_id, "homestore_replication",
-                                             std::dynamic_pointer_cast< nuraft_mesg::mesg_state_mgr >(rdev));
-    if (!raft_result) {
-        HS_DBG_ASSERT(false, "Unable to join the group_id={} with error={}", boost::uuids::to_string(group_id).c_str(),
-                      raft_result.error());
-    }
+    // Attach the listener to the raft
+    auto listener = m_repl_app->create_repl_dev_listener(group_id);
+    listener->set_repl_dev(rdev.get());
+    rdev->attach_listener(std::move(listener));
 
-    // Add the RaftReplDev to the list of repl_devs
+    // Add the RaftReplDev to the list of repl_devs, it joins the RAFT group once its logs are recovered
     add_repl_dev(group_id, rdev);
 }
 
@@ -226,9 +281,12 @@ AsyncReplResult<> RaftReplService::replace_member(group_id_t group_id, replica_i
 std::unique_ptr< CPContext > RaftReplServiceCPHandler::on_switchover_cp(CP* cur_cp, CP* new_cp) { return nullptr; }
 
 folly::Future< bool > RaftReplServiceCPHandler::cp_flush(CP* cp) {
-    repl_service().iterate_repl_devs(
-        [cp](cshared< ReplDev >& repl_dev) { std::static_pointer_cast< RaftReplDev >(repl_dev)->cp_flush(cp); });
-    return folly::makeFuture< bool >(true);
+    // Superblks of all the repl devs are written together as one batch of meta blk writes
+    std::vector< folly::Future< bool > > futs;
+    repl_service().iterate_repl_devs([cp, &futs](cshared< ReplDev >& repl_dev) {
+        futs.emplace_back(std::static_pointer_cast< RaftReplDev >(repl_dev)->cp_flush(cp));
+    });
+    return folly::collectAllUnsafe(futs).thenValue([](auto&&) { return true; });
 }
 
 void RaftReplServiceCPHandler::cp_cleanup(CP* cp) {
@@ -17,12 +17,15 @@
 #include <set>
 #include <string>
 #include <shared_mutex>
+#include <utility>
+#include <vector>
 
 #include <folly/Expected.h>
 #include <folly/futures/Future.h>
 #include <nuraft_mesg/nuraft_mesg.hpp>
 #include <sisl/fds/buffer.hpp>
 #include <sisl/logging/logging.h>
+#include <sisl/metrics/metrics.hpp>
 
 #include <homestore/homestore.hpp>
 #include <homestore/superblk_handler.hpp>
@@ -31,12 +34,47 @@
 namespace homestore {
 
 struct repl_dev_superblk;
+
+// Metrics of all the RaftReplDevs together, per group metrics don't scale to thousands of groups on a node
+class RaftReplDevMetrics : public sisl::MetricsGroup {
+public:
+    RaftReplDevMetrics() : sisl::MetricsGroup("RaftReplDevs", "AllRaftReplDevs") {
+        REGISTER_HISTOGRAM(rdev_leader_alloc_latency, "Leader write blk allocation latency",
+                           "rdev_leader_stage_latency", {"stage", "alloc"});
+        REGISTER_HISTOGRAM(rdev_leader_data_write_latency, "Leader write local data write latency",
+                           "rdev_leader_stage_latency", {"stage", "data_write"});
+        REGISTER_HISTOGRAM(rdev_leader_push_latency, "Leader write data push to followers latency",
+                           "rdev_leader_stage_latency", {"stage", "push"});
+        REGISTER_HISTOGRAM(rdev_leader_log_flush_latency, "Leader write latency from proposal till log is flushed",
+                           "rdev_leader_stage_latency", {"stage", "log_flush"});
+        REGISTER_HISTOGRAM(rdev_leader_quorum_latency, "Leader write latency from proposal till quorum is reached",
+                           "rdev_leader_stage_latency", {"stage", "quorum"});
+        REGISTER_HISTOGRAM(rdev_leader_commit_latency, "Leader write commit latency", "rdev_leader_stage_latency",
+                           {"stage", "commit"});
+        REGISTER_HISTOGRAM(rdev_leader_write_latency, "Leader write latency from submission till commit");
+        REGISTER_HISTOGRAM(rdev_propose_batch_size, "Number of journal entries proposed to raft in one append",
+                           HistogramBucketsType(LinearUpto128Buckets));
+        REGISTER_COUNTER(rdev_leader_window_waits, "Number of leader writes which waited for room in write window");
+        register_me_to_farm();
+    }
+
+    RaftReplDevMetrics(RaftReplDevMetrics const&) = delete;
+    RaftReplDevMetrics(RaftReplDevMetrics&&) noexcept = delete;
+    RaftReplDevMetrics& operator=(RaftReplDevMetrics const&) = delete;
+    RaftReplDevMetrics& operator=(RaftReplDevMetrics&&) noexcept = delete;
+
+    ~RaftReplDevMetrics() { deregister_me_from_farm(); }
+};
+
 class RaftReplService : public GenericReplService,
                         public nuraft_mesg::MessagingApplication,
                         public std::enable_shared_from_this< RaftReplService > {
 private:
     shared< nuraft_mesg::Manager > m_msg_mgr;
     json_superblk m_config_sb;
+    RaftReplDevMetrics m_rdev_metrics;
+    std::vector< std::pair< sisl::byte_view, void* > > m_loaded_sbs;        // Repl dev superblks found before start
+    std::vector< std::pair< sisl::byte_view, void* > > m_loaded_config_sbs; // Raft config superblks found before start
 
 public:
     RaftReplService(cshared< ReplApplication >& repl_app);
@@ -48,10 +86,13 @@ public:
     std::shared_ptr< nuraft_mesg::mesg_state_mgr > create_state_mgr(int32_t srv_id,
                                                                     nuraft_mesg::group_id_t const& group_id) override;
     nuraft_mesg::Manager& msg_manager() { return *m_msg_mgr; }
+    RaftReplDevMetrics& rdev_metrics() { return m_rdev_metrics; }
 
 protected:
     ///////////////////// Overrides of GenericReplService ////////////////////
     void start() override;
+    void stop() override;
+    void on_logs_recovered() override;
     AsyncReplResult< shared< ReplDev > > create_repl_dev(group_id_t group_id,
                                                          std::set< replica_id_t > const& members) override;
     void load_repl_dev(sisl::byte_view const& buf, void* meta_cookie) override;
@@ -60,6 +101,8 @@ protected:
 
 private:
     void raft_group_config_found(sisl::byte_view const& buf, void* meta_cookie);
+    void apply_raft_group_config(sisl::byte_view const& buf, void* meta_cookie);
+    void open_repl_dev(sisl::byte_view const& buf, void* meta_cookie);
 };
 
 class RaftReplServiceCPHandler : public CPCallbacks {
@@ -0,0 +1,132 @@
+/*********************************************************************************
+ * Modifications Copyright 2017-2019 eBay Inc.
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *    https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed
+ * under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+ * CONDITIONS OF ANY KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations under the License.
+ *
+ *********************************************************************************/
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include <benchmark/benchmark.h>
+#include <folly/MPMCQueue.h>
+#include <sisl/logging/logging.h>
+
+#include <homestore/replication/repl_dev.h>
+#include "replication/repl_dev/common.h"
+
+SISL_LOGGING_INIT(HOMESTORE_LOG_MODS)
+
+using namespace homestore;
+
+// Follower side lifecycle of a request in the repl_key map: data push and raft log append each look up (or create)
+// the req for the key, and it is removed once its data is written. Each benchmark thread acts as a different
+// originator, so that the keys do not collide across threads.
+
+// A context of a different size than repl_req_ctx, which is allocated from the heap instead of the freelist
+struct heap_req_ctx : public repl_req_ctx {
+    uint64_t pad{0};
+};
+
+template < typename ReqT >
+static repl_req_ptr_t get_or_create(repl_key_req_map_t& map, repl_key const& rkey) {
+    if (auto const it = map.find(rkey); it != map.cend()) { return it->second; }
+    auto const [it, happened] = map.try_emplace(rkey, repl_req_ptr_t(new ReqT()));
+    return it->second;
+}
+
+template < typename ReqT >
+static void BM_ReqMap(benchmark::State& state) {
+    static repl_key_req_map_t s_map;
+    repl_key rkey{.server_id = state.thread_index(), .term = 1, .dsn = 0};
+    for ([[maybe_unused]] auto _ : state) {
+        ++rkey.dsn;
+        benchmark::DoNotOptimize(get_or_create< ReqT >(s_map, rkey)); // Data pushed
+        benchmark::DoNotOptimize(get_or_create< ReqT >(s_map, rkey)); // Log appended
+        s_map.erase(rkey);                                              // Data written
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Baseline with a single lock protecting the whole map
+static void BM_ReqMap_Locked(benchmark::State& state) {
+    static std::mutex s_mtx;
+    static std::unordered_map< repl_key, repl_req_ptr_t, repl_key::Hasher > s_map;
+
+    auto const get_or_create = [](repl_key const& rkey) {
+        std::unique_lock lg{s_mtx};
+        auto [it, happened] = s_map.try_emplace(rkey, nullptr);
+        if (happened) { it->second = repl_req_ptr_t(new repl_req_ctx()); }
+        return it->second;
+    };
+
+    repl_key rkey{.server_id = state.thread_index(), .term = 1, .dsn = 0};
+    for ([[maybe_unused]] auto _ : state) {
+        ++rkey.dsn;
+        benchmark::DoNotOptimize(get_or_create(rkey));
+        benchmark::DoNotOptimize(get_or_create(rkey));
+        repl_req_ptr_t rreq;
+        {
+            std::unique_lock lg{s_mtx};
+            auto it = s_map.find(rkey);
+            rreq = std::move(it->second); // Release the req outside the lock
+            s_map.erase(it);
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Followers create a req on the data channel or raft thread and release it on the commit thread. Each benchmark thread
+// creates the reqs and hands them over to a releaser thread of its own, which drops them.
+template < typename ReqT >
+static void BM_ReqAlloc_CrossThread(benchmark::State& state) {
+    folly::MPMCQueue< repl_req_ptr_t > handoff{1024};
+    std::atomic< bool > stop{false};
+    std::thread releaser([&handoff, &stop]() {
+        repl_req_ptr_t rreq;
+        while (!stop.load(std::memory_order_acquire)) {
+            while (handoff.read(rreq)) {
+                rreq.reset();
+            }
+        }
+        while (handoff.read(rreq)) {
+            rreq.reset();
+        }
+    });
+
+    for ([[maybe_unused]] auto _ : state) {
+        handoff.blockingWrite(repl_req_ptr_t(new ReqT()));
+    }
+    stop.store(true, std::memory_order_release);
+    releaser.join();
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_TEMPLATE(BM_ReqAlloc_CrossThread, repl_req_ctx)
+    ->Name("ReqAlloc_CrossThread_Pooled")
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ReqAlloc_CrossThread, heap_req_ctx)
+    ->Name("ReqAlloc_CrossThread_Heap")
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ReqMap, repl_req_ctx)->Name("ReqMap_Pooled")->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ReqMap, heap_req_ctx)->Name("ReqMap_Heap")->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(BM_ReqMap_Locked)->Name("ReqMap_Locked")->ThreadRange(1, 16)->UseRealTime();
+
+int main(int argc, char** argv) {
+    ::benchmark::Initialize(&argc, argv);
+    ::benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
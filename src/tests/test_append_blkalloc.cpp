@@ -14,14 +14,17 @@
  *
  *********************************************************************************/
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <cassert>
 #include <cstdint>
 #include <functional>
+#include <future>
 #include <iostream>
 #include <limits>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <random>
 #include <thread>
 #include <vector>
@@ -32,6 +35,8 @@
 #include <iomgr/iomgr_flip.hpp>
 #include <iomgr/io_environment.hpp>
 #include "blkalloc/append_blk_allocator.h"
+#include "device/chunk.h"
+#include "device/device.h"
 #include "common/homestore_assert.hpp"
 #include "common/homestore_config.hpp"
 #include "test_common/homestore_test_common.hpp"
@@ -57,6 +62,7 @@ constexpr uint64_t Gi{Ki * Mi};
 struct Param {
     uint64_t num_io;
     uint64_t run_time;
+    uint32_t bench_max_threads;
 };
 
 static Param gp;
@@ -162,6 +168,33 @@ public:
             });
     }
 
+    //
+    // write io_size bytes of data on worker thread and wait for it, optionally into the given chunk;
+    // caller is responsible to free the sg buffer;
+    //
+    MultiBlkId write_and_wait(uint64_t io_size, sisl::sg_list& sg, std::optional< chunk_num_t > chunk = std::nullopt) {
+        iovec iov;
+        iov.iov_len = io_size;
+        iov.iov_base = iomanager.iobuf_alloc(512, io_size);
+        test_common::HSTestHelper::fill_data_buf(r_cast< uint8_t* >(iov.iov_base), iov.iov_len);
+        sg.iovs.push_back(iov);
+        sg.size += io_size;
+
+        MultiBlkId blkid;
+        folly::Promise< std::error_code > p;
+        auto f = p.getFuture();
+        iomanager.run_on_forget(iomgr::reactor_regex::random_worker, [this, &sg, &blkid, chunk, &p]() {
+            blk_alloc_hints hints;
+            hints.chunk_id_hint = chunk;
+            inst().async_alloc_write(sg, hints, blkid).thenValue([this, &blkid, &p](auto&& err) {
+                if (!err) { inst().commit_blk(blkid); }
+                p.setValue(err);
+            });
+        });
+        RELEASE_ASSERT(!std::move(f).get(), "Write failure");
+        return blkid;
+    }
+
 private:
     //
     // call this api when caller needs the write buffer and blkids;
@@ -283,9 +316,194 @@ TEST_F(AppendBlkAllocatorTest, TestWriteThenRecovey) {
     LOGINFO("Step 9: do shutdown. ");
 }
 
+TEST_F(AppendBlkAllocatorTest, TestGCRelocatesLiveBlks) {
+    HS_SETTINGS_FACTORY().modifiable_settings([](auto& s) {
+        s.blkallocator.gc_garbage_ratio_pct = 50;
+        s.blkallocator.gc_max_bytes_per_sec = 0;
+    });
+    HS_SETTINGS_FACTORY().save();
+
+    auto const io_size = inst().get_blk_size();
+    LOGINFO("Step 1: write 3 blks into the same chunk");
+    std::array< sisl::sg_list, 3 > sgs;
+    auto const bid0 = write_and_wait(io_size, sgs[0]);
+    auto const chunk = bid0.chunk_num();
+    auto const bid1 = write_and_wait(io_size, sgs[1], chunk);
+    auto const live_bid = write_and_wait(io_size, sgs[2], chunk);
+
+    LOGINFO("Step 2: free the first 2 blks, leaving garbage behind the live blk={}", live_bid.to_string());
+    RELEASE_ASSERT(!inst().async_free_blk(bid0).get(), "Failed to free blks");
+    RELEASE_ASSERT(!inst().async_free_blk(bid1).get(), "Failed to free blks");
+
+    MultiBlkId remapped_bid;
+    inst().register_gc_handler(
+        [&live_bid](chunk_num_t c) {
+            return (c == live_bid.chunk_num()) ? std::vector< MultiBlkId >{live_bid} : std::vector< MultiBlkId >{};
+        },
+        [&live_bid, &remapped_bid](MultiBlkId const& old_bid, MultiBlkId const& new_bid) {
+            RELEASE_ASSERT(old_bid == live_bid, "Remap of unexpected blkid");
+            remapped_bid = new_bid;
+        });
+
+    LOGINFO("Step 3: run gc and expect the chunk to be reclaimed");
+    ASSERT_EQ(inst().gc_chunks().get(), 1u);
+    ASSERT_TRUE(remapped_bid.is_valid());
+    ASSERT_NE(remapped_bid.chunk_num(), chunk);
+
+    LOGINFO("Step 4: read the relocated blk={} and verify", remapped_bid.to_string());
+    sisl::sg_list read_sg;
+    read_sg.iovs.push_back(iovec{iomanager.iobuf_alloc(512, io_size), io_size});
+    read_sg.size = io_size;
+    RELEASE_ASSERT(!inst().async_read(remapped_bid, read_sg, io_size).get(), "Read failure");
+    ASSERT_TRUE(test_common::HSTestHelper::compare(read_sg, sgs[2]));
+
+    LOGINFO("Step 5: reclaimed chunk should serve allocation from its start");
+    sisl::sg_list new_sg;
+    auto const new_bid = write_and_wait(io_size, new_sg, chunk);
+    ASSERT_EQ(new_bid.blk_num(), 0u);
+
+    free(read_sg);
+    free(new_sg);
+    for (auto& sg : sgs) {
+        free(sg);
+    }
+    test_common::HSTestHelper::trigger_cp(true /* wait */);
+}
+
+TEST_F(AppendBlkAllocatorTest, TestGCWaitsForUncommittedBlks) {
+    HS_SETTINGS_FACTORY().modifiable_settings([](auto& s) {
+        s.blkallocator.gc_garbage_ratio_pct = 50;
+        s.blkallocator.gc_max_bytes_per_sec = 0;
+        s.blkallocator.gc_drain_timeout_ms = 200;
+    });
+    HS_SETTINGS_FACTORY().save();
+
+    auto const io_size = inst().get_blk_size();
+    LOGINFO("Step 1: write 2 blks into the same chunk and allocate one more blk after them, without committing it");
+    std::array< sisl::sg_list, 2 > sgs;
+    auto const bid0 = write_and_wait(io_size, sgs[0]);
+    auto const chunk = bid0.chunk_num();
+    auto const bid1 = write_and_wait(io_size, sgs[1], chunk);
+    blk_alloc_hints hints;
+    hints.chunk_id_hint = chunk;
+    MultiBlkId pending_bid;
+    ASSERT_EQ(inst().alloc_blks(io_size, hints, pending_bid), BlkAllocStatus::SUCCESS);
+    ASSERT_EQ(pending_bid.chunk_num(), chunk);
+
+    LOGINFO("Step 2: free the first 2 blks, leaving garbage behind the uncommitted blk={}", pending_bid.to_string());
+    RELEASE_ASSERT(!inst().async_free_blk(bid0).get(), "Failed to free blks");
+    RELEASE_ASSERT(!inst().async_free_blk(bid1).get(), "Failed to free blks");
+
+    std::atomic< bool > committed{false};
+    std::atomic< uint32_t > live_calls{0};
+    MultiBlkId remapped_bid;
+    inst().register_gc_handler(
+        [&](chunk_num_t c) {
+            if (c != chunk) { return std::vector< MultiBlkId >{}; }
+            ++live_calls;
+            return committed.load() ? std::vector< MultiBlkId >{pending_bid} : std::vector< MultiBlkId >{};
+        },
+        [&](MultiBlkId const& old_bid, MultiBlkId const& new_bid) {
+            RELEASE_ASSERT(old_bid == pending_bid, "Remap of unexpected blkid");
+            remapped_bid = new_bid;
+        });
+
+    LOGINFO("Step 3: gc should skip the chunk, since the allocation is not committed within the drain timeout");
+    ASSERT_EQ(inst().gc_chunks().get(), 0u);
+    ASSERT_EQ(live_calls.load(), 0u) << "Live blks are not expected to be taken while allocations are in flight";
+
+    LOGINFO("Step 4: commit the blk while gc is draining, gc should relocate it");
+    HS_SETTINGS_FACTORY().modifiable_settings([](auto& s) { s.blkallocator.gc_drain_timeout_ms = 10000; });
+    HS_SETTINGS_FACTORY().save();
+    auto gc_fut = inst().gc_chunks();
+    std::this_thread::sleep_for(std::chrono::milliseconds{100});
+    ASSERT_EQ(live_calls.load(), 0u) << "Live blks are not expected to be taken while allocations are in flight";
+    committed.store(true);
+    inst().commit_blk(pending_bid);
+    ASSERT_EQ(gc_fut.get(), 1u);
+    ASSERT_EQ(live_calls.load(), 1u);
+    ASSERT_TRUE(remapped_bid.is_valid());
+    ASSERT_NE(remapped_bid.chunk_num(), chunk);
+
+    for (auto& sg : sgs) {
+        free(sg);
+    }
+    test_common::HSTestHelper::trigger_cp(true /* wait */);
+}
+
+class AppendBlkAllocContentionTest : public AppendBlkAllocatorTest {
+public:
+    virtual void SetUp() override {
+        // Few large chunks, so that a round of allocation on one chunk takes long enough to measure
+        test_common::HSTestHelper::start_homestore(
+            "test_append_blkalloc",
+            {{HS_SERVICE::META, {.size_pct = 5.0}},
+             {HS_SERVICE::DATA,
+              {.size_pct = 80.0, .blkalloc_type = homestore::blk_allocator_type_t::append, .num_chunks = 4}}});
+    }
+
+    // Threads allocate single blks concurrently from an empty chunk till it is full. Returns the number of allocations
+    // per second, after validating that every blk of the chunk was handed out exactly once.
+    double alloc_full_chunk(AppendBlkAllocator* allocator, uint32_t nthreads) {
+        allocator->reset();
+        std::vector< std::vector< blk_num_t > > thread_blks(nthreads);
+        std::vector< std::thread > threads;
+
+        auto const start = std::chrono::steady_clock::now();
+        for (uint32_t t{0}; t < nthreads; ++t) {
+            threads.emplace_back([allocator, &blks = thread_blks[t]]() {
+                BlkId bid;
+                while (allocator->alloc_contiguous(bid) == BlkAllocStatus::SUCCESS) {
+                    blks.push_back(bid.blk_num());
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        auto const elapsed = std::chrono::duration< double >(std::chrono::steady_clock::now() - start).count();
+
+        std::vector< bool > seen(allocator->get_total_blks(), false);
+        size_t nallocs{0};
+        for (auto const& blks : thread_blks) {
+            for (auto const b : blks) {
+                RELEASE_ASSERT(!seen[b], "blk={} allocated twice", b);
+                seen[b] = true;
+            }
+            nallocs += blks.size();
+        }
+        RELEASE_ASSERT_EQ(nallocs, allocator->get_total_blks(), "All blks of chunk are expected to be allocated");
+        RELEASE_ASSERT_EQ(allocator->available_blks(), 0, "Allocator is expected to be full");
+        return nallocs / elapsed;
+    }
+};
+
+TEST_F(AppendBlkAllocContentionTest, AllocContention) {
+    sisl::sg_list sg;
+    auto const bid = write_and_wait(inst().get_blk_size(), sg);
+    free(sg);
+    auto* allocator = r_cast< AppendBlkAllocator* >(
+        hs()->device_mgr()->get_chunk_mutable(bid.chunk_num())->blk_allocator_mutable());
+    LOGINFO("Benchmarking allocation contention on chunk={} with {} blks", bid.chunk_num(),
+            allocator->get_total_blks());
+
+    for (uint32_t nthreads{1}; nthreads <= gp.bench_max_threads; nthreads *= 2) {
+        double best_rate{0};
+        for (uint32_t round{0}; round < 3; ++round) {
+            best_rate = std::max(best_rate, alloc_full_chunk(allocator, nthreads));
+        }
+        LOGINFO("threads={} allocs_per_sec={:.0f}", nthreads, best_rate);
+    }
+
+    allocator->reset();
+    test_common::HSTestHelper::trigger_cp(true /* wait */);
+}
+
 SISL_OPTION_GROUP(test_append_blkalloc,
                   (run_time, "", "run_time", "running time in seconds",
-                   ::cxxopts::value< uint64_t >()->default_value("30"), "number"));
+                   ::cxxopts::value< uint64_t >()->default_value("30"), "number"),
+                  (bench_max_threads, "", "bench_max_threads", "max number of threads for contention benchmark",
+                   ::cxxopts::value< uint32_t >()->default_value("16"), "number"));
 
 int main(int argc, char* argv[]) {
     int parsed_argc{argc};
@@ -296,6 +514,7 @@ int main(int argc, char* argv[]) {
 
     gp.run_time = SISL_OPTIONS["run_time"].as< uint64_t >();
     gp.num_io = SISL_OPTIONS["num_io"].as< uint64_t >();
+    gp.bench_max_threads = SISL_OPTIONS["bench_max_threads"].as< uint32_t >();
 
     return RUN_ALL_TESTS();
 }
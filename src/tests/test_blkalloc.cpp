@@ -16,6 +16,7 @@
 #include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cstdint>
 #include <functional>
 #include <iostream>
@@ -30,6 +31,7 @@
 #include <boost/dynamic_bitset.hpp>
 #include <sisl/fds/bitword.hpp>
 #include <folly/ConcurrentSkipList.h>
+#include <folly/ScopeGuard.h>
 #include <folly/concurrency/ConcurrentHashMap.h>
 #include <sisl/logging/logging.h>
 #include <sisl/options/options.h>
@@ -38,6 +40,7 @@
 #include "blkalloc/blk_cache.h"
 #include "common/homestore_assert.hpp"
 #include "common/homestore_config.hpp"
+#include "blkalloc/extent_blk_allocator.h"
 #include "blkalloc/fixed_blk_allocator.h"
 #include "blkalloc/varsize_blk_allocator.h"
 
@@ -845,6 +848,303 @@ TEST_F(VarsizeBlkAllocatorTest, alloc_var_scatter_direct_unirandsize_without_sla
     alloc_var_scatter_direct_unirandsize(this);
 }
 #endif
+namespace {
+double alloc_free_rate(VarsizeBlkAllocatorTest* const block_test_pointer, const uint32_t nthreads,
+                       const uint64_t num_iters) {
+    static constexpr size_t inflight_per_thread{16};
+    static constexpr blk_count_t nblks{4};
+
+    const auto start_time{std::chrono::steady_clock::now()};
+    block_test_pointer->run_parallel(
+        nthreads, num_iters, [&](const uint64_t iters_per_thread, std::atomic< bool >& terminate_flag) {
+            blk_alloc_hints hints;
+            hints.is_contiguous = true;
+
+            // Keep a few blks inflight per thread, similar to an io thread which frees what it allocated earlier
+            std::vector< BlkId > inflight;
+            inflight.reserve(inflight_per_thread);
+            for (uint64_t i{0}; (i < iters_per_thread) && !terminate_flag; ++i) {
+                BlkId bid;
+                if (block_test_pointer->m_allocator->alloc(nblks, hints, bid) != BlkAllocStatus::SUCCESS) {
+                    terminate_flag = true;
+                    break;
+                }
+                if (inflight.size() == inflight_per_thread) {
+                    block_test_pointer->m_allocator->free(inflight[i % inflight_per_thread]);
+                    inflight[i % inflight_per_thread] = bid;
+                } else {
+                    inflight.push_back(bid);
+                }
+            }
+            for (auto const& bid : inflight) {
+                block_test_pointer->m_allocator->free(bid);
+            }
+        });
+    const auto elapsed_us{std::chrono::duration_cast< std::chrono::microseconds >(std::chrono::steady_clock::now() -
+                                                                                   start_time)
+                              .count()};
+    return (num_iters * 1000000.0) / std::max< int64_t >(elapsed_us, 1);
+}
+} // namespace
+
+TEST_F(VarsizeBlkAllocatorTest, alloc_rate_thread_scaling) {
+    const auto num_iters{SISL_OPTIONS["iters"].as< uint64_t >()};
+    const auto max_threads{SISL_OPTIONS["bench_max_threads"].as< uint32_t >()};
+
+    for (const uint32_t num_magazines : {0u, 64u}) {
+        HS_SETTINGS_FACTORY().modifiable_settings(
+            [num_magazines](auto& s) { s.blkallocator.num_blk_magazines = num_magazines; });
+        HS_SETTINGS_FACTORY().save();
+
+        for (uint32_t nthreads{1}; nthreads <= max_threads; nthreads *= 2) {
+            create_allocator();
+            const auto rate{alloc_free_rate(this, nthreads, num_iters)};
+            LOGINFO("magazines={} threads={} alloc+free rate={:.0f} ops/sec", num_magazines, nthreads, rate);
+            ASSERT_EQ(m_allocator->available_blks(), m_total_count) << "Expected all blks to be free after the run";
+            m_allocator.reset();
+        }
+    }
+}
+
+TEST_F(VarsizeBlkAllocatorTest, magazine_hit_and_drain) {
+    static constexpr blk_count_t nblks{4};
+    auto const set_drain_interval = [](uint32_t interval_ms) {
+        HS_SETTINGS_FACTORY().modifiable_settings(
+            [interval_ms](auto& s) { s.blkallocator.blk_magazine_drain_interval_ms = interval_ms; });
+        HS_SETTINGS_FACTORY().save();
+    };
+    auto const restore_interval = folly::makeGuard([&set_drain_interval]() { set_drain_interval(100u); });
+    auto const counter = [this](std::string const& desc) {
+        return m_allocator->get_metrics_in_json()["Counters"].value(desc, int64_t{0});
+    };
+    auto const refills = [&counter]() {
+        return counter("Number of times per thread magazine is refilled from blk cache");
+    };
+    auto const drains = [&counter]() {
+        return counter("Number of times all magazines are drained because of low space");
+    };
+
+    set_drain_interval(0u);
+    create_allocator();
+    blk_alloc_hints hints;
+    hints.is_contiguous = true;
+
+    LOGINFO("Step 1: Blk freed by a thread is handed back to it from its magazine, without a refill");
+    BlkId bid;
+    ASSERT_EQ(m_allocator->alloc(nblks, hints, bid), BlkAllocStatus::SUCCESS);
+    m_allocator->free(bid);
+    auto const refills_before = refills();
+    BlkId hit_bid;
+    ASSERT_EQ(m_allocator->alloc(nblks, hints, hit_bid), BlkAllocStatus::SUCCESS);
+    ASSERT_EQ(hit_bid.blk_num(), bid.blk_num()) << "Expected the alloc to hit the magazine";
+    ASSERT_EQ(refills(), refills_before) << "Magazine is refilled while it had the blk";
+
+    LOGINFO("Step 2: Allocation with temperature hint bypasses the magazine");
+    m_allocator->free(hit_bid);
+    blk_alloc_hints temp_hints;
+    temp_hints.is_contiguous = true;
+    temp_hints.desired_temp = 1;
+    BlkId temp_bid;
+    ASSERT_EQ(m_allocator->alloc(nblks, temp_hints, temp_bid), BlkAllocStatus::SUCCESS);
+    ASSERT_NE(temp_bid.blk_num(), hit_bid.blk_num()) << "Hinted alloc is served from the magazine";
+    m_allocator->free(temp_bid);
+
+    LOGINFO("Step 3: Allocate the entire space, so that the only free blks are in the magazines");
+    std::vector< BlkId > bids;
+    while (m_allocator->alloc(nblks, hints, bid) == BlkAllocStatus::SUCCESS) {
+        bids.push_back(bid);
+    }
+    ASSERT_GT(bids.size(), 2u);
+    auto const alloc_on_other_thread = [this, &hints]() {
+        BlkAllocStatus status;
+        std::thread([this, &hints, &status]() {
+            BlkId out_bid;
+            status = m_allocator->alloc(nblks, hints, out_bid);
+        }).join();
+        return status;
+    };
+
+    LOGINFO("Step 4: Another thread finds the blk freed into this thread's magazine by draining the magazines");
+    m_allocator->free(bids.back());
+    bids.pop_back();
+    auto const drains_before = drains();
+    ASSERT_EQ(alloc_on_other_thread(), BlkAllocStatus::SUCCESS);
+    ASSERT_EQ(drains(), drains_before + 1);
+
+    LOGINFO("Step 5: Magazines are not drained again within the drain interval");
+    set_drain_interval(3600u * 1000u);
+    m_allocator->free(bids.back());
+    bids.pop_back();
+    ASSERT_NE(alloc_on_other_thread(), BlkAllocStatus::SUCCESS) << "Magazines are drained within the interval";
+    ASSERT_EQ(drains(), drains_before + 1);
+
+    set_drain_interval(0u);
+    ASSERT_EQ(alloc_on_other_thread(), BlkAllocStatus::SUCCESS);
+    ASSERT_EQ(drains(), drains_before + 2);
+    m_allocator.reset();
+}
+
+struct ExtentBlkAllocatorTest : public ::testing::Test, BlkAllocatorTest {
+    std::unique_ptr< ExtentBlkAllocator > m_allocator;
+
+    ExtentBlkAllocatorTest() : BlkAllocatorTest() { HomeStoreDynamicConfig::init_settings_default(); }
+    ExtentBlkAllocatorTest(const ExtentBlkAllocatorTest&) = delete;
+    ExtentBlkAllocatorTest(ExtentBlkAllocatorTest&&) noexcept = delete;
+    ExtentBlkAllocatorTest& operator=(const ExtentBlkAllocatorTest&) = delete;
+    ExtentBlkAllocatorTest& operator=(ExtentBlkAllocatorTest&&) noexcept = delete;
+    virtual ~ExtentBlkAllocatorTest() override = default;
+
+    virtual void SetUp() override { m_allocator = create_extent_allocator(); };
+    virtual void TearDown() override{};
+
+    std::unique_ptr< ExtentBlkAllocator > create_extent_allocator() const {
+        BlkAllocConfig cfg{4096, 4096, static_cast< uint64_t >(m_total_count) * 4096, false, "extent"};
+        return std::make_unique< ExtentBlkAllocator >(cfg, true, 0);
+    }
+
+    std::unique_ptr< VarsizeBlkAllocator > create_varsize_allocator() const {
+        VarsizeBlkAllocConfig cfg{4096,  4096,      4096u, static_cast< uint64_t >(m_total_count) * 4096,
+                                  false, "varsize", true /* use_slabs */};
+        return std::make_unique< VarsizeBlkAllocator >(cfg, true, 0);
+    }
+};
+
+TEST_F(ExtentBlkAllocatorTest, alloc_free_merge) {
+    static constexpr blk_count_t nblks{128};
+    blk_alloc_hints hints;
+    hints.is_contiguous = true;
+
+    LOGINFO("Step 1: Allocate the entire space in {} blks contiguous pieces", nblks);
+    std::vector< BlkId > bids;
+    for (uint32_t i{0}; i < m_total_count / nblks; ++i) {
+        BlkId bid;
+        ASSERT_EQ(m_allocator->alloc(nblks, hints, bid), BlkAllocStatus::SUCCESS);
+        ASSERT_EQ(bid.blk_count(), nblks);
+        bids.push_back(bid);
+    }
+    ASSERT_EQ(m_allocator->available_blks(), 0u) << "Expected no blocks to be free";
+
+    LOGINFO("Step 2: Free every other piece and validate they are not merged");
+    for (size_t i{0}; i < bids.size(); i += 2) {
+        m_allocator->free(bids[i]);
+        ASSERT_FALSE(m_allocator->is_blk_alloced(bids[i]));
+        ASSERT_TRUE(m_allocator->is_blk_alloced(bids[i + 1]));
+    }
+    ASSERT_EQ(m_allocator->num_free_extents(), bids.size() / 2);
+    ASSERT_EQ(m_allocator->largest_free_extent(), nblks);
+
+    LOGINFO("Step 3: Contiguous allocation larger than any extent should fail, but scattered should succeed");
+    BlkId bid;
+    ASSERT_EQ(m_allocator->alloc(nblks * 2, hints, bid), BlkAllocStatus::FAILED);
+
+    MultiBlkId mbid;
+    blk_alloc_hints scatter_hints;
+    scatter_hints.is_contiguous = false;
+    ASSERT_EQ(m_allocator->alloc(nblks * 2, scatter_hints, mbid), BlkAllocStatus::SUCCESS);
+    ASSERT_EQ(mbid.num_pieces(), 2u);
+    ASSERT_EQ(mbid.blk_count(), nblks * 2);
+    m_allocator->free(mbid);
+
+    LOGINFO("Step 4: Free the rest and validate all of it merges back to one extent");
+    for (size_t i{1}; i < bids.size(); i += 2) {
+        m_allocator->free(bids[i]);
+    }
+    ASSERT_EQ(m_allocator->num_free_extents(), 1u);
+    ASSERT_EQ(m_allocator->available_blks(), m_total_count);
+    ASSERT_EQ(m_allocator->largest_free_extent(), m_total_count);
+}
+
+namespace {
+struct frag_bench_result {
+    uint64_t nattempts{0};
+    uint64_t nfailed{0};
+    double avg_alloc_ns{0};
+};
+
+// Age the allocator with rounds of random sized alloc/free till it is nearly full and fragmented. Then measure large
+// contiguous allocations on it.
+frag_bench_result run_frag_benchmark(BlkAllocator& allocator, uint64_t total_blks, uint32_t fill_pct,
+                                     uint32_t num_age_rounds, uint64_t num_measure_iters) {
+    std::mt19937 re{0x5eed}; // Same workload for every allocator
+    std::uniform_int_distribution< blk_count_t > small_size{1, 64};
+    std::uniform_int_distribution< blk_count_t > large_size{64, 256};
+    blk_alloc_hints hints;
+    hints.is_contiguous = true;
+
+    std::vector< BlkId > alloced;
+    uint64_t used_blks{0};
+    const uint64_t target_blks{total_blks * fill_pct / 100};
+    for (uint32_t round{0}; round <= num_age_rounds; ++round) {
+        while (used_blks < target_blks) {
+            BlkId bid;
+            if (allocator.alloc(small_size(re), hints, bid) != BlkAllocStatus::SUCCESS) { break; }
+            used_blks += bid.blk_count();
+            alloced.push_back(bid);
+        }
+        if (round == num_age_rounds) { break; }
+
+        // Free a random third of what is allocated
+        std::shuffle(alloced.begin(), alloced.end(), re);
+        const auto nfree{alloced.size() / 3};
+        for (size_t i{0}; i < nfree; ++i) {
+            used_blks -= alloced.back().blk_count();
+            allocator.free(alloced.back());
+            alloced.pop_back();
+        }
+    }
+
+    // Make room for the measurement, by freeing random small pieces
+    std::shuffle(alloced.begin(), alloced.end(), re);
+    frag_bench_result res;
+    uint64_t total_ns{0};
+    for (uint64_t i{0}; i < num_measure_iters && !alloced.empty(); ++i) {
+        allocator.free(alloced.back());
+        alloced.pop_back();
+
+        BlkId bid;
+        const auto start{std::chrono::steady_clock::now()};
+        const auto status{allocator.alloc(large_size(re), hints, bid)};
+        total_ns += std::chrono::duration_cast< std::chrono::nanoseconds >(std::chrono::steady_clock::now() - start)
+                        .count();
+        ++res.nattempts;
+        if (status == BlkAllocStatus::SUCCESS) {
+            alloced.insert(alloced.begin(), bid); // Don't free these right away
+        } else {
+            ++res.nfailed;
+        }
+    }
+    res.avg_alloc_ns = res.nattempts ? (double(total_ns) / res.nattempts) : 0;
+
+    for (auto const& bid : alloced) {
+        allocator.free(bid);
+    }
+    return res;
+}
+} // namespace
+
+TEST_F(ExtentBlkAllocatorTest, fragmentation_benchmark) {
+    static constexpr uint32_t fill_pct{95};
+    static constexpr uint32_t num_age_rounds{8};
+    const auto num_iters{std::min< uint64_t >(SISL_OPTIONS["iters"].as< uint64_t >(), m_total_count / 64)};
+
+    LOGINFO("Step 1: Age varsize allocator to {}% full in {} rounds and measure {} large contiguous allocs", fill_pct,
+            num_age_rounds, num_iters);
+    auto varsize_allocator = create_varsize_allocator();
+    const auto varsize_res{run_frag_benchmark(*varsize_allocator, m_total_count, fill_pct, num_age_rounds, num_iters)};
+    LOGINFO("Varsize allocator: attempts={} failed={} avg_alloc_latency={:.0f}ns metrics={}",
+            varsize_res.nattempts, varsize_res.nfailed, varsize_res.avg_alloc_ns,
+            varsize_allocator->get_metrics_in_json().dump());
+    varsize_allocator.reset();
+
+    LOGINFO("Step 2: Run the same workload on extent allocator");
+    const auto extent_res{run_frag_benchmark(*m_allocator, m_total_count, fill_pct, num_age_rounds, num_iters)};
+    LOGINFO("Extent allocator: attempts={} failed={} avg_alloc_latency={:.0f}ns", extent_res.nattempts,
+            extent_res.nfailed, extent_res.avg_alloc_ns);
+
+    ASSERT_EQ(m_allocator->available_blks(), m_total_count) << "Expected all blks to be free after the run";
+    ASSERT_EQ(m_allocator->num_free_extents(), 1u) << "Expected all free blks to merge back to one extent";
+}
+
 template < typename T >
 std::shared_ptr< cxxopts::Value > opt_default(const char* val) {
     return ::cxxopts::value< T >()->default_value(val);
@@ -856,7 +1156,9 @@ SISL_OPTIONS_ENABLE(ENABLED_OPTIONS)
 SISL_OPTION_GROUP(test_blkalloc,
                   (num_blks, "", "num_blks", "number of blks", opt_default< uint32_t >("1000000"), "number"),
                   (iters, "", "iters", "number of iterations", opt_default< uint64_t >("100000"), "number"),
-                  (num_threads, "", "num_threads", "num_threads", opt_default< uint32_t >("8"), "number"))
+                  (num_threads, "", "num_threads", "num_threads", opt_default< uint32_t >("8"), "number"),
+                  (bench_max_threads, "", "bench_max_threads", "max threads to scale alloc rate benchmark upto",
+                   opt_default< uint32_t >("64"), "number"))
 
 int main(int argc, char* argv[]) {
     ::testing::InitGoogleTest(&argc, argv);
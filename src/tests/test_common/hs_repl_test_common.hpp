@@ -17,6 +17,7 @@
  */
 
 #pragma once
+#include <functional>
 #include <mutex>
 #include <condition_variable>
 #include <map>
@@ -163,12 +164,14 @@ public:
         folly_ = std::make_unique< folly::Init >(&tmp_argc, &argv_, true);
 
         LOGINFO("Starting Homestore replica={}", replica_num_);
-        test_common::HSTestHelper::start_homestore(
-            name_ + std::to_string(replica_num_),
-            {{HS_SERVICE::META, {.size_pct = 5.0}},
-             {HS_SERVICE::REPLICATION, {.size_pct = 60.0, .repl_app = std::make_unique< TestReplApplication >(*this)}},
-             {HS_SERVICE::LOG_REPLICATED, {.size_pct = 20.0}},
-             {HS_SERVICE::LOG_LOCAL, {.size_pct = 2.0}}});
+        start_homestore(false /* restart */, nullptr);
+    }
+
+    // Restarts the homestore of this replica. Replica stays down till while_down returns, so that the rest of the
+    // replicas make progress without it.
+    void restart(std::function< void() > while_down) {
+        LOGINFO("Restarting Homestore replica={}", replica_num_);
+        start_homestore(true /* restart */, std::move(while_down));
     }
 
     void teardown() {
@@ -187,7 +190,11 @@ public:
     Runner& runner() { return io_runner_; }
 
     void register_listener(std::shared_ptr< ReplDevListener > listener) {
-        if (replica_num_ != 0) { pending_listeners_.emplace_back(std::move(listener)); }
+        if (replica_num_ != 0) {
+            std::unique_lock lg(groups_mtx_);
+            pending_listeners_.emplace_back(std::move(listener));
+            pending_listeners_cv_.notify_all();
+        }
 
         ipc_data_->sync_for_member_start();
 
@@ -213,6 +220,9 @@ public:
         auto it = repl_groups_.find(group_id);
         if ((it != repl_groups_.end()) && (it->second != nullptr)) { return it->second; }
 
+        // Leader could create the group before this replica registers its listener, when more than one group is
+        // registered by the test. Give it a while before concluding that it is never going to be registered.
+        pending_listeners_cv_.wait_for(lg, std::chrono::seconds(30), [this]() { return !pending_listeners_.empty(); });
         RELEASE_ASSERT(!pending_listeners_.empty(),
                        "Looking for listener for group_id, but register_listener was not called");
 
@@ -244,6 +254,17 @@ public:
         }
     }
 
+private:
+    void start_homestore(bool restart, hs_before_services_starting_cb_t cb) {
+        test_common::HSTestHelper::start_homestore(
+            name_ + std::to_string(replica_num_),
+            {{HS_SERVICE::META, {.size_pct = 5.0}},
+             {HS_SERVICE::REPLICATION, {.size_pct = 60.0, .repl_app = std::make_unique< TestReplApplication >(*this)}},
+             {HS_SERVICE::LOG_REPLICATED, {.size_pct = 20.0}},
+             {HS_SERVICE::LOG_LOCAL, {.size_pct = 2.0}}},
+            std::move(cb), restart);
+    }
+
 private:
     uint16_t replica_num_;
     std::string name_;
@@ -258,6 +279,7 @@ private:
     std::condition_variable group_created_cv_;
     std::map< homestore::group_id_t, std::shared_ptr< homestore::ReplDevListener > > repl_groups_;
     std::vector< std::shared_ptr< homestore::ReplDevListener > > pending_listeners_; // pending to join raft group
+    std::condition_variable pending_listeners_cv_;
     std::map< homestore::replica_id_t, uint32_t > members_;
     std::set< uint32_t > up_members_;
     homestore::replica_id_t my_replica_id_;
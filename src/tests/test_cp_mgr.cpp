@@ -14,6 +14,12 @@
  *
  *********************************************************************************/
 
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <folly/ScopeGuard.h>
 #include <iomgr/io_environment.hpp>
 #include <sisl/logging/logging.h>
 #include <sisl/options/options.h>
@@ -23,6 +29,7 @@
 #include <homestore/meta_service.hpp>
 #include <homestore/checkpoint/cp_mgr.hpp>
 #include <homestore/checkpoint/cp.hpp>
+#include "common/homestore_config.hpp"
 #include "test_common/homestore_test_common.hpp"
 
 using namespace homestore;
@@ -75,18 +82,46 @@ public:
     folly::Future< bool > cp_flush(CP* cp) override {
         auto ctx = s_cast< TestCPContext* >(cp->context(cp_consumer_t::HS_CLIENT));
         ctx->validate(cp->id());
-        return folly::makeFuture< bool >(true);
+        {
+            std::unique_lock lg(s_flush_mtx);
+            if (!s_flushed_cps.empty()) { EXPECT_GT(cp->id(), s_flushed_cps.back()) << "Consumer flushed out of order"; }
+            s_flushed_cps.push_back(cp->id());
+        }
+
+        auto const delay_ms = s_flush_delay_ms.load();
+        if (delay_ms == 0) { return folly::makeFuture< bool >(true); }
+
+        // Simulate a slow flush
+        auto p = std::make_shared< folly::Promise< bool > >();
+        auto f = p->getFuture();
+        std::thread([p, delay_ms]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds{delay_ms});
+            p->setValue(true);
+        }).detach();
+        return f;
     }
 
     void cp_cleanup(CP* cp) override {}
 
     int cp_progress_percent() override { return 100; }
+
+    uint64_t cp_dirty_bytes(CP*) override { return s_dirty_bytes.load(); }
+
+    static inline std::atomic< uint32_t > s_flush_delay_ms{0};
+    static inline std::atomic< uint64_t > s_dirty_bytes{0};
+    static inline std::mutex s_flush_mtx;
+    static inline std::vector< cp_id_t > s_flushed_cps;
 };
 
 class TestCPMgr : public ::testing::Test {
 public:
     void SetUp() override {
         test_common::HSTestHelper::start_homestore("test_cp", {{HS_SERVICE::META, {.size_pct = 85.0}}});
+        {
+            std::unique_lock lg(TestCPCallbacks::s_flush_mtx);
+            TestCPCallbacks::s_flushed_cps.clear();
+        }
+        TestCPCallbacks::s_dirty_bytes = 0;
         hs()->cp_mgr().register_consumer(cp_consumer_t::HS_CLIENT, std::move(std::make_unique< TestCPCallbacks >()));
     }
     void TearDown() override { test_common::HSTestHelper::shutdown_homestore(); }
@@ -173,6 +208,98 @@ TEST_F(TestCPMgr, cp_start_and_flush) {
     this->trigger_cp(true /* wait */);
 }
 
+TEST_F(TestCPMgr, pipelined_cps) {
+    auto const orig_max_inflight = HS_DYNAMIC_CONFIG(generic.cp_max_inflight);
+    auto const restore = folly::makeGuard([orig_max_inflight]() {
+        TestCPCallbacks::s_flush_delay_ms = 0;
+        HS_SETTINGS_FACTORY().modifiable_settings(
+            [orig_max_inflight](auto& s) { s.generic.cp_max_inflight = orig_max_inflight; });
+        HS_SETTINGS_FACTORY().save();
+    });
+    HS_SETTINGS_FACTORY().modifiable_settings([](auto& s) { s.generic.cp_max_inflight = 2; });
+    HS_SETTINGS_FACTORY().save();
+
+    auto nrecords = SISL_OPTIONS["num_records"].as< uint32_t >();
+    TestCPCallbacks::s_flush_delay_ms = 1000;
+    auto const start_cp_id = homestore::hs()->cp_mgr().get_cur_cp()->id();
+
+    LOGINFO("Step 1: Simulate IO and trigger a cp which is slow to flush");
+    for (uint32_t i{0}; i < nrecords; ++i) {
+        this->simulate_io();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds{100});
+    this->trigger_cp(false /* wait */);
+
+    LOGINFO("Step 2: Simulate IO and trigger next cp while the previous cp is still flushing");
+    for (uint32_t i{0}; i < nrecords; ++i) {
+        this->simulate_io();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds{100});
+    this->trigger_cp(false /* wait */);
+
+    // Second cp is expected to be switched over right away, instead of waiting for the first cp to complete
+    ASSERT_EQ(homestore::hs()->cp_mgr().get_cur_cp()->id(), start_cp_id + 2) << "Next cp was not pipelined";
+
+    LOGINFO("Step 3: Trigger one more cp, which has to wait for a slot and wait for all of them to complete");
+    TestCPCallbacks::s_flush_delay_ms = 0;
+    this->trigger_cp(true /* wait */);
+}
+
+TEST_F(TestCPMgr, cp_sched_predictor) {
+    HS_SETTINGS_FACTORY().modifiable_settings([](auto& s) {
+        s.generic.cp_target_flush_ms = 1000;
+        s.generic.cp_target_recovery_ms = 1000 * 1000 * 1000;
+        s.generic.cp_timer_us = 3600ull * 1000 * 1000;
+        s.generic.cp_max_inflight = 1;
+    });
+    HS_SETTINGS_FACTORY().save();
+
+    auto& cp_mgr = homestore::hs()->cp_mgr();
+    auto const flush_target_triggers = [&cp_mgr]() {
+        return cp_mgr.get_metrics_in_json()["Counters"].value(
+            "cp triggered as predicted flush time reached its target", int64_t{0});
+    };
+    auto const wait_for_cp_after = [&cp_mgr](cp_id_t cp_id) {
+        for (uint32_t i{0}; (i < 50) && (cp_mgr.get_cur_cp()->id() == cp_id); ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds{100});
+        }
+        return cp_mgr.get_cur_cp()->id() != cp_id;
+    };
+
+    LOGINFO("Step 1: Predicted flush time well under its target, scheduler is not expected to trigger any cp");
+    auto const start_cp_id = cp_mgr.get_cur_cp()->id();
+    std::this_thread::sleep_for(std::chrono::milliseconds{1000});
+    ASSERT_EQ(cp_mgr.get_cur_cp()->id(), start_cp_id) << "cp triggered while under all targets";
+    ASSERT_EQ(flush_target_triggers(), 0);
+
+    LOGINFO("Step 2: Predicted flush time past its target, scheduler is expected to trigger a cp");
+    TestCPCallbacks::s_dirty_bytes = HS_DYNAMIC_CONFIG(generic.cp_initial_flush_bytes_per_sec) * 4;
+    ASSERT_TRUE(wait_for_cp_after(start_cp_id)) << "Scheduler did not trigger cp past the flush target";
+    TestCPCallbacks::s_dirty_bytes = 0;
+    ASSERT_GE(flush_target_triggers(), 1);
+    this->trigger_cp(true /* wait */);
+
+    LOGINFO("Step 3: Only inflight cp is slow to flush, scheduler can't trigger and shouldn't count a trigger");
+    auto const triggers_before = flush_target_triggers();
+    TestCPCallbacks::s_flush_delay_ms = 2000;
+    this->trigger_cp(false /* wait */);
+    TestCPCallbacks::s_dirty_bytes = 1ull << 52;
+    std::this_thread::sleep_for(std::chrono::milliseconds{1000});
+    ASSERT_EQ(flush_target_triggers(), triggers_before) << "Trigger counted for a cp which was never triggered";
+
+    TestCPCallbacks::s_dirty_bytes = 0;
+    TestCPCallbacks::s_flush_delay_ms = 0;
+    this->trigger_cp(true /* wait */);
+
+    HS_SETTINGS_FACTORY().modifiable_settings([](auto& s) {
+        s.generic.cp_target_flush_ms = 2000;
+        s.generic.cp_target_recovery_ms = 10000;
+        s.generic.cp_timer_us = 60000000;
+        s.generic.cp_max_inflight = 2;
+    });
+    HS_SETTINGS_FACTORY().save();
+}
+
 int main(int argc, char* argv[]) {
     int parsed_argc = argc;
     ::testing::InitGoogleTest(&parsed_argc, argv);
@@ -28,6 +28,8 @@
 #include <gtest/gtest.h>
 #include <iomgr/iomgr_flip.hpp>
 #include <folly/concurrency/ConcurrentHashMap.h>
+#include <folly/ScopeGuard.h>
+#include <sisl/metrics/metrics.hpp>
 
 #include <homestore/blk.h>
 #include <homestore/homestore.hpp>
@@ -68,6 +70,16 @@ struct Param {
 
 static Param gp;
 
+// Sum of the counter with given description across all the bitmap blk allocators
+static int64_t bitmap_alloc_counter(std::string const& desc) {
+    int64_t total{0};
+    auto j = sisl::MetricsFarm::getInstance().get_result_in_json();
+    for (auto const& [inst, metrics] : j["BitmapBlkAlloc"].items()) {
+        total += metrics["Counters"].value(desc, int64_t{0});
+    }
+    return total;
+}
+
 VENUM(DataSvcOp_t, uint8_t, async_alloc_write = 1, async_read = 2, async_free = 3, max_op = 4);
 
 typedef std::function< void(std::error_condition err, std::shared_ptr< std::vector< BlkId > > out_bids) >
@@ -816,6 +828,129 @@ TEST_F(BlkDataServiceTest, TestRandMixIOLoad) {
     wait_for_outstanding_io_done();
 }
 
+/**
+ * @brief Allocates and frees blks over several cps with the full copy of the bitmap held back, so that the bitmaps
+ * get persisted as deltas, then restarts and verifies the recovered allocator state.
+ */
+TEST_F(BlkDataServiceTest, TestBitmapDeltaRecovery) {
+    HS_SETTINGS_FACTORY().modifiable_settings([](auto& s) {
+        s.blkallocator.bitmap_full_persist_interval_cps = 1000;
+        s.blkallocator.bitmap_full_persist_dirty_pct = 100;
+        HS_SETTINGS_FACTORY().save();
+    });
+    auto const restore_settings = folly::makeGuard([]() {
+        HS_SETTINGS_FACTORY().modifiable_settings([](auto& s) {
+            s.blkallocator.bitmap_full_persist_interval_cps = 64;
+            s.blkallocator.bitmap_full_persist_dirty_pct = 25;
+            HS_SETTINGS_FACTORY().save();
+        });
+    });
+
+    auto const blk_size = inst().get_blk_size();
+    std::vector< MultiBlkId > live_bids;
+    LOGINFO("Step 1: Allocate and free blks across cps, so bitmaps are persisted as deltas");
+    test_common::HSTestHelper::trigger_cp(true /* wait */); // Fresh bitmaps are persisted in full the first time
+    auto const full_before = bitmap_alloc_counter("Number of times the full disk bitmap is persisted");
+    auto const delta_before = bitmap_alloc_counter("Number of times only the disk bitmap delta is persisted");
+    for (uint32_t round{0}; round < 5; ++round) {
+        for (uint32_t i{0}; i < 64; ++i) {
+            MultiBlkId bid;
+            ASSERT_EQ(inst().alloc_blks(blk_size * ((i % 16) + 1), blk_alloc_hints{}, bid), BlkAllocStatus::SUCCESS);
+            inst().commit_blk(bid);
+            live_bids.push_back(bid);
+        }
+        for (uint32_t i{0}; i < live_bids.size(); i += 3) {
+            inst().async_free_blk(live_bids[i]).get();
+            live_bids[i] = live_bids.back();
+            live_bids.pop_back();
+        }
+        test_common::HSTestHelper::trigger_cp(true /* wait */);
+    }
+    auto const used_before = inst().get_used_capacity();
+    ASSERT_EQ(bitmap_alloc_counter("Number of times the full disk bitmap is persisted"), full_before)
+        << "Full bitmap is persisted, though the interval and dirty pct should allow only deltas";
+    ASSERT_GT(bitmap_alloc_counter("Number of times only the disk bitmap delta is persisted"), delta_before)
+        << "No bitmap delta is persisted";
+
+    LOGINFO("Step 2: Restart homestore and verify the used capacity is recovered");
+    test_common::HSTestHelper::start_homestore("test_data_service", {{HS_SERVICE::META, {}}, {HS_SERVICE::DATA, {}}},
+                                               nullptr, true /* restart */);
+    ASSERT_EQ(inst().get_used_capacity(), used_before) << "Used capacity mismatch after restart";
+    ASSERT_GT(bitmap_alloc_counter("Number of disk bitmap portions recovered from delta"), 0)
+        << "Recovery did not apply the bitmap delta";
+
+    LOGINFO("Step 3: Verify new allocations do not overlap any of the blks which are still live");
+    std::unordered_set< uint64_t > live_blks;
+    auto const blk_key = [](chunk_num_t chunk, blk_num_t blk) { return (uint64_cast(chunk) << 32) | blk; };
+    for (auto const& bid : live_bids) {
+        auto it = bid.iterate();
+        while (auto const b = it.next()) {
+            for (blk_count_t c{0}; c < b->blk_count(); ++c) {
+                live_blks.insert(blk_key(b->chunk_num(), b->blk_num() + c));
+            }
+        }
+    }
+    for (uint32_t i{0}; i < 256; ++i) {
+        MultiBlkId bid;
+        ASSERT_EQ(inst().alloc_blks(blk_size * 4, blk_alloc_hints{}, bid), BlkAllocStatus::SUCCESS);
+        auto it = bid.iterate();
+        while (auto const b = it.next()) {
+            for (blk_count_t c{0}; c < b->blk_count(); ++c) {
+                ASSERT_EQ(live_blks.count(blk_key(b->chunk_num(), b->blk_num() + c)), 0)
+                    << "Blk " << b->to_string() << " allocated again after restart while still live";
+            }
+        }
+    }
+}
+
+/**
+ * @brief Allocates blks for batches of requests in one call and verifies every request gets its own non overlapping
+ * blks of the requested size, contiguous across the batch when the batch fits in a blkid.
+ */
+TEST_F(BlkDataServiceTest, TestBatchAllocBlks) {
+    auto const blk_size = inst().get_blk_size();
+    auto const blk_key = [](chunk_num_t chunk, blk_num_t blk) { return (uint64_cast(chunk) << 32) | blk; };
+    std::unordered_set< uint64_t > allocated_blks;
+    std::vector< MultiBlkId > all_bids;
+
+    for (uint32_t round{0}; round < 16; ++round) {
+        std::vector< uint32_t > sizes;
+        for (uint32_t i{0}; i < (round % 8) + 1; ++i) {
+            sizes.push_back(blk_size * ((i + round) % 4 + 1));
+        }
+
+        std::vector< MultiBlkId > bids;
+        ASSERT_EQ(inst().alloc_blks(sizes, blk_alloc_hints{}, bids), BlkAllocStatus::SUCCESS);
+        ASSERT_EQ(bids.size(), sizes.size()) << "Expected a blkid for every request of the batch";
+
+        for (size_t i{0}; i < bids.size(); ++i) {
+            ASSERT_EQ(bids[i].blk_count() * blk_size, sizes[i]) << "Blks allocated do not match the request size";
+            auto it = bids[i].iterate();
+            while (auto const b = it.next()) {
+                for (blk_count_t c{0}; c < b->blk_count(); ++c) {
+                    ASSERT_TRUE(allocated_blks.insert(blk_key(b->chunk_num(), b->blk_num() + c)).second)
+                        << "Blk " << b->to_string() << " allocated to more than one request";
+                }
+            }
+
+            // Fresh device has plenty of free space, so the batch is expected to be carved out of one range
+            if (i > 0) {
+                ASSERT_EQ(bids[i].chunk_num(), bids[i - 1].chunk_num());
+                ASSERT_EQ(bids[i].blk_num(), bids[i - 1].blk_num() + bids[i - 1].blk_count())
+                    << "Blks of the batch are expected to be contiguous";
+            }
+        }
+        for (auto const& bid : bids) {
+            inst().commit_blk(bid);
+        }
+        all_bids.insert(all_bids.end(), bids.begin(), bids.end());
+    }
+
+    for (auto const& bid : all_bids) {
+        inst().async_free_blk(bid).get();
+    }
+}
+
 // Stream related test
 
 SISL_OPTION_GROUP(test_data_service,
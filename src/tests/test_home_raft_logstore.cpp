@@ -7,6 +7,7 @@
 
 #include "test_common/homestore_test_common.hpp"
 #include "replication/log_store/home_raft_log_store.h"
+#include "replication/log_store/repl_log_store.h"
 
 using namespace homestore;
 
@@ -124,6 +125,7 @@ public:
         // Do invidivual get validation
         for (uint64_t lsn = m_start_lsn; lsn < uint64_cast(m_next_lsn); ++lsn) {
             validate_log(m_rls->entry_at(lsn), lsn);
+            ASSERT_EQ(m_rls->term_at(lsn), expected_term(lsn)) << "term_at mismatch at lsn=" << lsn;
         }
 
         // Do bulk get validation as well.
@@ -144,12 +146,16 @@ private:
         return nuraft::cs_new< nuraft::log_entry >(term, buf);
     }
 
-    void validate_log(const nuraft::ptr< nuraft::log_entry >& le, int64_t lsn) {
-        uint64_t expected_term;
+    uint64_t expected_term(int64_t lsn) {
+        uint64_t term;
         std::stringstream ss;
         ss << std::hex << m_shadow_log[lsn - 1].substr(0, 8);
-        ss >> expected_term;
-        ASSERT_EQ(le->get_term(), expected_term) << "Term mismatch at lsn=" << lsn;
+        ss >> term;
+        return term;
+    }
+
+    void validate_log(const nuraft::ptr< nuraft::log_entry >& le, int64_t lsn) {
+        ASSERT_EQ(le->get_term(), expected_term(lsn)) << "Term mismatch at lsn=" << lsn;
 
         nuraft::buffer& buf = le->get_buf();
         buf.pos(0);
@@ -257,6 +263,37 @@ TEST_F(TestRaftLogStore, lifecycle_test) {
     this->m_follower_store.append_read_test(nrecords); // total_records in follower = 4000
 }
 
+TEST(PendingAppendBatches, truncate_in_middle_of_batch) {
+    PendingAppendBatches batches;
+    auto const b1 = batches.add(10, 19);
+    auto const b2 = batches.add(20, 29);
+    ASSERT_EQ(batches.durable_upto(29), 9u) << "Log is durable only upto the first pending batch";
+
+    LOGINFO("Step 1: New leader overwrites the log from the middle of first batch, second batch is gone with it");
+    batches.truncate(15);
+    ASSERT_EQ(batches.durable_upto(29), 9u) << "Entries before the truncation point are still pending";
+
+    LOGINFO("Step 2: Follower appends the entries of new leader, one of the batches at the start lsn of a dropped one");
+    auto const b3 = batches.add(15, 19);
+    auto const b4 = batches.add(20, 24);
+
+    LOGINFO("Step 3: Completion of the dropped batch should not complete the new batch at the same start lsn");
+    batches.complete(20, b2);
+    batches.complete(10, b1);
+    batches.complete(15, b3);
+    ASSERT_EQ(batches.durable_upto(24), 19u) << "Completion of a truncated batch removed a newer batch";
+
+    batches.complete(20, b4);
+    ASSERT_EQ(batches.durable_upto(24), 24u) << "All the batches are completed, but some are still pending";
+
+    LOGINFO("Step 4: Truncating all pending batches, should not leave any of them behind");
+    auto const b5 = batches.add(25, 34);
+    batches.add(35, 44);
+    batches.truncate(25);
+    batches.complete(25, b5);
+    ASSERT_EQ(batches.durable_upto(44), 44u) << "Truncated batches are left behind as pending";
+}
+
 SISL_OPTIONS_ENABLE(logging, test_home_raft_log_store, iomgr, test_common_setup)
 SISL_OPTION_GROUP(test_home_raft_log_store,
                   (num_records, "", "num_records", "number of record to test",
@@ -13,12 +13,19 @@
  * specific language governing permissions and limitations under the License.
  *
  *********************************************************************************/
+#include <latch>
+#include <thread>
+
 #include <gtest/gtest.h>
 #include <boost/uuid/random_generator.hpp>
+#include <folly/ScopeGuard.h>
+#include <iomgr/iomgr_flip.hpp>
 
+#include <sisl/metrics/metrics.hpp>
 #include <sisl/utility/enum.hpp>
 #include "common/homestore_config.hpp"
 #include "common/resource_mgr.hpp"
+#include "index/index_node_cache.hpp"
 #include "test_common/homestore_test_common.hpp"
 #include "test_common/range_scheduler.hpp"
 #include "btree_helpers/btree_test_helper.hpp"
@@ -51,6 +58,45 @@ SISL_OPTION_GROUP(
     (seed, "", "seed", "random engine seed, use random if not defined",
      ::cxxopts::value< uint64_t >()->default_value("0"), "number"))
 
+// Value of the counter with given description in the metrics group instance
+static int64_t metrics_counter(std::string const& group, std::string const& instance, std::string const& desc) {
+    auto j = sisl::MetricsFarm::getInstance().get_result_in_json();
+    return j[group][instance]["Counters"].value(desc, int64_t{0});
+}
+
+static int64_t node_cache_counter(std::string const& desc) {
+    return metrics_counter("IndexNodeCache", "index_node_cache", desc);
+}
+
+static int64_t wb_cache_counter(std::string const& desc) {
+    return metrics_counter("IndexWBCache", "index_wb_cache", desc);
+}
+
+// Number of nodes read on demand, i.e. the reads issued by a reader which missed the cache
+static int64_t node_cache_demand_reads() {
+    return node_cache_counter("Index cache misses on leaf nodes") +
+        node_cache_counter("Index cache misses on level 1 nodes") +
+        node_cache_counter("Index cache misses on level 2 nodes") +
+        node_cache_counter("Index cache misses on level 3 and above");
+}
+
+// Create a clean index node of given level with its buffer at blk, as if it is read from the device
+template < typename K, typename V >
+static BtreeNodePtr make_cache_node(BtreeConfig const& cfg, blk_num_t blk, uint16_t level) {
+    auto idx_buf = std::make_shared< IndexBuffer >(BlkId{blk, 1, 0}, cfg.node_size(), 512u);
+    BtreeNode* n;
+    if (level == 0) {
+        auto raw_mem = new uint8_t[sizeof(SimpleNode< K, V >) + sizeof(IndexBtreeNode)];
+        n = new (raw_mem) SimpleNode< K, V >(idx_buf->raw_buffer(), blk, true /* init */, true /* is_leaf */, cfg);
+    } else {
+        auto raw_mem = new uint8_t[sizeof(SimpleNode< K, BtreeLinkInfo >) + sizeof(IndexBtreeNode)];
+        n = new (raw_mem) SimpleNode< K, BtreeLinkInfo >(idx_buf->raw_buffer(), blk, true, false, cfg);
+        n->set_level(level);
+    }
+    new (n->get_node_context()) IndexBtreeNode(idx_buf);
+    return BtreeNodePtr{n};
+}
+
 template < typename TestType >
 struct BtreeTest : public BtreeTestHelper< TestType >, public ::testing::Test {
     using T = TestType;
@@ -297,6 +343,356 @@ TYPED_TEST(BtreeTest, CpFlush) {
     LOGINFO("CpFlush test end");
 }
 
+TYPED_TEST(BtreeTest, TrickleFlush) {
+    using K = typename TestFixture::K;
+    using V = typename TestFixture::V;
+    LOGINFO("TrickleFlush test start");
+    static constexpr uint32_t trickle_threshold{4};
+    auto const set_trickle = [](uint32_t threshold, uint32_t batch) {
+        HS_SETTINGS_FACTORY().modifiable_settings([threshold, batch](auto& s) {
+            s.generic.index_trickle_flush_threshold = threshold;
+            s.generic.index_trickle_flush_batch = batch;
+            HS_SETTINGS_FACTORY().save();
+        });
+    };
+
+    auto const restore_trickle = folly::makeGuard([&set_trickle]() { set_trickle(1024u, 64u); });
+
+    LOGINFO("Step 1: Trickle dirty nodes beyond the {} most recent ones, while inserting entries with splits",
+            trickle_threshold);
+    set_trickle(trickle_threshold, 4u);
+    test_common::HSTestHelper::trigger_cp(true /* wait */); // So that the next CP picks up the settings
+    const auto num_entries = SISL_OPTIONS["num_entries"].as< uint32_t >();
+    for (uint32_t i = 0; i < num_entries; ++i) {
+        this->put(i, btree_put_type::INSERT);
+    }
+    test_common::HSTestHelper::trigger_cp(true /* wait */);
+
+    LOGINFO("Step 2: Update all entries, which dirties the leaves in place, without any split");
+    auto const trickled_before = wb_cache_counter("Number of dirty index nodes written ahead of CP flush");
+    auto const skipped_before = wb_cache_counter("Number of dirty index nodes CP flush found already trickled");
+    for (uint32_t i = 0; i < num_entries; ++i) {
+        this->range_put(i, i, V::generate_rand(), true /* update */);
+    }
+
+    LOGINFO("Step 3: Trigger CP flush, which should find the older leaves already written");
+    test_common::HSTestHelper::trigger_cp(true /* wait */);
+    auto const trickled = wb_cache_counter("Number of dirty index nodes written ahead of CP flush") - trickled_before;
+    auto const skipped =
+        wb_cache_counter("Number of dirty index nodes CP flush found already trickled") - skipped_before;
+    LOGINFO("Nodes trickled={}, skipped by CP flush={}", trickled, skipped);
+    ASSERT_GT(trickled, 0) << "No node is trickle flushed";
+    ASSERT_GT(skipped, 0) << "CP flush has written all the trickled nodes again";
+
+#ifdef _PRERELEASE
+    LOGINFO("Step 4: Update entries again and crash in the middle of the CP, with only the trickled nodes on disk");
+    std::map< K, V > const flushed_map = this->m_shadow_map.map_const();
+    auto const trickled_before_crash = wb_cache_counter("Number of dirty index nodes written ahead of CP flush");
+    for (uint32_t i = 0; i < num_entries; i += 2) {
+        this->range_put(i, i, V::generate_rand(), true /* update */);
+    }
+
+    flip::FlipClient* fc = iomgr_flip::client_instance();
+    flip::FlipFrequency freq;
+    freq.set_count(num_entries);
+    freq.set_percent(100);
+    fc->inject_noreturn_flip("index_cp_flush_crash_before_writes", {}, freq);
+    test_common::HSTestHelper::trigger_cp(true /* wait */);
+    fc->remove_flip("index_cp_flush_crash_before_writes");
+    ASSERT_GT(wb_cache_counter("Number of dirty index nodes written ahead of CP flush") - trickled_before_crash, 0)
+        << "No node is trickle flushed before the crash";
+
+    this->destroy_btree();
+    this->restart_homestore();
+    std::this_thread::sleep_for(std::chrono::seconds{1});
+    LOGINFO("Restarted homestore with index recovered and repaired from CP journal");
+
+    // Every entry should be found with either its last flushed or its updated value, latter only from trickled nodes
+    uint32_t num_trickled_entries{0};
+    for (auto const& [key, value] : this->m_shadow_map.map_const()) {
+        auto copy_key = std::make_unique< K >(key);
+        auto out_v = std::make_unique< V >();
+        auto req = BtreeSingleGetRequest{copy_key.get(), out_v.get()};
+        ASSERT_EQ(this->m_bt->get(req), btree_status_t::success) << "Missing key " << key << " after recovery";
+        if (*out_v == flushed_map.at(key)) { continue; }
+        ASSERT_EQ(*out_v, value) << "Recovered value of key " << key << " is neither flushed nor updated one";
+        ++num_trickled_entries;
+    }
+    LOGINFO("Entries recovered from trickled nodes={}", num_trickled_entries);
+    ASSERT_GT(num_trickled_entries, 0u) << "Updates on trickled nodes are lost on crash";
+
+    // Update the entries lost in the crash again, so that the tree matches the shadow map
+    for (uint32_t i = 0; i < num_entries; i += 2) {
+        this->range_put(i, i, V::generate_rand(), true /* update */);
+    }
+    this->do_query(0, num_entries - 1, 1000);
+#endif
+
+    LOGINFO("TrickleFlush test end");
+}
+
+TYPED_TEST(BtreeTest, TornSplitRepair) {
+#ifdef _PRERELEASE
+    LOGINFO("TornSplitRepair test start");
+    const auto num_entries = SISL_OPTIONS["num_entries"].as< uint32_t >();
+    LOGINFO("Step 1: Insert {} entries and flush them, so that the tree has interior nodes", num_entries);
+    for (uint32_t i = 0; i < num_entries; ++i) {
+        this->put(i, btree_put_type::INSERT);
+    }
+    test_common::HSTestHelper::trigger_cp(true /* wait */);
+
+    LOGINFO("Step 2: Insert more entries to split leaves, and crash the CP after the children but before parents");
+    for (uint32_t i = num_entries; i < num_entries + num_entries / 10; ++i) {
+        this->put(i, btree_put_type::INSERT);
+    }
+    flip::FlipClient* fc = iomgr_flip::client_instance();
+    flip::FlipFrequency freq;
+    freq.set_count(num_entries);
+    freq.set_percent(100);
+    fc->inject_noreturn_flip("index_cp_flush_crash_before_parent_writes", {}, freq);
+    test_common::HSTestHelper::trigger_cp(true /* wait */);
+    fc->remove_flip("index_cp_flush_crash_before_parent_writes");
+
+    LOGINFO("Step 3: Restart, recovery should repair the torn splits from the CP journal");
+    this->destroy_btree();
+    this->restart_homestore();
+    std::this_thread::sleep_for(std::chrono::seconds{1});
+
+    // Entries moved to the new siblings are reachable only if their links are added back to the parents
+    this->get_all();
+    this->do_query(0, num_entries + num_entries / 10 - 1, 1000);
+
+    LOGINFO("Step 4: Insert on the repaired tree and validate after another restart");
+    for (uint32_t i = num_entries + num_entries / 10; i < num_entries + num_entries / 5; ++i) {
+        this->put(i, btree_put_type::INSERT);
+    }
+    test_common::HSTestHelper::trigger_cp(true /* wait */);
+    this->destroy_btree();
+    this->restart_homestore();
+    std::this_thread::sleep_for(std::chrono::seconds{1});
+    this->get_all();
+    LOGINFO("TornSplitRepair test end");
+#endif
+}
+
+TYPED_TEST(BtreeTest, ConcurrentNodeReads) {
+    using K = typename TestFixture::K;
+    using V = typename TestFixture::V;
+    static constexpr uint32_t num_readers{8};
+    LOGINFO("ConcurrentNodeReads test start");
+
+    const auto num_entries = SISL_OPTIONS["num_entries"].as< uint32_t >();
+    for (uint32_t i = 0; i < num_entries; ++i) {
+        this->put(i, btree_put_type::INSERT);
+    }
+    test_common::HSTestHelper::trigger_cp(true /* wait */);
+    auto const expected = this->m_shadow_map.map_const();
+
+    auto const read_all = [this, &expected](std::latch& start) {
+        start.arrive_and_wait();
+        for (auto const& [key, value] : expected) {
+            auto k = std::make_unique< K >(key);
+            auto v = std::make_unique< V >();
+            auto req = BtreeSingleGetRequest{k.get(), v.get()};
+            ASSERT_EQ(this->m_bt->get(req), btree_status_t::success) << "Missing key " << key << " in btree";
+            ASSERT_EQ((const V&)req.value(), value) << "Incorrect value for key=" << key;
+        }
+    };
+
+    LOGINFO("Step 1: Restart with cold cache and read all {} entries from one reader", expected.size());
+    this->destroy_btree();
+    this->restart_homestore();
+    auto reads_before = node_cache_demand_reads();
+    {
+        std::latch start{1};
+        read_all(start);
+    }
+    auto const single_reads = node_cache_demand_reads() - reads_before;
+
+    LOGINFO("Step 2: Restart with cold cache and read all entries from {} readers in lock step", num_readers);
+    this->destroy_btree();
+    this->restart_homestore();
+    reads_before = node_cache_demand_reads();
+    auto const joins_before = node_cache_counter("Number of cache misses which joined a read already in flight");
+    {
+        std::latch start{num_readers};
+        std::vector< std::thread > readers;
+        for (uint32_t r{0}; r < num_readers; ++r) {
+            readers.emplace_back([&read_all, &start]() { read_all(start); });
+        }
+        for (auto& t : readers) {
+            t.join();
+        }
+    }
+    auto const concurrent_reads = node_cache_demand_reads() - reads_before;
+    auto const joins =
+        node_cache_counter("Number of cache misses which joined a read already in flight") - joins_before;
+
+    LOGINFO("Node reads with one reader={}, with {} readers={}, reads joined={}", single_reads, num_readers,
+            concurrent_reads, joins);
+    ASSERT_EQ(concurrent_reads, single_reads) << "Concurrent readers of a node should share a single read of it";
+    LOGINFO("ConcurrentNodeReads test end");
+}
+
+TYPED_TEST(BtreeTest, SweepQueryPrefetch) {
+    LOGINFO("SweepQueryPrefetch test start");
+
+    const auto num_entries = SISL_OPTIONS["num_entries"].as< uint32_t >();
+    for (uint32_t i = 0; i < num_entries; ++i) {
+        this->put(i, btree_put_type::INSERT);
+    }
+    test_common::HSTestHelper::trigger_cp(true /* wait */);
+
+    LOGINFO("Step 1: Restart with cold cache and prefetch disabled, query all entries with pagination of 75");
+    auto const prefetch_nodes = this->m_cfg.m_max_sweep_prefetch_nodes;
+    this->m_cfg.m_max_sweep_prefetch_nodes = 0;
+    this->destroy_btree();
+    this->restart_homestore();
+    auto reads_before = node_cache_demand_reads();
+    this->query_all_paginate(75);
+    auto const reads_without_prefetch = node_cache_demand_reads() - reads_before;
+
+    LOGINFO("Step 2: Restart with cold cache and prefetch of {} nodes, query all entries again", prefetch_nodes);
+    this->m_cfg.m_max_sweep_prefetch_nodes = prefetch_nodes;
+    this->destroy_btree();
+    this->restart_homestore();
+    reads_before = node_cache_demand_reads();
+    auto const prefetch_before = node_cache_counter("Number of node reads issued ahead by prefetch");
+    this->query_all_paginate(75);
+    auto const reads_with_prefetch = node_cache_demand_reads() - reads_before;
+    auto const prefetched = node_cache_counter("Number of node reads issued ahead by prefetch") - prefetch_before;
+
+    LOGINFO("Node reads on demand without prefetch={}, with prefetch={}, prefetched={}", reads_without_prefetch,
+            reads_with_prefetch, prefetched);
+    ASSERT_GT(prefetched, 0) << "Sweep query didn't prefetch any node";
+    ASSERT_LT(reads_with_prefetch, reads_without_prefetch) << "Prefetched nodes are not used by the sweep query";
+    LOGINFO("SweepQueryPrefetch test end");
+}
+
+TYPED_TEST(BtreeTest, NodeCacheScanResistance) {
+    using K = typename TestFixture::K;
+    using V = typename TestFixture::V;
+    static constexpr uint32_t capacity{64};
+    static constexpr uint32_t working_set{16};
+    static constexpr uint32_t scan_size{1024};
+
+    IndexNodeCache cache{capacity * this->m_cfg.node_size(), this->m_cfg.node_size(), 1 /* num_shards */};
+
+    LOGINFO("Step 1: Load a working set of {} leaves into a cache of {} nodes and access them again", working_set,
+            capacity);
+    for (blk_num_t b{0}; b < working_set; ++b) {
+        ASSERT_TRUE(cache.insert(make_cache_node< K, V >(this->m_cfg, b, 0)));
+        BtreeNodePtr node;
+        ASSERT_TRUE(cache.get(BlkId{b, 1, 0}, node));
+    }
+
+    LOGINFO("Step 2: Scan {} leaves once, which is many times the capacity", scan_size);
+    for (blk_num_t b{working_set}; b < working_set + scan_size; ++b) {
+        ASSERT_TRUE(cache.insert(make_cache_node< K, V >(this->m_cfg, b, 0)));
+    }
+
+    LOGINFO("Step 3: Validate the working set survived the scan and the cache is within capacity");
+    for (blk_num_t b{0}; b < working_set; ++b) {
+        ASSERT_TRUE(cache.contains(BlkId{b, 1, 0})) << "Working set node blk=" << b << " is evicted by the scan";
+    }
+    uint32_t cached_scan_nodes{0};
+    for (blk_num_t b{working_set}; b < working_set + scan_size; ++b) {
+        if (cache.contains(BlkId{b, 1, 0})) { ++cached_scan_nodes; }
+    }
+    ASSERT_LE(cached_scan_nodes + working_set, capacity) << "Cache has grown beyond its capacity";
+
+    LOGINFO("Step 4: Pin more nodes than the capacity and validate inserts neither evict them nor get stuck");
+    std::vector< BtreeNodePtr > pinned;
+    for (blk_num_t b{0}; b < 2 * capacity; ++b) {
+        pinned.push_back(make_cache_node< K, V >(this->m_cfg, 100000 + b, 0));
+        ASSERT_TRUE(cache.insert(pinned.back()));
+    }
+    for (auto const& node : pinned) {
+        ASSERT_TRUE(cache.contains(IndexBtreeNode::convert(node.get())->m_idx_buf->m_blkid))
+            << "Node in use is evicted";
+    }
+}
+
+TYPED_TEST(BtreeTest, NodeCacheLevelMetrics) {
+    using K = typename TestFixture::K;
+    using V = typename TestFixture::V;
+
+    IndexNodeCache cache{1024 * this->m_cfg.node_size(), this->m_cfg.node_size(), 1 /* num_shards */};
+
+    // Level i is accessed (i + 1) times and missed (i + 2) times, so that each counter has a distinct value
+    for (uint16_t level{0}; level < 5; ++level) {
+        auto node = make_cache_node< K, V >(this->m_cfg, level, level);
+        for (uint16_t i{0}; i < level + 2; ++i) {
+            cache.record_miss(node);
+        }
+        ASSERT_TRUE(cache.insert(node));
+        for (uint16_t i{0}; i < level + 1; ++i) {
+            BtreeNodePtr out_node;
+            ASSERT_TRUE(cache.get(BlkId{level, 1, 0}, out_node));
+        }
+    }
+
+    auto const counters = cache.get_metrics_in_json()["Counters"];
+    LOGINFO("Index node cache metrics: {}", counters.dump());
+    ASSERT_EQ(counters["Index cache hits on leaf nodes"].get< int64_t >(), 1);
+    ASSERT_EQ(counters["Index cache hits on level 1 nodes"].get< int64_t >(), 2);
+    ASSERT_EQ(counters["Index cache hits on level 2 nodes"].get< int64_t >(), 3);
+    ASSERT_EQ(counters["Index cache hits on level 3 and above"].get< int64_t >(), 4 + 5);
+    ASSERT_EQ(counters["Index cache misses on leaf nodes"].get< int64_t >(), 2);
+    ASSERT_EQ(counters["Index cache misses on level 1 nodes"].get< int64_t >(), 3);
+    ASSERT_EQ(counters["Index cache misses on level 2 nodes"].get< int64_t >(), 4);
+    ASSERT_EQ(counters["Index cache misses on level 3 and above"].get< int64_t >(), 5 + 6);
+}
+
+TYPED_TEST(BtreeTest, SnapshotQuery) {
+    using K = typename TestFixture::K;
+    using V = typename TestFixture::V;
+    LOGINFO("SnapshotQuery test start");
+
+    const auto num_entries = SISL_OPTIONS["num_entries"].as< uint32_t >();
+    for (uint32_t i = 0; i < num_entries; i += 2) {
+        this->put(i, btree_put_type::INSERT);
+    }
+
+    auto snap = this->m_bt->create_snapshot().get();
+    auto const expected = this->m_shadow_map.map_const();
+    LOGINFO("Snapshot taken at cp {} with {} entries", snap->m_cp_id, expected.size());
+
+    // Modify the tree after snapshot, with enough inserts to split the nodes and removes to merge them
+    for (uint32_t i = 1; i < num_entries; i += 2) {
+        this->put(i, btree_put_type::INSERT);
+    }
+    for (uint32_t i = 0; i < num_entries; i += 6) {
+        this->remove_one(i);
+    }
+    test_common::HSTestHelper::trigger_cp(true /* wait */);
+
+    LOGINFO("Query the snapshot with pagination of 75 entries and validate with the entries as of snapshot");
+    BtreeQueryRequest< K > qreq{BtreeKeyRange< K >{K{0}, true, K{num_entries - 1}, true},
+                                BtreeQueryType::SNAPSHOT_QUERY, 75};
+    qreq.set_snapshot(snap);
+
+    auto it = expected.begin();
+    std::vector< std::pair< K, V > > out_vector;
+    btree_status_t ret;
+    do {
+        out_vector.clear();
+        ret = this->m_bt->query(qreq, out_vector);
+        ASSERT_TRUE((ret == btree_status_t::success) || (ret == btree_status_t::has_more)) << "Snapshot query failed";
+        for (auto const& [k, v] : out_vector) {
+            ASSERT_NE(it, expected.end()) << "Snapshot query returned more entries than in snapshot";
+            ASSERT_EQ(k.key(), it->first.key()) << "Snapshot query returned incorrect key";
+            ASSERT_EQ(v, it->second) << "Snapshot query returned incorrect value for key=" << k;
+            ++it;
+        }
+    } while (ret == btree_status_t::has_more);
+    ASSERT_EQ(it, expected.end()) << "Snapshot query missed some entries";
+
+    LOGINFO("Query the live tree after snapshot queries");
+    this->query_all_paginate(80);
+    LOGINFO("SnapshotQuery test end");
+}
+
 TYPED_TEST(BtreeTest, MultipleCpFlush) {
     LOGINFO("MultipleCpFlush test start");
 
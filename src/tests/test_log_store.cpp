@@ -37,6 +37,7 @@
 #include <vector>
 
 #include <sisl/fds/buffer.hpp>
+#include <folly/ScopeGuard.h>
 #include <folly/Synchronized.h>
 #include <iomgr/io_environment.hpp>
 #include <iomgr/http_server.hpp>
@@ -1129,6 +1130,106 @@ TEST_F(LogStoreTest, FlushSync) {
 #endif
 }
 
+TEST_F(LogStoreTest, FlushAsyncCoalescing) {
+    // Neither the threshold nor the timer flushes within the test, only the flushes requested by flush_async do
+    HS_SETTINGS_FACTORY().modifiable_settings([](auto& s) {
+        s.logstore.max_time_between_flush_us = 30000000ul; // 30 seconds
+        s.logstore.flush_threshold_size = 1048576ul;       // 1MB
+    });
+    HS_SETTINGS_FACTORY().save();
+    auto const restore = folly::makeGuard([]() {
+        HS_SETTINGS_FACTORY().modifiable_settings([](auto& s) {
+            s.logstore.max_time_between_flush_us = 300ul;
+            s.logstore.flush_threshold_size = 64ul;
+        });
+        HS_SETTINGS_FACTORY().save();
+#ifdef _PRERELEASE
+        iomgr_flip::client_instance()->remove_flip("simulate_log_flush_delay");
+#endif
+    });
+
+    auto const wait_for_issue = []() {
+        while (true) {
+            bool all_issued{true};
+            for (auto const& lsc : SampleDB::instance().m_log_store_clients) {
+                if (lsc->m_log_store->get_contiguous_issued_seq_num(-1) < lsc->m_cur_lsn.load() - 1) {
+                    all_issued = false;
+                }
+            }
+            if (all_issued) { break; }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    };
+
+    auto const cur_lsns = []() {
+        std::vector< logstore_seq_num_t > lsns;
+        for (auto const& lsc : SampleDB::instance().m_log_store_clients) {
+            lsns.push_back(lsc->m_cur_lsn.load());
+        }
+        return lsns;
+    };
+
+    // Requests a flush of every record inserted since given lsns separately and waits for all the callbacks
+    auto const flush_async_all = [](std::vector< logstore_seq_num_t > const& from_lsns) {
+        auto ncompleted = std::make_shared< std::atomic< uint64_t > >(0);
+        uint64_t nrequests{0};
+        for (size_t i{0}; i < SampleDB::instance().m_log_store_clients.size(); ++i) {
+            auto const& lsc = SampleDB::instance().m_log_store_clients[i];
+            for (auto lsn = from_lsns[i]; lsn < lsc->m_cur_lsn.load(); ++lsn) {
+                ++nrequests;
+                lsc->m_log_store->flush_async(lsn, [ncompleted]() { ncompleted->fetch_add(1); });
+            }
+        }
+
+        auto const start_time = Clock::now();
+        while ((ncompleted->load() < nrequests) && (get_elapsed_time_ms(start_time) < 10000)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        ASSERT_EQ(ncompleted->load(), nrequests) << "Not all the flush_async callbacks completed";
+    };
+
+#ifdef _PRERELEASE
+    auto const coalesced_before =
+        sisl::MetricsFarm::getInstance().get_result_in_json()["LogStores"]["AllLogStores"]["Counters"].value(
+            "Number of async flush requests served by a flush requested by another log store", int64_t{0});
+
+    // Hold the first flush for a while, so that the requests arriving meanwhile have to be coalesced
+    flip::FlipClient* fc = iomgr_flip::client_instance();
+    flip::FlipFrequency freq;
+    freq.set_count(1);
+    freq.set_percent(100);
+    flip::FlipCondition dont_care_cond;
+    fc->create_condition("", flip::Operator::DONT_CARE, (int)1, &dont_care_cond);
+    fc->inject_delay_flip("simulate_log_flush_delay", {dont_care_cond}, freq, 1000000); // Delay by 1 second
+#endif
+
+    LOGINFO("Step 1: Insert records on all the log stores, none of them are flushed yet");
+    auto start_lsns = cur_lsns();
+    this->init(200);
+    this->kickstart_inserts(1, 200);
+    wait_for_issue();
+
+    LOGINFO("Step 2: Request a flush for every record and verify all of them complete");
+    flush_async_all(start_lsns);
+    this->wait_for_inserts();
+
+#ifdef _PRERELEASE
+    auto const coalesced_after =
+        sisl::MetricsFarm::getInstance().get_result_in_json()["LogStores"]["AllLogStores"]["Counters"].value(
+            "Number of async flush requests served by a flush requested by another log store", int64_t{0});
+    ASSERT_GT(coalesced_after, coalesced_before) << "Expected the flush requests to be coalesced";
+    fc->remove_flip("simulate_log_flush_delay");
+#endif
+
+    LOGINFO("Step 3: Insert a few more and verify their flush requests are not lost in the previous coalescing");
+    start_lsns = cur_lsns();
+    this->init(8);
+    this->kickstart_inserts(1, 8);
+    wait_for_issue();
+    flush_async_all(start_lsns);
+    this->wait_for_inserts();
+}
+
 TEST_F(LogStoreTest, Rollback) {
     LOGINFO("Step 1: Reinit the 500 records on a single logstore to start rollback test");
     this->init(500, {std::make_pair(1ull, 100)}); // Last entry = 500
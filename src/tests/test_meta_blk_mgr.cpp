@@ -25,7 +25,9 @@
 #include <memory>
 #include <mutex>
 #include <random>
+#include <set>
 #include <string>
+#include <thread>
 #include <vector>
 #include <iomgr/io_environment.hpp>
 #include <sisl/logging/logging.h>
@@ -84,6 +86,7 @@ public:
     enum class meta_op_type : uint8_t { write = 1, update = 2, remove = 3, read = 4 };
 
     std::string mtype;
+    std::vector< std::string > m_bench_mtypes; // additional sub types registered along with mtype
     Clock::time_point m_start_time;
     std::vector< meta_sub_type > actual_cb_order;
     std::vector< meta_sub_type > actual_on_complete_cb_order;
@@ -384,6 +387,96 @@ public:
         }
     }
 
+    // Patch small random ranges of the only sb and write them as delta updates, returns number of compactions
+    uint32_t do_delta_updates(uint32_t nupdates) {
+        static thread_local std::random_device rd;
+        static thread_local std::default_random_engine re{rd()};
+
+        std::unique_lock< std::mutex > lg{m_mtx};
+        HS_REL_ASSERT_EQ(m_write_sbs.size(), 1u);
+        auto& info = m_write_sbs.begin()->second;
+        auto* mblk = s_cast< meta_blk* >(info.cookie);
+        const auto bid = mblk->hdr.h.bid.to_integer();
+        const auto used_size = m_mbm->used_size();
+
+        uint32_t ncompactions{0};
+        for (uint32_t i{0}; i < nupdates; ++i) {
+            std::string new_str = info.str;
+            std::uniform_int_distribution< size_t > offset_rand{0, new_str.size() - 129};
+            std::uniform_int_distribution< size_t > len_rand{1, 128};
+            gen_rand_buf(r_cast< uint8_t* >(new_str.data()) + offset_rand(re), len_rand(re));
+
+            const auto ranges = MetaBlkService::dirty_ranges(r_cast< const uint8_t* >(info.str.data()),
+                                                             r_cast< const uint8_t* >(new_str.data()), new_str.size());
+            const auto ovf_bid = mblk->hdr.h.ovf_bid.to_integer();
+            m_mbm->update_sub_sb_delta(r_cast< const uint8_t* >(new_str.data()), new_str.size(), ranges, info.cookie);
+            if (mblk->hdr.h.ovf_bid.to_integer() != ovf_bid) { ++ncompactions; }
+            info.str = std::move(new_str);
+
+            // Delta or compacted, the space used should remain same
+            HS_REL_ASSERT_EQ(m_mbm->used_size(), used_size, "Used size changed by delta update");
+        }
+
+        // Read back should give the image with all the deltas applied
+        lg.unlock();
+        m_mbm->read_sub_sb(mtype);
+        lg.lock();
+        HS_REL_ASSERT(m_cb_blks[bid] == info.str, "Context data mismatch after delta updates");
+        return ncompactions;
+    }
+
+    // Concurrently add (and then update) sbs through the async api from multiple threads, so that they get batched
+    void do_async_writes(uint32_t nthreads, uint32_t nwrites_per_thread) {
+        std::vector< std::thread > threads;
+        for (uint32_t t{0}; t < nthreads; ++t) {
+            threads.emplace_back([this, nwrites_per_thread]() {
+                std::vector< std::pair< folly::Future< void* >, std::string > > futs;
+                for (uint32_t i{0}; i < nwrites_per_thread; ++i) {
+                    auto const sz = rand_size(do_overflow());
+                    std::string str(sz, '\0');
+                    gen_rand_buf(r_cast< uint8_t* >(str.data()), sz);
+                    auto f = m_mbm->async_add_sub_sb(mtype, r_cast< const uint8_t* >(str.data()), sz);
+                    futs.emplace_back(std::move(f), std::move(str));
+                }
+
+                std::vector< std::pair< void*, std::string > > added;
+                for (auto& [f, str] : futs) {
+                    void* cookie = std::move(f).get();
+                    HS_REL_ASSERT_NE(cookie, nullptr);
+                    added.emplace_back(cookie, std::move(str));
+                }
+
+                // Update every other sb that was added, while other threads are still adding
+                std::vector< folly::Future< bool > > update_futs;
+                for (size_t i{0}; i < added.size(); i += 2) {
+                    auto const sz = rand_size(do_overflow());
+                    added[i].second = std::string(sz, '\0');
+                    gen_rand_buf(r_cast< uint8_t* >(added[i].second.data()), sz);
+                    update_futs.push_back(m_mbm->async_update_sub_sb(
+                        r_cast< const uint8_t* >(added[i].second.data()), sz, added[i].first));
+                }
+                for (auto& f : update_futs) {
+                    HS_REL_ASSERT_EQ(std::move(f).get(), true);
+                }
+
+                std::unique_lock< std::mutex > lg{m_mtx};
+                for (auto& [cookie, str] : added) {
+                    const auto bid = s_cast< const meta_blk* >(cookie)->hdr.h.bid.to_integer();
+                    HS_REL_ASSERT(m_write_sbs.find(bid) == m_write_sbs.end(), "cookie already in the map.");
+                    m_write_sbs[bid].cookie = cookie;
+                    m_write_sbs[bid].str = std::move(str);
+                    m_total_wrt_sz += total_size_written(cookie);
+                    ++m_wrt_cnt;
+                }
+            });
+        }
+
+        for (auto& t : threads) {
+            t.join();
+        }
+        HS_REL_ASSERT_EQ(m_total_wrt_sz, m_mbm->used_size(), "Used size mismatch after async writes");
+    }
+
     // compare m_cb_blks with m_write_sbs;
     void verify_cb_blks() {
         std::unique_lock< std::mutex > lg{m_mtx};
@@ -468,6 +561,24 @@ public:
         restart_homestore();
     }
 
+    void set_recovery_settings(uint32_t read_ahead_blks, uint32_t nthreads, bool parallel_handlers) {
+        HS_SETTINGS_FACTORY().modifiable_settings([&](auto& s) {
+            s.metablk.recovery_read_ahead_blks = read_ahead_blks;
+            s.metablk.recovery_threads = nthreads;
+            s.metablk.recovery_parallel_handlers = parallel_handlers;
+            HS_SETTINGS_FACTORY().save();
+        });
+    }
+
+    // restart with the given recovery settings and return the time taken for homestore to come up, in ms;
+    uint64_t timed_recovery(uint32_t read_ahead_blks, uint32_t nthreads, bool parallel_handlers) {
+        set_recovery_settings(read_ahead_blks, nthreads, parallel_handlers);
+        m_cb_blks.clear();
+        const auto start = Clock::now();
+        restart_homestore();
+        return std::chrono::duration_cast< std::chrono::milliseconds >(Clock::now() - start).count();
+    }
+
     void validate() {
         // verify received blks via callbaks are all good;
         verify_cb_blks();
@@ -547,16 +658,20 @@ public:
 
         HS_REL_ASSERT_EQ(m_mbm->total_size() - m_total_wrt_sz, m_mbm->available_blks() * m_mbm->block_size());
 
-        m_mbm->deregister_handler(mtype);
-        m_mbm->register_handler(
-            mtype,
-            [this](meta_blk* mblk, sisl::byte_view buf, size_t size) {
-                if (mblk) {
-                    std::unique_lock< std::mutex > lg{m_mtx};
-                    m_cb_blks[mblk->hdr.h.bid.to_integer()] = std::string{r_cast< const char* >(buf.bytes()), size};
-                }
-            },
-            [this](bool success) { HS_DBG_ASSERT_EQ(success, true); });
+        std::set< std::string > types{m_bench_mtypes.begin(), m_bench_mtypes.end()};
+        types.insert(mtype);
+        for (auto const& type : types) {
+            m_mbm->deregister_handler(type);
+            m_mbm->register_handler(
+                type,
+                [this](meta_blk* mblk, sisl::byte_view buf, size_t size) {
+                    if (mblk) {
+                        std::unique_lock< std::mutex > lg{m_mtx};
+                        m_cb_blks[mblk->hdr.h.bid.to_integer()] = std::string{r_cast< const char* >(buf.bytes()), size};
+                    }
+                },
+                [this](bool success) { HS_DBG_ASSERT_EQ(success, true); });
+        }
     }
 
     void register_client_inlcuding_dependencies() {
@@ -811,6 +926,83 @@ TEST_F(VMetaBlkMgrTest, random_load_test) {
     this->shutdown();
 }
 
+// 1. partial updates of an overflow sb are written as delta records, compacted once they exceed the limit;
+// 2. recovery test and verify callback context data has all the deltas applied;
+TEST_F(VMetaBlkMgrTest, delta_update_test) {
+    mtype = "Test_Delta_Update";
+    reset_counters();
+    m_start_time = Clock::now();
+    register_client();
+
+    this->do_sb_write(true /* overflow */, 64 * Ki);
+
+    // Enough updates to exceed max delta records at least twice
+    const uint32_t nupdates = 2 * (HS_DYNAMIC_CONFIG(metablk.max_delta_records) + 1);
+    const auto ncompactions = this->do_delta_updates(nupdates);
+    LOGINFO("{} delta updates done with {} compactions", nupdates, ncompactions);
+    EXPECT_GE(ncompactions, 2u);
+    EXPECT_LT(ncompactions, nupdates / 2);
+
+    this->recover_with_on_complete();
+
+    this->validate();
+
+    this->shutdown();
+}
+
+// 1. concurrent async adds and updates, which get coalesced into batches;
+// 2. recovery test and verify callback context data matches;
+TEST_F(VMetaBlkMgrTest, async_batched_write_test) {
+    mtype = "Test_Async_Batched_Write";
+    reset_counters();
+    m_start_time = Clock::now();
+    register_client();
+
+    this->do_async_writes(8 /* nthreads */, 32 /* nwrites_per_thread */);
+
+    this->recover_with_on_complete();
+
+    this->validate();
+
+    this->shutdown();
+}
+
+// 1. write a large number of sbs across several independent sub types, some of them with overflow blks;
+// 2. compare the startup time of a serial recovery against the read ahead and parallel recovery, which also dispatches
+// the sub types concurrently;
+TEST_F(VMetaBlkMgrTest, recovery_startup_bench) {
+    for (uint32_t t{0}; t < 8; ++t) {
+        m_bench_mtypes.push_back("Test_Recovery_Startup_Bench_" + std::to_string(t));
+    }
+    mtype = m_bench_mtypes[0];
+    reset_counters();
+    m_start_time = Clock::now();
+    register_client();
+
+    const auto num_sbs = SISL_OPTIONS["bench_num_sbs"].as< uint32_t >();
+    for (uint32_t i{0}; i < num_sbs; ++i) {
+        mtype = m_bench_mtypes[i % m_bench_mtypes.size()];
+        if ((i % 8) == 0) {
+            EXPECT_GT(this->do_sb_write(true /* overflow */, 64 * Ki), uint64_cast(0));
+        } else {
+            EXPECT_GT(this->do_sb_write(false, m_mbm->meta_blk_context_sz()), uint64_cast(0));
+        }
+    }
+
+    const auto serial_ms = this->timed_recovery(1 /* read_ahead_blks */, 1 /* nthreads */, false);
+    this->validate();
+
+    const auto parallel_ms = this->timed_recovery(256 /* read_ahead_blks */, 4 /* nthreads */, true);
+    this->validate();
+
+    LOGINFO("Recovery of {} sbs took {} ms serially and {} ms with read ahead and parallel recovery", num_sbs,
+            serial_ms, parallel_ms);
+
+    // back to the defaults
+    this->set_recovery_settings(256, 4, false);
+    this->shutdown();
+}
+
 #ifdef _PRERELEASE // release build doens't have flip point
 //
 // 1. Turn on flip to simulate fix is not there;
@@ -896,10 +1088,13 @@ SISL_OPTION_GROUP(
     (per_update, "", "per_update", "update percentage", ::cxxopts::value< uint32_t >()->default_value("20"), "number"),
     (per_write, "", "per_write", "write percentage", ::cxxopts::value< uint32_t >()->default_value("60"), "number"),
     (per_remove, "", "per_remove", "remove percentage", ::cxxopts::value< uint32_t >()->default_value("20"), "number"),
-    (bitmap, "", "bitmap", "bitmap test", ::cxxopts::value< bool >()->default_value("false"), "true or false"));
+    (bitmap, "", "bitmap", "bitmap test", ::cxxopts::value< bool >()->default_value("false"), "true or false"),
+    (bench_num_sbs, "", "bench_num_sbs", "number of sbs written for recovery startup benchmark",
+     ::cxxopts::value< uint32_t >()->default_value("2000"), "number"));
 
 int main(int argc, char* argv[]) {
-    ::testing::GTEST_FLAG(filter) = "*random*:VMetaBlkMgrTest.recovery_test";
+    ::testing::GTEST_FLAG(filter) = "*random*:VMetaBlkMgrTest.recovery_test:VMetaBlkMgrTest.async_batched_write_test:"
+                                    "VMetaBlkMgrTest.delta_update_test:VMetaBlkMgrTest.recovery_startup_bench";
     ::testing::InitGoogleTest(&argc, argv);
     SISL_OPTIONS_LOAD(argc, argv, logging, test_meta_blk_mgr, iomgr, test_common_setup);
     sisl::logging::SetLogger("test_meta_blk_mgr");
@@ -15,6 +15,7 @@
 #include <vector>
 #include <iostream>
 #include <filesystem>
+#include <limits>
 #include <thread>
 
 #include <gtest/gtest.h>
@@ -25,6 +26,7 @@
 #include <folly/init/Init.h>
 #include <folly/executors/GlobalExecutor.h>
 #include <gtest/gtest.h>
+#include <iomgr/iomgr_flip.hpp>
 
 #include <homestore/blk.h>
 #include <homestore/homestore.hpp>
@@ -45,7 +47,11 @@ SISL_LOGGING_INIT(HOMESTORE_LOG_MODS)
 
 SISL_OPTION_GROUP(test_raft_repl_dev,
                   (block_size, "", "block_size", "block size to io",
-                   ::cxxopts::value< uint32_t >()->default_value("4096"), "number"));
+                   ::cxxopts::value< uint32_t >()->default_value("4096"), "number"),
+                  (num_groups, "", "num_groups", "number of raft groups for multi group tests",
+                   ::cxxopts::value< uint32_t >()->default_value("64"), "number"),
+                  (snapshot_distance, "", "snapshot_distance", "raft log distance between snapshots",
+                   ::cxxopts::value< uint32_t >()->default_value("100"), "number"));
 SISL_OPTIONS_ENABLE(logging, test_raft_repl_dev, iomgr, test_common_setup, test_repl_common_setup)
 
 static std::unique_ptr< test_common::HSReplTestHelper > g_helper;
@@ -133,6 +139,57 @@ public:
 
     void on_replica_stop() override {}
 
+    bool get_snapshot_entries(int64_t from_lsn, int64_t upto_lsn, uint64_t max_data_size,
+                              std::vector< snapshot_entry >& out_entries) override {
+        std::map< int64_t, std::pair< Key, Value > > lsn_ordered;
+        {
+            std::shared_lock lk(db_mtx_);
+            for (auto const& [k, v] : inmem_db_) {
+                if ((v.lsn_ > from_lsn) && (v.lsn_ <= upto_lsn)) { lsn_ordered.emplace(v.lsn_, std::pair{k, v}); }
+            }
+        }
+
+        uint64_t data_size{0};
+        for (auto const& [lsn, kv] : lsn_ordered) {
+            if (!out_entries.empty() && (data_size >= max_data_size)) { return false; }
+            auto const& [k, v] = kv;
+            test_req::journal_header jheader{.data_size = v.data_size_, .data_pattern = v.data_pattern_};
+
+            snapshot_entry entry;
+            entry.lsn = lsn;
+            entry.header = sisl::io_blob_safe(sizeof(test_req::journal_header));
+            std::memcpy(entry.header.bytes(), &jheader, sizeof(test_req::journal_header));
+            entry.key = sisl::io_blob_safe(sizeof(uint64_t));
+            std::memcpy(entry.key.bytes(), &k.id_, sizeof(uint64_t));
+            entry.blkid = v.blkid_;
+            out_entries.push_back(std::move(entry));
+            data_size += v.data_size_;
+        }
+        return true;
+    }
+
+    void on_snapshot_entry(snapshot_entry const& entry) override {
+        LOGINFO("[Replica={}] Received snapshot entry of lsn={}", g_helper->replica_num(), entry.lsn);
+        auto jheader = r_cast< test_req::journal_header const* >(entry.header.cbytes());
+        Key k{.id_ = *(r_cast< uint64_t const* >(entry.key.cbytes()))};
+        Value v{.lsn_ = entry.lsn,
+                .data_size_ = jheader->data_size,
+                .data_pattern_ = jheader->data_pattern,
+                .blkid_ = entry.blkid};
+
+        MultiBlkId replaced_blkid;
+        {
+            std::unique_lock lk(db_mtx_);
+            if (auto const it = inmem_db_.find(k); it != inmem_db_.end()) { replaced_blkid = it->second.blkid_; }
+            inmem_db_.insert_or_assign(k, v);
+        }
+
+        // Entry replaces whatever we had for the key, its blks are not referred anymore
+        if (replaced_blkid.is_valid() && !(replaced_blkid == entry.blkid)) {
+            repl_dev()->async_free_blks(entry.lsn, replaced_blkid);
+        }
+    }
+
     void db_write(uint64_t data_size, uint32_t max_size_per_iov) {
         auto req = intrusive< test_req >(new test_req());
         req->jheader.data_size = data_size;
@@ -196,10 +253,21 @@ public:
         dbs_.emplace_back(std::move(db));
     }
 
+    void add_db() {
+        auto db = std::make_shared< TestReplicatedDB >();
+        g_helper->register_listener(db);
+        dbs_.emplace_back(std::move(db));
+    }
+
     void generate_writes(uint64_t data_size, uint32_t max_size_per_iov) {
         pick_one_db().db_write(data_size, max_size_per_iov);
     }
 
+    void generate_writes_across_dbs(uint64_t data_size, uint32_t max_size_per_iov) {
+        auto const n = next_db_.fetch_add(1, std::memory_order_relaxed);
+        dbs_[n % dbs_.size()]->db_write(data_size, max_size_per_iov);
+    }
+
     void wait_for_all_writes(uint64_t exp_writes) {
         while (true) {
             uint64_t total_writes{0};
@@ -220,8 +288,11 @@ public:
 
     TestReplicatedDB& pick_one_db() { return *dbs_[0]; }
 
+    size_t num_dbs() const { return dbs_.size(); }
+
 private:
     std::vector< std::shared_ptr< TestReplicatedDB > > dbs_;
+    std::atomic< uint64_t > next_db_{0};
 };
 
 TEST_F(RaftReplDevTest, All_Append) {
@@ -245,6 +316,194 @@ TEST_F(RaftReplDevTest, All_Append) {
     g_helper->sync_for_cleanup_start();
 }
 
+TEST_F(RaftReplDevTest, All_Append_Dropped_Push) {
+    LOGINFO("Homestore replica={} setup completed", g_helper->replica_num());
+#ifdef _PRERELEASE
+    if (g_helper->replica_num() != 0) {
+        // Drop the first few pushes received, followers have to fetch their data from the leader to commit them
+        flip::FlipClient* fc = iomgr_flip::client_instance();
+        flip::FlipFrequency freq;
+        freq.set_count(10);
+        freq.set_percent(100);
+        fc->inject_noreturn_flip("drop_push_data", {}, freq);
+    }
+#endif
+    g_helper->sync_for_test_start();
+
+    if (g_helper->replica_num() == 0) {
+        g_helper->sync_dataset_size(SISL_OPTIONS["num_io"].as< uint64_t >());
+        auto block_size = SISL_OPTIONS["block_size"].as< uint32_t >();
+        g_helper->runner().set_num_tasks(g_helper->dataset_size());
+        g_helper->runner().set_task([this, block_size]() { this->generate_writes(block_size, block_size); });
+        g_helper->runner().execute().get();
+    }
+
+    this->wait_for_all_writes(g_helper->dataset_size());
+
+    g_helper->sync_for_verify_start();
+    LOGINFO("Validate all data written so far by reading them, including the ones fetched by followers");
+    this->validate_all_data();
+
+    g_helper->sync_for_cleanup_start();
+}
+
+TEST_F(RaftReplDevTest, All_Append_Small_Write_Window) {
+    LOGINFO("Homestore replica={} setup completed", g_helper->replica_num());
+    // Only a couple of writes in flight on the leader, rest of them queue up and are admitted as the ones ahead commit
+    HS_SETTINGS_FACTORY().modifiable_settings([](auto& s) {
+        s.consensus.leader_max_inflight_writes = 2;
+        s.consensus.leader_inflight_write_kb = 16;
+    });
+    HS_SETTINGS_FACTORY().save();
+    g_helper->sync_for_test_start();
+
+    if (g_helper->replica_num() == 0) {
+        g_helper->sync_dataset_size(SISL_OPTIONS["num_io"].as< uint64_t >());
+        auto block_size = SISL_OPTIONS["block_size"].as< uint32_t >();
+        g_helper->runner().set_num_tasks(g_helper->dataset_size());
+        g_helper->runner().set_task([this, block_size]() { this->generate_writes(block_size, block_size); });
+        g_helper->runner().execute().get();
+    }
+
+    this->wait_for_all_writes(g_helper->dataset_size());
+
+    g_helper->sync_for_verify_start();
+    LOGINFO("Validate all data written so far by reading them, including the ones which waited for the window");
+    this->validate_all_data();
+
+    HS_SETTINGS_FACTORY().modifiable_settings([](auto& s) {
+        s.consensus.leader_max_inflight_writes = 1024;
+        s.consensus.leader_inflight_write_kb = 65536;
+    });
+    HS_SETTINGS_FACTORY().save();
+    g_helper->sync_for_cleanup_start();
+}
+
+TEST_F(RaftReplDevTest, All_Rollback_Before_Data) {
+    LOGINFO("Homestore replica={} setup completed", g_helper->replica_num());
+    g_helper->sync_for_test_start();
+
+    if (g_helper->replica_num() != 0) {
+        // Follower receives the log of a req whose data is yet to arrive and raft rolls it back before the data
+        // does. Append waiting for the data has to be released by the rollback.
+        auto rdev = dynamic_cast< RaftReplDev* >(pick_one_db().repl_dev());
+        ASSERT_NE(rdev, nullptr) << "Expected a raft repl dev";
+
+        auto const block_size = SISL_OPTIONS["block_size"].as< uint32_t >();
+        TestReplicatedDB::test_req::journal_header jheader{.data_size = block_size, .data_pattern = 0};
+        uint64_t key_id = (uint64_t)rand() << 32 | rand();
+        repl_key const rkey{.server_id = 0, .term = std::numeric_limits< uint64_t >::max(), .dsn = 1};
+
+        auto rreq = rdev->follower_create_req(rkey, sisl::blob{uintptr_cast(&jheader), sizeof(jheader)},
+                                              sisl::blob{uintptr_cast(&key_id), sizeof(key_id)}, block_size);
+        ASSERT_TRUE(rreq->local_blkid.is_valid()) << "Expected blks to be allocated for the req";
+
+        std::vector< repl_req_ptr_t > rreqs{rreq};
+        auto fut = rdev->notify_after_data_written(&rreqs);
+        ASSERT_FALSE(fut.isReady()) << "Data is not received yet, append should be waiting for it";
+
+        rdev->rollback_req(rreq);
+        fut.wait(std::chrono::seconds(5));
+        ASSERT_TRUE(fut.isReady()) << "Rollback did not release the append waiting for the data";
+        ASSERT_TRUE(rreq->state.load() & uint32_cast(repl_req_state_t::ROLLED_BACK));
+    }
+
+    g_helper->sync_for_cleanup_start();
+}
+
+TEST_F(RaftReplDevTest, All_Resync_Lagging_Replica) {
+    LOGINFO("Homestore replica={} setup completed", g_helper->replica_num());
+    g_helper->sync_for_test_start();
+
+    auto const lagging_replica = SISL_OPTIONS["replicas"].as< uint32_t >() - 1;
+    if (g_helper->replica_num() == lagging_replica) {
+        // Stay down while the rest of the replicas write many more entries than the snapshot distance. Leader
+        // compacts the logs this replica needs in the meantime, so it has to resync from the leader's snapshot.
+        g_helper->restart([]() {
+            LOGINFO("Replica={} is down, waiting for the rest of the replicas to complete the writes",
+                    g_helper->replica_num());
+            g_helper->sync_for_verify_start();
+        });
+        this->wait_for_all_writes(g_helper->dataset_size());
+    } else {
+        if (g_helper->replica_num() == 0) {
+            g_helper->sync_dataset_size(SISL_OPTIONS["num_io"].as< uint64_t >());
+            auto block_size = SISL_OPTIONS["block_size"].as< uint32_t >();
+            g_helper->runner().set_num_tasks(g_helper->dataset_size());
+            g_helper->runner().set_task([this, block_size]() { this->generate_writes(block_size, block_size); });
+            g_helper->runner().execute().get();
+        }
+        this->wait_for_all_writes(g_helper->dataset_size());
+        g_helper->sync_for_verify_start();
+    }
+
+    LOGINFO("Validate all data written so far by reading them, including the ones resynced from snapshot");
+    this->validate_all_data();
+
+    g_helper->sync_for_cleanup_start();
+}
+
+TEST_F(RaftReplDevTest, All_Append_Bench) {
+    LOGINFO("Homestore replica={} setup completed", g_helper->replica_num());
+    g_helper->sync_for_test_start();
+
+    auto const block_size = SISL_OPTIONS["block_size"].as< uint32_t >();
+    auto const start_time = Clock::now();
+    if (g_helper->replica_num() == 0) {
+        g_helper->sync_dataset_size(SISL_OPTIONS["num_io"].as< uint64_t >());
+        LOGINFO("Benchmark replicated writes of {} Bytes on local replicas", block_size);
+        g_helper->runner().set_num_tasks(g_helper->dataset_size());
+        g_helper->runner().set_task([this, block_size]() { this->generate_writes(block_size, block_size); });
+        g_helper->runner().execute().get();
+    }
+
+    this->wait_for_all_writes(g_helper->dataset_size());
+    auto const elapsed_us = get_elapsed_time_us(start_time);
+    LOGINFO("Replica={} completed {} replicated writes of {} Bytes in {} ms, iops={}", g_helper->replica_num(),
+            g_helper->dataset_size(), block_size, elapsed_us / 1000,
+            (g_helper->dataset_size() * 1000 * 1000) / std::max(elapsed_us, uint64_cast(1)));
+
+    g_helper->sync_for_verify_start();
+    LOGINFO("Validate all data written so far by reading them");
+    this->validate_all_data();
+
+    g_helper->sync_for_cleanup_start();
+}
+
+TEST_F(RaftReplDevTest, All_Multi_Group_Append_Bench) {
+    // Many small groups on the same set of replicas, all of them sharing the data journal of each replica. Replicas
+    // talk to each other over the loopback interface.
+    auto const num_groups = SISL_OPTIONS["num_groups"].as< uint32_t >();
+    for (uint32_t i{1}; i < num_groups; ++i) {
+        this->add_db();
+    }
+    LOGINFO("Homestore replica={} setup completed with {} groups", g_helper->replica_num(), this->num_dbs());
+    g_helper->sync_for_test_start();
+
+    auto const block_size = SISL_OPTIONS["block_size"].as< uint32_t >();
+    auto const start_time = Clock::now();
+    if (g_helper->replica_num() == 0) {
+        g_helper->sync_dataset_size(SISL_OPTIONS["num_io"].as< uint64_t >());
+        LOGINFO("Benchmark replicated writes of {} Bytes spread across {} groups", block_size, this->num_dbs());
+        g_helper->runner().set_num_tasks(g_helper->dataset_size());
+        g_helper->runner().set_task([this, block_size]() { this->generate_writes_across_dbs(block_size, block_size); });
+        g_helper->runner().execute().get();
+    }
+
+    this->wait_for_all_writes(g_helper->dataset_size());
+    auto const elapsed_us = get_elapsed_time_us(start_time);
+    LOGINFO("Replica={} completed {} replicated writes of {} Bytes across {} groups in {} ms, iops={}",
+            g_helper->replica_num(), g_helper->dataset_size(), block_size, this->num_dbs(), elapsed_us / 1000,
+            (g_helper->dataset_size() * 1000 * 1000) / std::max(elapsed_us, uint64_cast(1)));
+    LOGINFO("Journal metrics: {}", sisl::MetricsFarm::getInstance().get_result_in_json()["LogStores"].dump(4));
+
+    g_helper->sync_for_verify_start();
+    LOGINFO("Validate all data written so far by reading them");
+    this->validate_all_data();
+
+    g_helper->sync_for_cleanup_start();
+}
+
 int main(int argc, char* argv[]) {
     int parsed_argc{argc};
     char** orig_argv = argv;
@@ -253,6 +512,14 @@ int main(int argc, char* argv[]) {
     SISL_OPTIONS_LOAD(parsed_argc, argv, logging, test_raft_repl_dev, iomgr, test_common_setup, test_repl_common_setup);
 
     FLAGS_folly_global_cpu_executor_threads = 4;
+
+    // Snapshot often enough that the logs needed by a lagging replica are compacted within a test. All replicas run
+    // the same version, so the data can be pushed on the batch rpc.
+    HS_SETTINGS_FACTORY().modifiable_settings([](auto& s) {
+        s.consensus.snapshot_freq_distance = SISL_OPTIONS["snapshot_distance"].as< uint32_t >();
+        s.consensus.data_push_batch_rpc = true;
+    });
+    HS_SETTINGS_FACTORY().save();
     g_helper = std::make_unique< test_common::HSReplTestHelper >("test_raft_repl_dev", orig_argv);
     g_helper->setup();
 
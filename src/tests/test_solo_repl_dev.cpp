@@ -93,6 +93,7 @@ public:
     class Listener : public ReplDevListener {
     private:
         SoloReplDevTest& m_test;
+        int64_t m_last_lsn{-1};
 
     public:
         Listener(SoloReplDevTest& test) : m_test{test} {}
@@ -100,6 +101,9 @@ public:
 
         void on_commit(int64_t lsn, sisl::blob const& header, sisl::blob const& key, MultiBlkId const& blkids,
                        cintrusive< repl_req_ctx >& ctx) override {
+            // Commits are called one at a time, every request with an lsn of its own which keeps increasing
+            ASSERT_GT(lsn, m_last_lsn) << "lsn of a commit is not unique and increasing";
+            m_last_lsn = lsn;
             if (ctx == nullptr) {
                 m_test.validate_replay(*repl_dev(), lsn, header, key, blkids);
             } else {
@@ -142,7 +146,7 @@ public:
     };
 
 protected:
-    test_common::Runner m_io_runner;
+    test_common::Runner m_io_runner{SISL_OPTIONS["num_io"].as< uint64_t >(), SISL_OPTIONS["qdepth"].as< uint32_t >()};
     test_common::Waiter m_task_waiter;
     shared< ReplDev > m_repl_dev1;
     shared< ReplDev > m_repl_dev2;
@@ -295,9 +299,41 @@ TEST_F(SoloReplDevTest, TestHeaderOnly) {
     this->m_task_waiter.start([this]() { this->restart(); }).get();
 }
 
+TEST_F(SoloReplDevTest, GroupCommitThroughput) {
+    auto const run_writes = [this](uint32_t batch_size) {
+        HS_SETTINGS_FACTORY().modifiable_settings([batch_size](auto& s) {
+            s.consensus.solo_journal_batch_size = batch_size;
+            HS_SETTINGS_FACTORY().save();
+        });
+
+        this->m_io_runner.set_task([this]() { this->write_io(0u, 0u, g_block_size); });
+        auto const start_time = Clock::now();
+        this->m_io_runner.execute().get();
+        auto const elapsed_us = std::max(get_elapsed_time_us(start_time), uint64_cast(1));
+        return this->m_io_runner.total_tasks_ * 1000000 / elapsed_us;
+    };
+
+    auto const default_batch_size = HS_DYNAMIC_CONFIG(consensus.solo_journal_batch_size);
+    LOGINFO("Step 1: Write {} header only entries with qdepth={}, a journal record per entry",
+            this->m_io_runner.total_tasks_, SISL_OPTIONS["qdepth"].as< uint32_t >());
+    auto const single_iops = run_writes(1u);
+
+    LOGINFO("Step 2: Write {} header only entries, grouping upto {} entries in a journal record",
+            this->m_io_runner.total_tasks_, default_batch_size);
+    auto const group_iops = run_writes(default_batch_size);
+
+    LOGINFO("Journal writes per sec: record per entry={}, group commit={}", single_iops, group_iops);
+
+    LOGINFO("Step 3: Restart homestore and validate replay of the entries written both ways");
+    this->m_task_waiter.expected_comp.store(2 * this->m_io_runner.total_tasks_);
+    this->m_task_waiter.start([this]() { this->restart(); }).get();
+}
+
 SISL_OPTION_GROUP(test_solo_repl_dev,
                   (block_size, "", "block_size", "block size to io",
-                   ::cxxopts::value< uint32_t >()->default_value("4096"), "number"));
+                   ::cxxopts::value< uint32_t >()->default_value("4096"), "number"),
+                  (qdepth, "", "qdepth", "number of writes outstanding",
+                   ::cxxopts::value< uint32_t >()->default_value("8"), "number"));
 
 int main(int argc, char* argv[]) {
     int parsed_argc{argc};